@@ -33,6 +33,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <mitkIOUtil.h>
 #include <itkTractDensityImageFilter.h>
 #include <itkTractsToFiberEndingsImageFilter.h>
+#include <itksys/SystemTools.hxx>
 
 
 mitk::FiberBundle::Pointer LoadFib(std::string filename)
@@ -44,6 +45,56 @@ mitk::FiberBundle::Pointer LoadFib(std::string filename)
   return dynamic_cast<mitk::FiberBundle*>(baseData.GetPointer());
 }
 
+template< class TImage >
+void SaveImage(TImage* outImg, std::string filename)
+{
+  mitk::Image::Pointer img = mitk::Image::New();
+  img->InitializeByItk(outImg);
+  img->SetVolume(outImg->GetBufferPointer());
+  mitk::IOUtil::Save(img, filename );
+}
+
+/** Tract density images of all bundles. With a reference image, all bundles are rasterized in one pass. */
+template< class OutPixType >
+void CreateTdi(const std::vector< mitk::FiberBundle::Pointer >& fibs, const std::vector< std::string >& outFileNames, TDI_MODE mode, bool normalize, float upsampling, mitk::Image::Pointer ref_img)
+{
+  typedef itk::Image<OutPixType, 3> OutImageType;
+
+  typename OutImageType::Pointer itkImage = nullptr;
+  if (ref_img.IsNotNull())
+  {
+    itkImage = OutImageType::New();
+    CastToItkImage(ref_img, itkImage);
+  }
+
+  std::vector< std::vector< mitk::FiberBundle::Pointer > > runs;
+  if (itkImage.IsNotNull())
+    runs.push_back(fibs);
+  else
+    for (auto fib : fibs)
+      runs.push_back({fib});
+
+  unsigned int f = 0;
+  for (auto run : runs)
+  {
+    typename itk::TractDensityImageFilter< OutImageType >::Pointer generator = itk::TractDensityImageFilter< OutImageType >::New();
+    generator->SetFiberBundle(run.at(0));
+    generator->SetFiberBundles(run);
+    generator->SetMode(mode);
+    generator->SetOutputAbsoluteValues(!normalize);
+    generator->SetUpsamplingFactor(upsampling);
+    if (itkImage.IsNotNull())
+    {
+      generator->SetInputImage(itkImage);
+      generator->SetUseImageGeometry(true);
+    }
+    generator->Update();
+
+    for (auto outImg : generator->GetBundleImages())
+      SaveImage(outImg.GetPointer(), outFileNames.at(f++));
+  }
+}
+
 /*!
 \brief Modify input tractogram: fiber resampling, compression, pruning and transformation.
 */
@@ -57,8 +108,8 @@ int main(int argc, char* argv[])
   parser.setContributor("MIC");
 
   parser.setArgumentPrefix("--", "-");
-  parser.addArgument("", "i", mitkCommandLineParser::String, "Input:", "input fiber bundle", us::Any(), false);
-  parser.addArgument("", "o", mitkCommandLineParser::String, "Output:", "output image", us::Any(), false);
+  parser.addArgument("", "i", mitkCommandLineParser::StringList, "Input:", "input fiber bundles", us::Any(), false);
+  parser.addArgument("", "o", mitkCommandLineParser::String, "Output:", "output image (for multiple inputs, the input file names are appended)", us::Any(), false);
   parser.addArgument("binary", "", mitkCommandLineParser::Bool, "Binary output:", "calculate binary tract envelope", us::Any());
   parser.addArgument("normalize", "", mitkCommandLineParser::Bool, "Normalized output:", "normalize output to 0-1", us::Any());
   parser.addArgument("endpoints", "", mitkCommandLineParser::Bool, "Output endpoints image:", "calculate image of fiber endpoints instead of mask", us::Any());
@@ -92,12 +143,26 @@ int main(int argc, char* argv[])
   if (parsedArgs.count("reference_image"))
     reference_image = us::any_cast<std::string>(parsedArgs["reference_image"]);
 
-  std::string inFileName = us::any_cast<std::string>(parsedArgs["i"]);
+  mitkCommandLineParser::StringContainerType inFileNames = us::any_cast<mitkCommandLineParser::StringContainerType>(parsedArgs["i"]);
   std::string outFileName = us::any_cast<std::string>(parsedArgs["o"]);
 
+  // one output per input: <output>_<input name>.<output extension>
+  std::vector< std::string > outFileNames;
+  if (inFileNames.size()==1)
+    outFileNames.push_back(outFileName);
+  else
+  {
+    std::string ext = itksys::SystemTools::GetFilenameLastExtension(outFileName);
+    std::string base = outFileName.substr(0, outFileName.size()-ext.size());
+    for (auto inFileName : inFileNames)
+      outFileNames.push_back(base + "_" + itksys::SystemTools::GetFilenameWithoutLastExtension(inFileName) + ext);
+  }
+
   try
   {
-    mitk::FiberBundle::Pointer fib = LoadFib(inFileName);
+    std::vector< mitk::FiberBundle::Pointer > fibs;
+    for (auto inFileName : inFileNames)
+      fibs.push_back(LoadFib(inFileName));
 
     mitk::Image::Pointer ref_img;
     if (!reference_image.empty())
@@ -105,93 +170,41 @@ int main(int argc, char* argv[])
 
     if (endpoints)
     {
-      typedef unsigned int OutPixType;
-      typedef itk::Image<OutPixType, 3> OutImageType;
-
-      typedef itk::TractsToFiberEndingsImageFilter< OutImageType > ImageGeneratorType;
-      ImageGeneratorType::Pointer generator = ImageGeneratorType::New();
-      generator->SetFiberBundle(fib);
-      generator->SetUpsamplingFactor(upsampling);
-
-      if (ref_img.IsNotNull())
+      for (unsigned int f=0; f<fibs.size(); ++f)
       {
-        OutImageType::Pointer itkImage = OutImageType::New();
-        CastToItkImage(ref_img, itkImage);
-        generator->SetInputImage(itkImage);
-        generator->SetUseImageGeometry(true);
-
+        mitk::FiberBundle::Pointer fib = fibs.at(f);
+        typedef unsigned int OutPixType;
+        typedef itk::Image<OutPixType, 3> OutImageType;
+
+        typedef itk::TractsToFiberEndingsImageFilter< OutImageType > ImageGeneratorType;
+        ImageGeneratorType::Pointer generator = ImageGeneratorType::New();
+        generator->SetFiberBundle(fib);
+        generator->SetUpsamplingFactor(upsampling);
+
+        if (ref_img.IsNotNull())
+        {
+          OutImageType::Pointer itkImage = OutImageType::New();
+          CastToItkImage(ref_img, itkImage);
+          generator->SetInputImage(itkImage);
+          generator->SetUseImageGeometry(true);
+
+        }
+        generator->Update();
+
+        // get output image
+        typedef itk::Image<OutPixType,3> OutType;
+        OutType::Pointer outImg = generator->GetOutput();
+        mitk::Image::Pointer img = mitk::Image::New();
+        img->InitializeByItk(outImg.GetPointer());
+        img->SetVolume(outImg->GetBufferPointer());
+
+        mitk::IOUtil::Save(img, outFileNames.at(f) );
       }
-      generator->Update();
-
-      // get output image
-      typedef itk::Image<OutPixType,3> OutType;
-      OutType::Pointer outImg = generator->GetOutput();
-      mitk::Image::Pointer img = mitk::Image::New();
-      img->InitializeByItk(outImg.GetPointer());
-      img->SetVolume(outImg->GetBufferPointer());
-
-      mitk::IOUtil::Save(img, outFileName );
     }
     else if (binary)
-    {
-      typedef unsigned char OutPixType;
-      typedef itk::Image<OutPixType, 3> OutImageType;
-
-      itk::TractDensityImageFilter< OutImageType >::Pointer generator = itk::TractDensityImageFilter< OutImageType >::New();
-      generator->SetFiberBundle(fib);
-      generator->SetMode(TDI_MODE::BINARY);
-      generator->SetOutputAbsoluteValues(!normalize);
-      generator->SetUpsamplingFactor(upsampling);
-
-      if (ref_img.IsNotNull())
-      {
-        OutImageType::Pointer itkImage = OutImageType::New();
-        CastToItkImage(ref_img, itkImage);
-        generator->SetInputImage(itkImage);
-        generator->SetUseImageGeometry(true);
-
-      }
-      generator->Update();
-
-      // get output image
-      typedef itk::Image<OutPixType,3> OutType;
-      OutType::Pointer outImg = generator->GetOutput();
-      mitk::Image::Pointer img = mitk::Image::New();
-      img->InitializeByItk(outImg.GetPointer());
-      img->SetVolume(outImg->GetBufferPointer());
-
-      mitk::IOUtil::Save(img, outFileName );
-    }
+      CreateTdi< unsigned char >(fibs, outFileNames, TDI_MODE::BINARY, normalize, upsampling, ref_img);
     else
-    {
-      typedef float OutPixType;
-      typedef itk::Image<OutPixType, 3> OutImageType;
-
-      itk::TractDensityImageFilter< OutImageType >::Pointer generator = itk::TractDensityImageFilter< OutImageType >::New();
-      generator->SetFiberBundle(fib);
-      generator->SetMode(TDI_MODE::DENSITY);
-      generator->SetOutputAbsoluteValues(!normalize);
-      generator->SetUpsamplingFactor(upsampling);
-
-      if (ref_img.IsNotNull())
-      {
-        OutImageType::Pointer itkImage = OutImageType::New();
-        CastToItkImage(ref_img, itkImage);
-        generator->SetInputImage(itkImage);
-        generator->SetUseImageGeometry(true);
-
-      }
-      generator->Update();
-
-      // get output image
-      typedef itk::Image<OutPixType,3> OutType;
-      OutType::Pointer outImg = generator->GetOutput();
-      mitk::Image::Pointer img = mitk::Image::New();
-      img->InitializeByItk(outImg.GetPointer());
-      img->SetVolume(outImg->GetBufferPointer());
-
-      mitk::IOUtil::Save(img, outFileName );
-    }
+      CreateTdi< float >(fibs, outFileNames, TDI_MODE::DENSITY, normalize, upsampling, ref_img);
 
   }
   catch (const itk::ExceptionObject& e)
@@ -205,6 +205,7 @@ int main(int argc, char* argv[])
   parser.addArgument("", "o", mitkCommandLineParser::String, "Output File Name", "output file", us::Any(), false, false, false, mitkCommandLineParser::Output);
   parser.addArgument("dwprefix", "p", mitkCommandLineParser::String, "Recursive Scan Prefix", "prefix for subfolders search rootdir is specified by the 'inputdir' argument value", us::Any(), true);
   parser.addArgument("dryrun", "s", mitkCommandLineParser::Bool, "Dry run","do not read, only look for input files ", us::Any(), true );
+  parser.addArgument("header_cache", "c", mitkCommandLineParser::String, "Header cache", "file storing the parsed diffusion headers, repeated imports of unchanged files skip the header analysis", us::Any(), true);
 
   std::map<std::string, us::Any> parsedArgs = parser.parseArguments(argc, argv);
   if (parsedArgs.size()==0)
@@ -231,6 +232,14 @@ int main(int argc, char* argv[])
   // retrieve the output
   std::string outputFile = us::any_cast< std::string >( parsedArgs["o"] );
 
+  std::string headerCacheFile;
+  if( parsedArgs.count("header_cache") )
+  {
+    headerCacheFile = us::any_cast< std::string >( parsedArgs["header_cache"] );
+    if( itksys::SystemTools::FileExists( headerCacheFile.c_str(), true ) && !mitk::DiffusionHeaderDICOMFileReader::LoadHeaderCache( headerCacheFile ) )
+      MITK_WARN << "Unable to read header cache " << headerCacheFile;
+  }
+
   // if the executable is called with a single directory, just parse the given folder for files and read them into a diffusion image
   if( !search_for_subdirs )
   {
@@ -310,6 +319,9 @@ int main(int argc, char* argv[])
 
   }
 
+  if( !headerCacheFile.empty() && !mitk::DiffusionHeaderDICOMFileReader::SaveHeaderCache( headerCacheFile ) )
+    MITK_WARN << "Unable to write header cache " << headerCacheFile;
+
   return 1;
 }
 
@@ -29,6 +29,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <itksys/SystemTools.hxx>
 
 #include <mitkFiberBundle.h>
+#include <mitkFiberBundleStreamWriter.h>
 #include <itkStreamlineTrackingFilter.h>
 #include <Algorithms/TrackingHandlers/mitkTrackingDataHandler.h>
 #include <Algorithms/TrackingHandlers/mitkTrackingHandlerPeaks.h>
@@ -127,6 +128,7 @@ int main(int argc, char* argv[])
   parser.addArgument("no_data_interpolation", "", mitkCommandLineParser::Bool, "Don't interpolate input data:", "don't interpolate input image values");
   parser.addArgument("no_mask_interpolation", "", mitkCommandLineParser::Bool, "Don't interpolate masks:", "don't interpolate mask image values");
   parser.addArgument("compress", "", mitkCommandLineParser::Bool, "Compress:", "compress output fibers (lossy)");
+  parser.addArgument("stream", "", mitkCommandLineParser::Bool, "Stream output:", "write the fibers to the output file (.trk or .tck) in batches during tracking instead of keeping the whole tractogram in memory (no compression)");
   parser.addArgument("fix_seed", "", mitkCommandLineParser::Bool, "Fix Random Seed:", "always use the same random numbers");
   parser.addArgument("parameter_file", "", mitkCommandLineParser::String, "Parameter File:", "load parameters from json file (svae using MITK Diffusion GUI). the parameters loaded form this file are overwritten by the manually set parameters.", us::Any(), true, false, false, mitkCommandLineParser::Input);
   parser.endGroup();
@@ -292,8 +294,17 @@ int main(int argc, char* argv[])
     params->m_MaxNumFibers = us::any_cast<int>(parsedArgs["max_tracts"]);
 
 
+  bool stream_output = false;
+  if (parsedArgs.count("stream"))
+    stream_output = us::any_cast<bool>(parsedArgs["stream"]);
+
   std::string ext = itksys::SystemTools::GetFilenameExtension(outFile);
-  if (ext != ".fib" && ext != ".trk")
+  if (stream_output && ext != ".trk" && ext != ".tck")
+  {
+    MITK_INFO << "Streaming output only supports .trk and .tck files.";
+    return EXIT_FAILURE;
+  }
+  else if (!stream_output && ext != ".fib" && ext != ".trk")
   {
     MITK_INFO << "Output file format not supported. Use one of .fib, .trk, .nii, .nii.gz, .nrrd";
     return EXIT_FAILURE;
@@ -501,12 +512,30 @@ int main(int argc, char* argv[])
   tracker->SetTargetRegions(target);
   tracker->SetExclusionRegions(exclusion);
   tracker->SetTrackingHandler(handler);
-  if (ext != ".fib" && ext != ".trk")
+  if (!stream_output && ext != ".fib" && ext != ".trk")
     params->m_OutputProbMap = true;
   tracker->SetParameters(params);
-  tracker->Update();
 
-  if (ext == ".fib" || ext == ".trk")
+  if (stream_output)
+  {
+    if (params->m_CompressFibers)
+      MITK_WARN << "Fiber compression is not applied to streamed output.";
+
+    mitk::FiberBundleStreamWriter writer;
+    writer.Open(outFile, reference_image->GetGeometry());
+    tracker->SetStreamWriter(&writer);
+    tracker->Update();
+    tracker->SetStreamWriter(nullptr);
+    writer.Close();
+  }
+  else
+    tracker->Update();
+
+  if (stream_output)
+  {
+    // fibers have already been written
+  }
+  else if (ext == ".fib" || ext == ".trk")
   {
 
     vtkSmartPointer< vtkPolyData > poly = tracker->GetFiberPolyData();
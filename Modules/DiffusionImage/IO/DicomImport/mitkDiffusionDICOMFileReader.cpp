@@ -355,18 +355,18 @@ void mitk::DiffusionDICOMFileReader
       continue;
     }
 
-    bool canread = false;
-    // iterate over the threeD+t block
-
+    // iterate over the threeD+t block, the headers of all timesteps are parsed in parallel
     int numberOfTimesteps = block_0.GetIntProperty("timesteps", 1);
     int framesPerTimestep = block_0.GetImageFrameList().size() / numberOfTimesteps;
 
+    std::vector< std::string > timestepFilenames;
     for( int idx = 0; idx < numberOfTimesteps; idx++ )
     {
       int access_idx = idx * framesPerTimestep;
       DICOMImageFrameInfo::Pointer frame = this->GetOutput( outputidx ).GetImageFrameList().at( access_idx );
-      canread = headerReader->ReadDiffusionHeader( frame->Filename );
+      timestepFilenames.push_back( frame->Filename );
     }
+    bool canread = headerReader->ReadDiffusionHeaders( timestepFilenames );
 
     if( canread )
     {
@@ -16,6 +16,43 @@ See LICENSE.txt or http://www.mitk.org for details.
 
 #include "mitkDiffusionHeaderDICOMFileReader.h"
 
+#include <itksys/SystemTools.hxx>
+#include <itkTimeProbe.h>
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <mutex>
+
+namespace
+{
+
+struct CachedDiffusionHeader
+{
+  long int modified;
+  unsigned long size;
+  bool success;
+  mitk::DiffusionImageDICOMHeaderInformation header;
+};
+
+// (reader class, file path) -> parsed header
+typedef std::map< std::pair< std::string, std::string >, CachedDiffusionHeader > DiffusionHeaderCacheType;
+
+}
+
+static DiffusionHeaderCacheType& GetDiffusionHeaderCache()
+{
+  static DiffusionHeaderCacheType cache;
+  return cache;
+}
+
+static std::mutex& GetDiffusionHeaderCacheMutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
 mitk::DiffusionHeaderDICOMFileReader
 ::DiffusionHeaderDICOMFileReader()
 {
@@ -28,6 +65,184 @@ mitk::DiffusionHeaderDICOMFileReader
 
 }
 
+bool mitk::DiffusionHeaderDICOMFileReader
+::ExtractDiffusionHeader( const gdcm::DataSet&, DiffusionImageDICOMHeaderInformation& ) const
+{
+  return false;
+}
+
+bool mitk::DiffusionHeaderDICOMFileReader
+::ReadHeaderDataSet( const std::string& filename, gdcm::Reader& reader )
+{
+  // stop in front of the pixel data, the diffusion information is stored in the (private) tags before
+  const gdcm::Tag t_pixel_data( 0x7fe0, 0x0010 );
+  std::set< gdcm::Tag > skip_tags;
+  skip_tags.insert( t_pixel_data );
+
+  reader.SetFileName( filename.c_str() );
+  try
+  {
+    return reader.ReadUpToTag( t_pixel_data, skip_tags );
+  }
+  catch( const std::exception& e )
+  {
+    MITK_ERROR << "Failed to read DICOM header of " << filename << ": " << e.what();
+    return false;
+  }
+}
+
+bool mitk::DiffusionHeaderDICOMFileReader
+::ReadCachedDiffusionHeader( const std::string& filename, DiffusionImageDICOMHeaderInformation& header ) const
+{
+  const std::string path = itksys::SystemTools::CollapseFullPath( filename );
+  const long int modified = itksys::SystemTools::ModifiedTime( path );
+  const unsigned long size = itksys::SystemTools::FileLength( path );
+  const auto key = std::make_pair( std::string( this->GetNameOfClass() ), path );
+
+  {
+    std::lock_guard< std::mutex > lock( GetDiffusionHeaderCacheMutex() );
+    auto it = GetDiffusionHeaderCache().find( key );
+    if( it != GetDiffusionHeaderCache().end() && it->second.modified == modified && it->second.size == size )
+    {
+      header = it->second.header;
+      return it->second.success;
+    }
+  }
+
+  gdcm::Reader gdcmReader;
+  if( !ReadHeaderDataSet( path, gdcmReader ) )
+  {
+    MITK_ERROR << "Unable to read DICOM header of " << filename;
+    return false;
+  }
+
+  CachedDiffusionHeader entry;
+  entry.modified = modified;
+  entry.size = size;
+  entry.success = this->ExtractDiffusionHeader( gdcmReader.GetFile().GetDataSet(), entry.header );
+  header = entry.header;
+
+  std::lock_guard< std::mutex > lock( GetDiffusionHeaderCacheMutex() );
+  GetDiffusionHeaderCache()[ key ] = entry;
+  return entry.success;
+}
+
+bool mitk::DiffusionHeaderDICOMFileReader
+::ReadDiffusionHeader( std::string filename )
+{
+  MITK_INFO << " -- Analyzing: " << filename;
+
+  DiffusionImageDICOMHeaderInformation header;
+  if( !this->ReadCachedDiffusionHeader( filename, header ) )
+    return false;
+
+  header.Print();
+  m_HeaderInformationList.push_back( header );
+  return true;
+}
+
+bool mitk::DiffusionHeaderDICOMFileReader
+::ReadDiffusionHeaders( const std::vector< std::string >& filenames )
+{
+  itk::TimeProbe clock;
+  clock.Start();
+
+  const int num_files = static_cast<int>( filenames.size() );
+  DICOMHeaderListType headers( num_files );
+  std::vector< char > success( num_files, 0 );
+
+  // network storage: the latency of the single files dominates, so the reads are spread over all threads
+#pragma omp parallel for schedule(dynamic, 1)
+  for( int i=0; i<num_files; i++ )
+    success[i] = this->ReadCachedDiffusionHeader( filenames[i], headers[i] );
+
+  // log in file order after the parallel reads
+  bool all_read = true;
+  for( int i=0; i<num_files; i++ )
+  {
+    MITK_INFO << " -- Analyzing: " << filenames[i];
+    if( success[i] )
+    {
+      headers[i].Print();
+      m_HeaderInformationList.push_back( headers[i] );
+    }
+    else
+      all_read = false;
+  }
+
+  clock.Stop();
+  MITK_INFO("diffusion.dicomreader") << "Parsed " << num_files << " diffusion headers in " << clock.GetTotal() << "s";
+
+  return all_read;
+}
+
+bool mitk::DiffusionHeaderDICOMFileReader
+::LoadHeaderCache( const std::string& filename )
+{
+  std::ifstream file( filename.c_str() );
+  if( !file.is_open() )
+    return false;
+
+  std::lock_guard< std::mutex > lock( GetDiffusionHeaderCacheMutex() );
+  std::string line;
+  unsigned int num_entries = 0;
+  while( std::getline( file, line ) )
+  {
+    if( line.empty() || line[0] == '#' )
+      continue;
+
+    // reader modified size success b_value g_x g_y g_z baseline isotropic path
+    std::istringstream iss( line );
+    std::string reader;
+    std::string path;
+    CachedDiffusionHeader entry;
+    iss >> reader >> entry.modified >> entry.size >> entry.success >> entry.header.b_value
+        >> entry.header.g_vector[0] >> entry.header.g_vector[1] >> entry.header.g_vector[2]
+        >> entry.header.baseline >> entry.header.isotropic;
+    std::getline( iss >> std::ws, path );
+    if( iss.fail() || path.empty() )
+    {
+      MITK_WARN << "Skipping invalid entry in DICOM header cache " << filename;
+      continue;
+    }
+
+    GetDiffusionHeaderCache()[ std::make_pair( reader, path ) ] = entry;
+    num_entries++;
+  }
+
+  MITK_INFO("diffusion.dicomreader") << "Loaded " << num_entries << " cached diffusion headers from " << filename;
+  return true;
+}
+
+bool mitk::DiffusionHeaderDICOMFileReader
+::SaveHeaderCache( const std::string& filename )
+{
+  std::ofstream file( filename.c_str() );
+  if( !file.is_open() )
+    return false;
+
+  file.precision( 17 );
+  file << "# reader modified size success b_value g_x g_y g_z baseline isotropic path\n";
+
+  std::lock_guard< std::mutex > lock( GetDiffusionHeaderCacheMutex() );
+  for( const auto& item : GetDiffusionHeaderCache() )
+  {
+    const CachedDiffusionHeader& entry = item.second;
+    file << item.first.first << " " << entry.modified << " " << entry.size << " " << entry.success << " " << entry.header.b_value << " "
+         << entry.header.g_vector[0] << " " << entry.header.g_vector[1] << " " << entry.header.g_vector[2] << " "
+         << entry.header.baseline << " " << entry.header.isotropic << " " << item.first.second << "\n";
+  }
+
+  return file.good();
+}
+
+void mitk::DiffusionHeaderDICOMFileReader
+::ClearHeaderCache()
+{
+  std::lock_guard< std::mutex > lock( GetDiffusionHeaderCacheMutex() );
+  GetDiffusionHeaderCache().clear();
+}
+
 mitk::DiffusionHeaderDICOMFileReader::DICOMHeaderListType
 mitk::DiffusionHeaderDICOMFileReader
 ::GetHeaderInformation()
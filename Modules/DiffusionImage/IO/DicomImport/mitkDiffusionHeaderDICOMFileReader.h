@@ -73,7 +73,11 @@ struct DiffusionImageMosaicDICOMHeaderInformation
  *
  * @brief Abstract class for all vendor specific diffusion file header reader
  *
- * To provide a diffusion header reader for a new vendor, reimplement the \sa ReadDiffusionHeader method.
+ * To provide a diffusion header reader for a new vendor, reimplement the \sa ExtractDiffusionHeader method.
+ *
+ * The files are only read up to the pixel data. The parsed headers are cached per file (path, modification time and
+ * size) for the lifetime of the process, the cache can be stored to and restored from a file to speed up repeated
+ * imports of the same series.
  */
 class MITKDIFFUSIONIMAGE_EXPORT DiffusionHeaderDICOMFileReader
     : public itk::LightObject
@@ -89,15 +93,39 @@ public:
    * @brief IsDiffusionHeader Parse the given dicom file and collect the special diffusion image information
    * @return
    */
-  virtual bool ReadDiffusionHeader( std::string ){ return false; }
+  virtual bool ReadDiffusionHeader( std::string filename );
+
+  /**
+   * @brief Parse the given dicom files in parallel and append their diffusion information in the given order
+   * @return true if the headers of all files could be parsed
+   */
+  bool ReadDiffusionHeaders( const std::vector< std::string >& filenames );
 
   DICOMHeaderListType GetHeaderInformation();
 
+  /** @brief Add the headers stored with SaveHeaderCache to the cache. Outdated entries are ignored when they are used. */
+  static bool LoadHeaderCache( const std::string& filename );
+  static bool SaveHeaderCache( const std::string& filename );
+  static void ClearHeaderCache();
+
 protected:
   DiffusionHeaderDICOMFileReader();
 
   ~DiffusionHeaderDICOMFileReader() override;
 
+  /**
+   * @brief Extract the diffusion information from the data set of a single file (without pixel data)
+   *
+   * Called concurrently for different files, so implementations must not modify the reader.
+   */
+  virtual bool ExtractDiffusionHeader( const gdcm::DataSet& dataset, DiffusionImageDICOMHeaderInformation& header ) const;
+
+  /** @brief Read the data set of the given file up to the pixel data */
+  static bool ReadHeaderDataSet( const std::string& filename, gdcm::Reader& reader );
+
+  /** @brief Parse a single file or retrieve its header from the cache */
+  bool ReadCachedDiffusionHeader( const std::string& filename, DiffusionImageDICOMHeaderInformation& header ) const;
+
   DICOMHeaderListType m_HeaderInformationList;
 };
 
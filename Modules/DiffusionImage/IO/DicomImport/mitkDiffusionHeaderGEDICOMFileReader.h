@@ -15,12 +15,12 @@ public:
   mitkClassMacro( DiffusionHeaderGEDICOMFileReader, DiffusionHeaderDICOMFileReader )
   itkNewMacro( Self )
 
-  bool ReadDiffusionHeader(std::string filename) override;
-
 protected:
   DiffusionHeaderGEDICOMFileReader();
 
   ~DiffusionHeaderGEDICOMFileReader() override;
+
+  bool ExtractDiffusionHeader( const gdcm::DataSet& dataset, DiffusionImageDICOMHeaderInformation& header_info ) const override;
 };
 
 }
@@ -29,23 +29,17 @@ mitk::DiffusionHeaderPhilipsDICOMFileReader::~DiffusionHeaderPhilipsDICOMFileRea
 
 }
 
-bool mitk::DiffusionHeaderPhilipsDICOMFileReader::ReadDiffusionHeader(std::string filename)
+bool mitk::DiffusionHeaderPhilipsDICOMFileReader::ExtractDiffusionHeader( const gdcm::DataSet& dataset, DiffusionImageDICOMHeaderInformation& header_info ) const
 {
-  gdcm::Reader gdcmReader;
-  gdcmReader.SetFileName( filename.c_str() );
-
-  gdcmReader.Read();
-
   gdcm::Tag philips_bvalue_tag( 0x2001, 0x1003 );
   //gdcm::Tag philips_gradient_direction( 0x2001, 0x1004 );
 
-  DiffusionImageDICOMHeaderInformation header_info;
   //std::string tagvalue_string;
   //char* pEnd;
 
   // reveal b-value
   float bvalue = 0;
-  if( RevealBinaryTagC( philips_bvalue_tag, gdcmReader.GetFile().GetDataSet(), (char*) &bvalue) )
+  if( RevealBinaryTagC( philips_bvalue_tag, dataset, (char*) &bvalue) )
   {
 
     header_info.b_value = std::ceil( bvalue );
@@ -59,13 +53,6 @@ bool mitk::DiffusionHeaderPhilipsDICOMFileReader::ReadDiffusionHeader(std::strin
     return false;
   }
 
-  gdcm::Tag philips_new_bvalue_tag( 0x0018,0x9087 );
-  double dbvalue = 0;
-  if( RevealBinaryTagC( philips_new_bvalue_tag, gdcmReader.GetFile().GetDataSet(), (char*) &dbvalue) )
-  {
-    MITK_INFO("philips.dicom.diffusion.bvalue") << dbvalue;
-  }
-
   if( header_info.baseline )
   {
     // no direction in unweighted images
@@ -73,15 +60,10 @@ bool mitk::DiffusionHeaderPhilipsDICOMFileReader::ReadDiffusionHeader(std::strin
   }
   else
   {
-    MITK_INFO("philips.dicom.diffusion.gradientdir") << "Parsing gradient direction.";
-
     gdcm::Tag philips_gradient_direction_new( 0x0018, 0x9089 );
     double gr_dir_arr[3] = {1,0,-1};
 
-    if( RevealBinaryTagC( philips_gradient_direction_new, gdcmReader.GetFile().GetDataSet(), (char*) &gr_dir_arr ) )
-    {
-      MITK_INFO("philips.dicom.diffusion.gradient") << "(" << gr_dir_arr[0] <<"," << gr_dir_arr[1] <<"," <<gr_dir_arr[2] <<")";
-    }
+    RevealBinaryTagC( philips_gradient_direction_new, dataset, (char*) &gr_dir_arr );
 
     header_info.g_vector.copy_in( &gr_dir_arr[0] );
     if( header_info.g_vector.two_norm() < vnl_math::eps )
@@ -91,7 +73,5 @@ bool mitk::DiffusionHeaderPhilipsDICOMFileReader::ReadDiffusionHeader(std::strin
     }
   }
 
-  this->m_HeaderInformationList.push_back( header_info );
-
   return true;
 }
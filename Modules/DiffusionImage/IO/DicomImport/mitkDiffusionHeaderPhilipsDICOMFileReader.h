@@ -31,12 +31,12 @@ public:
   mitkClassMacro( DiffusionHeaderPhilipsDICOMFileReader, DiffusionHeaderDICOMFileReader )
   itkNewMacro( Self )
 
-  bool ReadDiffusionHeader(std::string filename) override;
-
 protected:
   DiffusionHeaderPhilipsDICOMFileReader();
 
   ~DiffusionHeaderPhilipsDICOMFileReader() override;
+
+  bool ExtractDiffusionHeader( const gdcm::DataSet& dataset, DiffusionImageDICOMHeaderInformation& header_info ) const override;
 };
 
 }
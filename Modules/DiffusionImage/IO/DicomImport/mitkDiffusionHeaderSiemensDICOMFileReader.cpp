@@ -75,7 +75,7 @@ static bool GetTagFromHierarchy( std::vector< gdcm::Tag > hierarchy, const gdcm:
  * @brief Extract b value from the siemens diffusion tag
  */
 bool mitk::DiffusionHeaderSiemensDICOMFileReader
-::ExtractSiemensDiffusionTagInformation( std::string tag_value, mitk::DiffusionImageDICOMHeaderInformation& values)
+::ExtractSiemensDiffusionTagInformation( std::string tag_value, mitk::DiffusionImageDICOMHeaderInformation& values) const
 {
   SiemensDiffusionHeaderType hformat = mitk::GetHeaderType( tag_value );
   Siemens_Header_Format specs = this->m_SiemensFormatsCollection.at( hformat );
@@ -171,19 +171,10 @@ mitk::DiffusionHeaderSiemensDICOMFileReader
 }
 
 bool mitk::DiffusionHeaderSiemensDICOMFileReader
-::ReadDiffusionHeader(std::string filename)
+::ExtractDiffusionHeader( const gdcm::DataSet& dataset, DiffusionImageDICOMHeaderInformation& values ) const
 {
-  gdcm::Reader gdcmReader;
-  gdcmReader.SetFileName( filename.c_str() );
-
-  gdcmReader.Read();
-
-  MITK_INFO << " -- Analyzing: " << filename;
-
   bool retVal = false;
 
-  const gdcm::DataSet& dataset = gdcmReader.GetFile().GetDataSet();
-
   const gdcm::Tag t_sie_diffusion( 0x0029,0x1010 );
   //const gdcm::Tag t_sie_diffusion_vec( 0x0029,0x100e );
   //const gdcm::Tag t_sie_diffusion2( 0x0029,0x100c );
@@ -191,10 +182,7 @@ bool mitk::DiffusionHeaderSiemensDICOMFileReader
   std::string siemens_diffusionheader_str;
   if( RevealBinaryTag( t_sie_diffusion, dataset, siemens_diffusionheader_str ) )
   {
-    DiffusionImageDICOMHeaderInformation values;
     this->ExtractSiemensDiffusionTagInformation( siemens_diffusionheader_str, values );
-
-    m_HeaderInformationList.push_back( values );
     retVal = true;
   }
   else
@@ -209,11 +197,9 @@ bool mitk::DiffusionHeaderSiemensDICOMFileReader
     gdcm::DataSet bvalueset;
     GetTagFromHierarchy( bv_hierarchy, t_sie_bvalue, dataset, bvalueset );
 
-    DiffusionImageDICOMHeaderInformation values;
     double dbvalue = 0;
     if( mitk::RevealBinaryTagC( t_sie_bvalue, bvalueset, (char*) &dbvalue) )
     {
-      MITK_INFO("siemens.dicom.diffusion.bvalue") << dbvalue;
       values.b_value = std::ceil( dbvalue );
 
       if( values.b_value == 0)
@@ -229,19 +215,12 @@ bool mitk::DiffusionHeaderSiemensDICOMFileReader
       GetTagFromHierarchy( g_hierarchy, t_sie_gradient, dataset, bvalueset );
 
       double gr_dir_arr[3] = {1,0,-1};
-      if( mitk::RevealBinaryTagC( t_sie_gradient, bvalueset, (char*) &gr_dir_arr ) )
-      {
-        MITK_INFO("siemens.dicom.diffusion.gradient") << "(" << gr_dir_arr[0] <<"," << gr_dir_arr[1] <<"," <<gr_dir_arr[2] <<")";
-      }
+      mitk::RevealBinaryTagC( t_sie_gradient, bvalueset, (char*) &gr_dir_arr );
 
       values.g_vector.copy_in( &gr_dir_arr[0] );
     }
 
-    if( true )
-    {
-      m_HeaderInformationList.push_back( values );
-      retVal = true;
-    }
+    retVal = true;
   }
 
   return retVal;
@@ -33,14 +33,14 @@ public:
   mitkClassMacro( DiffusionHeaderSiemensDICOMFileReader, DiffusionHeaderDICOMFileReader )
   itkNewMacro( Self )
 
-  bool ReadDiffusionHeader(std::string filename) override;
-
 protected:
   DiffusionHeaderSiemensDICOMFileReader();
 
   ~DiffusionHeaderSiemensDICOMFileReader() override;
 
-  bool ExtractSiemensDiffusionTagInformation( std::string tag_value, mitk::DiffusionImageDICOMHeaderInformation& values );
+  bool ExtractDiffusionHeader( const gdcm::DataSet& dataset, DiffusionImageDICOMHeaderInformation& values ) const override;
+
+  bool ExtractSiemensDiffusionTagInformation( std::string tag_value, mitk::DiffusionImageDICOMHeaderInformation& values ) const;
 
   std::vector< Siemens_Header_Format > m_SiemensFormatsCollection;
 };
@@ -18,18 +18,21 @@ mitk::DiffusionHeaderSiemensMosaicDICOMFileReader
 void mitk::DiffusionHeaderSiemensMosaicDICOMFileReader
 ::RetrieveMosaicInformation(std::string filename)
 {
+  gdcm::Reader gdcmReader;
+  if( !ReadHeaderDataSet( filename, gdcmReader ) )
+  {
+    MITK_ERROR << "Unable to read DICOM header of " << filename;
+    return;
+  }
+  const gdcm::DataSet& dataset = gdcmReader.GetFile().GetDataSet();
+
   // retrieve also mosaic information
-  if( !this->ReadDiffusionHeader( filename ) )
+  DiffusionImageMosaicDICOMHeaderInformation header_values;
+  if( !this->ExtractMosaicHeader( dataset, header_values, &m_MosaicDescriptor ) )
   {
     MITK_ERROR << "Using MOSAIC Reader for non-mosaic files ";
   }
 
-  gdcm::Reader gdcmReader;
-  gdcmReader.SetFileName( filename.c_str() );
-
-  gdcmReader.Read();
-  const gdcm::DataSet& dataset = gdcmReader.GetFile().GetDataSet();
-
   // (0018,0088) DS [2.5]                                    #   4, 1 SpacingBetweenSlices
   // important for mosaic data
   std::string spacing_between_slices;
@@ -70,16 +73,19 @@ void mitk::DiffusionHeaderSiemensMosaicDICOMFileReader
 }
 
 bool mitk::DiffusionHeaderSiemensMosaicDICOMFileReader
-::ReadDiffusionHeader(std::string filename)
+::ExtractDiffusionHeader( const gdcm::DataSet& dataset, DiffusionImageDICOMHeaderInformation& values ) const
 {
-  gdcm::Reader gdcmReader;
-  gdcmReader.SetFileName( filename.c_str() );
-
-  gdcmReader.Read();
+  DiffusionImageMosaicDICOMHeaderInformation header_values;
+  if( !this->ExtractMosaicHeader( dataset, header_values, nullptr ) )
+    return false;
 
-  MITK_INFO << " -- Analyzing: " << filename;
+  values = header_values;
+  return true;
+}
 
-  const gdcm::DataSet& dataset = gdcmReader.GetFile().GetDataSet();
+bool mitk::DiffusionHeaderSiemensMosaicDICOMFileReader
+::ExtractMosaicHeader( const gdcm::DataSet& dataset, DiffusionImageMosaicDICOMHeaderInformation& header_values, MosaicDescriptor* descriptor ) const
+{
 
   const gdcm::Tag t_sie_diffusion( 0x0029,0x1010 );
   const gdcm::Tag t_sie_diffusion_alt( 0x0029,0x1110 );
@@ -88,7 +94,6 @@ bool mitk::DiffusionHeaderSiemensMosaicDICOMFileReader
   if( RevealBinaryTag( t_sie_diffusion, dataset, siemens_diffusionheader_str )
       || RevealBinaryTag( t_sie_diffusion_alt, dataset, siemens_diffusionheader_str) )
   {
-    mitk::DiffusionImageMosaicDICOMHeaderInformation header_values;
     // wait for success
     if( !this->ExtractSiemensDiffusionTagInformation( siemens_diffusionheader_str, header_values ))
       return false;
@@ -106,7 +111,8 @@ bool mitk::DiffusionHeaderSiemensMosaicDICOMFileReader
                         );
 
       header_values.n_images = value_array[0];
-      this->m_MosaicDescriptor.nimages = value_array[0];
+      if( descriptor != nullptr )
+        descriptor->nimages = value_array[0];
     }
 
     tag_position = siemens_diffusionheader_str.find("SliceNormalVector", 0);
@@ -127,17 +133,15 @@ bool mitk::DiffusionHeaderSiemensMosaicDICOMFileReader
       if( value_array.size() > 2 )
       {
         header_values.slicenormalup = (value_array[2] > 0);
-        this->m_MosaicDescriptor.slicenormalup = ( value_array[2] > 0);
+        if( descriptor != nullptr )
+          descriptor->slicenormalup = ( value_array[2] > 0);
       }
 
     }
 
-
-
-    m_HeaderInformationList.push_back( header_values );
-
+    return true;
   }
 
-  return (m_HeaderInformationList.size() > 0);
+  return false;
 
 }
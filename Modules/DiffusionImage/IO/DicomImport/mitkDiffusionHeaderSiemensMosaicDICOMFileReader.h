@@ -32,8 +32,6 @@ public:
                   DiffusionHeaderSiemensDICOMFileReader )
   itkNewMacro( Self )
 
-  bool ReadDiffusionHeader(std::string filename) override;
-
   mitk::MosaicDescriptor GetMosaicDescriptor()
   {
     return m_MosaicDescriptor;
@@ -46,6 +44,11 @@ protected:
 
   ~DiffusionHeaderSiemensMosaicDICOMFileReader() override;
 
+  bool ExtractDiffusionHeader( const gdcm::DataSet& dataset, DiffusionImageDICOMHeaderInformation& values ) const override;
+
+  /** @brief Extract the diffusion and mosaic information, the mosaic layout is also written to the descriptor if it is not null */
+  bool ExtractMosaicHeader( const gdcm::DataSet& dataset, DiffusionImageMosaicDICOMHeaderInformation& header_values, MosaicDescriptor* descriptor ) const;
+
   mitk::MosaicDescriptor m_MosaicDescriptor;
 };
 
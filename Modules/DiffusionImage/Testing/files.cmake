@@ -1,4 +1,5 @@
 set(MODULE_CUSTOM_TESTS
   mitkDiffusionPropertySerializerTest.cpp
+  mitkDiffusionHeaderDICOMFileReaderTest.cpp
 )
 
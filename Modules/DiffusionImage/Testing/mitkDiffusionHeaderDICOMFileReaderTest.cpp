@@ -0,0 +1,251 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#include "mitkIOUtil.h"
+#include "mitkTestingMacros.h"
+#include "mitkTestFixture.h"
+
+#include <mitkDiffusionHeaderGEDICOMFileReader.h>
+#include <itksys/SystemTools.hxx>
+
+#include <gdcmWriter.h>
+#include <gdcmUIDGenerator.h>
+
+#include <fstream>
+#include <sstream>
+
+/** Exposes the header-only read and the header extraction of the GE reader */
+class TestGEDICOMFileReader : public mitk::DiffusionHeaderGEDICOMFileReader
+{
+public:
+
+  mitkClassMacro( TestGEDICOMFileReader, mitk::DiffusionHeaderGEDICOMFileReader )
+  itkSimpleNewMacro( Self )
+
+  static bool ReadHeaderOnly( const std::string& filename, gdcm::Reader& reader )
+  {
+    return ReadHeaderDataSet( filename, reader );
+  }
+
+  bool Extract( const gdcm::DataSet& dataset, mitk::DiffusionImageDICOMHeaderInformation& header ) const
+  {
+    return this->ExtractDiffusionHeader( dataset, header );
+  }
+};
+
+class mitkDiffusionHeaderDICOMFileReaderTestSuite : public mitk::TestFixture
+{
+
+  CPPUNIT_TEST_SUITE(mitkDiffusionHeaderDICOMFileReaderTestSuite);
+  MITK_TEST(Equal_HeaderOnlyAndFullRead_ReturnsTrue);
+  MITK_TEST(Equal_CachedAndFullRead_ReturnsTrue);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+
+  std::vector< std::string > m_Files;
+  std::vector< unsigned int > m_BValues;
+
+  static void InsertElement( gdcm::DataSet& dataset, const gdcm::Tag& tag, const gdcm::VR& vr, std::string value )
+  {
+    // DICOM values have even length, UIDs are padded with 0
+    if( value.size() % 2 )
+      value += vr==gdcm::VR::UI ? '\0' : ' ';
+    gdcm::DataElement de( tag );
+    de.SetVR( vr );
+    de.SetByteValue( value.c_str(), static_cast<uint32_t>( value.size() ) );
+    dataset.Insert( de );
+  }
+
+  /** Writes a minimal GE diffusion weighted DICOM file with the given b-value, gradient and pixel data size */
+  static void WriteGEFile( const std::string& filename, unsigned int bvalue, const double* gradient, unsigned int num_pixel_bytes )
+  {
+    gdcm::Writer writer;
+    gdcm::File& file = writer.GetFile();
+    file.GetHeader().SetDataSetTransferSyntax( gdcm::TransferSyntax::ExplicitVRLittleEndian );
+    gdcm::DataSet& dataset = file.GetDataSet();
+
+    gdcm::UIDGenerator uid;
+    InsertElement( dataset, gdcm::Tag( 0x0008, 0x0016 ), gdcm::VR::UI, "1.2.840.10008.5.1.4.1.1.4" );
+    InsertElement( dataset, gdcm::Tag( 0x0008, 0x0018 ), gdcm::VR::UI, uid.Generate() );
+    InsertElement( dataset, gdcm::Tag( 0x0008, 0x0070 ), gdcm::VR::LO, "GE MEDICAL SYSTEMS" );
+
+    InsertElement( dataset, gdcm::Tag( 0x0019, 0x0010 ), gdcm::VR::LO, "GEMS_ACQU_01" );
+    for( unsigned int i=0; i<3; ++i )
+    {
+      std::ostringstream g;
+      g << gradient[i];
+      InsertElement( dataset, gdcm::Tag( 0x0019, 0x10bb + i ), gdcm::VR::DS, g.str() );
+    }
+
+    // b-value followed by "\8\0\0"
+    InsertElement( dataset, gdcm::Tag( 0x0043, 0x0010 ), gdcm::VR::LO, "GEMS_PARM_01" );
+    InsertElement( dataset, gdcm::Tag( 0x0043, 0x1039 ), gdcm::VR::IS, std::to_string( bvalue ) + "\\8\\0\\0" );
+
+    std::string pixels( num_pixel_bytes, '\1' );
+    gdcm::DataElement pixel_data( gdcm::Tag( 0x7fe0, 0x0010 ) );
+    pixel_data.SetVR( gdcm::VR::OW );
+    pixel_data.SetByteValue( pixels.c_str(), static_cast<uint32_t>( pixels.size() ) );
+    dataset.Insert( pixel_data );
+
+    writer.SetFileName( filename.c_str() );
+    CPPUNIT_ASSERT_MESSAGE( "Writing test DICOM file " + filename, writer.Write() );
+  }
+
+  /** Header of the given file from a full read including the pixel data */
+  static mitk::DiffusionImageDICOMHeaderInformation ReadFull( const std::string& filename )
+  {
+    TestGEDICOMFileReader::Pointer reader = TestGEDICOMFileReader::New();
+    gdcm::Reader gdcm_reader;
+    gdcm_reader.SetFileName( filename.c_str() );
+    CPPUNIT_ASSERT_MESSAGE( "Full read of " + filename, gdcm_reader.Read() );
+    CPPUNIT_ASSERT_MESSAGE( "Full read contains pixel data", gdcm_reader.GetFile().GetDataSet().FindDataElement( gdcm::Tag( 0x7fe0, 0x0010 ) ) );
+
+    mitk::DiffusionImageDICOMHeaderInformation header;
+    CPPUNIT_ASSERT_MESSAGE( "Extract header of full read", reader->Extract( gdcm_reader.GetFile().GetDataSet(), header ) );
+    return header;
+  }
+
+  static bool Equal( const mitk::DiffusionImageDICOMHeaderInformation& a, const mitk::DiffusionImageDICOMHeaderInformation& b )
+  {
+    return a.b_value==b.b_value && (a.g_vector-b.g_vector).inf_norm()<1e-6 && a.baseline==b.baseline && a.isotropic==b.isotropic;
+  }
+
+  static std::vector< std::string > ReadLines( const std::string& filename )
+  {
+    std::vector< std::string > lines;
+    std::ifstream file( filename.c_str() );
+    std::string line;
+    while( std::getline( file, line ) )
+      lines.push_back( line );
+    return lines;
+  }
+
+public:
+
+  void setUp() override
+  {
+    mitk::DiffusionHeaderDICOMFileReader::ClearHeaderCache();
+
+    double gradients[3][3] = { {0, 0, 0}, {1, 0, 0}, {0, 0.6, 0.8} };
+    m_BValues = { 0, 1000, 2000 };
+    m_Files.clear();
+    for( unsigned int i=0; i<m_BValues.size(); ++i )
+    {
+      m_Files.push_back( mitk::IOUtil::GetTempPath() + "diffusion_header_test_" + std::to_string( i ) + ".dcm" );
+      WriteGEFile( m_Files.back(), m_BValues[i], gradients[i], 1024 );
+    }
+  }
+
+  void tearDown() override
+  {
+    mitk::DiffusionHeaderDICOMFileReader::ClearHeaderCache();
+    for( auto file : m_Files )
+      itksys::SystemTools::RemoveFile( file );
+  }
+
+  void Equal_HeaderOnlyAndFullRead_ReturnsTrue()
+  {
+    TestGEDICOMFileReader::Pointer reader = TestGEDICOMFileReader::New();
+    for( auto file : m_Files )
+    {
+      gdcm::Reader gdcm_reader;
+      CPPUNIT_ASSERT_MESSAGE( "Header-only read of " + file, TestGEDICOMFileReader::ReadHeaderOnly( file, gdcm_reader ) );
+      CPPUNIT_ASSERT_MESSAGE( "Header-only read stops before the pixel data", !gdcm_reader.GetFile().GetDataSet().FindDataElement( gdcm::Tag( 0x7fe0, 0x0010 ) ) );
+
+      mitk::DiffusionImageDICOMHeaderInformation header;
+      CPPUNIT_ASSERT_MESSAGE( "Extract header of header-only read", reader->Extract( gdcm_reader.GetFile().GetDataSet(), header ) );
+      CPPUNIT_ASSERT_MESSAGE( "Header-only and full read should be equal", Equal( header, ReadFull( file ) ) );
+    }
+
+    CPPUNIT_ASSERT_MESSAGE( "Parallel header parsing", reader->ReadDiffusionHeaders( m_Files ) );
+    mitk::DiffusionHeaderDICOMFileReader::DICOMHeaderListType headers = reader->GetHeaderInformation();
+    CPPUNIT_ASSERT_MESSAGE( "One header per file", headers.size()==m_Files.size() );
+    for( unsigned int i=0; i<m_Files.size(); ++i )
+    {
+      CPPUNIT_ASSERT_MESSAGE( "Headers in file order", headers[i].b_value==m_BValues[i] );
+      CPPUNIT_ASSERT_MESSAGE( "Parallel and full read should be equal", Equal( headers[i], ReadFull( m_Files[i] ) ) );
+    }
+  }
+
+  void Equal_CachedAndFullRead_ReturnsTrue()
+  {
+    TestGEDICOMFileReader::Pointer reader = TestGEDICOMFileReader::New();
+    CPPUNIT_ASSERT_MESSAGE( "Parse headers", reader->ReadDiffusionHeaders( m_Files ) );
+
+    std::string cache_file = mitk::IOUtil::GetTempPath() + "diffusion_header_test_cache.txt";
+    CPPUNIT_ASSERT_MESSAGE( "Save header cache", mitk::DiffusionHeaderDICOMFileReader::SaveHeaderCache( cache_file ) );
+
+    // Manipulate the stored cache:
+    // file 0: different b-value, valid modification time and size -> the cached value has to be used
+    // file 1: different b-value and modification time -> outdated, the file has to be parsed
+    // file 2: unchanged entry, but the file is rewritten with a different size and b-value -> outdated
+    std::vector< std::string > lines = ReadLines( cache_file );
+    std::ofstream out( cache_file.c_str() );
+    for( auto line : lines )
+    {
+      if( !line.empty() && line[0]!='#' )
+      {
+        // reader modified size success b_value g_x g_y g_z baseline isotropic path
+        std::istringstream iss( line );
+        std::string reader_name, path;
+        long int modified;
+        unsigned long size;
+        bool success, baseline, isotropic;
+        unsigned int b_value;
+        double g[3];
+        iss >> reader_name >> modified >> size >> success >> b_value >> g[0] >> g[1] >> g[2] >> baseline >> isotropic;
+        std::getline( iss >> std::ws, path );
+
+        if( path==itksys::SystemTools::CollapseFullPath( m_Files[0] ) )
+          b_value = 555;
+        else if( path==itksys::SystemTools::CollapseFullPath( m_Files[1] ) )
+        {
+          b_value = 777;
+          modified -= 10;
+        }
+
+        std::ostringstream entry;
+        entry.precision( 17 );
+        entry << reader_name << " " << modified << " " << size << " " << success << " " << b_value << " "
+              << g[0] << " " << g[1] << " " << g[2] << " " << baseline << " " << isotropic << " " << path;
+        line = entry.str();
+      }
+      out << line << "\n";
+    }
+    out.close();
+
+    double gradient[3] = { 0, 1, 0 };
+    WriteGEFile( m_Files[2], 3000, gradient, 2048 );
+
+    mitk::DiffusionHeaderDICOMFileReader::ClearHeaderCache();
+    CPPUNIT_ASSERT_MESSAGE( "Load header cache", mitk::DiffusionHeaderDICOMFileReader::LoadHeaderCache( cache_file ) );
+    itksys::SystemTools::RemoveFile( cache_file );
+
+    TestGEDICOMFileReader::Pointer cached_reader = TestGEDICOMFileReader::New();
+    CPPUNIT_ASSERT_MESSAGE( "Parse headers with cache", cached_reader->ReadDiffusionHeaders( m_Files ) );
+    mitk::DiffusionHeaderDICOMFileReader::DICOMHeaderListType headers = cached_reader->GetHeaderInformation();
+    CPPUNIT_ASSERT_MESSAGE( "One header per file", headers.size()==m_Files.size() );
+
+    CPPUNIT_ASSERT_MESSAGE( "Valid cache entry should be used", headers[0].b_value==555 );
+    CPPUNIT_ASSERT_MESSAGE( "Entry with different modification time should be ignored", Equal( headers[1], ReadFull( m_Files[1] ) ) );
+    CPPUNIT_ASSERT_MESSAGE( "Entry of changed file should be ignored", Equal( headers[2], ReadFull( m_Files[2] ) ) );
+    CPPUNIT_ASSERT_MESSAGE( "Changed file should be parsed", headers[2].b_value==3000 );
+  }
+
+};
+
+MITK_TEST_SUITE_REGISTRATION(mitkDiffusionHeaderDICOMFileReader)
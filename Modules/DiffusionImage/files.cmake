@@ -2,6 +2,7 @@ set(H_FILES
 
     mitkDiffusionImageHeaderInformation.h
     mitkDiffusionImageHelperFunctions.h
+    mitkLevenbergMarquardtSolver.h
 
     IO/mitkDiffusionImageMimeTypes.h
     IO/mitkDiffusionImageObjectFactory.h
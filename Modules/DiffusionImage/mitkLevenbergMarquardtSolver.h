@@ -0,0 +1,466 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#ifndef __mitkLevenbergMarquardtSolver_h_
+#define __mitkLevenbergMarquardtSolver_h_
+
+#include <vnl/vnl_vector_fixed.h>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+namespace mitk
+{
+
+/**
+  * \brief Levenberg-Marquardt least-squares solver for voxelwise fits of models with few parameters.
+  *
+  * Replacement for vnl_levenberg_marquardt in the voxelwise model fits (ADC, bi-exponential, kurtosis, IVIM). The
+  * model provides its residuals together with their analytic derivatives, so no finite difference Jacobians are
+  * needed, and the normal equations are accumulated residual by residual in fixed-size arrays, so a fit does not
+  * allocate any memory. Steps are scaled with the diagonal of J^T*J (as MINPACK) and the damping is updated with the
+  * gain ratio of each step.
+  *
+  * The model type has to provide:
+  *
+  *   static const unsigned int NumberOfParameters;
+  *   unsigned int GetNumberOfResiduals() const;
+  *   void SetParameters(const double* x);                     // precompute everything that does not depend on the residual index
+  *   double GetResidual(unsigned int s, double* dr_dx) const;  // residual s and its derivatives with respect to all parameters
+  *
+  * MinimizeBatch() fits many voxels with the same model configuration together and needs one more model method, see
+  * there.
+  *
+  * The solver keeps a reference to the model. Model and solver are not thread safe, use one instance per thread.
+  */
+template< class TModel >
+class LevenbergMarquardtSolver
+{
+public:
+
+  static const unsigned int NumberOfParameters = TModel::NumberOfParameters;
+  typedef vnl_vector_fixed< double, TModel::NumberOfParameters > ParametersType;
+
+  LevenbergMarquardtSolver(TModel& model)
+    : m_Model(model)
+    , m_MaxFunctionEvaluations(2000)
+    , m_FunctionTolerance(1e-10)
+    , m_ParameterTolerance(1e-8)
+    , m_GradientTolerance(1e-5)
+    , m_StartError(0)
+    , m_EndError(0)
+    , m_NumberOfEvaluations(0)
+  {}
+
+  /** Default values correspond to vnl_levenberg_marquardt. */
+  void SetMaxFunctionEvaluations(unsigned int n) { m_MaxFunctionEvaluations = n; }
+  void SetFunctionTolerance(double v) { m_FunctionTolerance = v; }
+  void SetParameterTolerance(double v) { m_ParameterTolerance = v; }
+  void SetGradientTolerance(double v) { m_GradientTolerance = v; }
+
+  /** RMS of the residuals before and after the last fit (as vnl_levenberg_marquardt::get_start_error/get_end_error) */
+  double GetStartError() const { return m_StartError; }
+  double GetEndError() const { return m_EndError; }
+  unsigned int GetNumberOfEvaluations() const { return m_NumberOfEvaluations; }
+
+  /** Euclidean norm of the residual vector at x. */
+  double GetResidualNorm(const ParametersType& x) const
+  {
+    Evaluation e;
+    Evaluate(x, e);
+    return std::sqrt(e.m_Cost);
+  }
+
+  /** Fits the model to its current measurements. x contains the start position and receives the result. */
+  void Minimize(ParametersType& x)
+  {
+    FitState state;
+    Evaluation e;
+    Evaluate(x, e);
+    Start(state, e);
+
+    ParametersType x_new;
+    while (!state.m_Done)
+    {
+      if (!ProposeStep(state, x, x_new))
+        continue;
+      Evaluate(x_new, e);
+      FinishStep(state, x, x_new, e);
+    }
+    m_StartError = state.m_StartError;
+    m_EndError = std::sqrt(state.m_Cost/std::max(m_Model.GetNumberOfResiduals(), 1u));
+    m_NumberOfEvaluations = state.m_NumberOfEvaluations;
+  }
+
+  /**
+    * Fits a batch of voxels that share the model configuration (e.g. the b-values). measurements contains num_voxels
+    * consecutive measurement vectors of length GetNumberOfResiduals(), x the start positions and receives the results.
+    * The voxels are iterated in lockstep, in blocks of BatchBlockSize voxels: the proposed steps of all unfinished
+    * voxels of a block are evaluated together, one residual (b-value) at a time for all voxels, so the model computes
+    * its b-value dependent terms once per step of the block instead of once per voxel. Each voxel takes the same steps as with Minimize(). The RMS errors are only
+    * written if end_errors is not null, GetStartError(), GetEndError() and GetNumberOfEvaluations() refer to the last
+    * voxel of the batch. The model has to provide additionally:
+    *
+    *   // residual s and its derivatives for num_voxels voxels, x and dr_dx hold NumberOfParameters values per voxel
+    *   void GetResiduals(unsigned int s, unsigned int num_voxels, const double* x, const double* const* measurements, double* r, double* dr_dx) const;
+    */
+  void MinimizeBatch(const double* measurements, unsigned int num_voxels, ParametersType* x, double* end_errors=nullptr)
+  {
+    const unsigned int num_residuals = m_Model.GetNumberOfResiduals();
+
+    // the voxels are processed in blocks, so that the states of a block stay in the cache
+    BatchBuffer buffer;
+    std::vector< unsigned int > active;
+    std::vector< unsigned int > proposed;
+    active.reserve(BatchBlockSize);
+    proposed.reserve(BatchBlockSize);
+    for (unsigned int block_start=0; block_start<num_voxels; block_start+=BatchBlockSize)
+    {
+      const unsigned int block_size = std::min(BatchBlockSize, num_voxels-block_start);
+      ParametersType* block_x = x + block_start;
+
+      active.clear();
+      for (unsigned int v=0; v<block_size; ++v)
+      {
+        active.push_back(v);
+        buffer.m_Measurements[v] = measurements + static_cast<std::size_t>(block_start+v)*num_residuals;
+      }
+      EvaluateBatch(active, block_x, buffer);
+      for (unsigned int v=0; v<block_size; ++v)
+        Start(buffer.m_States[v], buffer.m_Evaluations[v]);
+
+      while (!active.empty())
+      {
+        proposed.clear();
+        for (unsigned int v : active)
+          if (ProposeStep(buffer.m_States[v], block_x[v], buffer.m_XNew[v]))
+            proposed.push_back(v);
+
+        for (unsigned int k=0; k<proposed.size(); ++k)
+          buffer.m_Measurements[k] = measurements + static_cast<std::size_t>(block_start+proposed[k])*num_residuals;
+        EvaluateBatch(proposed, buffer.m_XNew, buffer);
+        for (unsigned int k=0; k<proposed.size(); ++k)
+          FinishStep(buffer.m_States[proposed[k]], block_x[proposed[k]], buffer.m_XNew[proposed[k]], buffer.m_Evaluations[k]);
+
+        active.erase(std::remove_if(active.begin(), active.end(), [&](unsigned int v){ return buffer.m_States[v].m_Done; }), active.end());
+      }
+
+      for (unsigned int v=0; v<block_size; ++v)
+      {
+        const FitState& state = buffer.m_States[v];
+        m_StartError = state.m_StartError;
+        m_EndError = std::sqrt(state.m_Cost/std::max(num_residuals, 1u));
+        m_NumberOfEvaluations = state.m_NumberOfEvaluations;
+        if (end_errors!=nullptr)
+          end_errors[block_start+v] = m_EndError;
+      }
+    }
+  }
+
+protected:
+
+  /** Squared residual norm, J^T*J and J^T*r at one position */
+  struct Evaluation
+  {
+    double m_JtJ[NumberOfParameters][NumberOfParameters];
+    double m_JtR[NumberOfParameters];
+    double m_Cost;
+  };
+
+  /** Iteration state of one fit */
+  struct FitState
+  {
+    double        m_JtJ[NumberOfParameters][NumberOfParameters];
+    double        m_JtR[NumberOfParameters];
+    double        m_Scale[NumberOfParameters];
+    double        m_Cost;
+    double        m_StartError;
+    double        m_Mu;
+    double        m_Nu;
+    double        m_Predicted;  ///< decrease of the linearized cost for the proposed step
+    double        m_XNorm;
+    double        m_HNorm;
+    unsigned int  m_NumberOfEvaluations;
+    bool          m_Done;
+  };
+
+  static const unsigned int BatchBlockSize = 64;
+
+  /** Fit states and packed parameters, residuals and derivatives of the voxels of one block of MinimizeBatch(). The
+   * evaluations and measurements are indexed by the position of the voxel in the list of evaluated voxels. */
+  struct BatchBuffer
+  {
+    FitState        m_States[BatchBlockSize];
+    Evaluation      m_Evaluations[BatchBlockSize];
+    ParametersType  m_XNew[BatchBlockSize];
+    double          m_X[BatchBlockSize*NumberOfParameters];
+    double          m_R[BatchBlockSize];
+    double          m_DrDx[BatchBlockSize*NumberOfParameters];
+    const double*   m_Measurements[BatchBlockSize];
+  };
+
+  /** Initializes the fit state with the evaluation at the start position. */
+  void Start(FitState& state, const Evaluation& e) const
+  {
+    const unsigned int n = NumberOfParameters;
+    CopyEvaluation(state, e);
+    state.m_NumberOfEvaluations = 1;
+    state.m_StartError = std::sqrt(e.m_Cost/std::max(m_Model.GetNumberOfResiduals(), 1u));
+    state.m_Done = !std::isfinite(e.m_Cost);
+    for (unsigned int a=0; a<n; ++a)
+      state.m_Scale[a] = e.m_JtJ[a][a]>0 ? e.m_JtJ[a][a] : 1.0;
+    state.m_Mu = 1e-3;
+    state.m_Nu = 2;
+  }
+
+  /** Proposes the next step x_new. Returns false if there is nothing to evaluate, either because the fit is done or
+   * because the damped normal equations could not be solved and the damping was increased. */
+  bool ProposeStep(FitState& state, const ParametersType& x, ParametersType& x_new) const
+  {
+    const unsigned int n = NumberOfParameters;
+    if (state.m_NumberOfEvaluations>=m_MaxFunctionEvaluations || !(state.m_Cost>0))
+    {
+      state.m_Done = true;
+      return false;
+    }
+
+    // gradient test: cosine of the angle between the residual vector and the columns of the Jacobian
+    double gnorm = 0;
+    for (unsigned int a=0; a<n; ++a)
+      if (state.m_JtJ[a][a]>0)
+        gnorm = std::max(gnorm, std::fabs(state.m_JtR[a])/std::sqrt(state.m_JtJ[a][a]*state.m_Cost));
+    if (gnorm<=m_GradientTolerance)
+    {
+      state.m_Done = true;
+      return false;
+    }
+
+    // damped normal equations (J^T*J + mu*D) h = -J^T*r
+    double h[NumberOfParameters];
+    if (!Solve(state.m_JtJ, state.m_Scale, state.m_Mu, state.m_JtR, h))
+    {
+      state.m_Mu *= state.m_Nu;
+      state.m_Nu *= 2;
+      if (state.m_Mu>1e30)
+        state.m_Done = true;
+      return false;
+    }
+
+    double xnorm = 0;
+    double hnorm = 0;
+    double predicted = 0;
+    for (unsigned int a=0; a<n; ++a)
+    {
+      x_new[a] = x[a] + h[a];
+      xnorm += state.m_Scale[a]*x[a]*x[a];
+      hnorm += state.m_Scale[a]*h[a]*h[a];
+
+      // decrease of the linearized cost ||r + J*h||^2
+      double jtjh = 0;
+      for (unsigned int b=0; b<n; ++b)
+        jtjh += state.m_JtJ[a][b]*h[b];
+      predicted -= h[a]*(2*state.m_JtR[a] + jtjh);
+    }
+    state.m_XNorm = std::sqrt(xnorm);
+    state.m_HNorm = std::sqrt(hnorm);
+    state.m_Predicted = predicted;
+    return true;
+  }
+
+  /** Accepts or rejects the proposed step x_new with its evaluation e and updates the damping. */
+  void FinishStep(FitState& state, ParametersType& x, const ParametersType& x_new, const Evaluation& e) const
+  {
+    const unsigned int n = NumberOfParameters;
+    ++state.m_NumberOfEvaluations;
+
+    double actual = state.m_Cost - e.m_Cost;
+    if (std::isfinite(e.m_Cost) && actual>0)
+    {
+      double rho = state.m_Predicted>0 ? actual/state.m_Predicted : 0;
+      bool converged = (actual<=m_FunctionTolerance*state.m_Cost && state.m_Predicted<=m_FunctionTolerance*state.m_Cost) || state.m_HNorm<=m_ParameterTolerance*state.m_XNorm;
+
+      x = x_new;
+      CopyEvaluation(state, e);
+      for (unsigned int a=0; a<n; ++a)
+        state.m_Scale[a] = std::max(state.m_Scale[a], state.m_JtJ[a][a]);
+
+      if (converged)
+      {
+        state.m_Done = true;
+        return;
+      }
+
+      double t = 2*rho-1;
+      state.m_Mu *= std::max(1.0/3, 1-t*t*t);
+      state.m_Nu = 2;
+    }
+    else
+    {
+      if (state.m_HNorm<=m_ParameterTolerance*state.m_XNorm)
+      {
+        state.m_Done = true;
+        return;
+      }
+      state.m_Mu *= state.m_Nu;
+      state.m_Nu *= 2;
+      if (state.m_Mu>1e30)
+        state.m_Done = true;
+    }
+  }
+
+  static void CopyEvaluation(FitState& state, const Evaluation& e)
+  {
+    const unsigned int n = NumberOfParameters;
+    state.m_Cost = e.m_Cost;
+    for (unsigned int a=0; a<n; ++a)
+    {
+      state.m_JtR[a] = e.m_JtR[a];
+      for (unsigned int b=0; b<n; ++b)
+        state.m_JtJ[a][b] = e.m_JtJ[a][b];
+    }
+  }
+
+  static void ClearEvaluation(Evaluation& e)
+  {
+    const unsigned int n = NumberOfParameters;
+    e.m_Cost = 0;
+    for (unsigned int a=0; a<n; ++a)
+    {
+      e.m_JtR[a] = 0;
+      for (unsigned int b=0; b<n; ++b)
+        e.m_JtJ[a][b] = 0;
+    }
+  }
+
+  /** Adds residual r with derivatives dr_dx to the lower triangle of J^T*J, to J^T*r and to the cost. */
+  static void Accumulate(Evaluation& e, double r, const double* dr_dx)
+  {
+    const unsigned int n = NumberOfParameters;
+    e.m_Cost += r*r;
+    for (unsigned int a=0; a<n; ++a)
+    {
+      e.m_JtR[a] += dr_dx[a]*r;
+      for (unsigned int b=0; b<=a; ++b)
+        e.m_JtJ[a][b] += dr_dx[a]*dr_dx[b];
+    }
+  }
+
+  static void Symmetrize(Evaluation& e)
+  {
+    const unsigned int n = NumberOfParameters;
+    for (unsigned int a=0; a<n; ++a)
+      for (unsigned int b=a+1; b<n; ++b)
+        e.m_JtJ[a][b] = e.m_JtJ[b][a];
+  }
+
+  /** Squared residual norm at x. Accumulates J^T*J and J^T*r. */
+  void Evaluate(const ParametersType& x, Evaluation& e) const
+  {
+    ClearEvaluation(e);
+    m_Model.SetParameters(x.data_block());
+    double dr_dx[NumberOfParameters];
+    const unsigned int num_residuals = m_Model.GetNumberOfResiduals();
+    for (unsigned int s=0; s<num_residuals; ++s)
+    {
+      double r = m_Model.GetResidual(s, dr_dx);
+      Accumulate(e, r, dr_dx);
+    }
+    Symmetrize(e);
+  }
+
+  /** Evaluates the voxels with the given block indices at positions x[voxel] into buffer.m_Evaluations. buffer.m_Measurements
+   * has to contain the measurements of the voxels in the same order. The residuals of each voxel are accumulated in the
+   * same order as by Evaluate(). */
+  void EvaluateBatch(const std::vector< unsigned int >& voxels, const ParametersType* x, BatchBuffer& buffer) const
+  {
+    const unsigned int n = NumberOfParameters;
+    const auto num_voxels = static_cast<unsigned int>(voxels.size());
+    if (num_voxels==0)
+      return;
+
+    for (unsigned int k=0; k<num_voxels; ++k)
+    {
+      ClearEvaluation(buffer.m_Evaluations[k]);
+      for (unsigned int a=0; a<n; ++a)
+        buffer.m_X[k*n + a] = x[voxels[k]][a];
+    }
+
+    const unsigned int num_residuals = m_Model.GetNumberOfResiduals();
+    for (unsigned int s=0; s<num_residuals; ++s)
+    {
+      m_Model.GetResiduals(s, num_voxels, buffer.m_X, buffer.m_Measurements, buffer.m_R, buffer.m_DrDx);
+      for (unsigned int k=0; k<num_voxels; ++k)
+        Accumulate(buffer.m_Evaluations[k], buffer.m_R[k], buffer.m_DrDx + k*n);
+    }
+
+    for (unsigned int k=0; k<num_voxels; ++k)
+      Symmetrize(buffer.m_Evaluations[k]);
+  }
+
+  /** Cholesky solution of (J^T*J + mu*diag(scale)) h = -J^T*r. Returns false if the matrix is not positive definite. */
+  static bool Solve(const double (&jtj)[NumberOfParameters][NumberOfParameters], const double (&scale)[NumberOfParameters], double mu, const double (&jtr)[NumberOfParameters], double (&h)[NumberOfParameters])
+  {
+    const unsigned int n = NumberOfParameters;
+    double l[NumberOfParameters][NumberOfParameters];
+    for (unsigned int a=0; a<n; ++a)
+      for (unsigned int b=0; b<=a; ++b)
+      {
+        double sum = jtj[a][b];
+        if (a==b)
+          sum += mu*scale[a];
+        for (unsigned int k=0; k<b; ++k)
+          sum -= l[a][k]*l[b][k];
+        if (a==b)
+        {
+          if (!(sum>0))
+            return false;
+          l[a][a] = std::sqrt(sum);
+        }
+        else
+          l[a][b] = sum/l[b][b];
+      }
+
+    for (unsigned int a=0; a<n; ++a)
+    {
+      double sum = -jtr[a];
+      for (unsigned int k=0; k<a; ++k)
+        sum -= l[a][k]*h[k];
+      h[a] = sum/l[a][a];
+    }
+    for (unsigned int a=n; a-->0;)
+    {
+      double sum = h[a];
+      for (unsigned int k=a+1; k<n; ++k)
+        sum -= l[k][a]*h[k];
+      h[a] = sum/l[a][a];
+    }
+    return true;
+  }
+
+  TModel&       m_Model;
+  unsigned int  m_MaxFunctionEvaluations;
+  double        m_FunctionTolerance;
+  double        m_ParameterTolerance;
+  double        m_GradientTolerance;
+  double        m_StartError;
+  double        m_EndError;
+  unsigned int  m_NumberOfEvaluations;
+};
+
+}
+
+#endif //__mitkLevenbergMarquardtSolver_h_
@@ -18,7 +18,8 @@ See LICENSE.txt or http://www.mitk.org for details.
 #define _itk_ADCFitFunctor_h_
 
 #include "itkDWIVoxelFunctor.h"
-#include "vnl/vnl_least_squares_function.h"
+#include <mitkLevenbergMarquardtSolver.h>
+#include <cmath>
 
 namespace itk
 {
@@ -49,16 +50,11 @@ protected:
   vnl_vector<double> m_BValueList;
 
   /**
-   * \brief The lestSquaresFunction struct for Non-Linear-Least-Squres fit of monoexponential model
+   * \brief The lestSquaresFunction struct for Non-Linear-Least-Squres fit of monoexponential model (mitk::LevenbergMarquardtSolver)
    */
-  struct lestSquaresFunction: public vnl_least_squares_function
+  struct lestSquaresFunction
   {
-
-    void set_measurements(const vnl_vector<double>& x)
-    {
-      measurements.set_size(x.size());
-      measurements.copy_in(x.data_block());
-    }
+    static const unsigned int NumberOfParameters = 1; /*number of unknowns [ ADC ]*/
 
     void set_bvalues(const vnl_vector<double>& x)
     {
@@ -71,29 +67,50 @@ protected:
       S0 = x;
     }
 
-    vnl_vector<double> measurements;
+    const double* measurements;
     vnl_vector<double> bValueVector;
     double S0;
-    int N;
+    unsigned int N;
+    double ADC;
 
     lestSquaresFunction(unsigned int number_of_measurements) :
-      vnl_least_squares_function(1 /*number of unknowns [ ADC ]*/, number_of_measurements, no_gradient)
+      measurements(nullptr), S0(0), N(number_of_measurements), ADC(0)
     {
-      N = get_number_of_residuals();
     }
 
-    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override {
+    unsigned int GetNumberOfResiduals() const { return N; }
 
-      const double & ADC = x[0];
+    bool SetMeasurements(const double* m)
+    {
+      measurements = m;
+      return true;
+    }
 
-      const vnl_vector<double> & b = bValueVector;
+    void SetParameters(const double* x)
+    {
+      ADC = x[0];
+    }
 
-      for(int s=0; s<N; s++)
-      {
-        double approx = S0 * std::exp(-b[s] * ADC);
-        fx[s] = std::fabs( measurements[s] - approx );
-      }
+    double GetResidual(unsigned int s, double* dr_dx) const
+    {
+      return Residual(bValueVector[s], S0, measurements[s], ADC, dr_dx);
+    }
+
+    /** batch evaluation for mitk::LevenbergMarquardtSolver::MinimizeBatch, the b-value is loaded once for all voxels */
+    void GetResiduals(unsigned int s, unsigned int num_voxels, const double* x, const double* const* m, double* r, double* dr_dx) const
+    {
+      const double b = bValueVector[s];
+      for (unsigned int v=0; v<num_voxels; ++v)
+        r[v] = Residual(b, S0, m[v][s], x[v], dr_dx + v);
+    }
 
+    static double Residual(double b, double S0, double measurement, double ADC, double* dr_dx)
+    {
+      double approx = S0 * std::exp(-b * ADC);
+      double diff = measurement - approx;
+      double sign = diff<0 ? -1.0 : 1.0;
+      dr_dx[0] = sign * b * approx;
+      return std::fabs( diff );
     }
   };
 };
@@ -20,9 +20,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include "itkDWIVoxelFunctor.h"
 #include <cmath>
 
-// vnl include
-#include "vnl/vnl_least_squares_function.h"
-#include "vnl/algo/vnl_levenberg_marquardt.h"
+#include <mitkLevenbergMarquardtSolver.h>
 
 namespace itk
 {
@@ -55,14 +53,9 @@ protected:
   /**
    * \brief The lestSquaresFunction struct for Non-Linear-Least-Squres fit of Biexponential model
    */
-  struct lestSquaresFunction: public vnl_least_squares_function
+  struct lestSquaresFunction
   {
-
-    void set_measurements(const vnl_vector<double>& x)
-    {
-      measurements.set_size(x.size());
-      measurements.copy_in(x.data_block());
-    }
+    static const unsigned int NumberOfParameters = 3; /*number of unknowns [ ADC_slow ADC_fast lambda]*/
 
     void set_bvalues(const vnl_vector<double>& x)
     {
@@ -75,31 +68,58 @@ protected:
       S0 = x;
     }
 
-    vnl_vector<double> measurements;
+    const double* measurements;
     vnl_vector<double> bValueVector;
     double S0;
-    int N;
+    unsigned int N;
+    double ADC_slow;
+    double ADC_fast;
+    double lambda;
 
     lestSquaresFunction(unsigned int number_of_measurements) :
-      vnl_least_squares_function(3 /*number of unknowns [ ADC_slow ADC_fast lambda]*/, number_of_measurements, no_gradient)
+      measurements(nullptr), S0(0), N(number_of_measurements), ADC_slow(0), ADC_fast(0), lambda(0)
     {
-      N = get_number_of_residuals();
     }
 
-    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override {
+    unsigned int GetNumberOfResiduals() const { return N; }
 
-      const double & ADC_slow = x[0];
-      const double & ADC_fast = x[1];
-      const double & lambda = x[2];
+    bool SetMeasurements(const double* m)
+    {
+      measurements = m;
+      return true;
+    }
 
-      const vnl_vector<double> & b = bValueVector;
+    void SetParameters(const double* x)
+    {
+      ADC_slow = x[0];
+      ADC_fast = x[1];
+      lambda = x[2];
+    }
 
-      for(int s=0; s<N; s++)
-      {
-        double approx = lambda * std::exp(-b[s] * ADC_slow) + (1-lambda) * std::exp(-b[s] * ADC_fast);
-        fx[s] = std::fabs( measurements[s] - approx*S0 );
-      }
+    double GetResidual(unsigned int s, double* dr_dx) const
+    {
+      return Residual(bValueVector[s], S0, measurements[s], ADC_slow, ADC_fast, lambda, dr_dx);
+    }
+
+    /** batch evaluation for mitk::LevenbergMarquardtSolver::MinimizeBatch, the b-value is loaded once for all voxels */
+    void GetResiduals(unsigned int s, unsigned int num_voxels, const double* x, const double* const* m, double* r, double* dr_dx) const
+    {
+      const double b = bValueVector[s];
+      for (unsigned int v=0; v<num_voxels; ++v)
+        r[v] = Residual(b, S0, m[v][s], x[3*v], x[3*v+1], x[3*v+2], dr_dx + 3*v);
+    }
 
+    static double Residual(double b, double S0, double measurement, double ADC_slow, double ADC_fast, double lambda, double* dr_dx)
+    {
+      const double e_slow = std::exp(-b * ADC_slow);
+      const double e_fast = std::exp(-b * ADC_fast);
+      double approx = lambda * e_slow + (1-lambda) * e_fast;
+      double diff = measurement - approx*S0;
+      double sign = diff<0 ? -S0 : S0;
+      dr_dx[0] = sign * b * lambda * e_slow;
+      dr_dx[1] = sign * b * (1-lambda) * e_fast;
+      dr_dx[2] = sign * (e_fast - e_slow);
+      return std::fabs( diff );
     }
   };
 
@@ -20,9 +20,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include "itkDWIVoxelFunctor.h"
 #include <cmath>
 
-// vnl include
-#include "vnl/vnl_least_squares_function.h"
-#include "vnl/algo/vnl_levenberg_marquardt.h"
+#include <mitkLevenbergMarquardtSolver.h>
 
 namespace itk
 {
@@ -55,19 +53,19 @@ protected:
   /**
    * \brief The lestSquaresFunction struct for Non-Linear-Least-Squres fit of Kurtosis
    */
-  struct lestSquaresFunction: public vnl_least_squares_function
+  struct lestSquaresFunction
   {
-
-    void set_measurements(const vnl_vector<double>& x)
-    {
-      measurements.set_size(x.size());
-      measurements.copy_in(x.data_block());
-    }
+    static const unsigned int NumberOfParameters = 2; /*number of unknowns [ADC AKC]*/
 
     void set_bvalues(const vnl_vector<double>& x)
     {
       bValueVector.set_size(x.size());
       bValueVector.copy_in(x.data_block());
+
+      // b-value dependent factor of the kurtosis term, computed once for all voxels
+      kurtosisFactorVector.set_size(x.size());
+      for (unsigned int s=0; s<x.size(); ++s)
+        kurtosisFactorVector[s] = 1./6. * x[s] * x[s];
     }
 
     void set_reference_measurement(const double & x)
@@ -75,29 +73,55 @@ protected:
       S0 = x;
     }
 
-    vnl_vector<double> measurements;
+    const double* measurements;
     vnl_vector<double> bValueVector;
+    vnl_vector<double> kurtosisFactorVector;  ///< b^2/6
     double S0;
-    int N;
+    unsigned int N;
+    double D;
+    double K;
 
     lestSquaresFunction(unsigned int number_of_measurements) :
-      vnl_least_squares_function(2 /*number of unknowns [ADC AKC]*/, number_of_measurements, no_gradient)
+      measurements(nullptr), S0(0), N(number_of_measurements), D(0), K(0)
     {
-      N = get_number_of_residuals();
     }
 
-    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override {
+    unsigned int GetNumberOfResiduals() const { return N; }
 
-      const double & D = x[0];
-      const double & K = x[1];
-      const vnl_vector<double> & b = bValueVector;
+    bool SetMeasurements(const double* m)
+    {
+      measurements = m;
+      return true;
+    }
 
-      for(int s=0; s<N; s++)
-      {
-        double approx = S0 * std::exp(- b[s] * D + 1./6. *b[s] * b[s] *D * D * K);
-        fx[s] = std::fabs( measurements[s] - approx );
-      }
+    void SetParameters(const double* x)
+    {
+      D = x[0];
+      K = x[1];
+    }
 
+    double GetResidual(unsigned int s, double* dr_dx) const
+    {
+      return Residual(bValueVector[s], kurtosisFactorVector[s], S0, measurements[s], D, K, dr_dx);
+    }
+
+    /** batch evaluation for mitk::LevenbergMarquardtSolver::MinimizeBatch, the b-value terms are loaded once for all voxels */
+    void GetResiduals(unsigned int s, unsigned int num_voxels, const double* x, const double* const* m, double* r, double* dr_dx) const
+    {
+      const double b = bValueVector[s];
+      const double c = kurtosisFactorVector[s];
+      for (unsigned int v=0; v<num_voxels; ++v)
+        r[v] = Residual(b, c, S0, m[v][s], x[2*v], x[2*v+1], dr_dx + 2*v);
+    }
+
+    static double Residual(double b, double c, double S0, double measurement, double D, double K, double* dr_dx)
+    {
+      double approx = S0 * std::exp(- b * D + c * D * D * K);
+      double diff = measurement - approx;
+      double sign = diff<0 ? -approx : approx;
+      dr_dx[0] = sign * (b - 2 * c * D * K);
+      dr_dx[1] = -sign * c * D * D;
+      return std::fabs( diff );
     }
   };
 
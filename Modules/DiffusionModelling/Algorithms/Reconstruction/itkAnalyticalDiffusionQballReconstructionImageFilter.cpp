@@ -26,6 +26,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <mitkDiffusionModellingHelperFunctions.h>
 
 #include <cstdio>
+#include <algorithm>
 #include <locale>
 #include <fstream>
 #include "itkPointShell.h"
@@ -43,7 +44,9 @@ AnalyticalDiffusionQballReconstructionImageFilter<T,TG,TO,ShOrder,NrOdfDirection
   m_DirectionsDuplicated(false),
   m_Delta1(0.001),
   m_Delta2(0.001),
-  m_UseMrtrixBasis(false)
+  m_UseMrtrixBasis(false),
+  m_UseBatchedReconstruction(true),
+  m_BatchSize(256)
 {
   // At least 1 inputs is necessary for a vector image.
   // For images added one at a time we need at least six
@@ -135,67 +138,53 @@ template<
     int ShOrder,
     int NrOdfDirections>
 vnl_vector<TOdfPixelType> itk::AnalyticalDiffusionQballReconstructionImageFilter<TReferenceImagePixelType, TGradientImagePixelType, TOdfPixelType, ShOrder, NrOdfDirections>::PreNormalize( vnl_vector<TOdfPixelType> vec, typename NumericTraits<ReferencePixelType>::AccumulateType b0 )
+{
+  PreNormalize(vec.data_block(), vec.size(), b0);
+  return vec;
+}
+
+template<
+    class TReferenceImagePixelType,
+    class TGradientImagePixelType,
+    class TOdfPixelType,
+    int ShOrder,
+    int NrOdfDirections>
+void itk::AnalyticalDiffusionQballReconstructionImageFilter<TReferenceImagePixelType, TGradientImagePixelType, TOdfPixelType, ShOrder, NrOdfDirections>::PreNormalize( TOdfPixelType* vec, unsigned int n, typename NumericTraits<ReferencePixelType>::AccumulateType b0 )
 {
   switch( m_NormalizationMethod )
   {
   case QBAR_STANDARD:
   {
-    int n = vec.size();
     double b0f = (double)b0;
-    for(int i=0; i<n; i++)
+    for(unsigned int i=0; i<n; i++)
     {
       vec[i] = vec[i]/b0f;
     }
-    return vec;
     break;
   }
   case QBAR_B_ZERO_B_VALUE:
+  case QBAR_ADC_ONLY:
   {
-    int n = vec.size();
-    for(int i=0; i<n; i++)
+    for(unsigned int i=0; i<n; i++)
     {
       if (vec[i]<=0)
         vec[i] = 0.001;
 
       vec[i] = log(vec[i]);
     }
-    return vec;
     break;
   }
   case QBAR_B_ZERO:
-  {
-    return vec;
-    break;
-  }
   case QBAR_NONE:
-  {
-    return vec;
-    break;
-  }
-  case QBAR_ADC_ONLY:
-  {
-    int n = vec.size();
-    for(int i=0; i<n; i++)
-    {
-      if (vec[i]<=0)
-        vec[i] = 0.001;
-
-      vec[i] = log(vec[i]);
-    }
-    return vec;
-    break;
-  }
   case QBAR_RAW_SIGNAL:
   {
-    return vec;
     break;
   }
   case QBAR_SOLID_ANGLE:
   case QBAR_NONNEG_SOLID_ANGLE:
   {
-    int n = vec.size();
     double b0f = (double)b0;
-    for(int i=0; i<n; i++)
+    for(unsigned int i=0; i<n; i++)
     {
       vec[i] = vec[i]/b0f;
 
@@ -210,12 +199,9 @@ vnl_vector<TOdfPixelType> itk::AnalyticalDiffusionQballReconstructionImageFilter
 
       vec[i] = log(-log(vec[i]));
     }
-    return vec;
     break;
   }
   }
-
-  return vec;
 }
 
 template< class T, class TG, class TO, int ShOrder, int NrOdfDirections>
@@ -276,6 +262,42 @@ void AnalyticalDiffusionQballReconstructionImageFilter<T,TG,TO,ShOrder,NrOdfDire
 template< class T, class TG, class TO, int ShOrder, int NrOdfDirections>
 void AnalyticalDiffusionQballReconstructionImageFilter<T,TG,TO,ShOrder,NrOdfDirections>
 ::DynamicThreadedGenerateData(const OutputImageRegionType& outputRegionForThread )
+{
+  // Compute the indicies of the baseline images and gradient images
+  std::vector<unsigned int> baselineind; // contains the indicies of
+  // the baseline images
+  std::vector<unsigned int> gradientind; // contains the indicies of
+  // the gradient images
+
+  for(GradientDirectionContainerType::ConstIterator gdcit = this->m_GradientDirectionContainer->Begin();
+      gdcit != this->m_GradientDirectionContainer->End(); ++gdcit)
+  {
+    float bval = gdcit.Value().two_norm();
+    bval = bval*bval*m_BValue;
+    if(bval < 100)
+      baselineind.push_back(gdcit.Index());
+    else
+      gradientind.push_back(gdcit.Index());
+  }
+
+  if( m_DirectionsDuplicated )
+  {
+    int gradIndSize = gradientind.size();
+    for(int i=0; i<gradIndSize; i++)
+      gradientind.push_back(gradientind[i]);
+  }
+
+  if (m_UseBatchedReconstruction)
+    ReconstructBatched(outputRegionForThread, baselineind, gradientind);
+  else
+    ReconstructVoxelwise(outputRegionForThread, baselineind, gradientind);
+
+  std::cout << "One Thread finished reconstruction" << std::endl;
+}
+
+template< class T, class TG, class TO, int ShOrder, int NrOdfDirections>
+void AnalyticalDiffusionQballReconstructionImageFilter<T,TG,TO,ShOrder,NrOdfDirections>
+::ReconstructVoxelwise(const OutputImageRegionType& outputRegionForThread, const std::vector<unsigned int>& baselineind, const std::vector<unsigned int>& gradientind )
 {
   typename OutputImageType::Pointer outputImage = static_cast< OutputImageType * >(this->ProcessObject::GetPrimaryOutput());
 
@@ -303,30 +325,6 @@ void AnalyticalDiffusionQballReconstructionImageFilter<T,TG,TO,ShOrder,NrOdfDire
   GradientIteratorType git(gradientImagePointer, outputRegionForThread );
   git.GoToBegin();
 
-  // Compute the indicies of the baseline images and gradient images
-  std::vector<unsigned int> baselineind; // contains the indicies of
-  // the baseline images
-  std::vector<unsigned int> gradientind; // contains the indicies of
-  // the gradient images
-
-  for(GradientDirectionContainerType::ConstIterator gdcit = this->m_GradientDirectionContainer->Begin();
-      gdcit != this->m_GradientDirectionContainer->End(); ++gdcit)
-  {
-    float bval = gdcit.Value().two_norm();
-    bval = bval*bval*m_BValue;
-    if(bval < 100)
-      baselineind.push_back(gdcit.Index());
-    else
-      gradientind.push_back(gdcit.Index());
-  }
-
-  if( m_DirectionsDuplicated )
-  {
-    int gradIndSize = gradientind.size();
-    for(int i=0; i<gradIndSize; i++)
-      gradientind.push_back(gradientind[i]);
-  }
-
   while( !git.IsAtEnd() )
   {
     GradientVectorType b = git.Get();
@@ -396,8 +394,148 @@ void AnalyticalDiffusionQballReconstructionImageFilter<T,TG,TO,ShOrder,NrOdfDire
     ++oit4; // coefficient image iterator
     ++git;  // Gradient  image iterator
   }
+}
 
-  std::cout << "One Thread finished reconstruction" << std::endl;
+template< class T, class TG, class TO, int ShOrder, int NrOdfDirections>
+void AnalyticalDiffusionQballReconstructionImageFilter<T,TG,TO,ShOrder,NrOdfDirections>
+::ReconstructBatched(const OutputImageRegionType& outputRegionForThread, const std::vector<unsigned int>& baselineind, const std::vector<unsigned int>& gradientind )
+{
+  if(m_NormalizationMethod == QBAR_NONNEG_SOLID_ANGLE)
+    itkExceptionMacro( << "Nonnegative Solid Angle not yet implemented");
+
+  typename OutputImageType::Pointer outputImage = static_cast< OutputImageType * >(this->ProcessObject::GetPrimaryOutput());
+
+  ImageRegionIterator< OutputImageType > oit(outputImage, outputRegionForThread);
+  oit.GoToBegin();
+
+  ImageRegionIterator< BZeroImageType > oit2(m_BZeroImage, outputRegionForThread);
+  oit2.GoToBegin();
+
+  ImageRegionIterator< FloatImageType > oit3(m_ODFSumImage, outputRegionForThread);
+  oit3.GoToBegin();
+
+  ImageRegionIterator< CoefficientImageType > oit4(m_CoefficientImage, outputRegionForThread);
+  oit4.GoToBegin();
+
+  typedef ImageRegionConstIterator< GradientImagesType > GradientIteratorType;
+  typedef typename GradientImagesType::PixelType         GradientVectorType;
+  typename GradientImagesType::Pointer gradientImagePointer = nullptr;
+
+  // Would have liked a dynamic_cast here, but seems SGI doesn't like it
+  // The enum will ensure that an inappropriate cast is not done
+  gradientImagePointer = static_cast< GradientImagesType * >(
+                           this->ProcessObject::GetInput(0) );
+
+  GradientIteratorType git(gradientImagePointer, outputRegionForThread );
+  git.GoToBegin();
+
+  const unsigned int numGradients = m_NumberOfGradientDirections;
+  const unsigned int numCoeffs = m_NumberCoefficients;
+  const unsigned int batchSize = std::max(1u, m_BatchSize);
+
+  // one row per voxel that passes the b0 threshold
+  std::vector<TO> signals(batchSize*numGradients);
+  std::vector<TO> coeffs(batchSize*numCoeffs);
+  std::vector<TO> odfs(batchSize*NrOdfDirections);
+  std::vector< typename NumericTraits<ReferencePixelType>::AccumulateType > b0s(batchSize);
+  std::vector<int> rows(batchSize);
+
+  while( !git.IsAtEnd() )
+  {
+    // gather the next block of voxels
+    unsigned int numVoxels = 0;
+    unsigned int numRows = 0;
+    for (; numVoxels<batchSize && !git.IsAtEnd(); ++numVoxels, ++git)
+    {
+      GradientVectorType b = git.Get();
+
+      typename NumericTraits<ReferencePixelType>::AccumulateType b0 = NumericTraits<ReferencePixelType>::Zero;
+      for(unsigned int i = 0; i < baselineind.size(); ++i)
+        b0 += b[baselineind[i]];
+      b0 /= this->m_NumberOfBaselineImages;
+      b0s[numVoxels] = b0;
+
+      if( (b0 != 0) && (b0 >= m_Threshold) )
+      {
+        TO* row = signals.data() + numRows*numGradients;
+        for( unsigned int i = 0; i< numGradients; i++ )
+          row[i] = static_cast<TO>(b[gradientind[i]]);
+        PreNormalize(row, numGradients, b0);
+        rows[numVoxels] = numRows++;
+      }
+      else
+        rows[numVoxels] = -1;
+    }
+
+    // SH fit and ODF evaluation for all gathered voxels
+    if (numRows>0)
+    {
+      BlockedGemm(signals.data(), m_CoeffReconstructionMatrixT.data_block(), coeffs.data(), numRows, numGradients, numCoeffs);
+      for (unsigned int r=0; r<numRows; ++r)
+        coeffs[r*numCoeffs] += 1.0/(2.0*sqrt(itk::Math::pi));
+
+      if(m_NormalizationMethod == QBAR_SOLID_ANGLE)
+        BlockedGemm(coeffs.data(), m_SphericalHarmonicBasisMatrixT.data_block(), odfs.data(), numRows, numCoeffs, NrOdfDirections);
+      else
+        BlockedGemm(signals.data(), m_ReconstructionMatrixT.data_block(), odfs.data(), numRows, numGradients, NrOdfDirections);
+    }
+
+    // scatter the results
+    for (unsigned int v=0; v<numVoxels; ++v)
+    {
+      OdfPixelType odf(0.0);
+      typename CoefficientImageType::PixelType coeffPixel(0.0);
+      if (rows[v]>=0)
+      {
+        odf = odfs.data() + rows[v]*NrOdfDirections;
+        coeffPixel = coeffs.data() + rows[v]*numCoeffs;
+        odf = Normalize(odf, b0s[v]);
+      }
+
+      oit.Set( odf );
+      oit2.Set( b0s[v] );
+      float sum = 0;
+      for (unsigned int k=0; k<odf.Size(); k++)
+        sum += (float) odf[k];
+      oit3.Set( sum-1 );
+      oit4.Set(coeffPixel);
+      ++oit;
+      ++oit3;
+      ++oit2;
+      ++oit4;
+    }
+  }
+}
+
+template< class T, class TG, class TO, int ShOrder, int NrOdfDirections>
+void AnalyticalDiffusionQballReconstructionImageFilter<T,TG,TO,ShOrder,NrOdfDirections>
+::BlockedGemm(const TO* A, const float* B, TO* C, unsigned int m, unsigned int k, unsigned int n)
+{
+  // tiles of B that stay in L1/L2 while all rows of A are streamed over them
+  const unsigned int blockK = 64;
+  const unsigned int blockN = 256;
+
+  std::fill(C, C+m*n, TO(0));
+  for (unsigned int k0=0; k0<k; k0+=blockK)
+  {
+    const unsigned int k1 = std::min(k, k0+blockK);
+    for (unsigned int n0=0; n0<n; n0+=blockN)
+    {
+      const unsigned int n1 = std::min(n, n0+blockN);
+      for (unsigned int i=0; i<m; ++i)
+      {
+        const TO* a = A + i*k;
+        TO* c = C + i*n;
+        for (unsigned int kk=k0; kk<k1; ++kk)
+        {
+          const TO aik = a[kk];
+          const float* b = B + kk*n;
+          for (unsigned int j=n0; j<n1; ++j)
+            c[j] += aik*b[j];
+        }
+      }
+    }
+  }
 }
 
 template< class T, class TG, class TO, int ShOrder, int NrOdfDirections>
@@ -576,6 +714,10 @@ void AnalyticalDiffusionQballReconstructionImageFilter<T,TG,TO,ShOrder,NrOdfDire
 
   m_SphericalHarmonicBasisMatrix  = mitk::sh::CalcShBasisForDirections(ShOrder, U->as_matrix());
   m_ReconstructionMatrix = m_SphericalHarmonicBasisMatrix * m_CoeffReconstructionMatrix;
+
+  m_ReconstructionMatrixT = m_ReconstructionMatrix.transpose();
+  m_CoeffReconstructionMatrixT = m_CoeffReconstructionMatrix.transpose();
+  m_SphericalHarmonicBasisMatrixT = m_SphericalHarmonicBasisMatrix.transpose();
 }
 
 template< class T, class TG, class TO, int ShOrder, int NrOdfDirections>
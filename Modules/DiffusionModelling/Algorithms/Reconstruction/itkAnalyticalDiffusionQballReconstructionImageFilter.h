@@ -23,6 +23,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include "vnl/algo/vnl_svd.h"
 #include "itkVectorContainer.h"
 #include "itkVectorImage.h"
+#include <vector>
 
 
 namespace itk{
@@ -67,6 +68,9 @@ namespace itk{
  * \li BasisFunctionCenters - the centers of the basis functions are used for
  * the sRBF (spherical radial basis functions interpolation). If not set, they
  * will be defaulted to equal m_EquatorNrSamplingPoints
+ * \li UseBatchedReconstruction - gather blocks of BatchSize voxels into a matrix and
+ * compute SH coefficients and ODF values as blocked matrix-matrix products (default).
+ * If false, every voxel is reconstructed separately by matrix-vector products.
  *
  * \par Template parameters
  * The class is templated over
@@ -177,6 +181,7 @@ public:
 
     OdfPixelType Normalize(OdfPixelType odf, typename NumericTraits<ReferencePixelType>::AccumulateType b0 );
     vnl_vector<TOdfPixelType> PreNormalize( vnl_vector<TOdfPixelType> vec, typename NumericTraits<ReferencePixelType>::AccumulateType b0  );
+    void PreNormalize( TOdfPixelType* vec, unsigned int n, typename NumericTraits<ReferencePixelType>::AccumulateType b0  );
 
     /** Threshold on the reference image data. The output ODF will be a null
    * pdf for pixels in the reference image that have a value less than this
@@ -198,6 +203,11 @@ public:
 
     itkSetMacro( UseMrtrixBasis, bool )
 
+    itkSetMacro( UseBatchedReconstruction, bool )
+    itkGetMacro( UseBatchedReconstruction, bool )
+    itkSetMacro( BatchSize, unsigned int )
+    itkGetMacro( BatchSize, unsigned int )
+
 #ifdef ITK_USE_CONCEPT_CHECKING
     /** Begin concept checking */
     itkConceptMacro(ReferenceEqualityComparableCheck,
@@ -228,11 +238,24 @@ protected:
     void DynamicThreadedGenerateData( const
                                OutputImageRegionType &outputRegionForThread) override;
 
+    /** Reconstructs one voxel after the other using matrix-vector products. */
+    void ReconstructVoxelwise( const OutputImageRegionType &outputRegionForThread, const std::vector<unsigned int>& baselineind, const std::vector<unsigned int>& gradientind );
+    /** Reconstructs blocks of m_BatchSize voxels using matrix-matrix products. */
+    void ReconstructBatched( const OutputImageRegionType &outputRegionForThread, const std::vector<unsigned int>& baselineind, const std::vector<unsigned int>& gradientind );
+
+    /** C (m x n) = A (m x k) * B (k x n), all matrices row-major. Each entry of C is accumulated in ascending
+     * order over k, like in the vnl matrix-vector product used by the voxelwise path. */
+    static void BlockedGemm( const TOdfPixelType* A, const float* B, TOdfPixelType* C, unsigned int m, unsigned int k, unsigned int n );
+
 private:
 
     vnl_matrix< float >                       m_ReconstructionMatrix;
     vnl_matrix< float >                       m_CoeffReconstructionMatrix;
     vnl_matrix< float >                       m_SphericalHarmonicBasisMatrix;
+    /** Transposed copies of the matrices above used by the batched reconstruction. */
+    vnl_matrix< float >                       m_ReconstructionMatrixT;
+    vnl_matrix< float >                       m_CoeffReconstructionMatrixT;
+    vnl_matrix< float >                       m_SphericalHarmonicBasisMatrixT;
     /** container to hold gradient directions */
     GradientDirectionContainerType::Pointer           m_GradientDirectionContainer;
     /** Number of gradient measurements */
@@ -253,6 +276,8 @@ private:
     TOdfPixelType                                     m_Delta1;
     TOdfPixelType                                     m_Delta2;
     bool                                              m_UseMrtrixBasis;
+    bool                                              m_UseBatchedReconstruction;
+    unsigned int                                      m_BatchSize;
 };
 
 }
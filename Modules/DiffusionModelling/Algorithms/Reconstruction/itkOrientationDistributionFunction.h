@@ -185,8 +185,24 @@ public:
 
   TComponent GetPrincipleCurvature(double alphaMinDegree, double alphaMaxDegree, int invert) const;
 
+  /** Read-only view on a contiguous range of direction indices. */
+  struct IndexRange
+  {
+    const int* m_Begin;
+    const int* m_End;
+    const int* begin() const { return m_Begin; }
+    const int* end() const { return m_End; }
+    std::size_t size() const { return static_cast<std::size_t>(m_End-m_Begin); }
+    int operator[](std::size_t i) const { return m_Begin[i]; }
+  };
+
+  /** Returns a copy of the neighbour indices of direction idx. Prefer GetNeighborRange in loops. */
   static std::vector<int> GetNeighbors(int idx);
 
+  /** Returns the sorted neighbour indices of direction idx on the base mesh. The table is built once and shared
+   * by all ODFs with the same number of directions, so the range can be used from multiple threads without locking. */
+  static IndexRange GetNeighborRange(int idx);
+
   static vtkPolyData* GetBaseMesh(){ComputeBaseMesh(); return m_BaseMesh;}
 
   static void ComputeBaseMesh();
@@ -203,15 +219,18 @@ private:
 
   static DirectionsType* m_Directions;
 
-  static std::vector< std::vector<int>* >* m_NeighborIdxs;
+  static void ComputeNeighborTable();
+
+  static std::vector<int> m_NeighborOffsets;  ///< CSR row offsets (NOdfDirections+1 entries) into m_NeighborIdxs
+  static std::vector<int> m_NeighborIdxs;
 
   static std::vector< std::vector<int>* >* m_AngularRangeIdxs;
 
-  static std::vector<int>* m_HalfSphereIdxs;
+  static std::vector<int> m_HalfSphereIdxs;
 
   static std::mutex m_MutexBaseMesh;
-  static std::mutex m_MutexHalfSphereIdxs;
-  static std::mutex m_MutexNeighbors;
+  static std::once_flag m_HalfSphereOnce;
+  static std::once_flag m_NeighborsOnce;
   static std::mutex m_MutexAngularRange;
   typename itk::DiffusionTensor3D<TComponent>::EigenValuesArrayType   m_EigenValues;
   typename itk::DiffusionTensor3D<TComponent>::EigenVectorsMatrixType m_EigenVectors;
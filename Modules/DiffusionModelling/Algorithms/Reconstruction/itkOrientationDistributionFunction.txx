@@ -29,6 +29,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <mitkLogMacros.h>
 #include <vtkDelaunay2D.h>
 #include <vtkPlane.h>
+#include <algorithm>
 
 namespace itk
 {
@@ -44,20 +45,23 @@ vnl_matrix_fixed<double, 3, N>* itk::OrientationDistributionFunction<T,N>::m_Dir
 = itk::PointShell<N, vnl_matrix_fixed<double, 3, N> >::DistributePointShell();
 
 template<class T, unsigned int N>
-std::vector< std::vector<int>* >* itk::OrientationDistributionFunction<T,N>::m_NeighborIdxs = nullptr;
+std::vector<int> itk::OrientationDistributionFunction<T,N>::m_NeighborOffsets;
+
+template<class T, unsigned int N>
+std::vector<int> itk::OrientationDistributionFunction<T,N>::m_NeighborIdxs;
 
 template<class T, unsigned int N>
 std::vector< std::vector<int>* >* itk::OrientationDistributionFunction<T,N>::m_AngularRangeIdxs = nullptr;
 
 template<class T, unsigned int N>
-std::vector<int>* itk::OrientationDistributionFunction<T,N>::m_HalfSphereIdxs = nullptr;
+std::vector<int> itk::OrientationDistributionFunction<T,N>::m_HalfSphereIdxs;
 
 template<class T, unsigned int N>
 std::mutex itk::OrientationDistributionFunction<T,N>::m_MutexBaseMesh;
 template<class T, unsigned int N>
-std::mutex itk::OrientationDistributionFunction<T,N>::m_MutexHalfSphereIdxs;
+std::once_flag itk::OrientationDistributionFunction<T,N>::m_HalfSphereOnce;
 template<class T, unsigned int N>
-std::mutex itk::OrientationDistributionFunction<T,N>::m_MutexNeighbors;
+std::once_flag itk::OrientationDistributionFunction<T,N>::m_NeighborsOnce;
 template<class T, unsigned int N>
 std::mutex itk::OrientationDistributionFunction<T,N>::m_MutexAngularRange;
 
@@ -588,11 +592,10 @@ OrientationDistributionFunction<T, NOdfDirections>
     {
       double p[3];
       points->GetPoint(i,p);
-      std::vector<int> neighbors = GetNeighbors(i);
-      for(std::size_t j=0; j<neighbors.size(); j++)
+      for(int nb : GetNeighborRange(i))
       {
         double n[3];
-        points->GetPoint(neighbors[j],n);
+        points->GetPoint(nb,n);
         double d = sqrt(
                      (p[0]-n[0])*(p[0]-n[0]) +
             (p[1]-n[1])*(p[1]-n[1]) +
@@ -702,13 +705,14 @@ OrientationDistributionFunction<T, NOdfDirections>
 template<class T, unsigned int NOdfDirections>
 int OrientationDistributionFunction<T, NOdfDirections>::GetPrincipalDiffusionDirectionIndex() const
 {
+  const T* values = this->GetDataPointer();
   T max = NumericTraits<T>::NonpositiveMin();
   int maxidx = -1;
   for( unsigned int i=0; i<InternalDimension; i++)
   {
-    if((*this)[i] >= max )
+    if( values[i] >= max )
     {
-      max = (*this)[i];
+      max = values[i];
       maxidx = i;
     }
   }
@@ -742,51 +746,61 @@ vnl_vector_fixed<double,3> OrientationDistributionFunction<T, NOdfDirections>::G
 }
 
 template<class T, unsigned int NOdfDirections>
-std::vector<int>
+void
 OrientationDistributionFunction<T, NOdfDirections>
-::GetNeighbors(int idx)
+::ComputeNeighborTable()
 {
   ComputeBaseMesh();
 
-  m_MutexNeighbors.lock();
-  if(m_NeighborIdxs == nullptr)
+  // collect the two other corners of every triangle for each of its corners
+  std::vector< std::vector<int> > idxs(NOdfDirections);
+  vtkCellArray* polys = m_BaseMesh->GetPolys();
+  polys->InitTraversal();
+  vtkIdType npts; vtkIdType const *pts;
+  while(polys->GetNextCell(npts,pts))
   {
-    m_NeighborIdxs = new std::vector< std::vector<int>* >();
-    vtkCellArray* polys = m_BaseMesh->GetPolys();
-
-    for(unsigned int i=0; i<NOdfDirections; i++)
+    if (npts<3)
+      continue;
+    for (int c=0; c<3; c++)
     {
-      auto      idxs = new std::vector<int>();
-      polys->InitTraversal();
-      vtkIdType npts; vtkIdType const *pts;
-      while(polys->GetNextCell(npts,pts))
-      {
-        if( pts[0] == i )
-        {
-          idxs->push_back(pts[1]);
-          idxs->push_back(pts[2]);
-        }
-        else if( pts[1] == i )
-        {
-          idxs->push_back(pts[0]);
-          idxs->push_back(pts[2]);
-        }
-        else if( pts[2] == i )
-        {
-          idxs->push_back(pts[0]);
-          idxs->push_back(pts[1]);
-        }
-      }
-      std::sort(idxs->begin(), idxs->end());
-      std::vector< int >::iterator endLocation;
-      endLocation = std::unique( idxs->begin(), idxs->end() );
-      idxs->erase(endLocation, idxs->end());
-      m_NeighborIdxs->push_back(idxs);
+      if (pts[c]<0 || pts[c]>=NOdfDirections)
+        continue;
+      idxs[pts[c]].push_back(static_cast<int>(pts[(c+1)%3]));
+      idxs[pts[c]].push_back(static_cast<int>(pts[(c+2)%3]));
     }
   }
-  m_MutexNeighbors.unlock();
 
-  return *m_NeighborIdxs->at(idx);
+  m_NeighborOffsets.resize(NOdfDirections+1);
+  m_NeighborOffsets[0] = 0;
+  for(unsigned int i=0; i<NOdfDirections; i++)
+  {
+    std::sort(idxs[i].begin(), idxs[i].end());
+    idxs[i].erase(std::unique(idxs[i].begin(), idxs[i].end()), idxs[i].end());
+    m_NeighborOffsets[i+1] = m_NeighborOffsets[i] + static_cast<int>(idxs[i].size());
+  }
+
+  m_NeighborIdxs.reserve(m_NeighborOffsets[NOdfDirections]);
+  for(unsigned int i=0; i<NOdfDirections; i++)
+    m_NeighborIdxs.insert(m_NeighborIdxs.end(), idxs[i].begin(), idxs[i].end());
+}
+
+template<class T, unsigned int NOdfDirections>
+typename OrientationDistributionFunction<T, NOdfDirections>::IndexRange
+OrientationDistributionFunction<T, NOdfDirections>
+::GetNeighborRange(int idx)
+{
+  std::call_once(m_NeighborsOnce, &Self::ComputeNeighborTable);
+  const int* data = m_NeighborIdxs.data();
+  return IndexRange{ data + m_NeighborOffsets[idx], data + m_NeighborOffsets[idx+1] };
+}
+
+template<class T, unsigned int NOdfDirections>
+std::vector<int>
+OrientationDistributionFunction<T, NOdfDirections>
+::GetNeighbors(int idx)
+{
+  IndexRange nbs = GetNeighborRange(idx);
+  return std::vector<int>(nbs.begin(), nbs.end());
 }
 
 /**
@@ -801,65 +815,59 @@ OrientationDistributionFunction<T, NOdfDirections>
   if( n == 0 )
     return GetPrincipalDiffusionDirectionIndex();
 
-  m_MutexHalfSphereIdxs.lock();
-  if( !m_HalfSphereIdxs )
+  // the half sphere is defined by the vector passed with the first call
+  std::call_once(m_HalfSphereOnce, [&rndVec]()
   {
-    m_HalfSphereIdxs = new std::vector<int>();
     for( unsigned int i=0; i<InternalDimension; i++)
     {
       if(dot_product(m_Directions->get_column(i),rndVec) > 0.0)
-      {
-        m_HalfSphereIdxs->push_back(i);
-      }
+        m_HalfSphereIdxs.push_back(i);
     }
-  }
-  m_MutexHalfSphereIdxs.unlock();
+  });
 
   // collect indices of directions
   // that are local maxima
-  std::vector<int> localMaxima;
-  std::vector<int>::iterator it;
-  for( it=m_HalfSphereIdxs->begin();
-       it!=m_HalfSphereIdxs->end();
-       it++)
-  {
-    std::vector<int> nbs = GetNeighbors(*it);
-    std::vector<int>::iterator it2;
+  const T* values = this->GetDataPointer();
+  int localMaxima[NOdfDirections];
+  int numMaxima = 0;
+  for( int idx : m_HalfSphereIdxs )
+  {
+    const T val = values[idx];
     bool max = true;
-    for(it2 = nbs.begin();
-        it2 != nbs.end();
-        it2++)
+    for( int nb : GetNeighborRange(idx) )
     {
-      if((*this)[*it2] > (*this)[*it])
+      if( values[nb] > val )
       {
         max = false;
         break;
       }
     }
     if(max)
-      localMaxima.push_back(*it);
+      localMaxima[numMaxima++] = idx;
   }
 
-  // delete n highest local maxima from list
-  // and return remaining highest
+  // remove the n highest local maxima from the list
+  // and return the remaining highest
   int maxidx = -1;
   for( int i=0; i<=n; i++ )
   {
     maxidx = -1;
+    int maxpos = -1;
     T max = NumericTraits<T>::NonpositiveMin();
-    for(it = localMaxima.begin();
-        it != localMaxima.end();
-        it++)
+    for( int j=0; j<numMaxima; j++ )
     {
-      if((*this)[*it]>max)
+      if( values[localMaxima[j]]>max )
       {
-        max = (*this)[*it];
-        maxidx = *it;
+        max = values[localMaxima[j]];
+        maxidx = localMaxima[j];
+        maxpos = j;
       }
     }
-    it = find(localMaxima.begin(), localMaxima.end(), maxidx);
-    if(it!=localMaxima.end())
-      localMaxima.erase(it);
+    if( maxpos>=0 )
+    {
+      std::copy(localMaxima+maxpos+1, localMaxima+numMaxima, localMaxima+maxpos);
+      --numMaxima;
+    }
   }
 
   return maxidx;
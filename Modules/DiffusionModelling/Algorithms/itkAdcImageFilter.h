@@ -25,8 +25,7 @@ This file is based heavily on a corresponding ITK filter.
 #include "itkImageToImageFilter.h"
 #include "itkVectorImage.h"
 #include <mitkDiffusionPropertyHelper.h>
-#include <vnl/algo/vnl_levenberg_marquardt.h>
-#include <vnl/vnl_least_squares_function.h>
+#include <mitkLevenbergMarquardtSolver.h>
 
 namespace itk{
 /** \class AdcImageFilter
@@ -65,21 +64,17 @@ public:
 
   /**
    * \brief The lestSquaresFunction struct for Non-Linear-Least-Squres fit of monoexponential model Si = S0*exp(-b*ADC)
+   * (mitk::LevenbergMarquardtSolver with analytic derivatives)
    */
-  struct adcLeastSquaresFunction: public vnl_least_squares_function
+  struct adcLeastSquaresFunction
   {
+    static const unsigned int NumberOfParameters = 1;
 
     void set_S0(double val)
     {
       S0 = val;
     }
 
-    void set_measurements(const vnl_vector<double>& m)
-    {
-      measurements.set_size(m.size());
-      measurements.copy_in(m.data_block());
-    }
-
     void set_bvalues(const vnl_vector<double>& x)
     {
       bValues.set_size(x.size());
@@ -89,21 +84,32 @@ public:
     vnl_vector<double> measurements;
     vnl_vector<double> bValues;
     double S0;
+    double ADC;
 
     adcLeastSquaresFunction(unsigned int number_of_measurements=1) :
-        vnl_least_squares_function(1, number_of_measurements, no_gradient)
+        measurements(number_of_measurements, 0), S0(0), ADC(0)
     {
     }
 
-    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override {
+    unsigned int GetNumberOfResiduals() const { return measurements.size(); }
 
-      const double & ADC = x[0];
+    bool SetMeasurements(const double* m)
+    {
+      measurements.copy_in(m);
+      return true;
+    }
 
-      for(unsigned int s=0; s<measurements.size(); s++)
-      {
-        double approx = S0 * std::exp(-bValues[s] * ADC);
-        fx[s] = std::fabs( measurements[s] - approx );
-      }
+    void SetParameters(const double* x)
+    {
+      ADC = x[0];
+    }
+
+    double GetResidual(unsigned int s, double* dr_dx) const
+    {
+      double approx = S0 * std::exp(-bValues[s] * ADC);
+      double diff = measurements[s] - approx;
+      dr_dx[0] = (diff<0 ? -1.0 : 1.0) * bValues[s] * approx;
+      return std::fabs( diff );
     }
   };
 
@@ -122,7 +128,7 @@ public:
   GradientContainerType m_GradientDirections;
   ItkUcharImageType::Pointer m_MaskImage;
 
-  double FitSingleVoxel( const typename InputImageType::PixelType &input);
+  double FitSingleVoxel( const typename InputImageType::PixelType &input, adcLeastSquaresFunction& f, mitk::LevenbergMarquardtSolver< adcLeastSquaresFunction >& lm);
 
 };
 
@@ -82,32 +82,25 @@ AdcImageFilter< TInPixelType, TOutPixelType>
 
 template< class TInPixelType, class TOutPixelType >
 double
-AdcImageFilter< TInPixelType, TOutPixelType>::FitSingleVoxel( const typename InputImageType::PixelType &input)
+AdcImageFilter< TInPixelType, TOutPixelType>::FitSingleVoxel( const typename InputImageType::PixelType &input, adcLeastSquaresFunction& f, mitk::LevenbergMarquardtSolver< adcLeastSquaresFunction >& lm)
 {
   double S0 = 0;
   int nonzero = 0;
-  vnl_vector<double> m; m.set_size(m_Nonzero_B_values.size());
   for (unsigned int i=0; i<m_B_values.size(); i++)
   {
     if (m_B_values[i]>1)
     {
-      m[nonzero] = input[i];
+      f.measurements[nonzero] = input[i];
       nonzero++;
     }
     else
       S0 += input[i];
   }
   S0 /= (m_B_values.size() - m_Nonzero_B_values.size());
-
-  adcLeastSquaresFunction f(m_Nonzero_B_values.size());
-  f.set_bvalues(m_Nonzero_B_values);
   f.set_S0(S0);
-  f.set_measurements(m);
-
-  vnl_levenberg_marquardt lm(f);
 
-  vnl_vector_fixed<double, 1> x; x.fill(0);
-  lm.minimize(x);
+  typename mitk::LevenbergMarquardtSolver< adcLeastSquaresFunction >::ParametersType x; x.fill(0);
+  lm.Minimize(x);
 
   return x[0];
 }
@@ -129,6 +122,12 @@ AdcImageFilter< TInPixelType, TOutPixelType>
 
   InputIteratorType git( inputImagePointer, outputRegionForThread );
   git.GoToBegin();
+
+  // the b-values are the same for all voxels, model and solver are reused
+  adcLeastSquaresFunction f(m_Nonzero_B_values.size());
+  f.set_bvalues(m_Nonzero_B_values);
+  mitk::LevenbergMarquardtSolver< adcLeastSquaresFunction > lm(f);
+
   while( !git.IsAtEnd() )
   {
     typename InputImageType::PixelType pix = git.Get();
@@ -181,7 +180,7 @@ AdcImageFilter< TInPixelType, TOutPixelType>
     }
     else
     {
-      outval = FitSingleVoxel(pix);
+      outval = FitSingleVoxel(pix, f, lm);
     }
 
     //        if (outval<-0.00001)
@@ -31,7 +31,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <vtkPolyLine.h>
 
 #include <boost/math/special_functions.hpp>
-#include <boost/timer/progress_display.hpp>
+#include <algorithm>
 
 using namespace boost::math;
 
@@ -50,6 +50,7 @@ OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
   , m_MaxNumPeaks(2)
   , m_RelativePeakThreshold(0.4)
   , m_AbsolutePeakThreshold(0)
+  , m_ShEvaluator(ShOrder)
   , m_AngularThreshold(0.9)
   , m_NumCoeffs((ShOrder*ShOrder + ShOrder + 2)/2 + ShOrder)
   , m_Toolkit(MRTRIX)
@@ -59,6 +60,8 @@ OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
   , m_ApplyDirectionMatrix(false)
   , m_ScaleByGfa(false)
   , m_Iterations(10)
+  , m_NumProcessedVoxels(0)
+  , m_NumVoxels(0)
 {
   this->SetNumberOfRequiredInputs(1);
 
@@ -86,9 +89,9 @@ double OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
     if (val>thr*0.9 && gfa*val>m_AbsolutePeakThreshold*0.9)
     {
       flag = true;
-      std::vector< int > neighbours = odf.GetNeighbors(i);
+      auto neighbours = odf.GetNeighborRange(i);
       for (unsigned int j=0; j<neighbours.size(); j++)
-        if (val<odf.GetElement(neighbours.at(j)))
+        if (val<odf.GetElement(neighbours[j]))
         {
           flag = false;
           break;
@@ -98,7 +101,7 @@ double OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
         container.push_back(odf.GetDirection(i).normalize());
         used[i] = true;
         for (unsigned int j=0; j<neighbours.size(); j++)
-          used[neighbours.at(j)] = true;
+          used[neighbours[j]] = true;
       }
     }
   }
@@ -190,6 +193,10 @@ void OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
     m_ShBasis = mitk::sh::CalcShBasisForDirections(ShOrder, dir_matrix);
   else
     m_ShBasis = mitk::sh::CalcShBasisForDirections(ShOrder, dir_matrix, false);
+  m_ShEvaluator = mitk::ShEvaluator(ShOrder, m_Toolkit==Toolkit::MRTRIX);
+
+  m_NumVoxels = ShCoeffImage->GetLargestPossibleRegion().GetNumberOfPixels();
+  m_NumProcessedVoxels = 0;
 
   MITK_INFO << "Starting peak extraction";
   MITK_INFO << "SH order: " << ShOrder;
@@ -197,14 +204,13 @@ void OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
   MITK_INFO << "Relative threshold: " << m_RelativePeakThreshold;
   MITK_INFO << "Absolute threshold: " << m_AbsolutePeakThreshold;
   MITK_INFO << "Angular threshold: " << m_AngularThreshold;
-  this->SetNumberOfWorkUnits(1);
 }
 
 template< class PixelType, int ShOrder, int NrOdfDirections >
 void OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
 ::AfterThreadedGenerateData()
 {
-
+  this->UpdateProgress(1.0f);
 }
 
 template< class PixelType, int ShOrder, int NrOdfDirections >
@@ -215,14 +221,28 @@ void OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
 
   ImageRegionConstIterator< CoefficientImageType > cit(ShCoeffImage, outputRegionForThread );
 
-  boost::timer::progress_display disp(outputRegionForThread.GetSize()[0]*outputRegionForThread.GetSize()[1]*outputRegionForThread.GetSize()[2]);
+  // each work unit counts its own voxels and adds them to the total once per image line. The work unit that crosses a
+  // percent step reports the progress to the observers of the filter.
+  const unsigned long line_length = outputRegionForThread.GetSize()[0];
+  const unsigned long progress_step = std::max(m_NumVoxels/100, 1ul);
+  unsigned long line_count = 0;
+  auto count_voxel = [&]()
+  {
+    if (++line_count<line_length)
+      return;
+    unsigned long progress = m_NumProcessedVoxels.fetch_add(line_count) + line_count;
+    if (progress/progress_step != (progress-line_count)/progress_step)
+      this->UpdateProgress(static_cast<float>(progress)/m_NumVoxels);
+    line_count = 0;
+  };
+
   OdfType odf;
   while( !cit.IsAtEnd() )
   {
     typename CoefficientImageType::IndexType idx3 = cit.GetIndex();
     if (m_MaskImage->GetPixel(idx3)==0)
     {
-      ++disp;
+      count_voxel();
       ++cit;
       continue;
     }
@@ -243,7 +263,7 @@ void OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
     }
     if (max<0.0001)
     {
-      ++disp;
+      count_voxel();
       ++cit;
       continue;
     }
@@ -262,10 +282,7 @@ void OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
       x[1] = spherical[0];  // phi
 
       VnlCostFunction cost;
-      if (m_Toolkit==Toolkit::MRTRIX)
-        cost.SetProblem(coeffs, ShOrder, true, max);
-      else
-        cost.SetProblem(coeffs, ShOrder, false, max);
+      cost.SetProblem(coeffs, &m_ShEvaluator);
 
       vnl_lbfgsb minimizer(cost);
       minimizer.set_f_tolerance(1e-6);
@@ -353,10 +370,9 @@ void OdfMaximaExtractionFilter< PixelType, ShOrder, NrOdfDirections>
       }
     }
     m_NumDirectionsImage->SetPixel(idx3, num);
-    ++disp;
+    count_voxel();
     ++cit;
   }
-  MITK_INFO << "One thread finished extraction";
 }
 
 }
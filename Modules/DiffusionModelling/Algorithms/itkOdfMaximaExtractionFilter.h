@@ -28,37 +28,50 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <itkOrientationDistributionFunction.h>
 #include <vnl/algo/vnl_lbfgsb.h>
 #include <mitkDiffusionModellingHelperFunctions.h>
+#include <mitkShEvaluator.h>
+#include <atomic>
 
 class VnlCostFunction : public vnl_cost_function
 {
 public:
 
-  bool mrtrix;
-  int ShOrder;
+  const mitk::ShEvaluator* evaluator;
   vnl_vector<float> coeffs;
-  double max;
-  void SetProblem(vnl_vector<float>& coeffs, int ShOrder, bool mrtrix, double max)
+  void SetProblem(vnl_vector<float>& coeffs, const mitk::ShEvaluator* evaluator)
   {
     this->coeffs = coeffs;
-    this->ShOrder = ShOrder;
-    this->mrtrix = mrtrix;
-    this->max = max;
+    this->evaluator = evaluator;
   }
 
-  VnlCostFunction(const int NumVars=2) : vnl_cost_function(NumVars)
+  VnlCostFunction(const int NumVars=2) : vnl_cost_function(NumVars), evaluator(nullptr)
   {
   }
 
   // cost function
   double f(vnl_vector<double> const &x)
   {
-    return -mitk::sh::GetValue(coeffs, ShOrder, x[0], x[1], mrtrix);
+    return -evaluator->GetValue(coeffs.data_block(), x[0], x[1]);
   }
 
   // gradient of cost function
   void gradf(vnl_vector<double> const &x, vnl_vector<double> &dx)
   {
-    fdgradf(x, dx);
+    double f;
+    compute(x, &f, &dx);
+  }
+
+  // cost function and gradient in one pass of the SH recurrences
+  void compute(vnl_vector<double> const &x, double *f, vnl_vector<double> *g)
+  {
+    double d_theta, d_phi;
+    double val = evaluator->GetValueAndGradient(coeffs.data_block(), x[0], x[1], d_theta, d_phi);
+    if (f!=nullptr)
+      *f = -val;
+    if (g!=nullptr)
+    {
+      (*g)[0] = -d_theta;
+      (*g)[1] = -d_phi;
+    }
   }
 };
 
@@ -67,6 +80,9 @@ namespace itk{
 
 /**
 * \brief Extract ODF peaks by searching all local maxima on a roughly sampled sphere and a successive gradient descent optimization
+*
+* Voxels are processed in parallel. The peak refinement evaluates the SH series and its analytic gradient with a
+* precomputed mitk::ShEvaluator.
 */
 
 template< class PixelType, int ShOrder, int NrOdfDirections >
@@ -155,6 +171,7 @@ Image< unsigned char, 3 > >
     double                                      m_RelativePeakThreshold;        ///< threshold on the peak length relative to the largest peak inside the current voxel
     double                                      m_AbsolutePeakThreshold;///< hard threshold on the peak length of all local maxima
     vnl_matrix< float >                         m_ShBasis;              ///< container for evaluated SH base functions
+    mitk::ShEvaluator                           m_ShEvaluator;          ///< SH series and gradient evaluation for the peak refinement
     double                                      m_AngularThreshold;
     const int                                   m_NumCoeffs;            ///< number of spherical harmonics coefficients
 
@@ -169,6 +186,9 @@ Image< unsigned char, 3 > >
     bool                                        m_ApplyDirectionMatrix;
     bool                                        m_ScaleByGfa;
     int                                         m_Iterations;
+
+    std::atomic< unsigned long >                m_NumProcessedVoxels;   ///< progress, every work unit adds its own count once per image line
+    unsigned long                               m_NumVoxels;
 };
 
 }
@@ -1,5 +1,7 @@
 set(MODULE_CUSTOM_TESTS
   mitkImageReconstructionTest.cpp
   mitkPeakShImageReaderTest.cpp
+  mitkOdfMaximaExtractionTest.cpp
+  mitkVoxelwiseModelFitTest.cpp
 )
 
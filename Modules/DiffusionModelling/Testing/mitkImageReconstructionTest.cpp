@@ -26,6 +26,11 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <itkAnalyticalDiffusionQballReconstructionImageFilter.h>
 #include <mitkImage.h>
 #include <mitkDiffusionPropertyHelper.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkImageRegionIterator.h>
+#include <itkTimeProbe.h>
+#include <cstdlib>
+#include <limits>
 
 
 #include <mitkTestFixture.h>
@@ -41,6 +46,8 @@ class mitkImageReconstructionTestSuite : public mitk::TestFixture
   MITK_TEST(CsaQball);
   MITK_TEST(ADC);
   MITK_TEST(RawSignal);
+  MITK_TEST(BatchedQball);
+  MITK_TEST(BenchmarkBatchedQball);
   CPPUNIT_TEST_SUITE_END();
 
   typedef itk::Image<float, 3> ItkFloatImgType;
@@ -53,6 +60,81 @@ class mitkImageReconstructionTestSuite : public mitk::TestFixture
       itk::VectorImage<short,3>::Pointer itkVectorImagePointer;
       mitk::DiffusionPropertyHelper::GradientDirectionsContainerType::ConstPointer gradients;
 
+  /** Runs the analytical Q-ball reconstruction with the voxelwise and with the batched kernel, checks that both
+   * yield the same ODFs. */
+  template< int ShOrder >
+  void CompareBatchedQball(int normalization)
+  {
+    typedef itk::AnalyticalDiffusionQballReconstructionImageFilter<short,short,float,ShOrder,ODF_SAMPLING_SIZE> FilterType;
+
+    unsigned int num_coeffs = (ShOrder*ShOrder + ShOrder + 2)/2 + ShOrder;
+    unsigned int num_gradients = 0;
+    for (auto it = gradients->Begin(); it != gradients->End(); ++it)
+      if (it.Value().two_norm()*it.Value().two_norm()*b_value >= 100)
+        ++num_gradients;
+    if (num_gradients < num_coeffs)
+    {
+      MITK_INFO << "Skipping SH order " << ShOrder << ": " << num_gradients << " gradients < " << num_coeffs << " coefficients";
+      return;
+    }
+
+    typename FilterType::OutputImageType::Pointer outputs[2];
+    for (int batched=0; batched<2; ++batched)
+    {
+      typename FilterType::Pointer filter = FilterType::New();
+      filter->SetBValue( b_value );
+      filter->SetGradientImage( gradients, itkVectorImagePointer );
+      filter->SetLambda(0.006);
+      filter->SetNormalizationMethod(static_cast<typename FilterType::Normalization>(normalization));
+      filter->SetUseBatchedReconstruction(batched==1);
+
+      filter->Update();
+      outputs[batched] = filter->GetOutput();
+    }
+
+    float max_diff = 0;
+    itk::ImageRegionConstIterator< typename FilterType::OutputImageType > it0(outputs[0], outputs[0]->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator< typename FilterType::OutputImageType > it1(outputs[1], outputs[1]->GetLargestPossibleRegion());
+    for (; !it0.IsAtEnd(); ++it0, ++it1)
+      for (unsigned int i=0; i<ODF_SAMPLING_SIZE; ++i)
+        max_diff = std::max(max_diff, std::fabs(it0.Get()[i]-it1.Get()[i]));
+
+    MITK_INFO << "SH order " << ShOrder << ": maximum difference " << max_diff;
+    MITK_TEST_CONDITION_REQUIRED(max_diff<0.0001, "Batched and voxelwise Q-ball reconstruction test.");
+  }
+
+  /** Prints the reconstructed voxels per second of the voxelwise and of the batched kernel (best of three runs). */
+  template< int ShOrder >
+  void BenchmarkQball(itk::VectorImage<short,3>::Pointer image)
+  {
+    typedef itk::AnalyticalDiffusionQballReconstructionImageFilter<short,short,float,ShOrder,ODF_SAMPLING_SIZE> FilterType;
+
+    double seconds[2];
+    for (int batched=0; batched<2; ++batched)
+    {
+      seconds[batched] = std::numeric_limits<double>::max();
+      for (int run=0; run<3; ++run)
+      {
+        typename FilterType::Pointer filter = FilterType::New();
+        filter->SetBValue( b_value );
+        filter->SetGradientImage( gradients, image );
+        filter->SetLambda(0.006);
+        filter->SetNormalizationMethod(FilterType::QBAR_SOLID_ANGLE);
+        filter->SetUseBatchedReconstruction(batched==1);
+
+        itk::TimeProbe clock;
+        clock.Start();
+        filter->Update();
+        clock.Stop();
+        seconds[batched] = std::min(seconds[batched], clock.GetTotal());
+      }
+    }
+
+    unsigned long num_voxels = image->GetLargestPossibleRegion().GetNumberOfPixels();
+    MITK_INFO << "SH order " << ShOrder << ": voxelwise " << num_voxels/std::max(seconds[0], 1e-9) << " voxels/s, batched "
+              << num_voxels/std::max(seconds[1], 1e-9) << " voxels/s, speedup " << seconds[0]/std::max(seconds[1], 1e-9);
+  }
+
   public:
 
   void setUp() override
@@ -170,6 +252,59 @@ class mitkImageReconstructionTestSuite : public mitk::TestFixture
     MITK_TEST_CONDITION_REQUIRED(mitk::Equal(*testImage, *odfImage, 0.1, true), "Raw signal modeling test.");
   }
 
+  void BatchedQball()
+  {
+    MITK_INFO << "Batched Q-ball reconstruction";
+    typedef itk::AnalyticalDiffusionQballReconstructionImageFilter<short,short,float,4,ODF_SAMPLING_SIZE> FilterType;
+    CompareBatchedQball<4>(FilterType::QBAR_STANDARD);
+    CompareBatchedQball<4>(FilterType::QBAR_SOLID_ANGLE);
+    CompareBatchedQball<6>(FilterType::QBAR_SOLID_ANGLE);
+    CompareBatchedQball<8>(FilterType::QBAR_SOLID_ANGLE);
+  }
+
+  /** Throughput of the voxelwise and the batched Q-ball kernel. Only runs if the environment variable
+   * MITK_RUN_BENCHMARKS is set, since the timings are meaningless on loaded test machines. */
+  void BenchmarkBatchedQball()
+  {
+    if (std::getenv("MITK_RUN_BENCHMARKS")==nullptr)
+    {
+      MITK_INFO << "Skipping Q-ball benchmark, set MITK_RUN_BENCHMARKS to run it";
+      return;
+    }
+
+    // tile the test image to a size where the timing is not dominated by the filter setup
+    itk::VectorImage<short,3>::RegionType in_region = itkVectorImagePointer->GetLargestPossibleRegion();
+    itk::VectorImage<short,3>::RegionType region;
+    for (unsigned int d=0; d<3; ++d)
+      region.SetSize(d, std::max<itk::SizeValueType>(in_region.GetSize(d), 64));
+    itk::VectorImage<short,3>::Pointer image = itk::VectorImage<short,3>::New();
+    image->SetSpacing(itkVectorImagePointer->GetSpacing());
+    image->SetOrigin(itkVectorImagePointer->GetOrigin());
+    image->SetDirection(itkVectorImagePointer->GetDirection());
+    image->SetRegions(region);
+    image->SetVectorLength(itkVectorImagePointer->GetVectorLength());
+    image->Allocate();
+    for (itk::ImageRegionIterator< itk::VectorImage<short,3> > it(image, region); !it.IsAtEnd(); ++it)
+    {
+      itk::VectorImage<short,3>::IndexType idx = it.GetIndex();
+      for (unsigned int d=0; d<3; ++d)
+        idx[d] = in_region.GetIndex(d) + (idx[d] % static_cast<itk::IndexValueType>(in_region.GetSize(d)));
+      it.Set(itkVectorImagePointer->GetPixel(idx));
+    }
+
+    unsigned int num_gradients = 0;
+    for (auto it = gradients->Begin(); it != gradients->End(); ++it)
+      if (it.Value().two_norm()*it.Value().two_norm()*b_value >= 100)
+        ++num_gradients;
+
+    MITK_INFO << "Q-ball benchmark, " << region.GetNumberOfPixels() << " voxels";
+    BenchmarkQball<4>(image);
+    if (num_gradients >= 28)
+      BenchmarkQball<6>(image);
+    if (num_gradients >= 45)
+      BenchmarkQball<8>(image);
+  }
+
 };
 
 MITK_TEST_SUITE_REGISTRATION(mitkImageReconstruction)
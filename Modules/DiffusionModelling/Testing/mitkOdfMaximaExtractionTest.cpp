@@ -0,0 +1,225 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#include <mitkTestingMacros.h>
+#include <mitkTestFixture.h>
+#include <mitkShEvaluator.h>
+#include <mitkDiffusionModellingHelperFunctions.h>
+#include <itkOdfMaximaExtractionFilter.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkTimeProbe.h>
+#include <random>
+
+class mitkOdfMaximaExtractionTestSuite : public mitk::TestFixture
+{
+
+  CPPUNIT_TEST_SUITE(mitkOdfMaximaExtractionTestSuite);
+  MITK_TEST(ShEvaluator);
+  MITK_TEST(PeakExtraction);
+  CPPUNIT_TEST_SUITE_END();
+
+  private:
+
+  /** Synthetic two-fiber crossing (90 degree, volume fractions 1 and 0.7) with a random orientation in every voxel.
+   * The coefficients are truncated delta functions of both fiber directions. The first fiber direction of every voxel
+   * is stored in dirs. */
+  template< int ShOrder >
+  typename itk::Image< itk::Vector< float, (ShOrder*ShOrder + ShOrder + 2)/2 + ShOrder >, 3 >::Pointer CreateCrossingImage(unsigned int size, std::vector< vnl_vector_fixed<double, 3> >& dirs)
+  {
+    typedef itk::Image< itk::Vector< float, (ShOrder*ShOrder + ShOrder + 2)/2 + ShOrder >, 3 > ImageType;
+    typename ImageType::Pointer image = ImageType::New();
+    typename ImageType::RegionType region;
+    region.SetSize(0, size);
+    region.SetSize(1, size);
+    region.SetSize(2, size);
+    image->SetRegions(region);
+    image->Allocate();
+
+    mitk::ShEvaluator evaluator(ShOrder);
+    std::vector< double > basis(evaluator.GetNumberOfCoefficients());
+    std::mt19937 rng(42);
+    std::normal_distribution<double> normal(0, 1);
+    dirs.clear();
+
+    itk::ImageRegionIterator< ImageType > it(image, region);
+    while (!it.IsAtEnd())
+    {
+      vnl_vector_fixed<double, 3> d1, r;
+      for (int i=0; i<3; ++i)
+      {
+        d1[i] = normal(rng);
+        r[i] = normal(rng);
+      }
+      d1.normalize();
+      vnl_vector_fixed<double, 3> d2 = vnl_cross_3d(d1, r).normalize();
+      dirs.push_back(d1);
+
+      typename ImageType::PixelType pix; pix.Fill(0.0);
+      double weights[2] = {1.0, 0.7};
+      vnl_vector_fixed<double, 3> fiber_dirs[2] = {d1, d2};
+      for (int f=0; f<2; ++f)
+      {
+        double spherical[3];
+        mitk::gradients::Cart2Sph(fiber_dirs[f][0], fiber_dirs[f][1], fiber_dirs[f][2], spherical);
+        evaluator.GetBasis(spherical[1], spherical[0], basis.data());
+        for (unsigned int j=0; j<basis.size(); ++j)
+          pix[j] += weights[f]*basis[j];
+      }
+      it.Set(pix);
+      ++it;
+    }
+    return image;
+  }
+
+  /** Runs the peak extraction single-threaded and multi-threaded, checks that both yield the same peaks, checks the
+   * direction of the largest peak and prints the processed voxels per second. */
+  template< int ShOrder >
+  void CompareThreadedPeakExtraction(unsigned int size)
+  {
+    typedef itk::OdfMaximaExtractionFilter< float, ShOrder, ODF_SAMPLING_SIZE > FilterType;
+
+    std::vector< vnl_vector_fixed<double, 3> > dirs;
+    auto image = CreateCrossingImage<ShOrder>(size, dirs);
+
+    typename FilterType::PeakImageType::Pointer outputs[2];
+    double seconds[2];
+    for (int threaded=0; threaded<2; ++threaded)
+    {
+      typename FilterType::Pointer filter = FilterType::New();
+      filter->SetInput(image);
+      filter->SetMaxNumPeaks(2);
+      filter->SetRelativePeakThreshold(0.4);
+      filter->SetAngularThreshold(cos(15.0*itk::Math::pi/180));
+      filter->SetNormalizationMethod(FilterType::NO_NORM);
+      filter->SetToolkit(FilterType::MRTRIX);
+      if (threaded==0)
+        filter->SetNumberOfWorkUnits(1);
+
+      itk::TimeProbe clock;
+      clock.Start();
+      filter->Update();
+      clock.Stop();
+      seconds[threaded] = clock.GetTotal();
+      outputs[threaded] = filter->GetPeakImage();
+    }
+
+    unsigned long num_voxels = image->GetLargestPossibleRegion().GetNumberOfPixels();
+    MITK_INFO << "SH order " << ShOrder << ": single-threaded " << num_voxels/std::max(seconds[0], 1e-9) << " voxels/s, multi-threaded " << num_voxels/std::max(seconds[1], 1e-9) << " voxels/s";
+
+    itk::ImageRegionConstIterator< typename FilterType::PeakImageType > it0(outputs[0], outputs[0]->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator< typename FilterType::PeakImageType > it1(outputs[1], outputs[1]->GetLargestPossibleRegion());
+    bool equal = true;
+    for (; !it0.IsAtEnd(); ++it0, ++it1)
+      if (it0.Get()!=it1.Get())
+        equal = false;
+    MITK_TEST_CONDITION_REQUIRED(equal, "Single-threaded and multi-threaded peak extraction test.");
+
+    // largest peak vs. first fiber direction
+    double max_angle = 0;
+    unsigned int v = 0;
+    itk::Index<4> idx4;
+    for (unsigned int z=0; z<size; ++z)
+      for (unsigned int y=0; y<size; ++y)
+        for (unsigned int x=0; x<size; ++x, ++v)
+        {
+          idx4[0] = x; idx4[1] = y; idx4[2] = z;
+          vnl_vector_fixed<double, 3> peak;
+          for (int j=0; j<3; ++j)
+          {
+            idx4[3] = j;
+            peak[j] = outputs[1]->GetPixel(idx4);
+          }
+          double angle = acos(std::min(1.0, fabs(dot_product(peak.normalize(), dirs[v]))))*180/itk::Math::pi;
+          max_angle = std::max(max_angle, angle);
+        }
+    MITK_INFO << "SH order " << ShOrder << ": maximum angular error " << max_angle << " degree";
+    MITK_TEST_CONDITION_REQUIRED(max_angle<10, "Peak direction test.");
+  }
+
+  public:
+
+  void setUp() override
+  {
+
+  }
+
+  void tearDown() override
+  {
+
+  }
+
+  void ShEvaluator()
+  {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for (int mrtrix=0; mrtrix<2; ++mrtrix)
+      for (unsigned int order=2; order<=12; order+=2)
+      {
+        mitk::ShEvaluator evaluator(order, mrtrix==1);
+        unsigned int num_coeffs = evaluator.GetNumberOfCoefficients();
+        std::vector< double > y(num_coeffs), dy_dtheta(num_coeffs), dy_dphi(num_coeffs);
+        vnl_vector<float> coeffs(num_coeffs);
+
+        double max_diff = 0;
+        double max_series_diff = 0;
+        double max_grad_diff = 0;
+        for (int i=0; i<500; ++i)
+        {
+          // include both poles
+          double theta = i<2 ? i*itk::Math::pi : uniform(rng)*itk::Math::pi;
+          double phi = (2*uniform(rng)-1)*itk::Math::pi;
+
+          // mitk::sh::Yj evaluates in single precision
+          evaluator.GetBasis(theta, phi, y.data(), dy_dtheta.data(), dy_dphi.data());
+          for (int k=0; k<=static_cast<int>(order); k+=2)
+            for (int m=-k; m<=k; ++m)
+              max_diff = std::max(max_diff, fabs(y[mitk::ShEvaluator::GetIndex(k, m)]-mitk::sh::Yj(m, k, theta, phi, mrtrix==1)));
+
+          for (unsigned int j=0; j<num_coeffs; ++j)
+            coeffs[j] = uniform(rng)-0.5;
+          double h = 1e-6;
+          theta = std::min(std::max(theta, h), itk::Math::pi-h);
+          double d_theta, d_phi;
+          double val = evaluator.GetValueAndGradient(coeffs.data_block(), theta, phi, d_theta, d_phi);
+          max_series_diff = std::max(max_series_diff, fabs(val-mitk::sh::GetValue(coeffs, order, theta, phi, mrtrix==1)));
+
+          double fd_theta = (evaluator.GetValue(coeffs.data_block(), theta+h, phi)-evaluator.GetValue(coeffs.data_block(), theta-h, phi))/(2*h);
+          double fd_phi = (evaluator.GetValue(coeffs.data_block(), theta, phi+h)-evaluator.GetValue(coeffs.data_block(), theta, phi-h))/(2*h);
+          max_grad_diff = std::max(max_grad_diff, std::max(fabs(d_theta-fd_theta), fabs(d_phi-fd_phi)));
+        }
+        MITK_INFO << "SH order " << order << (mrtrix==1 ? " (MRtrix)" : " (FSL)") << ": maximum difference " << max_diff << ", maximum series difference " << max_series_diff << ", maximum gradient difference " << max_grad_diff;
+        MITK_TEST_CONDITION_REQUIRED(max_diff<0.001, "SH evaluator basis test.");
+        MITK_TEST_CONDITION_REQUIRED(max_series_diff<0.01, "SH evaluator value test.");
+        MITK_TEST_CONDITION_REQUIRED(max_grad_diff<0.0001, "SH evaluator gradient test.");
+      }
+  }
+
+  void PeakExtraction()
+  {
+    // fixed size, so that the logged voxels/s of different runs are comparable
+    unsigned int size = 8;
+    MITK_INFO << "Peak extraction on " << size << "^3 voxels";
+    CompareThreadedPeakExtraction<4>(size);
+    CompareThreadedPeakExtraction<6>(size);
+    CompareThreadedPeakExtraction<8>(size);
+    CompareThreadedPeakExtraction<10>(size);
+    CompareThreadedPeakExtraction<12>(size);
+  }
+
+};
+
+MITK_TEST_SUITE_REGISTRATION(mitkOdfMaximaExtraction)
@@ -0,0 +1,280 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#include <mitkTestingMacros.h>
+#include <mitkTestFixture.h>
+#include <itkBiExpFitFunctor.h>
+#include <itkKurtosisFitFunctor.h>
+#include <itkTimeProbe.h>
+#include <mitkLevenbergMarquardtSolver.h>
+#include <vnl/vnl_least_squares_function.h>
+#include <vnl/algo/vnl_levenberg_marquardt.h>
+#include <random>
+
+class mitkVoxelwiseModelFitTestSuite : public mitk::TestFixture
+{
+
+  CPPUNIT_TEST_SUITE(mitkVoxelwiseModelFitTestSuite);
+  MITK_TEST(BiExpFit);
+  MITK_TEST(KurtosisFit);
+  MITK_TEST(BatchFit);
+  CPPUNIT_TEST_SUITE_END();
+
+  private:
+
+  /** Bi-exponential least-squares function with finite difference Jacobian, as fitted by the BiExpFitFunctor before
+   * it used mitk::LevenbergMarquardtSolver. */
+  struct VnlBiExpFunction : public vnl_least_squares_function
+  {
+    VnlBiExpFunction(const vnl_vector<double>& b, double s0)
+      : vnl_least_squares_function(3, b.size(), no_gradient)
+      , bvalues(b)
+      , S0(s0)
+    {}
+
+    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override
+    {
+      for (unsigned int s=0; s<bvalues.size(); ++s)
+      {
+        double approx = x[2] * std::exp(-bvalues[s] * x[0]) + (1-x[2]) * std::exp(-bvalues[s] * x[1]);
+        fx[s] = std::fabs( measurements[s] - approx*S0 );
+      }
+    }
+
+    vnl_vector<double> bvalues;
+    vnl_vector<double> measurements;
+    double S0;
+  };
+
+  /** Bi-exponential model for mitk::LevenbergMarquardtSolver with single voxel and batch evaluation */
+  struct BiExpModel
+  {
+    static const unsigned int NumberOfParameters = 3;
+
+    BiExpModel(const vnl_vector<double>& b, double s0) : bvalues(b), S0(s0), measurements(nullptr) {}
+
+    unsigned int GetNumberOfResiduals() const { return bvalues.size(); }
+
+    void SetParameters(const double* x)
+    {
+      params[0] = x[0]; params[1] = x[1]; params[2] = x[2];
+    }
+
+    double GetResidual(unsigned int s, double* dr_dx) const
+    {
+      return Residual(bvalues[s], measurements[s], params, dr_dx);
+    }
+
+    void GetResiduals(unsigned int s, unsigned int num_voxels, const double* x, const double* const* m, double* r, double* dr_dx) const
+    {
+      const double b = bvalues[s];
+      for (unsigned int v=0; v<num_voxels; ++v)
+        r[v] = Residual(b, m[v][s], x + 3*v, dr_dx + 3*v);
+    }
+
+    double Residual(double b, double measurement, const double* x, double* dr_dx) const
+    {
+      const double e_slow = std::exp(-b * x[0]);
+      const double e_fast = std::exp(-b * x[1]);
+      double diff = measurement - (x[2] * e_slow + (1-x[2]) * e_fast)*S0;
+      double sign = diff<0 ? -S0 : S0;
+      dr_dx[0] = sign * b * x[2] * e_slow;
+      dr_dx[1] = sign * b * (1-x[2]) * e_fast;
+      dr_dx[2] = sign * (e_fast - e_slow);
+      return std::fabs(diff);
+    }
+
+    vnl_vector<double> bvalues;
+    double S0;
+    const double* measurements;
+    double params[3];
+  };
+
+  /** Noisy bi-exponential signal with random parameters, one voxel per row */
+  vnl_matrix<double> CreateBiExpSignal(unsigned int seed)
+  {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> noise(0, 5);
+
+    vnl_matrix<double> signal(m_NumVoxels, m_BValues.size());
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      double adc_slow = 0.0001 + 0.0004*uniform(rng);
+      double adc_fast = 0.001 + 0.002*uniform(rng);
+      double lambda = 0.2 + 0.6*uniform(rng);
+      for (unsigned int s=0; s<m_BValues.size(); ++s)
+        signal(i, s) = m_S0*(lambda*std::exp(-m_BValues[s]*adc_slow) + (1-lambda)*std::exp(-m_BValues[s]*adc_fast)) + noise(rng);
+    }
+    return signal;
+  }
+
+  unsigned int m_NumVoxels;
+  vnl_vector<double> m_BValues;
+  double m_S0;
+
+  public:
+
+  void setUp() override
+  {
+    m_NumVoxels = 2000;
+
+    double b[5] = {500, 1000, 1500, 2000, 3000};
+    m_BValues = vnl_vector<double>(b, 5);
+    m_S0 = 1000;
+  }
+
+  void tearDown() override
+  {
+
+  }
+
+  void BiExpFit()
+  {
+    vnl_matrix<double> signal = CreateBiExpSignal(1);
+
+    itk::BiExpFitFunctor::Pointer functor = itk::BiExpFitFunctor::New();
+    functor->setListOfBValues(m_BValues);
+    functor->setTargetBValue(2500);
+    vnl_matrix<double> new_signal(m_NumVoxels, 2);
+
+    itk::TimeProbe clock;
+    clock.Start();
+    (*functor)(new_signal, signal, m_S0);
+    clock.Stop();
+
+    // reference fit with vnl_levenberg_marquardt and finite differences
+    VnlBiExpFunction vnl_function(m_BValues, m_S0);
+    vnl_levenberg_marquardt minimizer(vnl_function);
+    minimizer.set_max_function_evals(1000);
+    minimizer.set_f_tolerance(1e-10);
+    std::vector< double > vnl_errors(m_NumVoxels);
+    itk::TimeProbe vnl_clock;
+    vnl_clock.Start();
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      vnl_function.measurements = signal.get_row(i);
+      vnl_vector<double> x(3);
+      x[0] = 0; x[1] = 0.009; x[2] = 0.7;
+      minimizer.minimize_without_gradient(x);
+      vnl_errors[i] = minimizer.get_end_error();
+    }
+    vnl_clock.Stop();
+    MITK_INFO << "Bi-exponential fit: " << m_NumVoxels/std::max(clock.GetTotal(), 1e-9) << " voxels/s, vnl_levenberg_marquardt " << m_NumVoxels/std::max(vnl_clock.GetTotal(), 1e-9) << " voxels/s";
+
+    // the fits may end in different local minima for single voxels, but not systematically
+    unsigned int num_worse = 0;
+    double mean_error = 0;
+    double mean_vnl_error = 0;
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      if (new_signal(i, 1) > vnl_errors[i]*1.01 + 1e-6)
+        ++num_worse;
+      mean_error += new_signal(i, 1)/m_NumVoxels;
+      mean_vnl_error += vnl_errors[i]/m_NumVoxels;
+    }
+    MITK_INFO << "Mean RMS error " << mean_error << " (vnl_levenberg_marquardt " << mean_vnl_error << "), " << num_worse << " voxels with larger error";
+    MITK_TEST_CONDITION_REQUIRED(mean_error <= mean_vnl_error*1.01, "Bi-exponential fit error test.");
+    MITK_TEST_CONDITION_REQUIRED(num_worse <= m_NumVoxels/20, "Bi-exponential fit voxelwise error test.");
+  }
+
+  void KurtosisFit()
+  {
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    double target_b = 2500;
+    vnl_matrix<double> signal(m_NumVoxels, m_BValues.size());
+    vnl_vector<double> target(m_NumVoxels);
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      double adc = 0.0005 + 0.001*uniform(rng);
+      double akc = 0.3 + 0.9*uniform(rng);
+      for (unsigned int s=0; s<m_BValues.size(); ++s)
+        signal(i, s) = m_S0*std::exp(-m_BValues[s]*adc + 1./6.*m_BValues[s]*m_BValues[s]*adc*adc*akc);
+      target[i] = m_S0*std::exp(-target_b*adc + 1./6.*target_b*target_b*adc*adc*akc);
+    }
+
+    itk::KurtosisFitFunctor::Pointer functor = itk::KurtosisFitFunctor::New();
+    functor->setListOfBValues(m_BValues);
+    functor->setTargetBValue(target_b);
+    vnl_matrix<double> new_signal(m_NumVoxels, 2);
+
+    itk::TimeProbe clock;
+    clock.Start();
+    (*functor)(new_signal, signal, m_S0);
+    clock.Stop();
+    MITK_INFO << "Kurtosis fit: " << m_NumVoxels/std::max(clock.GetTotal(), 1e-9) << " voxels/s";
+
+    // noise free signal: the fit has to reproduce the signal at the target b-value
+    double max_diff = 0;
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+      max_diff = std::max(max_diff, std::fabs(new_signal(i, 0)-target[i])/target[i]);
+    MITK_INFO << "Maximum relative signal difference " << max_diff;
+    MITK_TEST_CONDITION_REQUIRED(max_diff < 0.001, "Kurtosis fit test.");
+  }
+
+  void BatchFit()
+  {
+    vnl_matrix<double> signal = CreateBiExpSignal(3);
+
+    BiExpModel model(m_BValues, m_S0);
+    typedef mitk::LevenbergMarquardtSolver< BiExpModel > SolverType;
+    SolverType minimizer(model);
+    minimizer.SetMaxFunctionEvaluations(1000);
+
+    SolverType::ParametersType x0;
+    x0[0] = 0; x0[1] = 0.009; x0[2] = 0.7;
+
+    // one fit per voxel
+    std::vector< SolverType::ParametersType > results(m_NumVoxels, x0);
+    std::vector< double > errors(m_NumVoxels);
+    itk::TimeProbe clock;
+    clock.Start();
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      model.measurements = signal[i];
+      minimizer.Minimize(results[i]);
+      errors[i] = minimizer.GetEndError();
+    }
+    clock.Stop();
+
+    // all voxels as one batch
+    std::vector< SolverType::ParametersType > batch_results(m_NumVoxels, x0);
+    std::vector< double > batch_errors(m_NumVoxels);
+    itk::TimeProbe batch_clock;
+    batch_clock.Start();
+    minimizer.MinimizeBatch(signal.data_block(), m_NumVoxels, batch_results.data(), batch_errors.data());
+    batch_clock.Stop();
+
+    MITK_INFO << "Bi-exponential fit: " << m_NumVoxels/std::max(clock.GetTotal(), 1e-9) << " voxels/s per voxel, " << m_NumVoxels/std::max(batch_clock.GetTotal(), 1e-9) << " voxels/s batch";
+
+    // every voxel of the batch takes the same steps as its single fit
+    bool equal = true;
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      if (errors[i]!=batch_errors[i])
+        equal = false;
+      for (unsigned int j=0; j<3; ++j)
+        if (results[i][j]!=batch_results[i][j])
+          equal = false;
+    }
+    MITK_TEST_CONDITION_REQUIRED(equal, "Batch fit equals single voxel fit.");
+  }
+
+};
+
+MITK_TEST_SUITE_REGISTRATION(mitkVoxelwiseModelFit)
@@ -46,6 +46,7 @@ set(CPP_FILES
 set(H_FILES
 
   mitkDiffusionModellingHelperFunctions.h
+  mitkShEvaluator.h
 
   # DataStructures
   IO/mitkOdfImage.h
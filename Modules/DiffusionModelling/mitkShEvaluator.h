@@ -0,0 +1,235 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#ifndef __mitkShEvaluator_h_
+#define __mitkShEvaluator_h_
+
+#include <vector>
+#include <cmath>
+
+namespace mitk
+{
+
+/**
+  * \brief Evaluates a real, symmetric spherical harmonics series and its gradient with respect to (theta, phi).
+  *
+  * Yields the same basis as mitk::sh::Yj (MRtrix and FSL/Descoteaux convention) but all normalization factors are
+  * precomputed in the constructor and the associated Legendre functions P_l^m as well as cos(m*phi) and sin(m*phi) are
+  * computed with the standard three-term recurrences, so one evaluation of the complete series costs O(ShOrder^2)
+  * multiplications instead of one boost special function call per coefficient. The theta derivatives are obtained by
+  * differentiating the recurrences, which is also well defined at the poles.
+  *
+  * All methods are const, so one evaluator can be shared by any number of threads. theta is expected in [0,pi].
+  */
+class ShEvaluator
+{
+public:
+
+  ShEvaluator(unsigned int sh_order, bool mrtrix=true)
+    : m_ShOrder(static_cast<int>(sh_order))
+    , m_Mrtrix(mrtrix)
+  {
+    const double pi = 3.14159265358979323846;
+    for (int m=0; m<=m_ShOrder; ++m)
+      for (int l=m; l<=m_ShOrder; ++l)
+      {
+        if (l%2!=0)
+          continue;
+
+        // N_l^m = sqrt( (2l+1)/(4pi) * (l-m)!/(l+m)! )
+        double ratio = 1.0;
+        for (int i=l-m+1; i<=l+m; ++i)
+          ratio /= i;
+        double norm = std::sqrt((2.0*l+1.0)/(4.0*pi)*ratio);
+
+        Term t;
+        if (m==0)
+        {
+          t.m_CosIndex = GetIndex(l, 0);
+          t.m_SinIndex = t.m_CosIndex;
+          t.m_CosFactor = norm;
+          t.m_SinFactor = 0;
+        }
+        else if (m_Mrtrix)
+        {
+          t.m_CosIndex = GetIndex(l, m);
+          t.m_SinIndex = GetIndex(l, -m);
+          t.m_CosFactor = norm;
+          t.m_SinFactor = norm;
+        }
+        else
+        {
+          t.m_CosIndex = GetIndex(l, -m);
+          t.m_SinIndex = GetIndex(l, m);
+          t.m_CosFactor = std::sqrt(2.0)*norm;
+          t.m_SinFactor = (m%2==0 ? 1.0 : -1.0)*std::sqrt(2.0)*norm;
+        }
+        m_Terms.push_back(t);
+      }
+  }
+
+  unsigned int GetShOrder() const { return static_cast<unsigned int>(m_ShOrder); }
+  unsigned int GetNumberOfCoefficients() const { return static_cast<unsigned int>((m_ShOrder*m_ShOrder + m_ShOrder + 2)/2 + m_ShOrder); }
+  bool GetMrtrix() const { return m_Mrtrix; }
+
+  /** Coefficient index j of degree l and order m, as used by mitk::sh. */
+  static unsigned int GetIndex(int l, int m) { return static_cast<unsigned int>((l*l + l + 2)/2 + m - 1); }
+
+  /** Value of the series with the given coefficients (GetNumberOfCoefficients() values) at (theta, phi). */
+  template< class TCoefficient >
+  double GetValue(const TCoefficient* coeffs, double theta, double phi) const
+  {
+    double val = 0;
+    Evaluate<false>(theta, phi, [&](unsigned int j, double y, double, double)
+    {
+      val += coeffs[j]*y;
+    });
+    return val;
+  }
+
+  /** Value of the series at (theta, phi) and its partial derivatives with respect to theta and phi. */
+  template< class TCoefficient >
+  double GetValueAndGradient(const TCoefficient* coeffs, double theta, double phi, double& d_theta, double& d_phi) const
+  {
+    double val = 0;
+    d_theta = 0;
+    d_phi = 0;
+    Evaluate<true>(theta, phi, [&](unsigned int j, double y, double dy_dtheta, double dy_dphi)
+    {
+      val += coeffs[j]*y;
+      d_theta += coeffs[j]*dy_dtheta;
+      d_phi += coeffs[j]*dy_dphi;
+    });
+    return val;
+  }
+
+  /** Writes all basis functions at (theta, phi) to y. The derivatives are only computed if the pointers are not null. */
+  void GetBasis(double theta, double phi, double* y, double* dy_dtheta=nullptr, double* dy_dphi=nullptr) const
+  {
+    if (dy_dtheta!=nullptr || dy_dphi!=nullptr)
+      Evaluate<true>(theta, phi, [&](unsigned int j, double v, double dt, double dp)
+      {
+        y[j] = v;
+        if (dy_dtheta!=nullptr)
+          dy_dtheta[j] = dt;
+        if (dy_dphi!=nullptr)
+          dy_dphi[j] = dp;
+      });
+    else
+      Evaluate<false>(theta, phi, [&](unsigned int j, double v, double, double)
+      {
+        y[j] = v;
+      });
+  }
+
+protected:
+
+  struct Term
+  {
+    unsigned int  m_CosIndex;
+    unsigned int  m_SinIndex;
+    double        m_CosFactor;
+    double        m_SinFactor;
+  };
+
+  /** Calls f(j, Y_j, dY_j/dtheta, dY_j/dphi) for every basis function. The derivatives are zero if TGradient is false. */
+  template< bool TGradient, class TCallback >
+  void Evaluate(double theta, double phi, TCallback f) const
+  {
+    const double cos_theta = std::cos(theta);
+    const double sin_theta = std::sin(theta);
+    const double cos_phi = std::cos(phi);
+    const double sin_phi = std::sin(phi);
+
+    // MRtrix evaluates the Legendre functions at -cos(theta)
+    const double x = m_Mrtrix ? -cos_theta : cos_theta;
+    const double dx = m_Mrtrix ? sin_theta : -sin_theta;
+
+    // P_m^m = (-1)^m (2m-1)!! sin(theta)^m (Condon-Shortley phase, as boost::math::legendre_p)
+    double pmm = 1;
+    double dpmm = 0;
+    double cos_m = 1;
+    double sin_m = 0;
+
+    auto term = m_Terms.begin();
+    for (int m=0; m<=m_ShOrder; ++m)
+    {
+      if (m>0)
+      {
+        double c = -(2.0*m-1.0);
+        if (TGradient)
+          dpmm = c*(dpmm*sin_theta + pmm*cos_theta);
+        pmm *= c*sin_theta;
+
+        double tmp = cos_m*cos_phi - sin_m*sin_phi;
+        sin_m = sin_m*cos_phi + cos_m*sin_phi;
+        cos_m = tmp;
+      }
+
+      // upward recurrence in l: (l-m) P_l^m = (2l-1) x P_{l-1}^m - (l+m-1) P_{l-2}^m
+      double p2 = 0, dp2 = 0;
+      double p1 = pmm, dp1 = dpmm;
+      for (int l=m; l<=m_ShOrder; ++l)
+      {
+        if (l>m)
+        {
+          double a = (2.0*l-1.0)/(l-m);
+          double b = (l+m-1.0)/(l-m);
+          double p = a*x*p1 - b*p2;
+          if (TGradient)
+          {
+            double dp = a*(dx*p1 + x*dp1) - b*dp2;
+            dp2 = dp1;
+            dp1 = dp;
+          }
+          p2 = p1;
+          p1 = p;
+        }
+
+        if (l%2!=0)
+          continue;
+
+        const Term& t = *term;
+        ++term;
+        if (m==0)
+          f(t.m_CosIndex, t.m_CosFactor*p1, TGradient ? t.m_CosFactor*dp1 : 0.0, 0.0);
+        else
+        {
+          double c = t.m_CosFactor*p1;
+          double s = t.m_SinFactor*p1;
+          if (TGradient)
+          {
+            f(t.m_CosIndex, c*cos_m, t.m_CosFactor*dp1*cos_m, -m*c*sin_m);
+            f(t.m_SinIndex, s*sin_m, t.m_SinFactor*dp1*sin_m, m*s*cos_m);
+          }
+          else
+          {
+            f(t.m_CosIndex, c*cos_m, 0.0, 0.0);
+            f(t.m_SinIndex, s*sin_m, 0.0, 0.0);
+          }
+        }
+      }
+    }
+  }
+
+  int                   m_ShOrder;
+  bool                  m_Mrtrix;
+  std::vector< Term >   m_Terms;    ///< normalization factors and coefficient indices of each (l,m>=0) pair in evaluation order
+};
+
+}
+
+#endif //__mitkShEvaluator_h_
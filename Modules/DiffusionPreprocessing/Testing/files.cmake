@@ -1,4 +1,5 @@
 set(MODULE_CUSTOM_TESTS
   mitkNonLocalMeansDenoisingTest.cpp
+  mitkResampleDwiImageFilterTest.cpp
 )
 
@@ -20,6 +20,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include "itkNonLocalMeansDenoisingFilter.h"
 #include "mitkITKImageImport.h"
 #include <mitkImageCast.h>
+#include <itkImageRegionConstIterator.h>
 
 class mitkNonLocalMeansDenoisingTestSuite : public mitk::TestFixture
 {
@@ -29,6 +30,9 @@ class mitkNonLocalMeansDenoisingTestSuite : public mitk::TestFixture
   MITK_TEST(Denoise_NLMr_shouldReturnTrue);
   MITK_TEST(Denoise_NLMv_shouldReturnTrue);
   MITK_TEST(Denoise_NLMvr_shouldReturnTrue);
+  MITK_TEST(Denoise_FastNLMg_shouldReturnTrue);
+  MITK_TEST(Denoise_FastNLMr_shouldReturnTrue);
+  MITK_TEST(Denoise_FastNLMv_shouldReturnTrue);
   CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -42,6 +46,31 @@ private:
   itk::Image<short, 3>::Pointer m_ImageMask;
   itk::NonLocalMeansDenoisingFilter<short>::Pointer m_DenoisingFilter;
 
+  /** Runs the fast mode and compares the result with the reference of the voxelwise computation. Single values may
+   * differ by one since the weights are summed in a different order. */
+  void CompareFastMode(std::string reference, bool rician, bool joint)
+  {
+    m_ReferenceImage = mitk::IOUtil::Load<mitk::Image>(GetTestDataFilePath(reference));
+    VectorImagetType::Pointer itkReference;
+    mitk::CastToItkImage(m_ReferenceImage, itkReference);
+
+    m_DenoisingFilter->SetUseRicianAdaption(rician);
+    m_DenoisingFilter->SetUseJointInformation(joint);
+    m_DenoisingFilter->SetUseFastMode(true);
+    m_DenoisingFilter->SetNumberOfWorkUnits(4);
+    m_DenoisingFilter->Update();
+
+    itk::ImageRegionConstIterator< VectorImagetType > it0(m_DenoisingFilter->GetOutput(), m_DenoisingFilter->GetOutput()->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator< VectorImagetType > it1(itkReference, itkReference->GetLargestPossibleRegion());
+    int max_diff = 0;
+    for (; !it0.IsAtEnd(); ++it0, ++it1)
+      for (unsigned int i=0; i<it0.Get().GetSize(); ++i)
+        max_diff = std::max(max_diff, std::abs(it0.Get()[i]-it1.Get()[i]));
+
+    MITK_INFO << "Maximum difference to voxelwise computation: " << max_diff;
+    MITK_TEST_CONDITION_REQUIRED(max_diff<=1, "Fast mode should return the result of the voxelwise computation.");
+  }
+
 public:
 
   /**
@@ -163,6 +192,21 @@ public:
     MITK_ASSERT_EQUAL( m_DenoisedImage, m_ReferenceImage, "NLMvr should always return the same result.");
   }
 
+  void Denoise_FastNLMg_shouldReturnTrue()
+  {
+    CompareFastMode("DiffusionImaging/Denoising/test_multi_NLMg.dwi", false, false);
+  }
+
+  void Denoise_FastNLMr_shouldReturnTrue()
+  {
+    CompareFastMode("DiffusionImaging/Denoising/test_multi_NLMr.dwi", true, false);
+  }
+
+  void Denoise_FastNLMv_shouldReturnTrue()
+  {
+    CompareFastMode("DiffusionImaging/Denoising/test_multi_NLMv.dwi", false, true);
+  }
+
 };
 
 MITK_TEST_SUITE_REGISTRATION(mitkNonLocalMeansDenoising)
@@ -0,0 +1,162 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#include "mitkTestingMacros.h"
+#include "mitkTestFixture.h"
+#include <itkResampleDwiImageFilter.h>
+#include <itkResampleImageFilter.h>
+#include <itkNearestNeighborInterpolateImageFunction.h>
+#include <itkLinearInterpolateImageFunction.h>
+#include <itkBSplineInterpolateImageFunction.h>
+#include <itkWindowedSincInterpolateImageFunction.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionConstIterator.h>
+#include <random>
+
+class mitkResampleDwiImageFilterTestSuite : public mitk::TestFixture
+{
+
+  CPPUNIT_TEST_SUITE(mitkResampleDwiImageFilterTestSuite);
+  MITK_TEST(NearestNeighbour);
+  MITK_TEST(Linear);
+  MITK_TEST(BSpline);
+  MITK_TEST(WindowedSinc);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+
+  typedef itk::ResampleDwiImageFilter<short> FilterType;
+  typedef FilterType::DwiImageType DwiImageType;
+  typedef FilterType::DwiChannelType ChannelType;
+
+  DwiImageType::Pointer m_Image;
+
+  /** Resamples every channel separately with itk::ResampleImageFilter (the former implementation of the filter) and
+   * returns the maximum difference to the vector-native resampling. */
+  int CompareToChannelwiseResampling(FilterType::Interpolation interpolation, itk::InterpolateImageFunction<ChannelType>* interpolator)
+  {
+    itk::Vector<double, 3> sampling;
+    sampling[0] = 1.5;
+    sampling[1] = 2;
+    sampling[2] = 0.5;
+
+    FilterType::Pointer filter = FilterType::New();
+    filter->SetInput(m_Image);
+    filter->SetSamplingFactor(sampling);
+    filter->SetInterpolation(interpolation);
+    filter->Update();
+    DwiImageType::Pointer output = filter->GetOutput();
+
+    int max_diff = 0;
+    for (unsigned int i=0; i<m_Image->GetVectorLength(); ++i)
+    {
+      ChannelType::Pointer channel = ChannelType::New();
+      channel->SetSpacing(m_Image->GetSpacing());
+      channel->SetOrigin(m_Image->GetOrigin());
+      channel->SetDirection(m_Image->GetDirection());
+      channel->SetRegions(m_Image->GetLargestPossibleRegion());
+      channel->Allocate();
+      itk::ImageRegionIterator<ChannelType> it(channel, channel->GetLargestPossibleRegion());
+      for (; !it.IsAtEnd(); ++it)
+        it.Set(m_Image->GetPixel(it.GetIndex())[i]);
+
+      itk::ResampleImageFilter<ChannelType, ChannelType>::Pointer resampler = itk::ResampleImageFilter<ChannelType, ChannelType>::New();
+      resampler->SetOutputSpacing(output->GetSpacing());
+      resampler->SetOutputOrigin(output->GetOrigin());
+      resampler->SetOutputDirection(output->GetDirection());
+      resampler->SetSize(output->GetLargestPossibleRegion().GetSize());
+      resampler->SetInterpolator(interpolator);
+      resampler->SetInput(channel);
+      resampler->Update();
+
+      itk::ImageRegionConstIterator<ChannelType> rit(resampler->GetOutput(), resampler->GetOutput()->GetLargestPossibleRegion());
+      for (; !rit.IsAtEnd(); ++rit)
+        max_diff = std::max(max_diff, std::abs(rit.Get()-output->GetPixel(rit.GetIndex())[i]));
+    }
+    MITK_INFO << "Maximum difference to channelwise resampling: " << max_diff;
+    return max_diff;
+  }
+
+public:
+
+  void setUp() override
+  {
+    DwiImageType::RegionType region;
+    region.SetSize(0, 11);
+    region.SetSize(1, 9);
+    region.SetSize(2, 7);
+
+    itk::Vector<double, 3> spacing;
+    spacing[0] = 2;
+    spacing[1] = 2.5;
+    spacing[2] = 3;
+    itk::Point<double, 3> origin;
+    origin[0] = -10;
+    origin[1] = 4;
+    origin[2] = 7.5;
+
+    m_Image = DwiImageType::New();
+    m_Image->SetSpacing(spacing);
+    m_Image->SetOrigin(origin);
+    m_Image->SetRegions(region);
+    m_Image->SetVectorLength(13);
+    m_Image->Allocate();
+
+    // random values with a constant border region
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> uniform(0, 4000);
+    itk::ImageRegionIterator<DwiImageType> it(m_Image, region);
+    for (; !it.IsAtEnd(); ++it)
+    {
+      DwiImageType::PixelType pix = it.Get();
+      for (unsigned int i=0; i<pix.GetSize(); ++i)
+        pix[i] = it.GetIndex()[0]<3 ? 1000 : uniform(rng);
+      it.Set(pix);
+    }
+  }
+
+  void tearDown() override
+  {
+    m_Image = nullptr;
+  }
+
+  void NearestNeighbour()
+  {
+    auto interpolator = itk::NearestNeighborInterpolateImageFunction<ChannelType>::New();
+    MITK_TEST_CONDITION_REQUIRED(CompareToChannelwiseResampling(FilterType::Interpolate_NearestNeighbour, interpolator)==0, "Nearest neighbour resampling test.");
+  }
+
+  void Linear()
+  {
+    auto interpolator = itk::LinearInterpolateImageFunction<ChannelType>::New();
+    MITK_TEST_CONDITION_REQUIRED(CompareToChannelwiseResampling(FilterType::Interpolate_Linear, interpolator)<=1, "Linear resampling test.");
+  }
+
+  void BSpline()
+  {
+    auto interpolator = itk::BSplineInterpolateImageFunction<ChannelType>::New();
+    MITK_TEST_CONDITION_REQUIRED(CompareToChannelwiseResampling(FilterType::Interpolate_BSpline, interpolator)<=1, "B-spline resampling test.");
+  }
+
+  void WindowedSinc()
+  {
+    auto interpolator = itk::WindowedSincInterpolateImageFunction<ChannelType, 3>::New();
+    MITK_TEST_CONDITION_REQUIRED(CompareToChannelwiseResampling(FilterType::Interpolate_WindowedSinc, interpolator)<=1, "Windowed sinc resampling test.");
+  }
+
+};
+
+MITK_TEST_SUITE_REGISTRATION(mitkResampleDwiImageFilter)
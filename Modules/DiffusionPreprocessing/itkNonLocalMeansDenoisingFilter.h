@@ -19,6 +19,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 
 #include "itkImageToImageFilter.h"
 #include "itkVectorImage.h"
+#include <vector>
 
 
 namespace itk{
@@ -83,6 +84,17 @@ namespace itk{
      * If this flag is true the filter uses a method which is optimized for Rician distributed noise.
      */
     itkSetMacro(UseRicianAdaption, bool)
+    /**
+     * @brief Set flag to use the fast blockwise computation
+     *
+     * If this flag is true, the input channels are copied to contiguous planes and the patch distances of all voxels
+     * for one search offset are computed at once with separable box sums. The weights are the same as in the default
+     * voxelwise computation, only the summation order differs, so single output values may differ by one.
+     * With joint information and rician adaption, the squared intensities are averaged in all channels.
+     * Default is false.
+     */
+    itkSetMacro(UseFastMode, bool)
+    itkGetMacro(UseFastMode, bool)
     /**
      * @brief Get the amount of calculated Voxels
      *
@@ -124,6 +136,20 @@ namespace itk{
      */
     void DynamicThreadedGenerateData( const OutputImageRegionType &outputRegionForThread) override;
 
+    /** @brief Releases the channel planes of the fast mode. */
+    void AfterThreadedGenerateData() override;
+
+    /**
+     * @brief Blockwise denoising procedure of the fast mode
+     *
+     * Processes the region in slabs. For every search offset, the squared channel differences of a slab (padded by the
+     * comparison radius) are summed with separable box filters, which yields the patch distances of all voxels of the slab.
+     */
+    void FastThreadedGenerateData( const OutputImageRegionType &outputRegionForThread);
+
+    /** @brief Replaces every value by the sum over a window of +-radius along one axis of a block, clipped at the block borders. */
+    static void BoxSum(double* data, const long* dims, int axis, int radius, std::vector<double>& line);
+
 
 
   private:
@@ -132,9 +158,11 @@ namespace itk{
     int m_ComparisonRadius;                           ///< Radius of the comparisonblock.
     bool m_UseJointInformation;                       ///< Flag to use joint information.
     bool m_UseRicianAdaption;                         ///< Flag to use rician adaption.
+    bool m_UseFastMode;                               ///< Flag to use the blockwise computation.
     unsigned int m_CurrentVoxelCount;                 ///< Amount of processed voxels.
     double m_Variance;                                ///< Estimated noise variance.
     typename MaskImageType::Pointer m_Mask;           ///< Pointer to the mask image.
+    std::vector<TPixelType> m_Channels;               ///< De-interleaved input channels (fast mode), one contiguous plane per channel.
   };
 }
 
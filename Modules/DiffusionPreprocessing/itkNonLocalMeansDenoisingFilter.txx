@@ -28,6 +28,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include "itkNeighborhoodIterator.h"
 #include <itkImageRegionIteratorWithIndex.h>
 #include <vector>
+#include <algorithm>
 
 namespace itk {
 
@@ -39,6 +40,7 @@ NonLocalMeansDenoisingFilter< TPixelType >
     m_ComparisonRadius(1),
     m_UseJointInformation(false),
     m_UseRicianAdaption(false),
+    m_UseFastMode(false),
     m_Variance(1),
     m_Mask(nullptr)
 {
@@ -58,6 +60,7 @@ NonLocalMeansDenoisingFilter< TPixelType >
   MITK_INFO << "Noisevariance: " << m_Variance;
   MITK_INFO << "Use Rician Adaption: " << std::boolalpha << m_UseRicianAdaption;
   MITK_INFO << "Use Joint Information: " << std::boolalpha << m_UseJointInformation;
+  MITK_INFO << "Use Fast Mode: " << std::boolalpha << m_UseFastMode;
 
 
   typename InputImageType::Pointer inputImagePointer = static_cast< InputImageType * >( this->ProcessObject::GetInput(0) );
@@ -121,15 +124,234 @@ NonLocalMeansDenoisingFilter< TPixelType >
     outputImage->SetRequestedRegion(region);
   }
 
+  if (m_UseFastMode)
+  {
+    if (inputImagePointer->GetBufferedRegion()!=inputImagePointer->GetLargestPossibleRegion())
+      itkExceptionMacro(<< "Fast mode requires the complete input image to be buffered.");
+
+    // de-interleave the channels into contiguous planes
+    const unsigned long num_voxels = inputImagePointer->GetLargestPossibleRegion().GetNumberOfPixels();
+    const unsigned int num_channels = inputImagePointer->GetVectorLength();
+    const TPixelType* in = inputImagePointer->GetBufferPointer();
+    m_Channels.resize(num_voxels*num_channels);
+#pragma omp parallel for
+    for (int i=0; i<static_cast<int>(num_channels); ++i)
+    {
+      TPixelType* plane = m_Channels.data() + i*num_voxels;
+      for (unsigned long v=0; v<num_voxels; ++v)
+        plane[v] = in[v*num_channels+i];
+    }
+  }
+
   m_CurrentVoxelCount = 0;
 }
 
 template< class TPixelType >
 void
 NonLocalMeansDenoisingFilter< TPixelType >
-::DynamicThreadedGenerateData(const OutputImageRegionType& outputRegionForThread )
+::AfterThreadedGenerateData()
 {
+  m_Channels.clear();
+  m_Channels.shrink_to_fit();
+}
+
+template< class TPixelType >
+void
+NonLocalMeansDenoisingFilter< TPixelType >
+::BoxSum(double* data, const long* dims, int axis, int radius, std::vector<double>& line)
+{
+  const long len = dims[axis];
+  const long stride = axis==0 ? 1 : (axis==1 ? dims[0] : dims[0]*dims[1]);
+  const long num_lines = dims[0]*dims[1]*dims[2]/len;
+  line.resize(len+1);
+  for (long l=0; l<num_lines; ++l)
+  {
+    // first element of the line
+    long start;
+    if (axis==0)
+      start = l*len;
+    else if (axis==1)
+      start = (l/dims[0])*dims[0]*dims[1] + l%dims[0];
+    else
+      start = l;
+
+    line[0] = 0;
+    for (long k=0; k<len; ++k)
+      line[k+1] = line[k] + data[start+k*stride];
+    for (long k=0; k<len; ++k)
+      data[start+k*stride] = line[std::min(len, k+radius+1)] - line[std::max(0l, k-radius)];
+  }
+}
+
+template< class TPixelType >
+void
+NonLocalMeansDenoisingFilter< TPixelType >
+::FastThreadedGenerateData(const OutputImageRegionType& outputRegionForThread)
+{
+  typename OutputImageType::Pointer outputImage = static_cast< OutputImageType * >(this->ProcessObject::GetOutput(0));
+  typename InputImageType::Pointer inputImagePointer = static_cast< InputImageType * >( this->ProcessObject::GetInput(0) );
+
+  const typename InputImageType::RegionType image_region = inputImagePointer->GetLargestPossibleRegion();
+  const long n[3] = { static_cast<long>(image_region.GetSize(0)), static_cast<long>(image_region.GetSize(1)), static_cast<long>(image_region.GetSize(2)) };
+  const unsigned long num_voxels = image_region.GetNumberOfPixels();
+  const unsigned int num_channels = inputImagePointer->GetVectorLength();
+  const long R = m_ComparisonRadius;
+  const long S = m_SearchRadius;
+
+  // output region and the part of the image needed for the patch distances, relative to the image start index
+  long r0[3], r1[3], b0[3], b1[3];
+  for (int a=0; a<3; ++a)
+  {
+    r0[a] = outputRegionForThread.GetIndex(a) - image_region.GetIndex(a);
+    r1[a] = r0[a] + static_cast<long>(outputRegionForThread.GetSize(a));
+    b0[a] = std::max(0l, r0[a]-R);
+    b1[a] = std::min(n[a], r1[a]+R);
+  }
+
+  // number of slices per slab, limits the accumulator memory
+  const unsigned long slice_values = (r1[0]-r0[0])*(r1[1]-r0[1])*(m_UseJointInformation ? num_channels : 1);
+  const long slab_size = std::max(1l, static_cast<long>((1ul<<22)/std::max(slice_values, 1ul)));
+
+  TPixelType* out = outputImage->GetBufferPointer();
+  std::vector<double> dist, line, acc_w, acc_v;
+  std::vector<long> count[3];
+
+  for (long z0=r0[2]; z0<r1[2] && !this->GetAbortGenerateData(); z0+=slab_size)
+  {
+    const long z1 = std::min(r1[2], z0+slab_size);
+    b0[2] = std::max(0l, z0-R);
+    b1[2] = std::min(n[2], z1+R);
+    const long bdims[3] = { b1[0]-b0[0], b1[1]-b0[1], b1[2]-b0[2] };
+    const long odims[3] = { r1[0]-r0[0], r1[1]-r0[1], z1-z0 };
+    const long num_out = odims[0]*odims[1]*odims[2];
+    dist.resize(bdims[0]*bdims[1]*bdims[2]);
+
+    // non-joint: every channel is denoised separately, joint: one pass with weights shared by all channels
+    const unsigned int num_passes = m_UseJointInformation ? 1 : num_channels;
+    const unsigned int pass_channels = m_UseJointInformation ? num_channels : 1;
+    for (unsigned int pass=0; pass<num_passes; ++pass)
+    {
+      const TPixelType* planes = m_Channels.data() + (m_UseJointInformation ? 0 : pass*num_voxels);
+      acc_w.assign(num_out, 0.0);
+      acc_v.assign(num_out*pass_channels, 0.0);
+
+      for (long dz=-S; dz<=S; ++dz)
+        for (long dy=-S; dy<=S; ++dy)
+          for (long dx=-S; dx<=S; ++dx)
+          {
+            const long d[3] = {dx, dy, dz};
+            const long doffset = dx + n[0]*(dy + n[1]*dz);
+
+            // squared differences between every block voxel q and q+d, zero if q+d is outside
+            unsigned long b = 0;
+            for (long z=b0[2]; z<b1[2]; ++z)
+              for (long y=b0[1]; y<b1[1]; ++y)
+              {
+                const bool line_inside = y+dy>=0 && y+dy<n[1] && z+dz>=0 && z+dz<n[2];
+                for (long x=b0[0]; x<b1[0]; ++x, ++b)
+                {
+                  if (!line_inside || x+dx<0 || x+dx>=n[0])
+                  {
+                    dist[b] = 0;
+                    continue;
+                  }
+                  const unsigned long q = x + n[0]*(y + n[1]*z);
+                  double sum = 0;
+                  for (unsigned int i=0; i<pass_channels; ++i)
+                  {
+                    double diff = static_cast<double>(planes[i*num_voxels+q]) - static_cast<double>(planes[i*num_voxels+q+doffset]);
+                    sum += diff*diff;
+                  }
+                  dist[b] = sum;
+                }
+              }
+
+            // patch distances
+            BoxSum(dist.data(), bdims, 0, R, line);
+            BoxSum(dist.data(), bdims, 1, R, line);
+            BoxSum(dist.data(), bdims, 2, R, line);
+
+            // number of compared voxel pairs along each axis
+            for (int a=0; a<3; ++a)
+            {
+              const long lo = std::max(0l, -d[a]);
+              const long hi = std::min(n[a], n[a]-d[a]);
+              const long p0 = a==2 ? z0 : r0[a];
+              count[a].resize(odims[a]);
+              for (long k=0; k<odims[a]; ++k)
+                count[a][k] = std::max(0l, std::min(hi, p0+k+R+1) - std::max(lo, p0+k-R));
+            }
 
+            unsigned long o = 0;
+            for (long z=z0; z<z1; ++z)
+              for (long y=r0[1]; y<r1[1]; ++y)
+              {
+                const bool line_inside = y+dy>=0 && y+dy<n[1] && z+dz>=0 && z+dz<n[2];
+                for (long x=r0[0]; x<r1[0]; ++x, ++o)
+                {
+                  if (!line_inside || x+dx<0 || x+dx>=n[0])
+                    continue;
+
+                  double size = count[0][x-r0[0]]*count[1][y-r0[1]]*count[2][z-z0];
+                  if (m_UseJointInformation)
+                    size *= num_channels + 1;
+                  const double sumk = dist[(x-b0[0]) + bdims[0]*((y-b0[1]) + bdims[1]*(z-b0[2]))];
+                  const double w = std::exp( - (sumk / size) / m_Variance);
+                  acc_w[o] += w;
+
+                  const unsigned long j = x+dx + n[0]*(y+dy + n[1]*(z+dz));
+                  for (unsigned int i=0; i<pass_channels; ++i)
+                  {
+                    double pixelJ = static_cast<double>(planes[i*num_voxels+j]);
+                    acc_v[o*pass_channels+i] += w*(m_UseRicianAdaption ? pixelJ*pixelJ : pixelJ);
+                  }
+                }
+              }
+          }
+
+      // write the masked voxels of this slab
+      unsigned long o = 0;
+      typename OutputImageType::IndexType index;
+      for (long z=z0; z<z1; ++z)
+        for (long y=r0[1]; y<r1[1]; ++y)
+          for (long x=r0[0]; x<r1[0]; ++x, ++o)
+          {
+            index[0] = x + image_region.GetIndex(0);
+            index[1] = y + image_region.GetIndex(1);
+            index[2] = z + image_region.GetIndex(2);
+            TPixelType* outpix = out + outputImage->ComputeOffset(index)*num_channels + (m_UseJointInformation ? 0 : pass);
+            const bool masked = m_Mask->GetPixel(index) != 0;
+            for (unsigned int i=0; i<pass_channels; ++i)
+            {
+              double sumj = 0;
+              if (masked)
+              {
+                sumj = acc_v[o*pass_channels+i]/acc_w[o];
+                if (m_UseRicianAdaption)
+                  sumj -= 2 * m_Variance;
+                if (sumj < 0)
+                  sumj = 0;
+                if (m_UseRicianAdaption)
+                  sumj = std::sqrt(sumj);
+              }
+              outpix[i] = std::floor(sumj + 0.5);
+            }
+          }
+    }
+    m_CurrentVoxelCount += num_out;
+  }
+}
+
+template< class TPixelType >
+void
+NonLocalMeansDenoisingFilter< TPixelType >
+::DynamicThreadedGenerateData(const OutputImageRegionType& outputRegionForThread )
+{
+  if (m_UseFastMode)
+  {
+    FastThreadedGenerateData(outputRegionForThread);
+    return;
+  }
 
   // initialize iterators
   typename OutputImageType::Pointer outputImage =
@@ -34,12 +34,21 @@ PURPOSE.  See the above copyright notices for more information.
 
 #include <itkImageToImageFilter.h>
 #include <itkVectorImage.h>
+#include <itkContinuousIndex.h>
+#include <vector>
 
 namespace itk
 {
 
 /**
-* \brief Resample DWI channel by channel.   */
+* \brief Resample DWI.
+*
+* The filter works directly on the vector pixels: the position of each output voxel in the input image and its
+* interpolation weights are computed once and applied to all channels. The output regions are processed in parallel.
+* Nearest neighbour, linear, cubic B-spline and windowed sinc (radius 3, Hamming window) interpolation yield the values
+* of itk::ResampleImageFilter with the corresponding ITK interpolators applied to every channel separately.
+* The B-spline coefficients are computed for blocks of channels, so their buffer is never larger than the input image.
+*/
 
 template <class TScalarType>
 class ResampleDwiImageFilter
@@ -126,9 +135,39 @@ public:
 
     void GenerateData() override;
 
+    typedef ContinuousIndex< double, 3 > ContinuousIndexType;
+    typedef typename DwiImageType::IndexType IndexType;
+
+    /** Continuous index of the output voxel in the input image, relative to the start of the input region. Returns
+     * false if the point is outside of the input buffer (as InterpolateImageFunction::IsInsideBuffer). */
+    bool GetInputIndex(const IndexType& index, ContinuousIndexType& cindex) const;
+
+    /** Resample all channels of the output region */
+    void ResampleNearestNeighbour(const ImageRegion<3>& region);
+    void ResampleLinear(const ImageRegion<3>& region);
+    void ResampleWindowedSinc(const ImageRegion<3>& region);
+
+    /** Resample the channels of the current B-spline coefficient block */
+    void ResampleBSpline(const ImageRegion<3>& region);
+
+    /** Cubic B-spline coefficients of the current channel block, computed as by BSplineDecompositionImageFilter */
+    void ComputeBSplineCoefficients();
+
+    /** Clamp to the range of the pixel type and truncate (as ResampleImageFilter) */
+    static TScalarType CastValue(double value);
+
     DoubleVectorType m_NewSpacing;
     ImageRegion<3>   m_NewImageRegion;
     Interpolation    m_Interpolation;
+
+    DwiImageType*         m_OutputImage;
+    const TScalarType*    m_InputBuffer;
+    long                  m_InputSize[3];
+    std::size_t           m_InputStride[3];     ///< pixel offset between neighbouring input voxels in each dimension
+    unsigned int          m_NumberOfChannels;
+    std::vector< double > m_Coefficients;       ///< B-spline coefficients of the current block, channel-interleaved
+    unsigned int          m_FirstBlockChannel;
+    unsigned int          m_BlockSize;
 };
 
 
@@ -36,13 +36,12 @@ PURPOSE.  See the above copyright notices for more information.
 #define _USE_MATH_DEFINES
 
 #include "itkResampleDwiImageFilter.h"
-#include <itkImageRegionIterator.h>
+#include <itkImageRegionIteratorWithIndex.h>
 #include <itkImageRegion.h>
-#include <itkResampleImageFilter.h>
-#include <itkBSplineInterpolateImageFunction.h>
-#include <itkNearestNeighborInterpolateImageFunction.h>
-#include <itkLinearInterpolateImageFunction.h>
-#include <itkWindowedSincInterpolateImageFunction.h>
+#include <itkMultiThreaderBase.h>
+#include <itkMath.h>
+#include <algorithm>
+#include <cmath>
 
 namespace itk
 {
@@ -51,6 +50,11 @@ template <class TScalarType>
 ResampleDwiImageFilter<TScalarType>
 ::ResampleDwiImageFilter()
     : m_Interpolation(Interpolate_Linear)
+    , m_OutputImage(nullptr)
+    , m_InputBuffer(nullptr)
+    , m_NumberOfChannels(0)
+    , m_FirstBlockChannel(0)
+    , m_BlockSize(0)
 {
     this->SetNumberOfRequiredInputs( 1 );
 }
@@ -60,20 +64,12 @@ void
 ResampleDwiImageFilter<TScalarType>
 ::GenerateData()
 {
-//    // initialize output image
-//    itk::Vector< double, 3 > spacing = this->GetInput()->GetSpacing();
-//    spacing[0] /= m_SamplingFactor[0];
-//    spacing[1] /= m_SamplingFactor[1];
-//    spacing[2] /= m_SamplingFactor[2];
-//    ImageRegion<3> region = this->GetInput()->GetLargestPossibleRegion();
-//    region.SetSize(0, region.GetSize(0)*m_SamplingFactor[0]);
-//    region.SetSize(1, region.GetSize(1)*m_SamplingFactor[1]);
-//    region.SetSize(2, region.GetSize(2)*m_SamplingFactor[2]);
-
-    itk::Point<double,3> origin = this->GetInput()->GetOrigin();
-    origin[0] -= this->GetInput()->GetSpacing()[0]/2;
-    origin[1] -= this->GetInput()->GetSpacing()[1]/2;
-    origin[2] -= this->GetInput()->GetSpacing()[2]/2;
+    const DwiImageType* input = this->GetInput();
+
+    itk::Point<double,3> origin = input->GetOrigin();
+    origin[0] -= input->GetSpacing()[0]/2;
+    origin[1] -= input->GetSpacing()[1]/2;
+    origin[2] -= input->GetSpacing()[2]/2;
 
     origin[0] += m_NewSpacing[0]/2;
     origin[1] += m_NewSpacing[1]/2;
@@ -82,83 +78,407 @@ ResampleDwiImageFilter<TScalarType>
     typename DwiImageType::Pointer outImage = DwiImageType::New();
     outImage->SetSpacing( m_NewSpacing );
     outImage->SetOrigin( origin );
-    outImage->SetDirection( this->GetInput()->GetDirection() );
+    outImage->SetDirection( input->GetDirection() );
     outImage->SetLargestPossibleRegion( m_NewImageRegion );
     outImage->SetBufferedRegion( m_NewImageRegion );
     outImage->SetRequestedRegion( m_NewImageRegion );
-    outImage->SetVectorLength( this->GetInput()->GetVectorLength() );
-    outImage->Allocate();
+    outImage->SetVectorLength( input->GetVectorLength() );
+    outImage->Allocate(true);
+
+    m_OutputImage = outImage;
+    m_InputBuffer = input->GetBufferPointer();
+    m_NumberOfChannels = input->GetVectorLength();
+    std::size_t stride = 1;
+    for (int d=0; d<3; ++d)
+    {
+        m_InputSize[d] = static_cast<long>(input->GetBufferedRegion().GetSize(d));
+        m_InputStride[d] = stride;
+        stride *= m_InputSize[d];
+    }
 
-    typename itk::ResampleImageFilter<DwiChannelType, DwiChannelType>::Pointer resampler = itk::ResampleImageFilter<DwiChannelType, DwiChannelType>::New();
-    resampler->SetOutputParametersFromImage(outImage);
+    MultiThreaderBase* threader = this->GetMultiThreader();
+    threader->SetNumberOfWorkUnits( this->GetNumberOfWorkUnits() );
 
     switch (m_Interpolation)
     {
     case Interpolate_NearestNeighbour:
     {
-        typename itk::NearestNeighborInterpolateImageFunction<DwiChannelType>::Pointer interp = itk::NearestNeighborInterpolateImageFunction<DwiChannelType>::New();
-        resampler->SetInterpolator(interp);
-        break;
-    }
-    case Interpolate_Linear:
-    {
-        typename itk::LinearInterpolateImageFunction<DwiChannelType>::Pointer interp = itk::LinearInterpolateImageFunction<DwiChannelType>::New();
-        resampler->SetInterpolator(interp);
+        threader->template ParallelizeImageRegion<3>(m_NewImageRegion, [this](const ImageRegion<3>& region)
+        {
+            this->ResampleNearestNeighbour(region);
+        }, nullptr);
         break;
     }
     case Interpolate_BSpline:
     {
-        typename itk::BSplineInterpolateImageFunction<DwiChannelType>::Pointer interp = itk::BSplineInterpolateImageFunction<DwiChannelType>::New();
-        resampler->SetInterpolator(interp);
+        // channel blocks with a coefficient buffer of at most the input image size
+        unsigned int block_size = std::max(1u, static_cast<unsigned int>(m_NumberOfChannels*sizeof(TScalarType)/sizeof(double)));
+        for (m_FirstBlockChannel=0; m_FirstBlockChannel<m_NumberOfChannels; m_FirstBlockChannel+=block_size)
+        {
+            m_BlockSize = std::min(block_size, m_NumberOfChannels-m_FirstBlockChannel);
+            this->ComputeBSplineCoefficients();
+            threader->template ParallelizeImageRegion<3>(m_NewImageRegion, [this](const ImageRegion<3>& region)
+            {
+                this->ResampleBSpline(region);
+            }, nullptr);
+        }
+        m_Coefficients.clear();
+        m_Coefficients.shrink_to_fit();
         break;
     }
     case Interpolate_WindowedSinc:
     {
-        typename itk::WindowedSincInterpolateImageFunction<DwiChannelType, 3>::Pointer interp = itk::WindowedSincInterpolateImageFunction<DwiChannelType, 3>::New();
-        resampler->SetInterpolator(interp);
+        threader->template ParallelizeImageRegion<3>(m_NewImageRegion, [this](const ImageRegion<3>& region)
+        {
+            this->ResampleWindowedSinc(region);
+        }, nullptr);
         break;
     }
+    case Interpolate_Linear:
     default:
     {
-        typename itk::LinearInterpolateImageFunction<DwiChannelType>::Pointer interp = itk::LinearInterpolateImageFunction<DwiChannelType>::New();
-        resampler->SetInterpolator(interp);
+        threader->template ParallelizeImageRegion<3>(m_NewImageRegion, [this](const ImageRegion<3>& region)
+        {
+            this->ResampleLinear(region);
+        }, nullptr);
     }
     }
 
-    for (unsigned int i=0; i<this->GetInput()->GetVectorLength(); i++)
+    m_OutputImage = nullptr;
+    m_InputBuffer = nullptr;
+    this->SetNthOutput(0, outImage);
+}
+
+template <class TScalarType>
+bool
+ResampleDwiImageFilter<TScalarType>
+::GetInputIndex(const IndexType& index, ContinuousIndexType& cindex) const
+{
+    typename DwiImageType::PointType point;
+    m_OutputImage->TransformIndexToPhysicalPoint(index, point);
+    this->GetInput()->TransformPhysicalPointToContinuousIndex(point, cindex);
+
+    const IndexType& start = this->GetInput()->GetBufferedRegion().GetIndex();
+    for (int d=0; d<3; ++d)
     {
-        typename DwiChannelType::Pointer channel = DwiChannelType::New();
-        channel->SetSpacing( this->GetInput()->GetSpacing() );
-        channel->SetOrigin( this->GetInput()->GetOrigin() );
-        channel->SetDirection( this->GetInput()->GetDirection() );
-        channel->SetLargestPossibleRegion( this->GetInput()->GetLargestPossibleRegion() );
-        channel->SetBufferedRegion( this->GetInput()->GetLargestPossibleRegion() );
-        channel->SetRequestedRegion( this->GetInput()->GetLargestPossibleRegion() );
-        channel->Allocate();
-
-        ImageRegionIterator<DwiChannelType> it(channel, channel->GetLargestPossibleRegion());
-        while(!it.IsAtEnd())
+        cindex[d] -= start[d];
+        // negated test to catch NaNs
+        if ( !(cindex[d] >= -0.5 && cindex[d] < m_InputSize[d]-0.5) )
+            return false;
+    }
+    return true;
+}
+
+template <class TScalarType>
+TScalarType
+ResampleDwiImageFilter<TScalarType>
+::CastValue(double value)
+{
+    if (value < static_cast<double>(NumericTraits<TScalarType>::NonpositiveMin()))
+        return NumericTraits<TScalarType>::NonpositiveMin();
+    if (value > static_cast<double>(NumericTraits<TScalarType>::max()))
+        return NumericTraits<TScalarType>::max();
+    return static_cast<TScalarType>(value);
+}
+
+template <class TScalarType>
+void
+ResampleDwiImageFilter<TScalarType>
+::ResampleNearestNeighbour(const ImageRegion<3>& region)
+{
+    const unsigned int num_channels = m_NumberOfChannels;
+    ImageRegionIteratorWithIndex<DwiImageType> it(m_OutputImage, region);
+    for (; !it.IsAtEnd(); ++it)
+    {
+        ContinuousIndexType cindex;
+        if (!this->GetInputIndex(it.GetIndex(), cindex))
+            continue;
+
+        std::size_t offset = 0;
+        for (int d=0; d<3; ++d)
+            offset += static_cast<std::size_t>(std::floor(cindex[d]+0.5))*m_InputStride[d];
+
+        const TScalarType* in = m_InputBuffer + offset*num_channels;
+        TScalarType* out = m_OutputImage->GetBufferPointer() + m_OutputImage->ComputeOffset(it.GetIndex())*num_channels;
+        for (unsigned int c=0; c<num_channels; ++c)
+            out[c] = in[c];
+    }
+}
+
+template <class TScalarType>
+void
+ResampleDwiImageFilter<TScalarType>
+::ResampleLinear(const ImageRegion<3>& region)
+{
+    const unsigned int num_channels = m_NumberOfChannels;
+    ImageRegionIteratorWithIndex<DwiImageType> it(m_OutputImage, region);
+    for (; !it.IsAtEnd(); ++it)
+    {
+        ContinuousIndexType cindex;
+        if (!this->GetInputIndex(it.GetIndex(), cindex))
+            continue;
+
+        // neighbours outside of the image are replaced by the border voxel, as in LinearInterpolateImageFunction
+        double distance[3];
+        std::size_t lower[3];
+        std::size_t upper[3];
+        for (int d=0; d<3; ++d)
         {
-            typename DwiImageType::PixelType pix = this->GetInput()->GetPixel(it.GetIndex());
-            it.Set(pix[i]);
-            ++it;
+            long base = std::max(0l, static_cast<long>(std::floor(cindex[d])));
+            distance[d] = std::max(0.0, cindex[d]-base);
+            lower[d] = base*m_InputStride[d];
+            upper[d] = std::min(base+1, m_InputSize[d]-1)*m_InputStride[d];
         }
 
-        resampler->SetInput(channel);
-        resampler->Update();
-        channel = resampler->GetOutput();
+        const TScalarType* in000 = m_InputBuffer + (lower[0]+lower[1]+lower[2])*num_channels;
+        const TScalarType* in100 = m_InputBuffer + (upper[0]+lower[1]+lower[2])*num_channels;
+        const TScalarType* in010 = m_InputBuffer + (lower[0]+upper[1]+lower[2])*num_channels;
+        const TScalarType* in110 = m_InputBuffer + (upper[0]+upper[1]+lower[2])*num_channels;
+        const TScalarType* in001 = m_InputBuffer + (lower[0]+lower[1]+upper[2])*num_channels;
+        const TScalarType* in101 = m_InputBuffer + (upper[0]+lower[1]+upper[2])*num_channels;
+        const TScalarType* in011 = m_InputBuffer + (lower[0]+upper[1]+upper[2])*num_channels;
+        const TScalarType* in111 = m_InputBuffer + (upper[0]+upper[1]+upper[2])*num_channels;
+        TScalarType* out = m_OutputImage->GetBufferPointer() + m_OutputImage->ComputeOffset(it.GetIndex())*num_channels;
 
-        ImageRegionIterator<DwiImageType> it2(outImage, outImage->GetLargestPossibleRegion());
-        while(!it2.IsAtEnd())
+        for (unsigned int c=0; c<num_channels; ++c)
         {
-            typename DwiImageType::PixelType pix = it2.Get();
-            pix[i] = channel->GetPixel(it2.GetIndex());
-            it2.Set(pix);
-            ++it2;
+            // same order of operations as LinearInterpolateImageFunction, so constant regions stay exact
+            const double val000 = in000[c];
+            const double val100 = in100[c];
+            const double val010 = in010[c];
+            const double val110 = in110[c];
+            const double val001 = in001[c];
+            const double val101 = in101[c];
+            const double val011 = in011[c];
+            const double val111 = in111[c];
+            const double valx00 = val000 + (val100-val000)*distance[0];
+            const double valx10 = val010 + (val110-val010)*distance[0];
+            const double valxx0 = valx00 + (valx10-valx00)*distance[1];
+            const double valx01 = val001 + (val101-val001)*distance[0];
+            const double valx11 = val011 + (val111-val011)*distance[0];
+            const double valxx1 = valx01 + (valx11-valx01)*distance[1];
+            out[c] = CastValue(valxx0 + (valxx1-valxx0)*distance[2]);
         }
     }
+}
 
-    this->SetNthOutput(0, outImage);
+template <class TScalarType>
+void
+ResampleDwiImageFilter<TScalarType>
+::ResampleWindowedSinc(const ImageRegion<3>& region)
+{
+    // WindowedSincInterpolateImageFunction with radius 3, Hamming window and zero flux Neumann boundary condition
+    const int radius = 3;
+    const int window_size = 2*radius;
+    const double window_factor = itk::Math::pi/radius;
+    const unsigned int num_channels = m_NumberOfChannels;
+    std::vector< double > values(num_channels);
+
+    ImageRegionIteratorWithIndex<DwiImageType> it(m_OutputImage, region);
+    for (; !it.IsAtEnd(); ++it)
+    {
+        ContinuousIndexType cindex;
+        if (!this->GetInputIndex(it.GetIndex(), cindex))
+            continue;
+
+        double weights[3][window_size];
+        std::size_t offsets[3][window_size];
+        for (int d=0; d<3; ++d)
+        {
+            long base = static_cast<long>(std::floor(cindex[d]));
+            double distance = cindex[d]-base;
+            double x = distance + radius;
+            for (int i=0; i<window_size; ++i)
+            {
+                if (distance==0.0)
+                    weights[d][i] = i==radius-1 ? 1 : 0;
+                else
+                {
+                    x -= 1.0;
+                    double px = itk::Math::pi*x;
+                    double sinc = x==0.0 ? 1.0 : std::sin(px)/px;
+                    weights[d][i] = (0.54 + 0.46*std::cos(x*window_factor))*sinc;
+                }
+                long idx = std::min(std::max(base+i-radius+1, 0l), m_InputSize[d]-1);
+                offsets[d][i] = idx*m_InputStride[d];
+            }
+        }
+
+        std::fill(values.begin(), values.end(), 0.0);
+        for (int k=0; k<window_size; ++k)
+            for (int j=0; j<window_size; ++j)
+                for (int i=0; i<window_size; ++i)
+                {
+                    const TScalarType* in = m_InputBuffer + (offsets[0][i]+offsets[1][j]+offsets[2][k])*num_channels;
+                    for (unsigned int c=0; c<num_channels; ++c)
+                    {
+                        double val = in[c];
+                        val *= weights[0][i];
+                        val *= weights[1][j];
+                        val *= weights[2][k];
+                        values[c] += val;
+                    }
+                }
+
+        TScalarType* out = m_OutputImage->GetBufferPointer() + m_OutputImage->ComputeOffset(it.GetIndex())*num_channels;
+        for (unsigned int c=0; c<num_channels; ++c)
+            out[c] = CastValue(values[c]);
+    }
+}
+
+template <class TScalarType>
+void
+ResampleDwiImageFilter<TScalarType>
+::ResampleBSpline(const ImageRegion<3>& region)
+{
+    // BSplineInterpolateImageFunction of order 3 with mirror boundary conditions
+    const unsigned int num_channels = m_NumberOfChannels;
+    const unsigned int block_size = m_BlockSize;
+    std::vector< double > values(block_size);
+
+    ImageRegionIteratorWithIndex<DwiImageType> it(m_OutputImage, region);
+    for (; !it.IsAtEnd(); ++it)
+    {
+        ContinuousIndexType cindex;
+        if (!this->GetInputIndex(it.GetIndex(), cindex))
+            continue;
+
+        double weights[3][4];
+        std::size_t offsets[3][4];
+        for (int d=0; d<3; ++d)
+        {
+            long first = static_cast<long>(std::floor(static_cast<float>(cindex[d]))) - 1;
+            double w = cindex[d] - (first+1);
+            weights[d][3] = (1.0/6.0)*w*w*w;
+            weights[d][0] = (1.0/6.0) + 0.5*w*(w-1.0) - weights[d][3];
+            weights[d][2] = w + weights[d][0] - 2.0*weights[d][3];
+            weights[d][1] = 1.0 - weights[d][0] - weights[d][2] - weights[d][3];
+
+            const long end = m_InputSize[d]-1;
+            for (int k=0; k<4; ++k)
+            {
+                long idx = first+k;
+                if (end==0)
+                    idx = 0;
+                if (idx<0)
+                    idx = -idx;
+                if (idx>end)
+                    idx = end-(idx-end);
+                idx = std::min(std::max(idx, 0l), end);
+                offsets[d][k] = idx*m_InputStride[d];
+            }
+        }
+
+        std::fill(values.begin(), values.end(), 0.0);
+        for (int z=0; z<4; ++z)
+            for (int y=0; y<4; ++y)
+                for (int x=0; x<4; ++x)
+                {
+                    double w = 1.0;
+                    w *= weights[0][x];
+                    w *= weights[1][y];
+                    w *= weights[2][z];
+                    const double* coeffs = m_Coefficients.data() + (offsets[0][x]+offsets[1][y]+offsets[2][z])*block_size;
+                    for (unsigned int c=0; c<block_size; ++c)
+                        values[c] += w*coeffs[c];
+                }
+
+        TScalarType* out = m_OutputImage->GetBufferPointer() + m_OutputImage->ComputeOffset(it.GetIndex())*num_channels + m_FirstBlockChannel;
+        for (unsigned int c=0; c<block_size; ++c)
+            out[c] = CastValue(values[c]);
+    }
+}
+
+template <class TScalarType>
+void
+ResampleDwiImageFilter<TScalarType>
+::ComputeBSplineCoefficients()
+{
+    const unsigned int num_channels = m_NumberOfChannels;
+    const unsigned int block_size = m_BlockSize;
+    const std::size_t num_voxels = m_InputStride[2]*m_InputSize[2];
+
+    m_Coefficients.resize(num_voxels*block_size);
+    for (std::size_t v=0; v<num_voxels; ++v)
+        for (unsigned int c=0; c<block_size; ++c)
+            m_Coefficients[v*block_size+c] = m_InputBuffer[v*num_channels + m_FirstBlockChannel + c];
+
+    // pole of the cubic B-spline and tolerance of BSplineDecompositionImageFilter
+    const double z = std::sqrt(3.0) - 2.0;
+    const double gain = (1.0 - z) * (1.0 - 1.0/z);
+    const long horizon = static_cast<long>(std::ceil(std::log(1e-10)/std::log(std::fabs(z))));
+    const std::size_t lines_per_chunk = 64;
+
+    for (int d=0; d<3; ++d)
+    {
+        const long length = m_InputSize[d];
+        if (length==1)
+            continue;
+
+        const std::size_t stride = m_InputStride[d];
+        const std::size_t num_lines = num_voxels/length;
+        const std::size_t num_chunks = (num_lines + lines_per_chunk - 1)/lines_per_chunk;
+
+        // all channels of a line are filtered at once, the operations on each channel are the ones of the 1D filter
+        this->GetMultiThreader()->ParallelizeArray(0, num_chunks, [&](SizeValueType chunk)
+        {
+            std::vector< double > scratch(length*block_size);
+            double* s = scratch.data();
+            for (std::size_t l=chunk*lines_per_chunk; l<std::min(num_lines, (chunk+1)*lines_per_chunk); ++l)
+            {
+                const std::size_t line_start = (l/stride)*stride*length + l%stride;
+                for (long n=0; n<length; ++n)
+                    for (unsigned int c=0; c<block_size; ++c)
+                        s[n*block_size+c] = m_Coefficients[(line_start + n*stride)*block_size + c]*gain;
+
+                for (unsigned int c=0; c<block_size; ++c)
+                {
+                    // causal initialization for mirror boundaries
+                    if (horizon<length)
+                    {
+                        double zn = z;
+                        double sum = s[c];
+                        for (long n=1; n<horizon; ++n)
+                        {
+                            sum += zn*s[n*block_size+c];
+                            zn *= z;
+                        }
+                        s[c] = sum;
+                    }
+                    else
+                    {
+                        double zn = z;
+                        double iz = 1.0/z;
+                        double z2n = std::pow(z, static_cast<double>(length-1));
+                        double sum = s[c] + z2n*s[(length-1)*block_size+c];
+                        z2n *= z2n*iz;
+                        for (long n=1; n<=length-2; ++n)
+                        {
+                            sum += (zn+z2n)*s[n*block_size+c];
+                            zn *= z;
+                            z2n *= iz;
+                        }
+                        s[c] = sum/(1.0-zn*zn);
+                    }
+                }
+
+                for (long n=1; n<length; ++n)
+                    for (unsigned int c=0; c<block_size; ++c)
+                        s[n*block_size+c] += z*s[(n-1)*block_size+c];
+
+                for (unsigned int c=0; c<block_size; ++c)
+                    s[(length-1)*block_size+c] = (z/(z*z-1.0))*(z*s[(length-2)*block_size+c] + s[(length-1)*block_size+c]);
+
+                for (long n=length-2; n>=0; --n)
+                    for (unsigned int c=0; c<block_size; ++c)
+                        s[n*block_size+c] = z*(s[(n+1)*block_size+c] - s[n*block_size+c]);
+
+                for (long n=0; n<length; ++n)
+                    for (unsigned int c=0; c<block_size; ++c)
+                        m_Coefficients[(line_start + n*stride)*block_size + c] = s[n*block_size+c];
+            }
+        }, nullptr);
+    }
 }
 
 template <class TScalarType>
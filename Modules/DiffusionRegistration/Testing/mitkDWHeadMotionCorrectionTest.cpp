@@ -25,7 +25,7 @@ typedef mitk::Image  DiffusionImageType;
 /**
  * @brief Custom test to provide CMD-line access to the mitk::DWIHeadMotionCorrectionFilter
  *
- * @param argv : Input and Output image full path
+ * @param argv : Input and Output image full path, optionally "parallel" to use the parallel registration mode
  */
 int mitkDWHeadMotionCorrectionTest( int argc, char* argv[] )
 {
@@ -39,6 +39,7 @@ int mitkDWHeadMotionCorrectionTest( int argc, char* argv[] )
   mitk::DWIHeadMotionCorrectionFilter::Pointer corrfilter = mitk::DWIHeadMotionCorrectionFilter::New();
 
   corrfilter->SetInput( dwimage );
+  corrfilter->SetParallelRegistration( argc > 3 && std::string(argv[3]) == "parallel" );
   corrfilter->Update();
 
   try
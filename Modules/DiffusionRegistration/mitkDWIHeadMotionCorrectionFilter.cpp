@@ -42,15 +42,78 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <mitkProperties.h>
 #include <mitkBValueMapProperty.h>
 
+#include "mitkPyramidImageRegistrationMethod.h"
+#include <itkBSplineInterpolateImageFunction.h>
+#include <itkImageRegionConstIteratorWithIndex.h>
+#include <itkMultiThreaderBase.h>
+#include <itkTimeProbe.h>
+#include <vnl/vnl_inverse.h>
+
 #include <vector>
+#include <algorithm>
+#include <mutex>
+#include <cmath>
 
 #include "mitkIOUtil.h"
 #include <itkImage.h>
 
 typedef mitk::DiffusionPropertyHelper DPH;
 typedef itk::ExtractDwiChannelFilter< short > ExtractorType;
+typedef mitk::DWIHeadMotionCorrectionFilter::ITKDiffusionImageType DwiImageType;
+typedef mitk::DWIHeadMotionCorrectionFilter::ITKDiffusionVolumeType DwiVolumeType;
+typedef mitk::PyramidImageRegistrationMethod::AffineTransformType AffineTransformType;
+
+/** Copies one channel of the vector image into a new volume. Unlike ExtractDwiChannelFilter this does not run a
+ * pipeline on the input, so it can be called by concurrent workers sharing the input image. */
+static DwiVolumeType::Pointer CopyChannel(const DwiImageType* image, int channel)
+{
+  DwiVolumeType::Pointer volume = DwiVolumeType::New();
+  volume->SetSpacing( image->GetSpacing() );
+  volume->SetOrigin( image->GetOrigin() );
+  volume->SetDirection( image->GetDirection() );
+  volume->SetRegions( image->GetLargestPossibleRegion() );
+  volume->Allocate();
+
+  const std::size_t num_channels = image->GetVectorLength();
+  const std::size_t num_voxels = volume->GetLargestPossibleRegion().GetNumberOfPixels();
+  const short* in = image->GetBufferPointer() + channel;
+  short* out = volume->GetBufferPointer();
+  for (std::size_t v=0; v<num_voxels; ++v)
+    out[v] = in[v*num_channels];
+  return volume;
+}
+
+/** Resamples the moving volume with the fixed-to-moving transform (B-spline of order 3) directly into one channel of
+ * the output image. Moving volume and output share the same grid. */
+static void ResampleIntoChannel(const DwiVolumeType* moving, const AffineTransformType* transform, DwiImageType* output, int channel)
+{
+  typedef itk::BSplineInterpolateImageFunction< DwiVolumeType, double, double > InterpolatorType;
+  InterpolatorType::Pointer interpolator = InterpolatorType::New();
+  interpolator->SetSplineOrder( 3 );
+  interpolator->SetInputImage( moving );
+
+  const std::size_t num_channels = output->GetVectorLength();
+  const double min_value = itk::NumericTraits< short >::min();
+  const double max_value = itk::NumericTraits< short >::max();
+  short* out = output->GetBufferPointer() + channel;
+
+  itk::ImageRegionConstIteratorWithIndex< DwiVolumeType > it( moving, moving->GetLargestPossibleRegion() );
+  for (std::size_t v=0; !it.IsAtEnd(); ++it, ++v)
+  {
+    DwiVolumeType::PointType point;
+    moving->TransformIndexToPhysicalPoint( it.GetIndex(), point );
+    point = transform->TransformPoint( point );
+
+    double value = 0;
+    if ( interpolator->IsInsideBuffer( point ) )
+      value = std::max( min_value, std::min( max_value, std::round( interpolator->Evaluate( point ) ) ) );
+    out[v*num_channels] = static_cast< short >( value );
+  }
+}
 
 mitk::DWIHeadMotionCorrectionFilter::DWIHeadMotionCorrectionFilter()
+  : m_ParallelRegistration(false)
+  , m_NumberOfParallelRegistrations(0)
 {
 
 }
@@ -75,67 +138,85 @@ void mitk::DWIHeadMotionCorrectionFilter::GenerateData()
   ITKDiffusionImageType::Pointer itkVectorImagePointer = DPH::GetItkVectorImage(input);
   int num_gradients = itkVectorImagePointer->GetVectorLength();
 
-  typedef itk::ComposeImageFilter < ITKDiffusionVolumeType > ComposeFilterType;
-  ComposeFilterType::Pointer composer = ComposeFilterType::New();
-
   // Extract unweighted volumes
   mitk::BValueMapProperty::BValueMap bval_map = DPH::GetBValueMap(input);
 
   int first_unweighted_index = bval_map.begin()->second.front();
   MITK_INFO << "Reference b-value: " << bval_map.begin()->first << " (volume " << first_unweighted_index << ")";
 
-  ExtractorType::Pointer filter = ExtractorType::New();
-  filter->SetInput( itkVectorImagePointer);
-  filter->SetChannelIndex(first_unweighted_index);
-  filter->Update();
-
-  mitk::Image::Pointer fixedImage = mitk::Image::New();
-  fixedImage->InitializeByItk( filter->GetOutput() );
-  fixedImage->SetImportChannel( filter->GetOutput()->GetBufferPointer() );
-  composer->SetInput(0, filter->GetOutput());
-
-  mitk::MultiModalAffineDefaultRegistrationAlgorithm< ITKDiffusionVolumeType >::Pointer algo = mitk::MultiModalAffineDefaultRegistrationAlgorithm< ITKDiffusionVolumeType >::New();
-  mitk::MAPAlgorithmHelper helper(algo);
-
   typedef vnl_matrix_fixed< double, 3, 3> TransformMatrixType;
   std::vector< TransformMatrixType > estimated_transforms;
-  std::vector< ITKDiffusionVolumeType::Pointer > registered_itk_images;
-  for (int i=0; i<num_gradients; ++i)
-  {
-    if (i==first_unweighted_index)
-      continue;
 
-    MITK_INFO << "Correcting volume " << i;
+  if (m_ParallelRegistration)
+  {
+    ITKDiffusionImageType::Pointer output = ITKDiffusionImageType::New();
+    output->SetSpacing( itkVectorImagePointer->GetSpacing() );
+    output->SetOrigin( itkVectorImagePointer->GetOrigin() );
+    output->SetDirection( itkVectorImagePointer->GetDirection() );
+    output->SetRegions( itkVectorImagePointer->GetLargestPossibleRegion() );
+    output->SetVectorLength( num_gradients );
+    output->Allocate();
+
+    estimated_transforms = RegisterVolumesParallel(itkVectorImagePointer, first_unweighted_index, output);
+    m_CorrectedImage = mitk::GrabItkImageMemory( output.GetPointer() );
+  }
+  else
+  {
+    typedef itk::ComposeImageFilter < ITKDiffusionVolumeType > ComposeFilterType;
+    ComposeFilterType::Pointer composer = ComposeFilterType::New();
 
     ExtractorType::Pointer filter = ExtractorType::New();
     filter->SetInput( itkVectorImagePointer);
-    filter->SetChannelIndex(i);
+    filter->SetChannelIndex(first_unweighted_index);
     filter->Update();
 
-    mitk::Image::Pointer movingImage = mitk::Image::New();
-    movingImage->InitializeByItk( filter->GetOutput() );
-    movingImage->SetImportChannel( filter->GetOutput()->GetBufferPointer() );
+    mitk::Image::Pointer fixedImage = mitk::Image::New();
+    fixedImage->InitializeByItk( filter->GetOutput() );
+    fixedImage->SetImportChannel( filter->GetOutput()->GetBufferPointer() );
+    composer->SetInput(0, filter->GetOutput());
+
+    mitk::MultiModalAffineDefaultRegistrationAlgorithm< ITKDiffusionVolumeType >::Pointer algo = mitk::MultiModalAffineDefaultRegistrationAlgorithm< ITKDiffusionVolumeType >::New();
+    mitk::MAPAlgorithmHelper helper(algo);
+
+    std::vector< ITKDiffusionVolumeType::Pointer > registered_itk_images;
+    for (int i=0; i<num_gradients; ++i)
+    {
+      if (i==first_unweighted_index)
+        continue;
+
+      MITK_INFO << "Correcting volume " << i;
+
+      ExtractorType::Pointer filter = ExtractorType::New();
+      filter->SetInput( itkVectorImagePointer);
+      filter->SetChannelIndex(i);
+      filter->Update();
 
-    helper.SetData(movingImage, fixedImage);
-    mitk::MAPRegistrationWrapper::Pointer reg = helper.GetMITKRegistrationWrapper();
-    mitk::MITKRegistrationHelper::Affine3DTransformType::Pointer affine = mitk::MITKRegistrationHelper::getAffineMatrix(reg, false);
-    estimated_transforms.push_back(affine->GetMatrix().GetVnlMatrix());
+      mitk::Image::Pointer movingImage = mitk::Image::New();
+      movingImage->InitializeByItk( filter->GetOutput() );
+      movingImage->SetImportChannel( filter->GetOutput()->GetBufferPointer() );
 
-    mitk::Image::Pointer registered_mitk_image = mitk::ImageMappingHelper::map(movingImage, reg, false, 0, nullptr, false, 0, mitk::ImageMappingInterpolator::BSpline_3);
-    ITKDiffusionVolumeType::Pointer registered_itk_image = ITKDiffusionVolumeType::New();
-    mitk::CastToItkImage(registered_mitk_image, registered_itk_image);
-    registered_itk_images.push_back(registered_itk_image);
+      helper.SetData(movingImage, fixedImage);
+      mitk::MAPRegistrationWrapper::Pointer reg = helper.GetMITKRegistrationWrapper();
+      mitk::MITKRegistrationHelper::Affine3DTransformType::Pointer affine = mitk::MITKRegistrationHelper::getAffineMatrix(reg, false);
+      estimated_transforms.push_back(affine->GetMatrix().GetVnlMatrix());
+
+      mitk::Image::Pointer registered_mitk_image = mitk::ImageMappingHelper::map(movingImage, reg, false, 0, nullptr, false, 0, mitk::ImageMappingInterpolator::BSpline_3);
+      ITKDiffusionVolumeType::Pointer registered_itk_image = ITKDiffusionVolumeType::New();
+      mitk::CastToItkImage(registered_mitk_image, registered_itk_image);
+      registered_itk_images.push_back(registered_itk_image);
     }
 
-  int i=1;
-  for (auto image : registered_itk_images)
-  {
-    composer->SetInput(i, image);
-    ++i;
+    int i=1;
+    for (auto image : registered_itk_images)
+    {
+      composer->SetInput(i, image);
+      ++i;
+    }
+    composer->Update();
+
+    m_CorrectedImage = mitk::GrabItkImageMemory( composer->GetOutput() );
   }
-  composer->Update();
 
-  m_CorrectedImage = mitk::GrabItkImageMemory( composer->GetOutput() );
   DPH::CopyProperties(input, m_CorrectedImage, true);
 
   typedef mitk::DiffusionImageCorrectionFilter CorrectionFilterType;
@@ -146,4 +227,124 @@ void mitk::DWIHeadMotionCorrectionFilter::GenerateData()
   DPH::InitializeImage(m_CorrectedImage);
 }
 
+std::vector< vnl_matrix_fixed< double, 3, 3 > > mitk::DWIHeadMotionCorrectionFilter::RegisterVolumesParallel(const ITKDiffusionImageType* input, int reference_index, ITKDiffusionImageType* output)
+{
+  typedef mitk::PyramidImageRegistrationMethod::ParametersType ParametersType;
+
+  const int num_gradients = static_cast<int>(input->GetVectorLength());
+  const std::size_t num_voxels = input->GetLargestPossibleRegion().GetNumberOfPixels();
+
+  // the reference volume is not resampled
+  const DiffusionPixelType* in = input->GetBufferPointer();
+  DiffusionPixelType* out = output->GetBufferPointer();
+  for (std::size_t v=0; v<num_voxels; ++v)
+    out[v*num_gradients + reference_index] = in[v*num_gradients + reference_index];
+
+  ITKDiffusionVolumeType::Pointer fixed_volume = CopyChannel(input, reference_index);
+
+  // affine parameters of the registered volumes, the reference counts as registered with the identity
+  std::vector< ParametersType > parameters(num_gradients, ParametersType(AffineTransformType::ParametersDimension));
+  parameters[reference_index].Fill(0);
+  parameters[reference_index][0] = parameters[reference_index][4] = parameters[reference_index][8] = 1;
+  std::mutex mutex;
+  std::string error_message;
+
+  int num_workers = static_cast<int>(m_NumberOfParallelRegistrations);
+  if (num_workers<=0)
+    num_workers = static_cast<int>(itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads());
+
+  // every registration gets its share of the threads instead of the ITK default
+  const unsigned int num_work_units = std::max(1u, itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads()/static_cast<unsigned int>(num_workers));
+  MITK_INFO << "Registering " << num_gradients-1 << " volumes, " << num_workers << " at a time with " << num_work_units << " threads each";
+
+  // The volumes are handed out in order of their index distance to the reference, alternating between the sides that
+  // exist, so the num_workers volumes in flight always form one wavefront moving outward without waiting for each
+  // other. Every volume starts at the transform of its nearest finished neighbour towards the reference, which is the
+  // adjacent volume i-1 (or i+1) as soon as that one is done.
+  std::vector< int > volumes;
+  const int max_distance = std::max(reference_index, num_gradients-1-reference_index);
+  for (int d=1; d<=max_distance; ++d)
+  {
+    if (reference_index-d>=0)
+      volumes.push_back(reference_index-d);
+    if (reference_index+d<num_gradients)
+      volumes.push_back(reference_index+d);
+  }
+  std::vector< unsigned char > finished(num_gradients, 0);
+  finished[reference_index] = 1;
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(num_workers)
+  for (int v=0; v<static_cast<int>(volumes.size()); ++v)
+  {
+    const int i = volumes[v];
+    const int step = i<reference_index ? 1 : -1;
+    int start_index = i+step;
+    ParametersType initial_parameters;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error_message.empty())
+        continue;
+      while (!finished[start_index])
+        start_index += step;
+      initial_parameters = parameters[start_index];
+    }
+
+    itk::TimeProbe clock;
+    clock.Start();
+    try
+    {
+      // every worker uses its own mitk images, the registration accesses them via mitk::ImageToItk
+      ITKDiffusionVolumeType::Pointer moving_volume = CopyChannel(input, i);
+      mitk::Image::Pointer fixed_image = mitk::Image::New();
+      fixed_image->InitializeByItk( fixed_volume.GetPointer() );
+      fixed_image->SetImportChannel( fixed_volume->GetBufferPointer() );
+      mitk::Image::Pointer moving_image = mitk::Image::New();
+      moving_image->InitializeByItk( moving_volume.GetPointer() );
+      moving_image->SetImportChannel( moving_volume->GetBufferPointer() );
+
+      mitk::PyramidImageRegistrationMethod::Pointer registration = mitk::PyramidImageRegistrationMethod::New();
+      registration->SetFixedImage( fixed_image );
+      registration->SetMovingImage( moving_image );
+      registration->SetCrossModalityOn();
+      registration->SetTransformToAffine();
+      registration->SetInitialParameters( initial_parameters );
+      registration->SetNumberOfWorkUnits( num_work_units );
+      registration->Update();
+
+      ParametersType result = registration->GetLastRegistrationParameters();
+      AffineTransformType::Pointer transform = AffineTransformType::New();
+      transform->SetParameters( result );
+      ResampleIntoChannel(moving_volume, transform, output, i);
+
+      // other workers read the transform as warm start once the volume is marked as finished
+      std::lock_guard<std::mutex> lock(mutex);
+      parameters[i] = result;
+      finished[i] = 1;
+    }
+    catch (const std::exception& e)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      error_message = e.what();
+    }
+    clock.Stop();
+    MITK_INFO << "Corrected volume " << i << " (started at transform of volume " << start_index << "): " << clock.GetTotal() << "s";
+  }
+
+  if (!error_message.empty())
+    mitkThrow() << "Registration failed: " << error_message;
+
+  // The registration transforms map from the reference to the moving volume, the gradient directions have to be
+  // rotated by the inverse (as the direct mapping of the sequential mode)
+  std::vector< vnl_matrix_fixed< double, 3, 3 > > estimated_transforms;
+  for (int i=0; i<num_gradients; ++i)
+  {
+    if (i==reference_index)
+      continue;
+    AffineTransformType::Pointer transform = AffineTransformType::New();
+    transform->SetParameters( parameters[i] );
+    estimated_transforms.push_back( vnl_inverse( transform->GetMatrix().GetVnlMatrix() ) );
+  }
+  return estimated_transforms;
+}
+
 #endif // MITKDWIHEADMOTIONCORRECTIONFILTER_CPP
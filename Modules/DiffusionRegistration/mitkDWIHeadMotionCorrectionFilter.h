@@ -24,6 +24,8 @@ See LICENSE.txt or http://www.mitk.org for details.
 
 #include "mitkITKImageImport.h"
 #include <itkVectorImage.h>
+#include <vnl/vnl_matrix_fixed.h>
+#include <vector>
 #include <MitkDiffusionRegistrationExports.h>
 
 namespace mitk
@@ -40,6 +42,10 @@ namespace mitk
  * as error metric. Second, the weighted gradient images are registered to the unweighted reference ( computed as average from the aligned images from first step )
  * by an affine transformation using the MattesMutualInformation metric as optimizer guidance.
  *
+ * In the parallel mode ( SetParallelRegistration(true) ) the volumes are registered concurrently by a bounded number
+ * of workers with the multi-resolution PyramidImageRegistrationMethod. Each registration starts at the transform of the
+ * nearest volume ( by index ) that is already finished, since consecutive volumes usually differ by small motion only,
+ * and each corrected volume is resampled directly into its channel of the preallocated output image.
  */
 
 class MITKDIFFUSIONREGISTRATION_EXPORT DWIHeadMotionCorrectionFilter
@@ -64,14 +70,31 @@ public:
   mitk::Image::Pointer GetCorrectedImage() const;
   void UpdateOutputInformation() override;
 
+  /** Register the volumes concurrently with warm starts (default false: sequential MatchPoint registration) */
+  itkSetMacro( ParallelRegistration, bool )
+  itkGetMacro( ParallelRegistration, bool )
+  itkBooleanMacro( ParallelRegistration )
+
+  /** Maximum number of volumes registered at the same time in parallel mode (0: number of ITK default threads). The
+   * ITK threads are split between the concurrent registrations. With more than one concurrent registration the warm
+   * starts depend on the order in which the registrations finish, so the results may differ slightly between runs. */
+  itkSetMacro( NumberOfParallelRegistrations, unsigned int )
+  itkGetMacro( NumberOfParallelRegistrations, unsigned int )
+
 protected:
   DWIHeadMotionCorrectionFilter();
   ~DWIHeadMotionCorrectionFilter() override {}
 
   mitk::Image::Pointer m_CorrectedImage;
+  bool m_ParallelRegistration;
+  unsigned int m_NumberOfParallelRegistrations;
 
   void GenerateData() override;
 
+  /** Parallel mode of GenerateData, writes the registered volumes into the given output image. Returns the estimated
+   * transforms of all volumes except the reference in index order. */
+  std::vector< vnl_matrix_fixed< double, 3, 3 > > RegisterVolumesParallel(const ITKDiffusionImageType* input, int reference_index, ITKDiffusionImageType* output);
+
 };
 
 } //end namespace mitk
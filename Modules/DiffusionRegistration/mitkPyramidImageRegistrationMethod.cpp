@@ -29,7 +29,9 @@ mitk::PyramidImageRegistrationMethod::PyramidImageRegistrationMethod()
     m_UseMask(false),
     m_EstimatedParameters(nullptr),
     m_InitialParameters(0),
-    m_Verbose(false)
+    m_Verbose(false),
+    m_InitializeByGeometry(false),
+    m_NumberOfWorkUnits(0)
 {
 
 }
@@ -236,6 +238,17 @@ RegisterTwoImagesV4(itk::Image<TPixel1, VImageDimension1>* itkImage1, itk::Image
     initialParams[0] = initialParams[4] = initialParams[8] = 1;
   }
 
+  // start at the given parameters ( e.g. the result of a registration of a similar image ) instead of the identity
+  const bool use_initial_parameters = m_InitialParameters.Size() > 0;
+  if( use_initial_parameters )
+  {
+    if( m_InitialParameters.Size() != paramDim )
+    {
+      mitkThrow() << "Initial parameters have dimension " << m_InitialParameters.Size() << ", the transform expects " << paramDim;
+    }
+    initialParams = m_InitialParameters;
+  }
+
 
   // [Prepare registration]
   //  The ITKv4 Methods ( the MI Metric ) require double-type images so we need to perform cast first
@@ -247,6 +260,12 @@ RegisterTwoImagesV4(itk::Image<TPixel1, VImageDimension1>* itkImage1, itk::Image
     caster_f->SetInput(0, referenceImage );
     caster_m->SetInput(0, movingImage );
 
+    if( m_NumberOfWorkUnits > 0 )
+    {
+      caster_f->SetNumberOfWorkUnits( m_NumberOfWorkUnits );
+      caster_m->SetNumberOfWorkUnits( m_NumberOfWorkUnits );
+    }
+
     caster_f->Update();
     caster_m->Update();
 
@@ -339,6 +358,12 @@ RegisterTwoImagesV4(itk::Image<TPixel1, VImageDimension1>* itkImage1, itk::Image
   optimizer->SetUpperLimit( 1.7 );
   optimizer->SetMaximumLineSearchIterations( 20 );
 
+  if( m_NumberOfWorkUnits > 0 )
+  {
+    optimizer->SetNumberOfWorkUnits( m_NumberOfWorkUnits );
+    base_metric->SetMaximumNumberOfWorkUnits( m_NumberOfWorkUnits );
+  }
+
   // add observer tag if verbose
   unsigned long vopt_tag = 0;
   if(m_Verbose)
@@ -372,6 +397,13 @@ RegisterTwoImagesV4(itk::Image<TPixel1, VImageDimension1>* itkImage1, itk::Image
     initialParams[5] = rigidTransform->GetParameters()[5];
   }
 
+  // The moving initial transform is a fixed prefix of the optimized transform, so the starting position has to be
+  // passed as the initial value of the optimized transform itself
+  if( use_initial_parameters )
+  {
+    transform->SetParameters( initialParams );
+  }
+
   // [Prepare Registration]
   //  Masking (Optional)
   if( m_UseMask )
@@ -410,9 +442,14 @@ RegisterTwoImagesV4(itk::Image<TPixel1, VImageDimension1>* itkImage1, itk::Image
     registration->SetMovingImage( 0, caster_m->GetOutput() );
     registration->SetMetric( base_metric );
     registration->SetOptimizer( optimizer );
-    registration->SetMovingInitialTransform( transform.GetPointer() );
+    if( use_initial_parameters )
+      registration->SetInitialTransform( dynamic_cast< AffineTransformType* >( transform.GetPointer() ) );
+    else
+      registration->SetMovingInitialTransform( transform.GetPointer() );
     registration->SetNumberOfLevels(max_pyramid_lvl);
     registration->SetShrinkFactorsPerLevel( shrink_factors );
+    if( m_NumberOfWorkUnits > 0 )
+      registration->SetNumberOfWorkUnits( m_NumberOfWorkUnits );
 
     // observe the pyramid level change in order to adapt parameters
     typename PyramidOptControlCommandv4<RegistrationType>::Pointer pyramid_observer =
@@ -464,9 +501,14 @@ RegisterTwoImagesV4(itk::Image<TPixel1, VImageDimension1>* itkImage1, itk::Image
     registration->SetMovingImage( 0, caster_m->GetOutput() );
     registration->SetMetric( base_metric );
     registration->SetOptimizer( optimizer );
-    registration->SetMovingInitialTransform( transform.GetPointer() );
+    if( use_initial_parameters )
+      registration->SetInitialTransform( dynamic_cast< RigidTransformType* >( transform.GetPointer() ) );
+    else
+      registration->SetMovingInitialTransform( transform.GetPointer() );
     registration->SetNumberOfLevels(max_pyramid_lvl);
     registration->SetShrinkFactorsPerLevel( shrink_factors );
+    if( m_NumberOfWorkUnits > 0 )
+      registration->SetNumberOfWorkUnits( m_NumberOfWorkUnits );
 
     // observe the pyramid level change in order to adapt parameters
     typename PyramidOptControlCommandv4<RigidRegistrationType>::Pointer pyramid_observer =
@@ -152,6 +152,16 @@ public:
     m_InitializeByGeometry = flag;
   }
 
+  /**
+   * @brief Set the number of work units used by the casters, the metric, the optimizer and the registration
+   *
+   * @param num number of work units, 0 (default) uses the ITK global default
+   */
+  void SetNumberOfWorkUnits(unsigned int num)
+  {
+    m_NumberOfWorkUnits = num;
+  }
+
   void Update();
 
   /**
@@ -315,6 +325,8 @@ protected:
 
   bool m_InitializeByGeometry;
 
+  unsigned int m_NumberOfWorkUnits;
+
   /**
    * @brief The method takes two itk::Images and performs a multi-scale registration on them
    *
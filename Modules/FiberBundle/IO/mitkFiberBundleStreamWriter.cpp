@@ -0,0 +1,163 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#include "mitkFiberBundleStreamWriter.h"
+#include <itksys/SystemTools.hxx>
+#include <vnl/vnl_inverse.h>
+#include <limits>
+
+mitk::FiberBundleStreamWriter::FiberBundleStreamWriter()
+  : m_FilePointer(nullptr)
+  , m_Tck(true)
+  , m_NumFibers(0)
+{
+  m_WorldToTrk.set_identity();
+}
+
+mitk::FiberBundleStreamWriter::~FiberBundleStreamWriter()
+{
+  if (m_FilePointer!=nullptr)
+    this->Close();
+}
+
+void mitk::FiberBundleStreamWriter::Open(const std::string& filename, const mitk::BaseGeometry* geometry)
+{
+  if (m_FilePointer!=nullptr)
+    this->Close();
+
+  std::string ext = itksys::SystemTools::LowerCase(itksys::SystemTools::GetFilenameLastExtension(filename));
+  if (ext==".tck")
+    m_Tck = true;
+  else if (ext==".trk")
+    m_Tck = false;
+  else
+    mitkThrow() << "Streaming output is only supported for .tck and .trk files: " << filename;
+
+  m_FilePointer = std::fopen(filename.c_str(), "w+b");
+  if (m_FilePointer==nullptr)
+    mitkThrow() << "Unable to create file " << filename;
+  m_Filename = filename;
+  m_NumFibers = 0;
+
+  if (m_Tck)
+  {
+    WriteTckHeader();
+    return;
+  }
+
+  if (geometry==nullptr)
+    mitkThrow() << "Reference geometry needed to write a .trk header!";
+
+  // same header and coordinate transform as TrackVisFiberReader::create/write
+  mitk::FiberBundle::Pointer dummy = mitk::FiberBundle::New();
+  dummy->SetTrackVisHeader(const_cast<mitk::BaseGeometry*>(geometry));
+  m_TrackVisHeader = dummy->GetTrackVisHeader();
+
+  vnl_matrix_fixed< double, 4, 4 > trk_to_world; trk_to_world.set_identity();
+  for (int i=0; i<4; ++i)
+    for (int j=0; j<4; ++j)
+    {
+      if (j<3)
+        trk_to_world[i][j] = m_TrackVisHeader.vox_to_ras[i][j]/m_TrackVisHeader.voxel_size[j];
+      else
+        trk_to_world[i][j] = m_TrackVisHeader.vox_to_ras[i][j];
+    }
+  for (int i=0; i<3; ++i)
+    if (m_TrackVisHeader.voxel_order[i]=="RAI"[i])
+      for (int j=0; j<4; ++j)
+        trk_to_world[i][j] *= -1;
+  m_WorldToTrk = vnl_inverse(trk_to_world);
+
+  if (std::fwrite(reinterpret_cast<char*>(&m_TrackVisHeader), 1, 1000, m_FilePointer) != 1000)
+    mitkThrow() << "Error writing TrackVis header to " << filename;
+}
+
+void mitk::FiberBundleStreamWriter::WriteTckHeader()
+{
+  // fixed width count and offset fields, so the header can be rewritten in place when the file is closed
+  char count[32];
+  sprintf(count, "%010u", m_NumFibers);
+  std::string header = "mrtrix tracks\ncount: " + std::string(count) + "\ndatatype: Float32LE\nfile: . ";
+  std::string end = "\nEND\n";
+  char offset[32];
+  sprintf(offset, "%010u", static_cast<unsigned int>(header.size() + 10 + end.size()));
+  header += offset + end;
+
+  std::fseek(m_FilePointer, 0, SEEK_SET);
+  if (std::fwrite(header.c_str(), 1, header.size(), m_FilePointer) != header.size())
+    mitkThrow() << "Error writing TCK header to " << m_Filename;
+}
+
+void mitk::FiberBundleStreamWriter::AddPoint(double x, double y, double z)
+{
+  if (m_Tck)
+  {
+    // MITK uses LPS, MRtrix RAS
+    m_Buffer.push_back(static_cast<float>(-x));
+    m_Buffer.push_back(static_cast<float>(-y));
+    m_Buffer.push_back(static_cast<float>(z));
+  }
+  else
+  {
+    // TRK coordinates are corner based, so we have to shift the center based coordinates by half a voxel
+    for (int r=0; r<3; ++r)
+      m_Buffer.push_back(static_cast<float>(m_WorldToTrk[r][0]*x + m_WorldToTrk[r][1]*y + m_WorldToTrk[r][2]*z + m_WorldToTrk[r][3]
+                         + m_TrackVisHeader.voxel_size[r]/2));
+  }
+}
+
+void mitk::FiberBundleStreamWriter::FlushFiber(int num_points)
+{
+  if (m_FilePointer==nullptr)
+    mitkThrow() << "Stream writer is not open!";
+  if (num_points<=0)
+    return;
+
+  if (m_Tck)
+  {
+    float nan = std::numeric_limits<float>::quiet_NaN();
+    m_Buffer.push_back(nan); m_Buffer.push_back(nan); m_Buffer.push_back(nan);
+  }
+  else if (std::fwrite(reinterpret_cast<char*>(&num_points), 1, 4, m_FilePointer) != 4)
+    mitkThrow() << "Error writing fiber to " << m_Filename;
+
+  if (std::fwrite(reinterpret_cast<char*>(m_Buffer.data()), sizeof(float), m_Buffer.size(), m_FilePointer) != m_Buffer.size())
+    mitkThrow() << "Error writing fiber to " << m_Filename;
+  ++m_NumFibers;
+}
+
+void mitk::FiberBundleStreamWriter::Close()
+{
+  if (m_FilePointer==nullptr)
+    return;
+
+  if (m_Tck)
+  {
+    float inf[3] = {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()};
+    std::fwrite(reinterpret_cast<char*>(inf), sizeof(float), 3, m_FilePointer);
+    WriteTckHeader();
+  }
+  else
+  {
+    int count = static_cast<int>(m_NumFibers);
+    std::fseek(m_FilePointer, 1000-12, SEEK_SET);
+    std::fwrite(reinterpret_cast<char*>(&count), 1, 4, m_FilePointer);
+  }
+
+  std::fclose(m_FilePointer);
+  m_FilePointer = nullptr;
+  MITK_INFO << "Wrote " << m_NumFibers << " fibers to " << m_Filename;
+}
@@ -0,0 +1,78 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#ifndef __mitkFiberBundleStreamWriter_h
+#define __mitkFiberBundleStreamWriter_h
+
+#include <mitkFiberBundle.h>
+#include <MitkFiberBundleExports.h>
+#include <vnl/vnl_matrix_fixed.h>
+#include <itkPoint.h>
+#include <cstdio>
+#include <string>
+
+namespace mitk
+{
+
+/**
+  * \brief Writes fibers to a .tck (MRtrix) or .trk (TrackVis) file one at a time, without assembling a FiberBundle
+  * in memory first. The fiber count in the header is updated in Close(). Not thread safe.
+  */
+class MITKFIBERBUNDLE_EXPORT FiberBundleStreamWriter
+{
+public:
+
+  FiberBundleStreamWriter();
+  ~FiberBundleStreamWriter();
+
+  /** Creates the file and writes the header. The format is selected by the file extension (.tck or .trk).
+   * The geometry is used for the TrackVis header and is ignored for .tck files. */
+  void Open(const std::string& filename, const mitk::BaseGeometry* geometry);
+
+  /** Appends one fiber. The points are in MITK world coordinates (LPS). */
+  template< class TContainer >
+  void WriteFiber(const TContainer& points)
+  {
+    m_Buffer.clear();
+    for (const auto& p : points)
+      AddPoint(p[0], p[1], p[2]);
+    FlushFiber(static_cast<int>(points.size()));
+  }
+
+  /** Writes the end of file marker (.tck) and the final fiber count. */
+  void Close();
+
+  bool IsOpen() const { return m_FilePointer!=nullptr; }
+  unsigned int GetNumFibers() const { return m_NumFibers; }
+
+protected:
+
+  void AddPoint(double x, double y, double z);
+  void FlushFiber(int num_points);
+  void WriteTckHeader();
+
+  std::FILE*                              m_FilePointer;
+  std::string                             m_Filename;
+  bool                                    m_Tck;
+  unsigned int                            m_NumFibers;
+  std::vector< float >                    m_Buffer;
+  mitk::FiberBundle::TrackVis_header      m_TrackVisHeader;
+  vnl_matrix_fixed< double, 4, 4 >        m_WorldToTrk;
+};
+
+}
+
+#endif
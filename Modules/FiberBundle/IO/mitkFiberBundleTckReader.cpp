@@ -33,6 +33,137 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include "mitkFiberBundleMimeTypes.h"
 #include <vtkTransformPolyDataFilter.h>
 #include <mitkLexicalCast.h>
+#include <mitkMappedFile.h>
+#include <vtkIdTypeArray.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <omp.h>
+
+namespace
+{
+  // number of float triplets scanned per parallel chunk
+  const std::size_t TCK_CHUNK_SIZE = 1 << 20;
+
+  struct TckChunk
+  {
+    std::size_t m_NumPoints = 0;
+    std::size_t m_NumDelimiters = 0;
+    bool        m_EndFound = false;
+  };
+
+  // 0: point, 1: streamline delimiter (NaN), 2: end of file (Inf)
+  inline int ClassifyTckTriplet(const float* p)
+  {
+    if (std::isinf(p[0]) || std::isinf(p[1]) || std::isinf(p[2]))
+      return 2;
+    if (std::isnan(p[0]) || std::isnan(p[1]) || std::isnan(p[2]))
+      return 1;
+    return 0;
+  }
+
+  /**
+   * Parses the float triplets following the header. A first parallel pass counts points and delimiters per chunk,
+   * a second pass writes points and cell offsets directly into the vtk arrays at the prefix sum positions.
+   * Coordinates are converted from RAS (MRtrix) to LPS (MITK) on the fly.
+   */
+  void ReadTckBody(const mitk::MappedFile& file, std::size_t offset, vtkPolyData* fiberPolyData)
+  {
+    const char* body = file.GetData() + offset;
+    const std::size_t num_triplets = (file.GetSize() - offset) / 12;
+    const std::size_t num_chunks = (num_triplets + TCK_CHUNK_SIZE - 1) / TCK_CHUNK_SIZE;
+
+    std::vector< TckChunk > chunks(num_chunks);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int c=0; c<static_cast<int>(num_chunks); ++c)
+    {
+      TckChunk& chunk = chunks[c];
+      std::size_t stop = std::min(num_triplets, (c+1)*TCK_CHUNK_SIZE);
+      for (std::size_t t=c*TCK_CHUNK_SIZE; t<stop; ++t)
+      {
+        float p[3];
+        std::memcpy(p, body + 12*t, 12);
+        int type = ClassifyTckTriplet(p);
+        if (type==2)
+        {
+          chunk.m_EndFound = true;
+          break;
+        }
+        if (type==1)
+          ++chunk.m_NumDelimiters;
+        else
+          ++chunk.m_NumPoints;
+      }
+    }
+
+    // everything after the first Inf triplet is ignored
+    std::size_t used_chunks = 0;
+    std::vector< std::size_t > point_offsets(1, 0);
+    std::vector< std::size_t > cell_offsets(1, 0);
+    while (used_chunks<num_chunks)
+    {
+      point_offsets.push_back(point_offsets.back() + chunks[used_chunks].m_NumPoints);
+      cell_offsets.push_back(cell_offsets.back() + chunks[used_chunks].m_NumDelimiters);
+      if (chunks[used_chunks++].m_EndFound)
+        break;
+    }
+    const std::size_t num_points = point_offsets.back();
+    const std::size_t num_cells = cell_offsets.back();
+
+    vtkSmartPointer<vtkFloatArray> coordinates = vtkSmartPointer<vtkFloatArray>::New();
+    coordinates->SetNumberOfComponents(3);
+    coordinates->SetNumberOfTuples(static_cast<vtkIdType>(num_points));
+    vtkSmartPointer<vtkIdTypeArray> offsets = vtkSmartPointer<vtkIdTypeArray>::New();
+    offsets->SetNumberOfValues(static_cast<vtkIdType>(num_cells+1));
+    float* point_buffer = coordinates->GetPointer(0);
+    vtkIdType* offset_buffer = offsets->GetPointer(0);
+    offset_buffer[0] = 0;
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int c=0; c<static_cast<int>(used_chunks); ++c)
+    {
+      std::size_t point = point_offsets[c];
+      std::size_t cell = cell_offsets[c];
+      std::size_t stop = std::min(num_triplets, (c+1)*TCK_CHUNK_SIZE);
+      for (std::size_t t=c*TCK_CHUNK_SIZE; t<stop; ++t)
+      {
+        float p[3];
+        std::memcpy(p, body + 12*t, 12);
+        int type = ClassifyTckTriplet(p);
+        if (type==2)
+          break;
+        if (type==1)
+          offset_buffer[++cell] = static_cast<vtkIdType>(point);
+        else
+        {
+          point_buffer[3*point] = -p[0];
+          point_buffer[3*point+1] = -p[1];
+          point_buffer[3*point+2] = p[2];
+          ++point;
+        }
+      }
+    }
+
+    // points are stored streamline by streamline, so the connectivity is the identity. Points after the last
+    // delimiter do not belong to a streamline.
+    const std::size_t num_ids = static_cast<std::size_t>(offset_buffer[num_cells]);
+    vtkSmartPointer<vtkIdTypeArray> connectivity = vtkSmartPointer<vtkIdTypeArray>::New();
+    connectivity->SetNumberOfValues(static_cast<vtkIdType>(num_ids));
+    vtkIdType* id_buffer = connectivity->GetPointer(0);
+#pragma omp parallel for
+    for (long long i=0; i<static_cast<long long>(num_ids); ++i)
+      id_buffer[i] = static_cast<vtkIdType>(i);
+
+    vtkSmartPointer<vtkPoints> vtkNewPoints = vtkSmartPointer<vtkPoints>::New();
+    vtkNewPoints->SetData(coordinates);
+    vtkSmartPointer<vtkCellArray> vtkNewCells = vtkSmartPointer<vtkCellArray>::New();
+    vtkNewCells->SetData(offsets, connectivity);
+
+    fiberPolyData->SetPoints(vtkNewPoints);
+    fiberPolyData->SetLines(vtkNewCells);
+    MITK_INFO << "Read " << num_cells << " streamlines with " << num_points << " points using " << omp_get_max_threads() << " threads";
+  }
+}
 
 
 mitk::FiberBundleTckReader::FiberBundleTckReader()
@@ -69,19 +200,15 @@ std::vector<itk::SmartPointer<mitk::BaseData> > mitk::FiberBundleTckReader::DoRe
     if (ext==".tck")
     {
       MITK_INFO << "Loading tractogram (MRtrix format): " << itksys::SystemTools::GetFilenameName(filename);
-      std::FILE* filePointer = std::fopen(filename.c_str(),"r+b");
-      std::string header = "";
-
-      bool header_end = false;
-      int count = 0;
-      while (!header_end)
-      {
-        char c;
-        count += std::fread(&c, 1, 1, filePointer);
-        header += c;
-        if (header.size() >= 3 && header.compare(header.size() - 3, 3, "END") == 0)
-          header_end = true;
-      }
+      MappedFile file;
+      file.Open(filename);
+      const char* data = file.GetData();
+
+      const char* end_tag = "END";
+      const char* header_end = std::search(data, data + file.GetSize(), end_tag, end_tag + 3);
+      if (header_end == data + file.GetSize())
+        mitkThrow() << "Could not find end of header in " << filename;
+      std::string header(data, header_end + 3);
       MITK_INFO << "TCK Header:";
       MITK_INFO << header;
 
@@ -100,54 +227,12 @@ std::vector<itk::SmartPointer<mitk::BaseData> > mitk::FiberBundleTckReader::DoRe
 
       }
 
-      if (header_size==-1)
+      if (header_size==-1 || static_cast<std::size_t>(header_size) > file.GetSize())
         mitkThrow() << "Could not parse header size from " << filename;
-      std::fseek ( filePointer , header_size , SEEK_SET );
-
-      vtkSmartPointer<vtkPoints> vtkNewPoints = vtkSmartPointer<vtkPoints>::New();
-      vtkSmartPointer<vtkCellArray> vtkNewCells = vtkSmartPointer<vtkCellArray>::New();
-      vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
-
-      float tmp[3];
-      count = 1;
-      int fiber_length = 0;
-      while (std::fread((char*)tmp, 1, 12, filePointer)==12)
-      {
-        if (std::isinf(tmp[0]) || std::isinf(tmp[1]) || std::isinf(tmp[1]))
-          break;
-        else if (std::isnan(tmp[0]) || std::isnan(tmp[1]) || std::isnan(tmp[2]))
-        {
-          count++;
-          fiber_length = 0;
-          vtkNewCells->InsertNextCell(container);
-          container = vtkSmartPointer<vtkPolyLine>::New();
-        }
-        else
-        {
-          fiber_length++;
-          vtkIdType id = vtkNewPoints->InsertNextPoint(tmp);
-          container->GetPointIds()->InsertNextId(id);
-        }
-      }
 
       vtkSmartPointer<vtkPolyData> fiberPolyData = vtkSmartPointer<vtkPolyData>::New();
-      fiberPolyData->SetPoints(vtkNewPoints);
-      fiberPolyData->SetLines(vtkNewCells);
-
-      // transform polydata from RAS (MRtrix) to LPS (MITK)
-      mitk::Geometry3D::Pointer geometry = mitk::Geometry3D::New();
-      vtkSmartPointer< vtkMatrix4x4 > matrix = vtkSmartPointer< vtkMatrix4x4 >::New();
-      matrix->Identity();
-      matrix->SetElement(0,0,-matrix->GetElement(0,0));
-      matrix->SetElement(1,1,-matrix->GetElement(1,1));
-      geometry->SetIndexToWorldTransformByVtkMatrix(matrix);
-
-      vtkSmartPointer<vtkTransformPolyDataFilter> transformFilter = vtkSmartPointer<vtkTransformPolyDataFilter>::New();
-      transformFilter->SetInputData(fiberPolyData);
-      transformFilter->SetTransform(geometry->GetVtkTransform());
-      transformFilter->Update();
-
-      FiberBundle::Pointer fib = FiberBundle::New(transformFilter->GetOutput());
+      ReadTckBody(file, header_size, fiberPolyData);
+      FiberBundle::Pointer fib = FiberBundle::New(fiberPolyData);
       result.push_back(fib.GetPointer());
     }
 
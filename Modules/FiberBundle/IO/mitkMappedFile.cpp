@@ -0,0 +1,141 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#include "mitkMappedFile.h"
+#include <mitkExceptionMacro.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+mitk::MappedFile::MappedFile()
+  : m_Data(nullptr)
+  , m_Size(0)
+  , m_FileHandle(INVALID_HANDLE_VALUE)
+  , m_MappingHandle(nullptr)
+{
+}
+
+void mitk::MappedFile::Open(const std::string& filename)
+{
+  this->Close();
+
+  m_FileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (m_FileHandle==INVALID_HANDLE_VALUE)
+    mitkThrow() << "Unable to open file " << filename;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(m_FileHandle, &size))
+  {
+    this->Close();
+    mitkThrow() << "Unable to determine size of file " << filename;
+  }
+  m_Size = static_cast<std::size_t>(size.QuadPart);
+  if (m_Size==0)
+    return;
+
+  m_MappingHandle = CreateFileMappingA(m_FileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (m_MappingHandle==nullptr)
+  {
+    this->Close();
+    mitkThrow() << "Unable to map file " << filename;
+  }
+
+  m_Data = static_cast<const char*>(MapViewOfFile(m_MappingHandle, FILE_MAP_READ, 0, 0, 0));
+  if (m_Data==nullptr)
+  {
+    this->Close();
+    mitkThrow() << "Unable to map file " << filename;
+  }
+}
+
+void mitk::MappedFile::Close()
+{
+  if (m_Data!=nullptr)
+    UnmapViewOfFile(m_Data);
+  if (m_MappingHandle!=nullptr)
+    CloseHandle(m_MappingHandle);
+  if (m_FileHandle!=INVALID_HANDLE_VALUE)
+    CloseHandle(m_FileHandle);
+  m_Data = nullptr;
+  m_Size = 0;
+  m_MappingHandle = nullptr;
+  m_FileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+mitk::MappedFile::MappedFile()
+  : m_Data(nullptr)
+  , m_Size(0)
+  , m_FileDescriptor(-1)
+{
+}
+
+void mitk::MappedFile::Open(const std::string& filename)
+{
+  this->Close();
+
+  m_FileDescriptor = open(filename.c_str(), O_RDONLY);
+  if (m_FileDescriptor<0)
+    mitkThrow() << "Unable to open file " << filename;
+
+  struct stat info;
+  if (fstat(m_FileDescriptor, &info)!=0)
+  {
+    this->Close();
+    mitkThrow() << "Unable to determine size of file " << filename;
+  }
+  m_Size = static_cast<std::size_t>(info.st_size);
+  if (m_Size==0)
+    return;
+
+  void* data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_FileDescriptor, 0);
+  if (data==MAP_FAILED)
+  {
+    this->Close();
+    mitkThrow() << "Unable to map file " << filename;
+  }
+  m_Data = static_cast<const char*>(data);
+
+  // the readers touch every page exactly once
+  madvise(data, m_Size, MADV_SEQUENTIAL);
+}
+
+void mitk::MappedFile::Close()
+{
+  if (m_Data!=nullptr)
+    munmap(const_cast<char*>(m_Data), m_Size);
+  if (m_FileDescriptor>=0)
+    close(m_FileDescriptor);
+  m_Data = nullptr;
+  m_Size = 0;
+  m_FileDescriptor = -1;
+}
+
+#endif
+
+mitk::MappedFile::~MappedFile()
+{
+  this->Close();
+}
@@ -0,0 +1,75 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#ifndef __mitkMappedFile_h
+#define __mitkMappedFile_h
+
+#include <MitkFiberBundleExports.h>
+#include <string>
+#include <cstddef>
+#include <cstring>
+
+namespace mitk
+{
+
+/**
+  * \brief Read-only memory mapping of a complete file (mmap on POSIX systems, CreateFileMapping on Windows).
+  *
+  * Used by the tractogram readers to parse large binary files without copying them through stdio buffers.
+  * The mapping is released in the destructor. Mapped data is not necessarily aligned, use Read() to
+  * extract typed values.
+  */
+class MITKFIBERBUNDLE_EXPORT MappedFile
+{
+public:
+
+  MappedFile();
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  /** Maps the file. Throws an mitk::Exception if the file can not be opened or mapped. */
+  void Open(const std::string& filename);
+  void Close();
+
+  const char* GetData() const { return m_Data; }
+  std::size_t GetSize() const { return m_Size; }
+
+  /** Copies sizeof(T) bytes at the given byte offset into a value of type T. */
+  template< class T >
+  T Read(std::size_t offset) const
+  {
+    T value;
+    std::memcpy(&value, m_Data + offset, sizeof(T));
+    return value;
+  }
+
+private:
+
+  const char*   m_Data;
+  std::size_t   m_Size;
+#ifdef _WIN32
+  void*         m_FileHandle;
+  void*         m_MappingHandle;
+#else
+  int           m_FileDescriptor;
+#endif
+};
+
+}
+
+#endif // __mitkMappedFile_h
@@ -1,5 +1,11 @@
 #include <mitkTrackvis.h>
+#include <mitkMappedFile.h>
 #include <vtkTransformPolyDataFilter.h>
+#include <vtkFloatArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkLinearTransform.h>
+#include <algorithm>
+#include <cstring>
 
 TrackVisFiberReader::TrackVisFiberReader()  { m_Filename = ""; m_FilePointer = nullptr; }
 
@@ -169,41 +175,9 @@ void TrackVisFiberReader::print_header()
 
 short TrackVisFiberReader::read( mitk::FiberBundle* fib, bool use_matrix, bool flip_x, bool flip_y, bool flip_z, bool print_header)
 {
-  int numPoints;
-  vtkSmartPointer<vtkPoints> vtkNewPoints = vtkSmartPointer<vtkPoints>::New();
-  vtkSmartPointer<vtkCellArray> vtkNewCells = vtkSmartPointer<vtkCellArray>::New();
   if (print_header)
     this->print_header();
 
-  while (fread((char*)&numPoints, 1, 4, m_FilePointer)==4)
-  {
-    if ( numPoints <= 0 )
-    {
-      printf( "[ERROR] Trying to read a fiber with %d points!\n", numPoints );
-      return -1;
-    }
-    vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
-
-    float tmp[3];
-    for(int i=0; i<numPoints; i++)
-    {
-      if (fread((char*)tmp, 1, 12, m_FilePointer) == 0)
-        MITK_ERROR << "TrackVis::read: Error during read.";
-
-      // TRK coordinates are corner based, so we have to shift them back to center based coordinates
-      tmp[0] -= m_Header.voxel_size[0]/2;
-      tmp[1] -= m_Header.voxel_size[1]/2;
-      tmp[2] -= m_Header.voxel_size[2]/2;
-      vtkIdType id = vtkNewPoints->InsertNextPoint(tmp);
-      container->GetPointIds()->InsertNextId(id);
-    }
-    vtkNewCells->InsertNextCell(container);
-  }
-
-  vtkSmartPointer<vtkPolyData> fiberPolyData = vtkSmartPointer<vtkPolyData>::New();
-  fiberPolyData->SetPoints(vtkNewPoints);
-  fiberPolyData->SetLines(vtkNewCells);
-
   mitk::Geometry3D::Pointer geometry = mitk::Geometry3D::New();
   vtkSmartPointer< vtkMatrix4x4 > matrix = vtkSmartPointer< vtkMatrix4x4 >::New();
   matrix->Identity();
@@ -265,11 +239,94 @@ short TrackVisFiberReader::read( mitk::FiberBundle* fib, bool use_matrix, bool f
   }
   geometry->SetIndexToWorldTransformByVtkMatrix(matrix);
 
-  vtkSmartPointer<vtkTransformPolyDataFilter> transformFilter = vtkSmartPointer<vtkTransformPolyDataFilter>::New();
-  transformFilter->SetInputData(fiberPolyData);
-  transformFilter->SetTransform(geometry->GetVtkTransform());
-  transformFilter->Update();
-  fib->SetFiberPolyData(transformFilter->GetOutput());
+  mitk::MappedFile file;
+  file.Open(m_Filename);
+
+  // locate all fibers in one pass over the point counts
+  const std::size_t point_stride = 12 + 4*static_cast<std::size_t>(std::max<short>(m_Header.n_scalars, 0));
+  const std::size_t property_size = 4*static_cast<std::size_t>(std::max<short>(m_Header.n_properties, 0));
+  std::vector< std::size_t > fiber_positions;
+  std::vector< vtkIdType > cell_offsets(1, 0);
+  if (m_Header.n_count>0)
+  {
+    fiber_positions.reserve(m_Header.n_count);
+    cell_offsets.reserve(m_Header.n_count+1);
+  }
+
+  int numPoints = 0;
+  std::size_t pos = 1000;
+  while (pos+4<=file.GetSize())
+  {
+    numPoints = file.Read<int>(pos);
+    if ( numPoints <= 0 )
+    {
+      printf( "[ERROR] Trying to read a fiber with %d points!\n", numPoints );
+      return -1;
+    }
+    std::size_t next = pos + 4 + numPoints*point_stride + property_size;
+    if (next>file.GetSize())
+    {
+      MITK_ERROR << "TrackVis::read: Error during read. File ends within fiber " << fiber_positions.size();
+      break;
+    }
+    fiber_positions.push_back(pos + 4);
+    cell_offsets.push_back(cell_offsets.back() + numPoints);
+    pos = next;
+  }
+
+  const vtkIdType num_fibers = static_cast<vtkIdType>(fiber_positions.size());
+  const vtkIdType num_points = cell_offsets.back();
+
+  vtkSmartPointer<vtkFloatArray> coordinates = vtkSmartPointer<vtkFloatArray>::New();
+  coordinates->SetNumberOfComponents(3);
+  coordinates->SetNumberOfTuples(num_points);
+  vtkSmartPointer<vtkIdTypeArray> offsets = vtkSmartPointer<vtkIdTypeArray>::New();
+  offsets->SetNumberOfValues(num_fibers+1);
+  vtkSmartPointer<vtkIdTypeArray> connectivity = vtkSmartPointer<vtkIdTypeArray>::New();
+  connectivity->SetNumberOfValues(num_points);
+  float* point_buffer = coordinates->GetPointer(0);
+  vtkIdType* id_buffer = connectivity->GetPointer(0);
+  std::copy(cell_offsets.begin(), cell_offsets.end(), offsets->GetPointer(0));
+
+  // Apply the index to world transform while copying. Same arithmetic as vtkLinearTransform::TransformPoints,
+  // so the result is identical to transforming the polydata afterwards.
+  double m[3][4];
+  vtkMatrix4x4* transform = geometry->GetVtkTransform()->GetMatrix();
+  for (int i=0; i<3; ++i)
+    for (int j=0; j<4; ++j)
+      m[i][j] = transform->GetElement(i, j);
+
+  const float half_voxel[3] = {m_Header.voxel_size[0]/2, m_Header.voxel_size[1]/2, m_Header.voxel_size[2]/2};
+  const char* data = file.GetData();
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (int f=0; f<static_cast<int>(num_fibers); ++f)
+  {
+    const char* record = data + fiber_positions[f];
+    for (vtkIdType id=cell_offsets[f]; id<cell_offsets[f+1]; ++id)
+    {
+      float tmp[3];
+      std::memcpy(tmp, record, 12);
+      record += point_stride;
+
+      // TRK coordinates are corner based, so we have to shift them back to center based coordinates
+      tmp[0] -= half_voxel[0];
+      tmp[1] -= half_voxel[1];
+      tmp[2] -= half_voxel[2];
+      for (int i=0; i<3; ++i)
+        point_buffer[3*id+i] = static_cast<float>(m[i][0]*tmp[0] + m[i][1]*tmp[1] + m[i][2]*tmp[2] + m[i][3]);
+      id_buffer[id] = id;
+    }
+  }
+
+  vtkSmartPointer<vtkPoints> vtkNewPoints = vtkSmartPointer<vtkPoints>::New();
+  vtkNewPoints->SetData(coordinates);
+  vtkSmartPointer<vtkCellArray> vtkNewCells = vtkSmartPointer<vtkCellArray>::New();
+  vtkNewCells->SetData(offsets, connectivity);
+
+  vtkSmartPointer<vtkPolyData> fiberPolyData = vtkSmartPointer<vtkPolyData>::New();
+  fiberPolyData->SetPoints(vtkNewPoints);
+  fiberPolyData->SetLines(vtkNewCells);
+  fib->SetFiberPolyData(fiberPolyData);
   fib->SetTrackVisHeader(geometry.GetPointer());
   fib->SetTrackVisHeader(m_Header);
 
@@ -20,6 +20,11 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <itksys/SystemTools.hxx>
 #include <mitkTestingConfig.h>
 #include <mitkIOUtil.h>
+#include <mitkFiberBundleStreamWriter.h>
+#include <itkTimeProbe.h>
+#include <vtkPolyLine.h>
+#include <cstdlib>
+#include <cmath>
 
 #include "mitkTestFixture.h"
 
@@ -28,6 +33,10 @@ class mitkFiberBundleReaderWriterTestSuite : public mitk::TestFixture
 
   CPPUNIT_TEST_SUITE(mitkFiberBundleReaderWriterTestSuite);
   MITK_TEST(Equal_SaveLoad_ReturnsTrue);
+  MITK_TEST(Equal_StreamWriteLoadTck_ReturnsTrue);
+  MITK_TEST(Equal_SaveLoadTrk_ReturnsTrue);
+  MITK_TEST(Equal_LoadSyntheticTck_MatchesReference);
+  MITK_TEST(Benchmark_LoadSyntheticTck);
   CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -36,6 +45,76 @@ private:
   mitk::FiberBundle::Pointer fib1;
   mitk::FiberBundle::Pointer fib2;
 
+  /** Per point reference implementation of the TCK body parser, used to validate and benchmark the mapped reader. */
+  mitk::FiberBundle::Pointer LoadTckReference(const std::string& filename)
+  {
+    std::FILE* filePointer = std::fopen(filename.c_str(),"rb");
+    std::string header = "";
+    while (header.size()<3 || header.compare(header.size() - 3, 3, "END") != 0)
+    {
+      char c;
+      if (std::fread(&c, 1, 1, filePointer)!=1)
+        break;
+      header += c;
+    }
+    std::string delimiter = "file: . ";
+    header.erase(0, header.find(delimiter) + delimiter.length());
+    std::fseek(filePointer, std::stol(header.substr(0, header.find("\n"))), SEEK_SET);
+
+    vtkSmartPointer<vtkPoints> vtkNewPoints = vtkSmartPointer<vtkPoints>::New();
+    vtkSmartPointer<vtkCellArray> vtkNewCells = vtkSmartPointer<vtkCellArray>::New();
+    vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
+    float tmp[3];
+    while (std::fread((char*)tmp, 1, 12, filePointer)==12)
+    {
+      if (std::isinf(tmp[0]) || std::isinf(tmp[1]) || std::isinf(tmp[2]))
+        break;
+      else if (std::isnan(tmp[0]) || std::isnan(tmp[1]) || std::isnan(tmp[2]))
+      {
+        vtkNewCells->InsertNextCell(container);
+        container = vtkSmartPointer<vtkPolyLine>::New();
+      }
+      else
+      {
+        tmp[0] = -tmp[0];
+        tmp[1] = -tmp[1];
+        vtkIdType id = vtkNewPoints->InsertNextPoint(tmp);
+        container->GetPointIds()->InsertNextId(id);
+      }
+    }
+    std::fclose(filePointer);
+
+    vtkSmartPointer<vtkPolyData> fiberPolyData = vtkSmartPointer<vtkPolyData>::New();
+    fiberPolyData->SetPoints(vtkNewPoints);
+    fiberPolyData->SetLines(vtkNewCells);
+    return mitk::FiberBundle::New(fiberPolyData);
+  }
+
+  /** Writes a tractogram of random length helices with about num_triplets points and fiber delimiters. */
+  void WriteSyntheticTck(const std::string& filename, std::size_t num_triplets)
+  {
+    mitk::FiberBundleStreamWriter writer;
+    writer.Open(filename, nullptr);
+    std::srand(0);
+    std::size_t written = 0;
+    unsigned int f = 0;
+    while (written<num_triplets)
+    {
+      unsigned int num_points = 20 + static_cast<unsigned int>(std::rand()%180);
+      std::vector< itk::Point<float, 3> > points(num_points);
+      for (unsigned int j=0; j<num_points; ++j)
+      {
+        points[j][0] = 50*std::cos(0.01f*j + f);
+        points[j][1] = 50*std::sin(0.01f*j + f);
+        points[j][2] = 0.5f*j - 50;
+      }
+      writer.WriteFiber(points);
+      written += num_points + 1;
+      ++f;
+    }
+    writer.Close();
+  }
+
 public:
 
   void setUp() override
@@ -66,6 +145,81 @@ public:
     //MITK_ASSERT_EQUAL(fib1, fib2, "A saved and re-loaded file should be equal");
   }
 
+  void Equal_StreamWriteLoadTck_ReturnsTrue()
+  {
+    std::string filename = std::string(MITK_TEST_OUTPUT_DIR)+"/streamWriterTest.tck";
+    mitk::FiberBundleStreamWriter writer;
+    writer.Open(filename, fib1->GetGeometry());
+    for (unsigned int i=0; i<fib1->GetNumFibers(); ++i)
+    {
+      vtkCell* cell = fib1->GetFiberPolyData()->GetCell(i);
+      std::vector< itk::Point<float, 3> > points;
+      for (int j=0; j<cell->GetNumberOfPoints(); ++j)
+        points.push_back(mitk::imv::GetItkPoint(cell->GetPoints()->GetPoint(j)));
+      writer.WriteFiber(points);
+    }
+    writer.Close();
+
+    fib2 = mitk::IOUtil::Load<mitk::FiberBundle>(filename);
+    CPPUNIT_ASSERT_MESSAGE("Should be equal", fib1->Equals(fib2));
+  }
+
+  void Equal_SaveLoadTrk_ReturnsTrue()
+  {
+    mitk::IOUtil::Save(fib1.GetPointer(), std::string(MITK_TEST_OUTPUT_DIR)+"/writerTest.trk");
+    fib2 = mitk::IOUtil::Load<mitk::FiberBundle>(std::string(MITK_TEST_OUTPUT_DIR)+"/writerTest.trk");
+    CPPUNIT_ASSERT_MESSAGE("Should be equal", fib1->Equals(fib2));
+  }
+
+  /** Writes a small synthetic tractogram (about 4 MB) and compares the output of the mapped TCK reader against the per point reference parser. */
+  void Equal_LoadSyntheticTck_MatchesReference()
+  {
+    std::string filename = std::string(MITK_TEST_OUTPUT_DIR)+"/synthetic.tck";
+    std::size_t num_triplets = 4*1024*1024/12;
+    WriteSyntheticTck(filename, num_triplets);
+
+    mitk::FiberBundle::Pointer reference = LoadTckReference(filename);
+    fib2 = mitk::IOUtil::Load<mitk::FiberBundle>(filename);
+    itksys::SystemTools::RemoveFile(filename);
+    CPPUNIT_ASSERT_MESSAGE("Should be equal", reference->Equals(fib2, 0.000001));
+  }
+
+  /**
+   * Compares the load time of the mapped TCK reader and the per point reference parser on a synthetic multi-GB
+   * tractogram. Only runs if the environment variable MITK_RUN_BENCHMARKS is set. The file size in GB can be set via
+   * MITK_FIBER_IO_BENCHMARK_GB (default 4).
+   */
+  void Benchmark_LoadSyntheticTck()
+  {
+    if (std::getenv("MITK_RUN_BENCHMARKS")==nullptr)
+    {
+      MITK_INFO << "Skipping TCK load benchmark, set MITK_RUN_BENCHMARKS to run it";
+      return;
+    }
+
+    double size_gb = 4;
+    if (const char* env = std::getenv("MITK_FIBER_IO_BENCHMARK_GB"))
+      size_gb = std::atof(env);
+
+    std::string filename = std::string(MITK_TEST_OUTPUT_DIR)+"/benchmark.tck";
+    WriteSyntheticTck(filename, static_cast<std::size_t>(size_gb*1024*1024*1024/12));
+
+    itk::TimeProbe clock;
+    clock.Start();
+    mitk::FiberBundle::Pointer reference = LoadTckReference(filename);
+    clock.Stop();
+    double reference_time = clock.GetTotal();
+
+    itk::TimeProbe clock2;
+    clock2.Start();
+    fib2 = mitk::IOUtil::Load<mitk::FiberBundle>(filename);
+    clock2.Stop();
+
+    MITK_INFO << "Load time for " << size_gb << " GB TCK file (" << reference->GetNumFibers() << " fibers): per point reference " << reference_time << "s, mapped reader " << clock2.GetTotal() << "s";
+    itksys::SystemTools::RemoveFile(filename);
+    CPPUNIT_ASSERT_MESSAGE("Should be equal", reference->Equals(fib2, 0.000001));
+  }
+
 };
 
 MITK_TEST_SUITE_REGISTRATION(mitkFiberBundleReaderWriter)
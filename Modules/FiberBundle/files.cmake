@@ -7,15 +7,18 @@ set(H_FILES
 
 
   mitkFiberBundle.h
+  mitkFiberEndpointIndex.h
 
   IO/mitkFiberBundleObjectFactory.h
   IO/mitkFiberBundleMimeTypes.h
   IO/mitkFiberBundleIOHelper.h
+  IO/mitkMappedFile.h
 
   IO/mitkTrackvis.h
   IO/mitkFiberBundleDicomReader.h
   IO/mitkFiberBundleDicomWriter.h
   IO/mitkFiberBundleTckReader.h
+  IO/mitkFiberBundleStreamWriter.h
   IO/mitkFiberBundleTrackVisReader.h
   IO/mitkFiberBundleTrackVisWriter.h
   IO/mitkFiberBundleVtkReader.h
@@ -34,16 +37,19 @@ set(CPP_FILES
   IO/mitkPlanarFigureCompositeSerializer.cpp
 
   mitkFiberBundle.cpp
+  mitkFiberEndpointIndex.cpp
 
   IO/mitkFiberBundleServiceActivator.cpp
   IO/mitkFiberBundleMimeTypes.cpp
   IO/mitkFiberBundleObjectFactory.cpp
   IO/mitkFiberBundleIOHelper.cpp
+  IO/mitkMappedFile.cpp
 
   IO/mitkTrackvis.cpp
   IO/mitkFiberBundleDicomReader.cpp
   IO/mitkFiberBundleDicomWriter.cpp
   IO/mitkFiberBundleTckReader.cpp
+  IO/mitkFiberBundleStreamWriter.cpp
   IO/mitkFiberBundleTrackVisReader.cpp
   IO/mitkFiberBundleTrackVisWriter.cpp
   IO/mitkFiberBundleVtkReader.cpp
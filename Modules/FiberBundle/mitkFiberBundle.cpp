@@ -15,6 +15,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 ===================================================================*/
 
 #include "mitkFiberBundle.h"
+#include "mitkFiberEndpointIndex.h"
 
 #include <mitkPlanarCircle.h>
 #include <mitkPlanarPolygon.h>
@@ -52,6 +53,8 @@ const char* mitk::FiberBundle::FIBER_ID_ARRAY = "Fiber_IDs";
 mitk::FiberBundle::FiberBundle( vtkPolyData* fiberPolyData )
   : m_NumFibers(0)
   , m_IsRAS(false)
+  , m_FiberPointViewSource(nullptr)
+  , m_FiberPointViewTime(0)
 {
   m_TrackVisHeader.hdr_size = 0;
   m_FiberWeights = vtkSmartPointer<vtkFloatArray>::New();
@@ -124,8 +127,34 @@ vtkSmartPointer<vtkPolyData> mitk::FiberBundle::GeneratePolyDataByIds(std::vecto
 }
 
 // merge two fiber bundles
-mitk::FiberBundle::Pointer mitk::FiberBundle::AddBundles(std::vector< mitk::FiberBundle::Pointer > fibs)
+mitk::FiberBundle::Pointer mitk::FiberBundle::AddBundles(std::vector< mitk::FiberBundle::Pointer > fibs, bool remove_duplicates)
 {
+  // flag fibers that have the same endpoints as a fiber occurring earlier in the merged bundle
+  std::vector< unsigned char > duplicate;
+  if (remove_duplicates)
+  {
+    const float max_dist = 0.000001f;
+    mitk::FiberEndpointIndex index(std::sqrt(2*max_dist));
+    unsigned int offset = 0;
+    index.AddFibers(m_FiberPolyData, offset);
+    offset += this->GetNumFibers();
+    for (auto fib : fibs)
+    {
+      index.AddFibers(fib->GetFiberPolyData(), offset);
+      offset += fib->GetNumFibers();
+    }
+    index.Build();
+
+    duplicate.resize(offset, 0);
+#pragma omp parallel for
+    for (int i=0; i<static_cast<int>(index.GetNumberOfFibers()); i++)
+    {
+      auto k = static_cast<unsigned int>(i);
+      if (index.FindEndpointMatch(index.GetStart(k), index.GetEnd(k), max_dist, k)>=0)
+        duplicate[index.GetFiberId(k)] = 1;
+    }
+  }
+
   vtkSmartPointer<vtkPolyData> vNewPolyData = vtkSmartPointer<vtkPolyData>::New();
   vtkSmartPointer<vtkCellArray> vNewLines = vtkSmartPointer<vtkCellArray>::New();
   vtkSmartPointer<vtkPoints> vNewPoints = vtkSmartPointer<vtkPoints>::New();
@@ -136,11 +165,16 @@ mitk::FiberBundle::Pointer mitk::FiberBundle::AddBundles(std::vector< mitk::Fibe
   auto num_weights = this->GetNumFibers();
   for (auto fib : fibs)
     num_weights += fib->GetNumFibers();
+  if (remove_duplicates)
+    num_weights -= static_cast<unsigned int>(std::count(duplicate.begin(), duplicate.end(), 1));
   weights->SetNumberOfValues(num_weights);
 
   unsigned int counter = 0;
-  for (unsigned int i=0; i<m_FiberPolyData->GetNumberOfCells(); ++i)
+  unsigned int global_id = 0;
+  for (unsigned int i=0; i<m_FiberPolyData->GetNumberOfCells(); ++i, ++global_id)
   {
+    if (remove_duplicates && duplicate[global_id])
+      continue;
     vtkCell* cell = m_FiberPolyData->GetCell(i);
     auto numPoints = cell->GetNumberOfPoints();
     vtkPoints* points = cell->GetPoints();
@@ -162,8 +196,10 @@ mitk::FiberBundle::Pointer mitk::FiberBundle::AddBundles(std::vector< mitk::Fibe
   for (auto fib : fibs)
   {
     // add new fiber bundle
-    for (unsigned int i=0; i<fib->GetFiberPolyData()->GetNumberOfCells(); i++)
+    for (unsigned int i=0; i<fib->GetFiberPolyData()->GetNumberOfCells(); i++, ++global_id)
     {
+      if (remove_duplicates && duplicate[global_id])
+        continue;
       vtkCell* cell = fib->GetFiberPolyData()->GetCell(i);
       auto numPoints = cell->GetNumberOfPoints();
       vtkPoints* points = cell->GetPoints();
@@ -373,96 +409,29 @@ mitk::FiberBundle::Pointer mitk::FiberBundle::SubtractBundle(mitk::FiberBundle*
   vtkSmartPointer<vtkCellArray> vNewLines = vtkSmartPointer<vtkCellArray>::New();
   vtkSmartPointer<vtkPoints> vNewPoints = vtkSmartPointer<vtkPoints>::New();
 
-  std::vector< std::vector< itk::Point<float, 3> > > points1;
-  for(unsigned int i=0; i<m_NumFibers; i++ )
-  {
-    vtkCell* cell = m_FiberPolyData->GetCell(i);
-    auto numPoints = cell->GetNumberOfPoints();
-    vtkPoints* points = cell->GetPoints();
-
-    if (points==nullptr || numPoints<=0)
-      continue;
-
-    itk::Point<float, 3> start = mitk::imv::GetItkPoint(points->GetPoint(0));
-    itk::Point<float, 3> end = mitk::imv::GetItkPoint(points->GetPoint(numPoints-1));
-
-    points1.push_back( {start, end} );
-  }
-
-  std::vector< std::vector< itk::Point<float, 3> > > points2;
-  for(unsigned int i=0; i<fib->GetNumFibers(); i++ )
-  {
-    vtkCell* cell = fib->GetFiberPolyData()->GetCell(i);
-    auto numPoints = cell->GetNumberOfPoints();
-    vtkPoints* points = cell->GetPoints();
-
-    if (points==nullptr || numPoints<=0)
-      continue;
+  // two fibers match if the mean squared distance of their endpoints is below this threshold
+  const float max_dist = 0.000001f;
+  mitk::FiberEndpointIndex index(std::sqrt(2*max_dist));
+  index.AddFibers(fib->GetFiberPolyData());
+  index.Build();
 
-    itk::Point<float, 3> start =mitk::imv::GetItkPoint(points->GetPoint(0));
-    itk::Point<float, 3> end =mitk::imv::GetItkPoint(points->GetPoint(numPoints-1));
-
-    points2.push_back( {start, end} );
-  }
+  mitk::FiberEndpointIndex own(std::sqrt(2*max_dist));
+  own.AddFibers(m_FiberPolyData);
 
-  //  int progress = 0;
-  std::vector< int > ids;
+  std::vector< unsigned char > keep(own.GetNumberOfFibers(), 0);
 #pragma omp parallel for
-  for (int i=0; i<static_cast<int>(points1.size()); i++)
+  for (int i=0; i<static_cast<int>(own.GetNumberOfFibers()); i++)
   {
-    bool match = false;
-    for (unsigned int j=0; j<points2.size(); j++)
-    {
-      auto v1 = points1.at(static_cast<unsigned int>(i));
-      auto v2 = points2.at(j);
-
-      float dist=0;
-      for (unsigned int c=0; c<v1.size(); c++)
-      {
-        float d = v1[c][0]-v2[c][0];
-        dist += d*d;
-
-        d = v1[c][1]-v2[c][1];
-        dist += d*d;
-
-        d = v1[c][2]-v2[c][2];
-        dist += d*d;
-      }
-      dist /= v1.size();
-
-      if (dist<0.000001f)
-      {
-        match = true;
-        break;
-      }
-
-      dist=0;
-      for (unsigned int c=0; c<v1.size(); c++)
-      {
-        float d = v1[v1.size()-1-c][0]-v2[c][0];
-        dist += d*d;
-
-        d = v1[v1.size()-1-c][1]-v2[c][1];
-        dist += d*d;
-
-        d = v1[v1.size()-1-c][2]-v2[c][2];
-        dist += d*d;
-      }
-      dist /= v1.size();
-
-      if (dist<0.000001f)
-      {
-        match = true;
-        break;
-      }
-    }
-
-#pragma omp critical
-    if (!match)
-      ids.push_back(i);
+    if (index.FindEndpointMatch(own.GetStart(static_cast<unsigned int>(i)), own.GetEnd(static_cast<unsigned int>(i)), max_dist)<0)
+      keep[static_cast<unsigned int>(i)] = 1;
   }
 
-  for( int i : ids )
+  std::vector< unsigned int > ids;
+  for (unsigned int i=0; i<own.GetNumberOfFibers(); i++)
+    if (keep[i])
+      ids.push_back(own.GetFiberId(i));
+
+  for( unsigned int i : ids )
   {
     vtkCell* cell = m_FiberPolyData->GetCell(i);
     auto numPoints = cell->GetNumberOfPoints();
@@ -494,6 +463,7 @@ mitk::FiberBundle::Pointer mitk::FiberBundle::SubtractBundle(mitk::FiberBundle*
  */
 void mitk::FiberBundle::SetFiberPolyData(vtkSmartPointer<vtkPolyData> fiberPD, bool updateGeometry)
 {
+  m_FiberPointViewSource = nullptr;
   if (fiberPD == nullptr)
     this->m_FiberPolyData = vtkSmartPointer<vtkPolyData>::New();
   else
@@ -541,17 +511,17 @@ void mitk::FiberBundle::ColorFibersByLength(bool opacity, bool weight_fibers, mi
   if (type!=mitk::LookupTable::MULTILABEL)
     mitkLookup->GetVtkLookupTable()->SetTableRange(m_MinFiberLength, m_MaxFiberLength);
 
+  const FiberPointView& view = GetFiberPointView();
   unsigned int count = 0;
-  for (unsigned int i=0; i<m_FiberPolyData->GetNumberOfCells(); i++)
+  for (unsigned int i=0; i<view.GetNumberOfFibers(); i++)
   {
-    vtkCell* cell = m_FiberPolyData->GetCell(i);
-    auto numPoints = cell->GetNumberOfPoints();
+    auto numPoints = view.GetNumberOfPoints(i);
 
     float l = m_FiberLengths.at(i)/m_MaxFiberLength;
     double color[3];
     mitkLookup->GetColor(m_FiberLengths.at(i), color);
 
-    for (int j=0; j<numPoints; j++)
+    for (unsigned int j=0; j<numPoints; j++)
     {
 
       rgba[0] = static_cast<unsigned char>(255.0 * color[0]);
@@ -561,7 +531,7 @@ void mitk::FiberBundle::ColorFibersByLength(bool opacity, bool weight_fibers, mi
         rgba[3] = static_cast<unsigned char>(255.0f * l);
       else
         rgba[3] = static_cast<unsigned char>(255.0);
-      m_FiberColors->InsertTypedTuple(cell->GetPointId(j), rgba);
+      m_FiberColors->InsertTypedTuple(view.GetPointId(i, j), rgba);
       count++;
     }
 
@@ -745,120 +715,130 @@ void mitk::FiberBundle::ColorFibersByCurvature(bool opacity, bool weight_fibers,
   m_FiberColors->SetNumberOfComponents(4);
   m_FiberColors->SetName("FIBER_COLORS");
 
-  std::vector< double > values;
+  MITK_INFO << "Coloring fibers by curvature";
+  const FiberPointView& view = GetFiberPointView();
+  int numFibers = static_cast<int>(view.GetNumberOfFibers());
+  boost::timer::progress_display disp(static_cast<unsigned long>(numFibers));
+
+  // one value per point of the view, fibers are processed independently
+  std::vector< double > values(view.m_PointIds.size(), 0.0);
+  std::vector< double > mean_curvatures(static_cast<std::size_t>(numFibers), 0.0);
   double min = 1;
   double max = 0;
-  MITK_INFO << "Coloring fibers by curvature";
-  boost::timer::progress_display disp(static_cast<unsigned long>(m_FiberPolyData->GetNumberOfCells()));
 
-  for (int i=0; i<m_FiberPolyData->GetNumberOfCells(); i++)
+#pragma omp parallel
   {
-    ++disp;
-    vtkCell* cell = m_FiberPolyData->GetCell(i);
-    auto numPoints = cell->GetNumberOfPoints();
-    vtkPoints* points = cell->GetPoints();
-    double mean_curv = 0;
-
-    // calculate curvatures
-    for (int j=0; j<numPoints; j++)
+    double thread_min = 1;
+    double thread_max = 0;
+#pragma omp for
+    for (int i=0; i<numFibers; i++)
     {
-      double dist = 0;
-      int c = j;
-      std::vector< vnl_vector_fixed< double, 3 > > vectors;
-      vnl_vector_fixed< double, 3 > meanV; meanV.fill(0.0);
-      while(dist<window/2 && c>1)
-      {
-        double p1[3];
-        points->GetPoint(c-1, p1);
-        double p2[3];
-        points->GetPoint(c, p2);
-
-        vnl_vector_fixed< double, 3 > v;
-        v[0] = p2[0]-p1[0];
-        v[1] = p2[1]-p1[1];
-        v[2] = p2[2]-p1[2];
-        dist += v.magnitude();
-        v.normalize();
-        vectors.push_back(v);
-        meanV += v;
-        c--;
-      }
-      c = j;
-      dist = 0;
-      while(dist<window/2 && c<numPoints-1)
-      {
-        double p1[3];
-        points->GetPoint(c, p1);
-        double p2[3];
-        points->GetPoint(c+1, p2);
-
-        vnl_vector_fixed< double, 3 > v;
-        v[0] = p2[0]-p1[0];
-        v[1] = p2[1]-p1[1];
-        v[2] = p2[2]-p1[2];
-        dist += v.magnitude();
-        v.normalize();
-        vectors.push_back(v);
-        meanV += v;
-        c++;
-      }
-      meanV.normalize();
+      auto fiber = static_cast<unsigned int>(i);
+      int numPoints = static_cast<int>(view.GetNumberOfPoints(fiber));
+      double mean_curv = 0;
 
-      double dev = 0;
-      for (unsigned int c=0; c<vectors.size(); c++)
+      // calculate curvatures
+      for (int j=0; j<numPoints; j++)
       {
-        double angle = dot_product(meanV, vectors.at(c));
-        if (angle>1.0)
-          angle = 1.0;
-        if (angle<-1.0)
-          angle = -1.0;
-        dev += acos(angle)*180/itk::Math::pi;
-      }
-      if (vectors.size()>0)
-        dev /= vectors.size();
+        double dist = 0;
+        int c = j;
+        std::vector< vnl_vector_fixed< double, 3 > > vectors;
+        vnl_vector_fixed< double, 3 > meanV; meanV.fill(0.0);
+        while(dist<window/2 && c>1)
+        {
+          const float* p1 = view.GetPoint(fiber, static_cast<unsigned int>(c-1));
+          const float* p2 = view.GetPoint(fiber, static_cast<unsigned int>(c));
+
+          vnl_vector_fixed< double, 3 > v;
+          v[0] = static_cast<double>(p2[0])-static_cast<double>(p1[0]);
+          v[1] = static_cast<double>(p2[1])-static_cast<double>(p1[1]);
+          v[2] = static_cast<double>(p2[2])-static_cast<double>(p1[2]);
+          dist += v.magnitude();
+          v.normalize();
+          vectors.push_back(v);
+          meanV += v;
+          c--;
+        }
+        c = j;
+        dist = 0;
+        while(dist<window/2 && c<numPoints-1)
+        {
+          const float* p1 = view.GetPoint(fiber, static_cast<unsigned int>(c));
+          const float* p2 = view.GetPoint(fiber, static_cast<unsigned int>(c+1));
+
+          vnl_vector_fixed< double, 3 > v;
+          v[0] = static_cast<double>(p2[0])-static_cast<double>(p1[0]);
+          v[1] = static_cast<double>(p2[1])-static_cast<double>(p1[1]);
+          v[2] = static_cast<double>(p2[2])-static_cast<double>(p1[2]);
+          dist += v.magnitude();
+          v.normalize();
+          vectors.push_back(v);
+          meanV += v;
+          c++;
+        }
+        meanV.normalize();
 
-      if (weight_fibers)
-        mean_curv += dev;
-      dev = 1.0-dev/180.0;
-      values.push_back(dev);
-      if (dev<min)
-        min = dev;
-      if (dev>max)
-        max = dev;
+        double dev = 0;
+        for (unsigned int c=0; c<vectors.size(); c++)
+        {
+          double angle = dot_product(meanV, vectors.at(c));
+          if (angle>1.0)
+            angle = 1.0;
+          if (angle<-1.0)
+            angle = -1.0;
+          dev += acos(angle)*180/itk::Math::pi;
+        }
+        if (vectors.size()>0)
+          dev /= vectors.size();
+
+        if (weight_fibers)
+          mean_curv += dev;
+        dev = 1.0-dev/180.0;
+        values[view.m_Offsets[fiber]+static_cast<unsigned int>(j)] = dev;
+        if (dev<thread_min)
+          thread_min = dev;
+        if (dev>thread_max)
+          thread_max = dev;
+      }
+      mean_curvatures[fiber] = mean_curv/numPoints;
+#pragma omp critical
+      ++disp;
     }
 
-    if (weight_fibers)
-      this->SetFiberWeight(i, mean_curv/numPoints);
+#pragma omp critical
+    {
+      if (thread_min<min)
+        min = thread_min;
+      if (thread_max>max)
+        max = thread_max;
+    }
   }
 
+  if (weight_fibers)
+    for (int i=0; i<numFibers; i++)
+      this->SetFiberWeight(static_cast<unsigned int>(i), static_cast<float>(mean_curvatures[static_cast<std::size_t>(i)]));
+
   mitk::LookupTable::Pointer mitkLookup = mitk::LookupTable::New();
   mitkLookup->SetType(type);
   if (type!=mitk::LookupTable::MULTILABEL)
     mitkLookup->GetVtkLookupTable()->SetTableRange(min, max);
 
-  unsigned int count = 0;
-  for (int i=0; i<m_FiberPolyData->GetNumberOfCells(); i++)
+  for (std::size_t k=0; k<values.size(); k++)
   {
-    vtkCell* cell = m_FiberPolyData->GetCell(i);
-    auto numPoints = cell->GetNumberOfPoints();
-    for (int j=0; j<numPoints; j++)
-    {
-      double color[3];
-      double dev = values.at(count);
-      mitkLookup->GetColor(dev, color);
+    double color[3];
+    double dev = values.at(k);
+    mitkLookup->GetColor(dev, color);
 
-      rgba[0] = static_cast<unsigned char>(255.0 * color[0]);
-      rgba[1] = static_cast<unsigned char>(255.0 * color[1]);
-      rgba[2] = static_cast<unsigned char>(255.0 * color[2]);
+    rgba[0] = static_cast<unsigned char>(255.0 * color[0]);
+    rgba[1] = static_cast<unsigned char>(255.0 * color[1]);
+    rgba[2] = static_cast<unsigned char>(255.0 * color[2]);
 
-      if (opacity)
-        rgba[3] = static_cast<unsigned char>(255.0f * dev/max);
-      else
-        rgba[3] = static_cast<unsigned char>(255.0);
+    if (opacity)
+      rgba[3] = static_cast<unsigned char>(255.0f * dev/max);
+    else
+      rgba[3] = static_cast<unsigned char>(255.0);
 
-      m_FiberColors->InsertTypedTuple(cell->GetPointId(j), rgba);
-      count++;
-    }
+    m_FiberColors->InsertTypedTuple(view.m_PointIds[k], rgba);
   }
   m_UpdateTime3D.Modified();
   m_UpdateTime2D.Modified();
@@ -933,30 +913,48 @@ void mitk::FiberBundle::ColorFibersByScalarMap(typename itk::Image<TPixel, 3>::P
   double min = 999999;
   double max = -999999;
 
-  for (unsigned int i=0; i<m_NumFibers; i++)
+  // image values along the fibers, the interpolator is only read and can be shared by all threads
+  const FiberPointView& view = GetFiberPointView();
+  int numFibers = static_cast<int>(view.GetNumberOfFibers());
+  std::vector< double > fiber_min(static_cast<std::size_t>(numFibers), min);
+  std::vector< double > fiber_max(static_cast<std::size_t>(numFibers), max);
+  std::vector< double > fiber_mean(static_cast<std::size_t>(numFibers), 0);
+#pragma omp parallel for
+  for (int i=0; i<numFibers; i++)
   {
-    vtkCell* cell = m_FiberPolyData->GetCell(i);
-    auto numPoints = cell->GetNumberOfPoints();
-    vtkPoints* points = cell->GetPoints();
+    auto fiber = static_cast<unsigned int>(i);
+    auto numPoints = view.GetNumberOfPoints(fiber);
     double mean_val = 0;
 
-    for (int j=0; j<numPoints; j++)
+    for (unsigned int j=0; j<numPoints; j++)
     {
-      double p[3];
-      points->GetPoint(j, p);
-      auto pixelValue = mitk::imv::GetImageValue<TPixel>(mitk::imv::GetItkPoint(p), interpolate, interpolator);
-
-      if (pixelValue>max)
-        max = pixelValue;
-      if (pixelValue<min)
-        min = pixelValue;
+      const float* p = view.GetPoint(fiber, j);
+      itk::Point<float, 3> px;
+      px[0] = p[0];
+      px[1] = p[1];
+      px[2] = p[2];
+      auto pixelValue = mitk::imv::GetImageValue<TPixel>(px, interpolate, interpolator);
+
+      if (pixelValue>fiber_max[fiber])
+        fiber_max[fiber] = pixelValue;
+      if (pixelValue<fiber_min[fiber])
+        fiber_min[fiber] = pixelValue;
 
       if (weight_fibers)
         mean_val += pixelValue;
     }
+    fiber_mean[fiber] = mean_val/numPoints;
+  }
+
+  for (int i=0; i<numFibers; i++)
+  {
+    if (fiber_max[static_cast<std::size_t>(i)]>max)
+      max = fiber_max[static_cast<std::size_t>(i)];
+    if (fiber_min[static_cast<std::size_t>(i)]<min)
+      min = fiber_min[static_cast<std::size_t>(i)];
 
     if (weight_fibers)
-      this->SetFiberWeight(i, mean_val/numPoints);
+      this->SetFiberWeight(static_cast<unsigned int>(i), static_cast<float>(fiber_mean[static_cast<std::size_t>(i)]));
   }
 
   mitk::LookupTable::Pointer mitkLookup = mitk::LookupTable::New();
@@ -964,13 +962,25 @@ void mitk::FiberBundle::ColorFibersByScalarMap(typename itk::Image<TPixel, 3>::P
   if (type!=mitk::LookupTable::MULTILABEL && max_cap > 0)
     mitkLookup->GetVtkLookupTable()->SetTableRange(min, max*max_cap);
 
-  for(long i=0; i<m_FiberPolyData->GetNumberOfPoints(); ++i)
+  // the lookup table is not thread safe, only the image values are computed in parallel
+  long numPoints = static_cast<long>(m_FiberPolyData->GetNumberOfPoints());
+  std::vector< double > pixelValues(static_cast<std::size_t>(numPoints));
+  std::vector< itk::Point<float, 3> > pointCoords(static_cast<std::size_t>(numPoints));
+  for(long i=0; i<numPoints; ++i)
   {
-    itk::Point<float, 3> px;
-    px[0] = pointSet->GetPoint(i)[0];
-    px[1] = pointSet->GetPoint(i)[1];
-    px[2] = pointSet->GetPoint(i)[2];
-    auto pixelValue = mitk::imv::GetImageValue<TPixel>(px, interpolate, interpolator);
+    double p[3];
+    pointSet->GetPoint(i, p);
+    pointCoords[static_cast<std::size_t>(i)][0] = p[0];
+    pointCoords[static_cast<std::size_t>(i)][1] = p[1];
+    pointCoords[static_cast<std::size_t>(i)][2] = p[2];
+  }
+#pragma omp parallel for
+  for(long i=0; i<numPoints; ++i)
+    pixelValues[static_cast<std::size_t>(i)] = mitk::imv::GetImageValue<TPixel>(pointCoords[static_cast<std::size_t>(i)], interpolate, interpolator);
+
+  for(long i=0; i<numPoints; ++i)
+  {
+    auto pixelValue = pixelValues[static_cast<std::size_t>(i)];
 
     double color[3];
     mitkLookup->GetColor(pixelValue, color);
@@ -1020,16 +1030,16 @@ void mitk::FiberBundle::ColorFibersByFiberWeights(bool opacity, mitk::LookupTabl
   if (type!=mitk::LookupTable::MULTILABEL)
     mitkLookup->GetVtkLookupTable()->SetTableRange(min, max);
 
+  const FiberPointView& view = GetFiberPointView();
   for (unsigned int i=0; i<m_NumFibers; i++)
   {
-    vtkCell* cell = m_FiberPolyData->GetCell(i);
-    auto numPoints = cell->GetNumberOfPoints();
+    auto numPoints = view.GetNumberOfPoints(i);
     auto weight = this->GetFiberWeight(i);
 
     double color[3];
     mitkLookup->GetColor(weight, color);
 
-    for (int j=0; j<numPoints; j++)
+    for (unsigned int j=0; j<numPoints; j++)
     {
       rgba[0] = static_cast<unsigned char>(255.0 * color[0]);
       rgba[1] = static_cast<unsigned char>(255.0 * color[1]);
@@ -1435,6 +1445,7 @@ void mitk::FiberBundle::UpdateFiberGeometry()
   cleaner->PointMergingOff();
   cleaner->Update();
   m_FiberPolyData = cleaner->GetOutput();
+  m_FiberPointViewSource = nullptr;
 
   m_FiberLengths.clear();
   m_MeanFiberLength = 0;
@@ -2093,29 +2104,24 @@ void mitk::FiberBundle::ResampleSpline(float pointDistance, double tension, doub
   vtkSmartPointer<vtkCellArray> vtkSmoothCells = vtkSmartPointer<vtkCellArray>::New(); //cellcontainer for smoothed lines
 
   MITK_INFO << "Smoothing fibers";
-  vtkSmartPointer<vtkFloatArray> newFiberWeights = vtkSmartPointer<vtkFloatArray>::New();
-  newFiberWeights->SetName("FIBER_WEIGHTS");
-  newFiberWeights->SetNumberOfValues(m_NumFibers);
-
-  std::vector< vtkSmartPointer<vtkPolyLine> > resampled_streamlines;
+  const FiberPointView& view = GetFiberPointView();
+  std::vector< std::vector< double > > resampled_streamlines;
   resampled_streamlines.resize(m_NumFibers);
 
   boost::timer::progress_display disp(m_NumFibers);
 #pragma omp parallel for
   for (int i=0; i<static_cast<int>(m_NumFibers); i++)
   {
+    auto fiber = static_cast<unsigned int>(i);
     vtkSmartPointer<vtkPoints> newPoints = vtkSmartPointer<vtkPoints>::New();
-    float length = 0;
-#pragma omp critical
+    float length = m_FiberLengths.at(fiber);
+    for (unsigned int j=0; j<view.GetNumberOfPoints(fiber); j++)
     {
-      length = m_FiberLengths.at(static_cast<unsigned int>(i));
-      ++disp;
-      vtkCell* cell = m_FiberPolyData->GetCell(i);
-      auto numPoints = cell->GetNumberOfPoints();
-      vtkPoints* points = cell->GetPoints();
-      for (int j=0; j<numPoints; j++)
-        newPoints->InsertNextPoint(points->GetPoint(j));
+      const float* p = view.GetPoint(fiber, j);
+      newPoints->InsertNextPoint(p[0], p[1], p[2]);
     }
+#pragma omp critical
+    ++disp;
 
     int sampling = static_cast<int>(std::ceil(length/pointDistance));
 
@@ -2142,23 +2148,23 @@ void mitk::FiberBundle::ResampleSpline(float pointDistance, double tension, doub
     vtkPolyData* outputFunction = functionSource->GetOutput();
     vtkPoints* tmpSmoothPnts = outputFunction->GetPoints(); //smoothPoints of current fiber
 
-    vtkSmartPointer<vtkPolyLine> smoothLine = vtkSmartPointer<vtkPolyLine>::New();
-
-#pragma omp critical
-    {
-      for (int j=0; j<tmpSmoothPnts->GetNumberOfPoints(); j++)
-      {
-        vtkIdType id = vtkSmoothPoints->InsertNextPoint(tmpSmoothPnts->GetPoint(j));
-        smoothLine->GetPointIds()->InsertNextId(id);
-      }
-
-      resampled_streamlines[static_cast<unsigned long>(i)] = smoothLine;
-    }
+    std::vector< double >& smoothLine = resampled_streamlines[fiber];
+    smoothLine.resize(3*static_cast<std::size_t>(tmpSmoothPnts->GetNumberOfPoints()));
+    for (int j=0; j<tmpSmoothPnts->GetNumberOfPoints(); j++)
+      tmpSmoothPnts->GetPoint(j, &smoothLine[3*static_cast<std::size_t>(j)]);
   }
 
-  for (auto container : resampled_streamlines)
+  // assemble the new polydata in fiber order
+  for (auto& smoothPoints : resampled_streamlines)
   {
-    vtkSmoothCells->InsertNextCell(container);
+    vtkSmartPointer<vtkPolyLine> smoothLine = vtkSmartPointer<vtkPolyLine>::New();
+    for (std::size_t j=0; j<smoothPoints.size(); j+=3)
+    {
+      vtkIdType id = vtkSmoothPoints->InsertNextPoint(&smoothPoints[j]);
+      smoothLine->GetPointIds()->InsertNextId(id);
+    }
+    vtkSmoothCells->InsertNextCell(smoothLine);
+    std::vector< double >().swap(smoothPoints);
   }
 
   m_FiberPolyData = vtkSmartPointer<vtkPolyData>::New();
@@ -2172,6 +2178,50 @@ void mitk::FiberBundle::ResampleSpline(float pointDistance)
   ResampleSpline(pointDistance, 0, 0, 0 );
 }
 
+const mitk::FiberBundle::FiberPointView& mitk::FiberBundle::GetFiberPointView() const
+{
+  std::lock_guard<std::mutex> lock(m_FiberPointViewMutex);
+  if (m_FiberPointViewSource==m_FiberPolyData.GetPointer() && m_FiberPointViewTime==m_FiberPolyData->GetMTime())
+    return m_FiberPointView;
+
+  FiberPointView& view = m_FiberPointView;
+  view.m_Offsets.assign(1, 0);
+  view.m_Points.clear();
+  view.m_PointIds.clear();
+
+  vtkPoints* points = m_FiberPolyData->GetPoints();
+  vtkCellArray* lines = m_FiberPolyData->GetLines();
+  if (points!=nullptr && lines!=nullptr)
+  {
+    auto numFibers = lines->GetNumberOfCells();
+    view.m_Offsets.reserve(static_cast<std::size_t>(numFibers)+1);
+    view.m_PointIds.reserve(static_cast<std::size_t>(lines->GetNumberOfConnectivityIds()));
+    view.m_Points.reserve(3*static_cast<std::size_t>(lines->GetNumberOfConnectivityIds()));
+
+    lines->InitTraversal();
+    for (vtkIdType i=0; i<numFibers; ++i)
+    {
+      vtkIdType const* idList;
+      vtkIdType numPoints;
+      lines->GetNextCell(numPoints, idList);
+      for (vtkIdType j=0; j<numPoints; ++j)
+      {
+        double p[3];
+        points->GetPoint(idList[j], p);
+        view.m_Points.push_back(static_cast<float>(p[0]));
+        view.m_Points.push_back(static_cast<float>(p[1]));
+        view.m_Points.push_back(static_cast<float>(p[2]));
+        view.m_PointIds.push_back(idList[j]);
+      }
+      view.m_Offsets.push_back(view.m_PointIds.size());
+    }
+  }
+
+  m_FiberPointViewSource = m_FiberPolyData.GetPointer();
+  m_FiberPointViewTime = m_FiberPolyData->GetMTime();
+  return m_FiberPointView;
+}
+
 unsigned int mitk::FiberBundle::GetNumberOfPoints() const
 {
   unsigned int points = 0;
@@ -2190,42 +2240,36 @@ void mitk::FiberBundle::Compress(float error)
 
   MITK_INFO << "Compressing fibers with max. error " << error << "mm";
   unsigned int numRemovedPoints = 0;
-  boost::timer::progress_display disp(static_cast<unsigned long>(m_FiberPolyData->GetNumberOfCells()));
+  const FiberPointView& view = GetFiberPointView();
+  int numFibers = static_cast<int>(view.GetNumberOfFibers());
+  boost::timer::progress_display disp(static_cast<unsigned long>(numFibers));
   vtkSmartPointer<vtkFloatArray> newFiberWeights = vtkSmartPointer<vtkFloatArray>::New();
   newFiberWeights->SetName("FIBER_WEIGHTS");
   newFiberWeights->SetNumberOfValues(m_NumFibers);
 
+  std::vector< std::vector< vnl_vector_fixed< double, 3 > > > compressed_streamlines(static_cast<std::size_t>(numFibers));
+  std::vector< unsigned int > removed_counts(static_cast<std::size_t>(numFibers), 0);
+
 #pragma omp parallel for
-  for (int i=0; i<static_cast<int>(m_FiberPolyData->GetNumberOfCells()); i++)
+  for (int i=0; i<numFibers; i++)
   {
-
+    auto fiber = static_cast<unsigned int>(i);
     std::vector< vnl_vector_fixed< double, 3 > > vertices;
-    float weight = 1;
-
-#pragma omp critical
+    for (unsigned int j=0; j<view.GetNumberOfPoints(fiber); j++)
     {
-      ++disp;
-      weight = m_FiberWeights->GetValue(i);
-      vtkCell* cell = m_FiberPolyData->GetCell(i);
-      auto numPoints = cell->GetNumberOfPoints();
-      vtkPoints* points = cell->GetPoints();
-
-      for (int j=0; j<numPoints; j++)
-      {
-        double cand[3];
-        points->GetPoint(j, cand);
-        vnl_vector_fixed< double, 3 > candV;
-        candV[0]=cand[0]; candV[1]=cand[1]; candV[2]=cand[2];
-        vertices.push_back(candV);
-      }
+      const float* cand = view.GetPoint(fiber, j);
+      vnl_vector_fixed< double, 3 > candV;
+      candV[0]=cand[0]; candV[1]=cand[1]; candV[2]=cand[2];
+      vertices.push_back(candV);
     }
+#pragma omp critical
+    ++disp;
 
     // calculate curvatures
     auto numPoints = vertices.size();
     std::vector< int > removedPoints; removedPoints.resize(numPoints, 0);
     removedPoints[0]=-1; removedPoints[numPoints-1]=-1;
 
-    vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
     unsigned int remCounter = 0;
 
     bool pointFound = true;
@@ -2285,24 +2329,27 @@ void mitk::FiberBundle::Compress(float error)
       }
     }
 
+    std::vector< vnl_vector_fixed< double, 3 > >& compressed = compressed_streamlines[fiber];
     for (unsigned int j=0; j<numPoints; j++)
-    {
       if (removedPoints[j]<=0)
-      {
-#pragma omp critical
-        {
-          vtkIdType id = vtkNewPoints->InsertNextPoint(vertices.at(j).data_block());
-          container->GetPointIds()->InsertNextId(id);
-        }
-      }
-    }
+        compressed.push_back(vertices.at(j));
+    removed_counts[fiber] = remCounter;
+  }
 
-#pragma omp critical
+  // assemble the new polydata in fiber order
+  for (unsigned int i=0; i<compressed_streamlines.size(); i++)
+  {
+    vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
+    for (auto& v : compressed_streamlines[i])
     {
-      newFiberWeights->SetValue(vtkNewCells->GetNumberOfCells(), weight);
-      numRemovedPoints += remCounter;
-      vtkNewCells->InsertNextCell(container);
+      vtkIdType id = vtkNewPoints->InsertNextPoint(v.data_block());
+      container->GetPointIds()->InsertNextId(id);
     }
+    std::vector< vnl_vector_fixed< double, 3 > >().swap(compressed_streamlines[i]);
+
+    newFiberWeights->SetValue(vtkNewCells->GetNumberOfCells(), m_FiberWeights->GetValue(i));
+    numRemovedPoints += removed_counts[i];
+    vtkNewCells->InsertNextCell(container);
   }
 
   if (vtkNewCells->GetNumberOfCells()>0)
@@ -2334,42 +2381,31 @@ void mitk::FiberBundle::ResampleToNumPoints(unsigned int targetPoints)
     newFiberWeights->SetNumberOfValues(m_NumFibers);
 
     unequal_fibs = false;
-    MITK_INFO << "Start";
-//    cv::parallel_for_(cv::Range(0, m_FiberPolyData->GetNumberOfCells()), [&](const cv::Range &range)
-//    {
-//        for (int i = range.start; i < range.end; i++)
-    for (unsigned int i=0; i<m_FiberPolyData->GetNumberOfCells(); i++)
-    {
+    const FiberPointView& view = GetFiberPointView();
+    int numFibers = static_cast<int>(view.GetNumberOfFibers());
+    std::vector< std::vector< vnl_vector_fixed< double, 3 > > > resampled_streamlines(static_cast<std::size_t>(numFibers));
 
+#pragma omp parallel for
+    for (int i=0; i<numFibers; i++)
+    {
+      auto fiber = static_cast<unsigned int>(i);
       std::vector< vnl_vector_fixed< double, 3 > > vertices;
-      float weight = 1;
       double seg_len = 0;
 
+      auto numPoints = view.GetNumberOfPoints(fiber);
+      if (numPoints!=targetPoints)
+        seg_len = static_cast<double>(this->GetFiberLength(fiber)/(targetPoints-1));
+      for (unsigned int j=0; j<numPoints; j++)
       {
-        weight = m_FiberWeights->GetValue(i);
-        vtkCell* cell = m_FiberPolyData->GetCell(i);
-        auto numPoints = cell->GetNumberOfPoints();
-        if (numPoints!=targetPoints)
-          seg_len = static_cast<double>(this->GetFiberLength(i)/(targetPoints-1));
-        vtkPoints* points = cell->GetPoints();
-
-        for (int j=0; j<numPoints; j++)
-        {
-          double cand[3];
-          points->GetPoint(j, cand);
-          vnl_vector_fixed< double, 3 > candV;
-          candV[0]=cand[0]; candV[1]=cand[1]; candV[2]=cand[2];
-          vertices.push_back(candV);
-        }
+        const float* cand = view.GetPoint(fiber, j);
+        vnl_vector_fixed< double, 3 > candV;
+        candV[0]=cand[0]; candV[1]=cand[1]; candV[2]=cand[2];
+        vertices.push_back(candV);
       }
 
-      vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
+      std::vector< vnl_vector_fixed< double, 3 > >& resampled = resampled_streamlines[fiber];
       vnl_vector_fixed< double, 3 > lastV = vertices.at(0);
-
-      {
-        vtkIdType id = vtkNewPoints->InsertNextPoint(lastV.data_block());
-        container->GetPointIds()->InsertNextId(id);
-      }
+      resampled.push_back(lastV);
       for (unsigned int j=1; j<vertices.size(); j++)
       {
         vnl_vector_fixed< double, 3 > vec = vertices.at(j) - lastV;
@@ -2406,33 +2442,32 @@ void mitk::FiberBundle::ResampleToNumPoints(unsigned int targetPoints)
             j--;
           }
 
-//#pragma omp critical
-          {
-            vtkIdType id = vtkNewPoints->InsertNextPoint(newV.data_block());
-            container->GetPointIds()->InsertNextId(id);
-          }
+          resampled.push_back(newV);
           lastV = newV;
         }
         else if ( (j==vertices.size()-1 && new_dist>0.0001) || seg_len<=0.0000001)
         {
-//#pragma omp critical
-          {
-            vtkIdType id = vtkNewPoints->InsertNextPoint(vertices.at(j).data_block());
-            container->GetPointIds()->InsertNextId(id);
-          }
+          resampled.push_back(vertices.at(j));
         }
       }
+    }
 
-//#pragma omp critical
+    // assemble the new polydata in fiber order
+    for (unsigned int i=0; i<resampled_streamlines.size(); i++)
+    {
+      vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
+      for (auto& v : resampled_streamlines[i])
       {
-        newFiberWeights->SetValue(vtkNewCells->GetNumberOfCells(), weight);
-        vtkNewCells->InsertNextCell(container);
-        if (container->GetNumberOfPoints()!=targetPoints)
-          unequal_fibs = true;
+        vtkIdType id = vtkNewPoints->InsertNextPoint(v.data_block());
+        container->GetPointIds()->InsertNextId(id);
       }
+      std::vector< vnl_vector_fixed< double, 3 > >().swap(resampled_streamlines[i]);
+
+      newFiberWeights->SetValue(vtkNewCells->GetNumberOfCells(), m_FiberWeights->GetValue(i));
+      vtkNewCells->InsertNextCell(container);
+      if (container->GetNumberOfPoints()!=targetPoints)
+        unequal_fibs = true;
     }
-//    });
-//    MITK_INFO << "Done";
 
     if (vtkNewCells->GetNumberOfCells()>0)
     {
@@ -2451,45 +2486,31 @@ void mitk::FiberBundle::ResampleLinear(double pointDistance)
   vtkSmartPointer<vtkCellArray> vtkNewCells = vtkSmartPointer<vtkCellArray>::New();
 
   MITK_INFO << "Resampling fibers (linear)";
-  boost::timer::progress_display disp(static_cast<unsigned long>(m_FiberPolyData->GetNumberOfCells()));
-  vtkSmartPointer<vtkFloatArray> newFiberWeights = vtkSmartPointer<vtkFloatArray>::New();
-  newFiberWeights->SetName("FIBER_WEIGHTS");
-  newFiberWeights->SetNumberOfValues(m_NumFibers);
+  const FiberPointView& view = GetFiberPointView();
+  int numFibers = static_cast<int>(view.GetNumberOfFibers());
+  boost::timer::progress_display disp(static_cast<unsigned long>(numFibers));
 
-  std::vector< vtkSmartPointer<vtkPolyLine> > resampled_streamlines;
-  resampled_streamlines.resize(static_cast<unsigned long>(m_FiberPolyData->GetNumberOfCells()));
+  std::vector< std::vector< vnl_vector_fixed< double, 3 > > > resampled_streamlines;
+  resampled_streamlines.resize(static_cast<std::size_t>(numFibers));
 
 #pragma omp parallel for
-  for (int i=0; i<static_cast<int>(m_FiberPolyData->GetNumberOfCells()); i++)
+  for (int i=0; i<numFibers; i++)
   {
-
+    auto fiber = static_cast<unsigned int>(i);
     std::vector< vnl_vector_fixed< double, 3 > > vertices;
-
-#pragma omp critical
+    for (unsigned int j=0; j<view.GetNumberOfPoints(fiber); j++)
     {
-      ++disp;
-      vtkCell* cell = m_FiberPolyData->GetCell(i);
-      auto numPoints = cell->GetNumberOfPoints();
-      vtkPoints* points = cell->GetPoints();
-
-      for (int j=0; j<numPoints; j++)
-      {
-        double cand[3];
-        points->GetPoint(j, cand);
-        vnl_vector_fixed< double, 3 > candV;
-        candV[0]=cand[0]; candV[1]=cand[1]; candV[2]=cand[2];
-        vertices.push_back(candV);
-      }
+      const float* cand = view.GetPoint(fiber, j);
+      vnl_vector_fixed< double, 3 > candV;
+      candV[0]=cand[0]; candV[1]=cand[1]; candV[2]=cand[2];
+      vertices.push_back(candV);
     }
+#pragma omp critical
+    ++disp;
 
-    vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
+    std::vector< vnl_vector_fixed< double, 3 > >& resampled = resampled_streamlines[fiber];
     vnl_vector_fixed< double, 3 > lastV = vertices.at(0);
-
-#pragma omp critical
-    {
-      vtkIdType id = vtkNewPoints->InsertNextPoint(lastV.data_block());
-      container->GetPointIds()->InsertNextId(id);
-    }
+    resampled.push_back(lastV);
     for (unsigned int j=1; j<vertices.size(); j++)
     {
       vnl_vector_fixed< double, 3 > vec = vertices.at(j) - lastV;
@@ -2526,31 +2547,26 @@ void mitk::FiberBundle::ResampleLinear(double pointDistance)
           j--;
         }
 
-#pragma omp critical
-        {
-          vtkIdType id = vtkNewPoints->InsertNextPoint(newV.data_block());
-          container->GetPointIds()->InsertNextId(id);
-        }
+        resampled.push_back(newV);
         lastV = newV;
       }
       else if (j==vertices.size()-1 && new_dist>0.0001)
       {
-#pragma omp critical
-        {
-          vtkIdType id = vtkNewPoints->InsertNextPoint(vertices.at(j).data_block());
-          container->GetPointIds()->InsertNextId(id);
-        }
+        resampled.push_back(vertices.at(j));
       }
     }
-
-#pragma omp critical
-    {
-      resampled_streamlines[static_cast<unsigned int>(i)] = container;
-    }
   }
 
-  for (auto container : resampled_streamlines)
+  // assemble the new polydata in fiber order
+  for (auto& resampled : resampled_streamlines)
   {
+    vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
+    for (auto& v : resampled)
+    {
+      vtkIdType id = vtkNewPoints->InsertNextPoint(v.data_block());
+      container->GetPointIds()->InsertNextId(id);
+    }
+    std::vector< vnl_vector_fixed< double, 3 > >().swap(resampled);
     vtkNewCells->InsertNextCell(container);
   }
 
@@ -2564,7 +2580,7 @@ void mitk::FiberBundle::ResampleLinear(double pointDistance)
 }
 
 // reapply selected colorcoding in case PolyData structure has changed
-bool mitk::FiberBundle::Equals(mitk::FiberBundle* fib, double eps)
+bool mitk::FiberBundle::Equals(mitk::FiberBundle* fib, double eps, bool ignore_order)
 {
   if (fib==nullptr)
   {
@@ -2579,6 +2595,61 @@ bool mitk::FiberBundle::Equals(mitk::FiberBundle* fib, double eps)
     return false;
   }
 
+  if (ignore_order)
+  {
+    // look up candidate fibers by their endpoints; with a per-coordinate tolerance of eps,
+    // matching endpoints are at most sqrt(3)*eps apart
+    mitk::FiberEndpointIndex index(static_cast<float>(std::sqrt(3.0)*eps));
+    index.AddFibers(fib->GetFiberPolyData());
+    index.Build();
+
+    mitk::FiberEndpointIndex own(1);
+    own.AddFibers(m_FiberPolyData);
+    if (own.GetNumberOfFibers()!=index.GetNumberOfFibers())
+    {
+      MITK_INFO << "Unequal number of non-empty fibers!";
+      return false;
+    }
+
+    vtkPolyData* polyData2 = fib->GetFiberPolyData();
+    std::vector< unsigned char > used(index.GetNumberOfFibers(), 0);
+    for (unsigned int i=0; i<own.GetNumberOfFibers(); i++)
+    {
+      vtkCell* cell = m_FiberPolyData->GetCell(own.GetFiberId(i));
+      auto numPoints = cell->GetNumberOfPoints();
+      vtkPoints* points = cell->GetPoints();
+
+      auto fiber_matches = [&](unsigned int k, bool flip)
+      {
+        if (used[k])
+          return false;
+        vtkCell* cell2 = polyData2->GetCell(index.GetFiberId(k));
+        if (cell2->GetNumberOfPoints()!=numPoints)
+          return false;
+        vtkPoints* points2 = cell2->GetPoints();
+        for (int j=0; j<numPoints; j++)
+        {
+          double p1[3]; double p2[3];
+          points->GetPoint(j, p1);
+          points2->GetPoint(flip ? numPoints-1-j : j, p2);
+          if (fabs(p1[0]-p2[0])>eps || fabs(p1[1]-p2[1])>eps || fabs(p1[2]-p2[2])>eps)
+            return false;
+        }
+        used[k] = 1;
+        return true;
+      };
+
+      if (index.ForEachCandidate(own.GetStart(i), [&](unsigned int k){ return fiber_matches(k, false); }))
+        continue;
+      if (index.ForEachCandidate(own.GetEnd(i), [&](unsigned int k){ return fiber_matches(k, true); }))
+        continue;
+
+      MITK_INFO << "No matching fiber found for fiber " << own.GetFiberId(i) << "!";
+      return false;
+    }
+    return true;
+  }
+
   for (unsigned int i=0; i<m_NumFibers; i++)
   {
     vtkCell* cell = m_FiberPolyData->GetCell(i);
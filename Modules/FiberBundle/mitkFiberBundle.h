@@ -35,6 +35,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <itkScalableAffineTransform.h>
 #include <mitkLookupTable.h>
 #include <mitkDiffusionImageHelperFunctions.h>
+#include <mutex>
 
 namespace mitk {
 
@@ -46,6 +47,23 @@ public:
 
     typedef itk::Image<unsigned char, 3> ItkUcharImgType;
 
+    /**
+     * \brief Read-only flat copy of all fiber points. Fiber i consists of the points m_Offsets[i] to m_Offsets[i+1]-1,
+     * the coordinates of point k are stored at m_Points[3*k] and its vtk point id at m_PointIds[k].
+     * In contrast to vtkPolyData::GetCell, the view can be read by several threads concurrently.
+     */
+    struct FiberPointView
+    {
+      std::vector< std::size_t >  m_Offsets;
+      std::vector< float >        m_Points;
+      std::vector< vtkIdType >    m_PointIds;
+
+      unsigned int GetNumberOfFibers() const { return m_Offsets.empty() ? 0 : static_cast<unsigned int>(m_Offsets.size()-1); }
+      unsigned int GetNumberOfPoints(unsigned int fiber) const { return static_cast<unsigned int>(m_Offsets[fiber+1]-m_Offsets[fiber]); }
+      const float* GetPoint(unsigned int fiber, unsigned int j) const { return &m_Points[3*(m_Offsets[fiber]+j)]; }
+      vtkIdType GetPointId(unsigned int fiber, unsigned int j) const { return m_PointIds[m_Offsets[fiber]+j]; }
+    };
+
     // fiber colorcodings
     static const char* FIBER_ID_ARRAY;
 
@@ -130,7 +148,7 @@ public:
 
     // add/subtract fibers
     FiberBundle::Pointer AddBundle(FiberBundle* fib);
-    mitk::FiberBundle::Pointer AddBundles(std::vector< mitk::FiberBundle::Pointer > fibs);
+    mitk::FiberBundle::Pointer AddBundles(std::vector< mitk::FiberBundle::Pointer > fibs, bool remove_duplicates=false); ///< remove_duplicates: skip fibers with the same endpoints as an already added fiber
     FiberBundle::Pointer SubtractBundle(FiberBundle* fib);
 
     // fiber subset extraction
@@ -163,11 +181,16 @@ public:
 
     unsigned int GetNumberOfPoints() const;
 
+    /** Flat point view of the current fibers. It is rebuilt lazily if the polydata was replaced or modified since the
+     * last call, so fetch the reference before entering a parallel region. Points changed in place without calling
+     * Modified() on the polydata are not detected. */
+    const FiberPointView& GetFiberPointView() const;
+
     // copy fiber bundle
     mitk::FiberBundle::Pointer GetDeepCopy();
 
-    // compare fiber bundles
-    bool Equals(FiberBundle* fib, double eps=0.01);
+    // compare fiber bundles (ignore_order: fibers may appear in any order and orientation)
+    bool Equals(FiberBundle* fib, double eps=0.01, bool ignore_order=false);
 
     vtkSmartPointer<vtkPolyData>    GeneratePolyDataByIds(std::vector<unsigned int> fiberIds, vtkSmartPointer<vtkFloatArray> weights);
 
@@ -241,6 +264,11 @@ private:
     TrackVis_header     m_TrackVisHeader;
 
     bool m_IsRAS;
+
+    mutable FiberPointView  m_FiberPointView;
+    mutable vtkPolyData*    m_FiberPointViewSource;
+    mutable vtkMTimeType    m_FiberPointViewTime;
+    mutable std::mutex      m_FiberPointViewMutex;
 };
 
 } // namespace mitk
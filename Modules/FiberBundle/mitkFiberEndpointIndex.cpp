@@ -0,0 +1,136 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#include "mitkFiberEndpointIndex.h"
+#include <vtkCellArray.h>
+#include <cmath>
+
+mitk::FiberEndpointIndex::FiberEndpointIndex(float radius)
+  : m_Radius(radius)
+{
+  if (m_Radius<=0)
+    m_Radius = 0.001f;
+}
+
+mitk::FiberEndpointIndex::~FiberEndpointIndex()
+{
+
+}
+
+void mitk::FiberEndpointIndex::AddFibers(vtkPolyData* fibers, unsigned int id_offset)
+{
+  if (fibers==nullptr || fibers->GetLines()==nullptr || fibers->GetPoints()==nullptr)
+    return;
+
+  vtkPoints* points = fibers->GetPoints();
+  vtkCellArray* lines = fibers->GetLines();
+  auto num_lines = lines->GetNumberOfCells();
+  m_Ids.reserve(m_Ids.size() + num_lines);
+  m_Starts.reserve(m_Starts.size() + num_lines);
+  m_Ends.reserve(m_Ends.size() + num_lines);
+
+  // traverse the connectivity directly, GetCell() would copy every fiber
+  vtkIdType numPoints = 0;
+  vtkIdType const* pointIds = nullptr;
+  unsigned int id = id_offset;
+  lines->InitTraversal();
+  while (lines->GetNextCell(numPoints, pointIds))
+  {
+    if (numPoints>0)
+    {
+      double s[3]; double e[3];
+      points->GetPoint(pointIds[0], s);
+      points->GetPoint(pointIds[numPoints-1], e);
+
+      PointType start; start[0] = static_cast<float>(s[0]); start[1] = static_cast<float>(s[1]); start[2] = static_cast<float>(s[2]);
+      PointType end; end[0] = static_cast<float>(e[0]); end[1] = static_cast<float>(e[1]); end[2] = static_cast<float>(e[2]);
+      AddFiber(id, start, end);
+    }
+    ++id;
+  }
+}
+
+void mitk::FiberEndpointIndex::AddFiber(unsigned int id, const PointType& start, const PointType& end)
+{
+  m_Ids.push_back(id);
+  m_Starts.push_back(start);
+  m_Ends.push_back(end);
+}
+
+void mitk::FiberEndpointIndex::Build()
+{
+  m_Keys.clear();
+  m_Keys.reserve(m_Starts.size());
+  for (unsigned int i=0; i<m_Starts.size(); ++i)
+  {
+    int64_t c[3];
+    GetCell(m_Starts[i], c);
+    m_Keys.push_back( {GetKey(c[0], c[1], c[2]), i} );
+  }
+  std::sort(m_Keys.begin(), m_Keys.end());
+}
+
+void mitk::FiberEndpointIndex::GetCell(const PointType& p, int64_t* c) const
+{
+  for (int i=0; i<3; ++i)
+    c[i] = static_cast<int64_t>(std::floor(p[i]/m_Radius));
+}
+
+uint64_t mitk::FiberEndpointIndex::GetKey(int64_t x, int64_t y, int64_t z)
+{
+  // 21 bits per axis; cells further apart collide, which only adds candidates that fail the exact distance check
+  const uint64_t mask = (uint64_t(1)<<21)-1;
+  return  (static_cast<uint64_t>(x) & mask)
+       | ((static_cast<uint64_t>(y) & mask) << 21)
+       | ((static_cast<uint64_t>(z) & mask) << 42);
+}
+
+int mitk::FiberEndpointIndex::FindEndpointMatch(const PointType& start, const PointType& end, float max_dist_sq, unsigned int max_index) const
+{
+  int match = -1;
+
+  // same orientation: candidate start close to query start
+  this->ForEachCandidate(start, [&](unsigned int i)
+  {
+    if (i>=max_index)
+      return false;
+    float dist = (m_Starts[i].SquaredEuclideanDistanceTo(start) + m_Ends[i].SquaredEuclideanDistanceTo(end))/2;
+    if (dist<max_dist_sq)
+    {
+      match = static_cast<int>(i);
+      return true;
+    }
+    return false;
+  });
+  if (match>=0)
+    return match;
+
+  // flipped orientation: candidate start close to query end
+  this->ForEachCandidate(end, [&](unsigned int i)
+  {
+    if (i>=max_index)
+      return false;
+    float dist = (m_Starts[i].SquaredEuclideanDistanceTo(end) + m_Ends[i].SquaredEuclideanDistanceTo(start))/2;
+    if (dist<max_dist_sq)
+    {
+      match = static_cast<int>(i);
+      return true;
+    }
+    return false;
+  });
+
+  return match;
+}
@@ -0,0 +1,98 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#ifndef _MITK_FiberEndpointIndex_H
+#define _MITK_FiberEndpointIndex_H
+
+#include <MitkFiberBundleExports.h>
+#include <vtkPolyData.h>
+#include <itkPoint.h>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace mitk {
+
+/**
+  * \brief Spatial hash of fiber start points on a regular grid. Used to find fibers with matching endpoints
+  * (in either orientation) without comparing every fiber against every other fiber.
+  *
+  * The grid spacing equals the search radius, so all fibers with a start point closer than the radius to a query
+  * point are located in the 27 grid cells around the query point. Cells are stored as a sorted key array.
+  */
+class MITKFIBERBUNDLE_EXPORT FiberEndpointIndex
+{
+public:
+
+  typedef itk::Point<float, 3> PointType;
+
+  FiberEndpointIndex(float radius);
+  ~FiberEndpointIndex();
+
+  /** Adds the start and end points of all fibers in the polydata. Fibers without points are skipped.
+   * The fiber ids are the cell ids plus id_offset. */
+  void AddFibers(vtkPolyData* fibers, unsigned int id_offset=0);
+  void AddFiber(unsigned int id, const PointType& start, const PointType& end);
+
+  /** Sorts the grid keys. Needs to be called after adding fibers and before any query. */
+  void Build();
+
+  unsigned int GetNumberOfFibers() const { return static_cast<unsigned int>(m_Ids.size()); }
+  unsigned int GetFiberId(unsigned int i) const { return m_Ids[i]; }
+  const PointType& GetStart(unsigned int i) const { return m_Starts[i]; }
+  const PointType& GetEnd(unsigned int i) const { return m_Ends[i]; }
+
+  /** Calls f(i) for every indexed fiber i whose start point lies in the grid neighbourhood of p. The callback
+   * returns true to stop the search. i is the position in the index, use GetFiberId(i) to get the fiber id. */
+  template< class TCallback >
+  bool ForEachCandidate(const PointType& p, TCallback f) const
+  {
+    int64_t c[3];
+    GetCell(p, c);
+    for (int64_t x=c[0]-1; x<=c[0]+1; ++x)
+      for (int64_t y=c[1]-1; y<=c[1]+1; ++y)
+        for (int64_t z=c[2]-1; z<=c[2]+1; ++z)
+        {
+          uint64_t key = GetKey(x, y, z);
+          auto it = std::lower_bound(m_Keys.begin(), m_Keys.end(), std::make_pair(key, 0u));
+          for (; it!=m_Keys.end() && it->first==key; ++it)
+            if (f(it->second))
+              return true;
+        }
+    return false;
+  }
+
+  /** Returns the index position of a fiber whose endpoints match start/end (or end/start) with a mean squared
+   * endpoint distance smaller than max_dist_sq, or -1. The radius of the index has to be at least
+   * sqrt(2*max_dist_sq) to find all matches. Only index positions smaller than max_index are considered. */
+  int FindEndpointMatch(const PointType& start, const PointType& end, float max_dist_sq, unsigned int max_index=std::numeric_limits<unsigned int>::max()) const;
+
+protected:
+
+  void GetCell(const PointType& p, int64_t* c) const;
+  static uint64_t GetKey(int64_t x, int64_t y, int64_t z);
+
+  float                                             m_Radius;
+  std::vector< unsigned int >                       m_Ids;
+  std::vector< PointType >                          m_Starts;
+  std::vector< PointType >                          m_Ends;
+  std::vector< std::pair<uint64_t, unsigned int> >  m_Keys;
+};
+
+}
+
+#endif
@@ -19,6 +19,109 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <math.h>
 #include <boost/timer/progress_display.hpp>
 #include <vnl/vnl_sparse_matrix.h>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+
+namespace
+{
+
+/**
+ * Uniform grid over the mean points of cluster centroids. The mean point is invariant to flipping the fiber and
+ * the mean euclidean distance of two fibers is never smaller than the distance of their mean points. With a cell
+ * size of at least the search radius, all centroids that can be closer than the radius are located in the 27 cells
+ * around the query point. Centroids move while fibers are added, so cells are updated when a mean point changes.
+ */
+class CentroidGrid
+{
+public:
+
+  CentroidGrid(double cell_size) : m_CellSize(cell_size) {}
+
+  void Insert(unsigned int k, const double* p)
+  {
+    uint64_t key = GetKey(p);
+    if (k>=m_Keys.size())
+      m_Keys.resize(k+1);
+    m_Keys[k] = key;
+    m_Cells[key].push_back(k);
+  }
+
+  void Update(unsigned int k, const double* p)
+  {
+    uint64_t key = GetKey(p);
+    if (key==m_Keys[k])
+      return;
+    std::vector< unsigned int >& cell = m_Cells[m_Keys[k]];
+    *std::find(cell.begin(), cell.end(), k) = cell.back();
+    cell.pop_back();
+    m_Keys[k] = key;
+    m_Cells[key].push_back(k);
+  }
+
+  template< class TCallback >
+  void ForEachCandidate(const double* p, TCallback f) const
+  {
+    int64_t c[3];
+    for (int i=0; i<3; ++i)
+      c[i] = static_cast<int64_t>(std::floor(p[i]/m_CellSize));
+    for (int64_t x=c[0]-1; x<=c[0]+1; ++x)
+      for (int64_t y=c[1]-1; y<=c[1]+1; ++y)
+        for (int64_t z=c[2]-1; z<=c[2]+1; ++z)
+        {
+          auto it = m_Cells.find(GetKey(x, y, z));
+          if (it!=m_Cells.end())
+            for (unsigned int k : it->second)
+              f(k);
+        }
+  }
+
+private:
+
+  uint64_t GetKey(const double* p) const
+  {
+    return GetKey(static_cast<int64_t>(std::floor(p[0]/m_CellSize)), static_cast<int64_t>(std::floor(p[1]/m_CellSize)), static_cast<int64_t>(std::floor(p[2]/m_CellSize)));
+  }
+
+  static uint64_t GetKey(int64_t x, int64_t y, int64_t z)
+  {
+    // 21 bits per axis; colliding cells only add candidates that fail the exact bound check
+    const uint64_t mask = (uint64_t(1)<<21)-1;
+    return  (static_cast<uint64_t>(x) & mask)
+         | ((static_cast<uint64_t>(y) & mask) << 21)
+         | ((static_cast<uint64_t>(z) & mask) << 42);
+  }
+
+  double                                                      m_CellSize;
+  std::vector< uint64_t >                                     m_Keys;
+  std::unordered_map< uint64_t, std::vector< unsigned int > > m_Cells;
+};
+
+void GetMeanPoint(const float* streamline, unsigned int num_points, double* mean)
+{
+  for (unsigned int r=0; r<3; ++r)
+  {
+    double sum = 0;
+    for (unsigned int j=0; j<num_points; ++j)
+      sum += streamline[r*num_points+j];
+    mean[r] = sum/num_points;
+  }
+}
+
+double SquaredDistance(const double* a, const double* b)
+{
+  return (a[0]-b[0])*(a[0]-b[0]) + (a[1]-b[1])*(a[1]-b[1]) + (a[2]-b[2])*(a[2]-b[2]);
+}
+
+// Search radius in mm for the mean point bound. Slightly enlarged, so float rounding of the exact distance can never
+// prune a cluster that the exhaustive search would select.
+double GetBoundRadius(float dist_thres, float scale)
+{
+  return 1.001*dist_thres/scale + 1e-6;
+}
+
+}
 
 namespace mitk{
 
@@ -97,111 +200,182 @@ float TractClusteringFilter::CalcOverlap(vnl_matrix<float>& t)
   return overlap;
 }
 
-std::vector<vnl_matrix<float> > TractClusteringFilter::ResampleFibers(mitk::FiberBundle::Pointer tractogram)
+std::vector< float > TractClusteringFilter::ResampleFibers(mitk::FiberBundle::Pointer tractogram)
 {
   mitk::FiberBundle::Pointer temp_fib = tractogram->GetDeepCopy();
   if (m_DoResampling)
     temp_fib->ResampleToNumPoints(m_NumPoints);
 
-  std::vector< vnl_matrix<float> > out_fib;
+  const mitk::FiberBundle::FiberPointView& view = temp_fib->GetFiberPointView();
+  const std::size_t size = 3*m_NumPoints;
+  std::vector< float > out_fib(view.GetNumberOfFibers()*size, 0.0);
 
-  for (int i=0; i<temp_fib->GetFiberPolyData()->GetNumberOfCells(); i++)
+#pragma omp parallel for
+  for (int i=0; i<static_cast<int>(view.GetNumberOfFibers()); i++)
   {
-    vtkCell* cell = temp_fib->GetFiberPolyData()->GetCell(i);
-    int numPoints = cell->GetNumberOfPoints();
-    vtkPoints* points = cell->GetPoints();
-
-    vnl_matrix<float> streamline;
-    streamline.set_size(3, m_NumPoints);
-    streamline.fill(0.0);
-
-    for (int j=0; j<numPoints; j++)
+    float* streamline = &out_fib[i*size];
+    unsigned int numPoints = std::min(view.GetNumberOfPoints(i), m_NumPoints);
+    for (unsigned int j=0; j<numPoints; j++)
     {
-      double cand[3];
-      points->GetPoint(j, cand);
-
-      vnl_vector_fixed< float, 3 > candV;
-      candV[0]=cand[0]; candV[1]=cand[1]; candV[2]=cand[2];
-      streamline.set_column(j, candV.as_vector());
+      const float* p = view.GetPoint(i, j);
+      streamline[j] = p[0];
+      streamline[m_NumPoints+j] = p[1];
+      streamline[2*m_NumPoints+j] = p[2];
     }
-
-    out_fib.push_back(streamline);
   }
 
   return out_fib;
 }
 
+ClusteringMetricEuclideanMean* TractClusteringFilter::GetMeanDistanceMetric() const
+{
+  if (m_Metrics.size()!=1)
+    return nullptr;
+  ClusteringMetricEuclideanMean* metric = dynamic_cast<ClusteringMetricEuclideanMean*>(m_Metrics.at(0));
+  if (metric==nullptr || !(metric->GetScale()>0))
+    return nullptr;
+  return metric;
+}
+
 std::vector< TractClusteringFilter::Cluster > TractClusteringFilter::ClusterStep(std::vector< unsigned int > f_indices, std::vector<float> distances)
 {
   float dist_thres = distances.back();
   distances.pop_back();
-  std::vector< Cluster > C;
 
+  const unsigned int size = 3*m_NumPoints;
   int N = f_indices.size();
 
-  Cluster c1;
-  c1.I.push_back(f_indices.at(0));
-  c1.h = T[f_indices.at(0)];
-  c1.n = 1;
-  C.push_back(c1);
-  if (f_indices.size()==1)
-    return C;
+  // cluster state in contiguous buffers: centroid sums (h), centroids (h/n) and the mean points of the centroids
+  std::vector< float > sums;
+  std::vector< float > centroids;
+  std::vector< double > means;
+  std::vector< int > counts;
+  std::vector< std::vector< unsigned int > > members;
+
+  // with the mean euclidean distance as only metric, candidate clusters are pruned by their mean point distance
+  ClusteringMetricEuclideanMean* mdf = GetMeanDistanceMetric();
+  double radius = 0;
+  std::unique_ptr< CentroidGrid > grid;
+  if (mdf!=nullptr)
+  {
+    radius = GetBoundRadius(dist_thres, mdf->GetScale());
+    grid.reset(new CentroidGrid(std::max(radius, 0.01)));
+  }
+  std::vector< vnl_matrix<float> > centroid_matrices;
 
-  for (int i=1; i<N; ++i)
+  for (int i=0; i<N; ++i)
   {
-    vnl_matrix<float> t = T.at(f_indices.at(i));
+    const float* t = GetStreamline(f_indices.at(i));
 
     int min_cluster_index = -1;
     float min_cluster_distance = 99999;
     bool flip = false;
 
-    for (unsigned int k=0; k<C.size(); ++k)
+    // the exhaustive search takes the first cluster with minimal distance, candidates are visited in grid order
+    auto check_candidate = [&](int k, float d, bool f)
     {
-      vnl_matrix<float> v = C.at(k).h / C.at(k).n;
-      bool f = false;
-      float d = 0;
-      for (auto m : m_Metrics)
-        d += m->CalculateDistance(t, v, f);
-      d /= m_Metrics.size();
-
-      if (d<min_cluster_distance)
+      if (d<min_cluster_distance || (d==min_cluster_distance && k<min_cluster_index))
       {
         min_cluster_distance = d;
         min_cluster_index = k;
         flip = f;
       }
+    };
+
+    double t_mean[3];
+    if (mdf!=nullptr)
+    {
+      GetMeanPoint(t, m_NumPoints, t_mean);
+      grid->ForEachCandidate(t_mean, [&](unsigned int k)
+      {
+        if (SquaredDistance(t_mean, &means[3*k]) > radius*radius)
+          return;
+        bool f = false;
+        float d = mdf->CalculateDistance(t, &centroids[k*size], m_NumPoints, f);
+        check_candidate(k, d, f);
+      });
+    }
+    else
+    {
+      vnl_matrix<float> t_matrix(t, 3, m_NumPoints);
+      for (unsigned int k=0; k<counts.size(); ++k)
+      {
+        bool f = false;
+        float d = 0;
+        for (auto m : m_Metrics)
+          d += m->CalculateDistance(t_matrix, centroid_matrices.at(k), f);
+        d /= m_Metrics.size();
+        check_candidate(k, d, f);
+      }
     }
 
-    if (min_cluster_index>=0 && min_cluster_distance<dist_thres)
+    int k = min_cluster_index;
+    if (k>=0 && min_cluster_distance<dist_thres)
     {
-      C[min_cluster_index].I.push_back(f_indices.at(i));
+      members[k].push_back(f_indices.at(i));
+      float* h = &sums[k*size];
       if (!flip)
-        C[min_cluster_index].h += t;
+      {
+        for (unsigned int j=0; j<size; ++j)
+          h[j] += t[j];
+      }
       else
-        C[min_cluster_index].h += t.fliplr();
-      C[min_cluster_index].n += 1;
+      {
+        for (unsigned int r=0; r<3; ++r)
+          for (unsigned int j=0; j<m_NumPoints; ++j)
+            h[r*m_NumPoints+j] += t[r*m_NumPoints+m_NumPoints-j-1];
+      }
+      counts[k] += 1;
+
+      float* v = &centroids[k*size];
+      float n = counts[k];
+      for (unsigned int j=0; j<size; ++j)
+        v[j] = h[j]/n;
+
+      if (mdf!=nullptr)
+      {
+        GetMeanPoint(v, m_NumPoints, &means[3*k]);
+        grid->Update(k, &means[3*k]);
+      }
+      else
+        centroid_matrices[k].copy_in(v);
     }
     else
     {
-      Cluster c;
-      c.I.push_back(f_indices.at(i));
-      c.h = t;
-      c.n = 1;
-      C.push_back(c);
+      k = counts.size();
+      members.push_back({f_indices.at(i)});
+      counts.push_back(1);
+      sums.insert(sums.end(), t, t+size);
+      centroids.insert(centroids.end(), t, t+size);
+      if (mdf!=nullptr)
+      {
+        means.insert(means.end(), t_mean, t_mean+3);
+        grid->Insert(k, t_mean);
+      }
+      else
+        centroid_matrices.push_back(vnl_matrix<float>(t, 3, m_NumPoints));
     }
   }
 
+  std::vector< Cluster > C(counts.size());
+  for (unsigned int k=0; k<C.size(); ++k)
+  {
+    C[k].I.swap(members[k]);
+    C[k].n = counts[k];
+    C[k].h = vnl_matrix<float>(&sums[k*size], 3, m_NumPoints);
+  }
+
   if (!distances.empty())
   {
-    std::vector< Cluster > outC;
-#pragma omp parallel for
+    // subclusters are appended in cluster order, so the result does not depend on the thread scheduling
+    std::vector< std::vector< Cluster > > subclusters(C.size());
+#pragma omp parallel for schedule(dynamic)
     for (int c=0; c<(int)C.size(); c++)
-    {
+      subclusters[c] = ClusterStep(C.at(c).I, distances);
 
-      std::vector< Cluster > tempC = ClusterStep(C.at(c).I, distances);
-#pragma omp critical
+    std::vector< Cluster > outC;
+    for (auto& tempC : subclusters)
       AppendCluster(outC, tempC);
-    }
     return outC;
   }
   else
@@ -273,38 +447,53 @@ std::vector< TractClusteringFilter::Cluster > TractClusteringFilter::MergeDuplic
 
   MITK_INFO << "Merging duplicate clusters with distance threshold " << m_MergeDuplicateThreshold;
 
+  ClusteringMetricEuclideanMean* mdf = GetMeanDistanceMetric();
+  double radius = mdf!=nullptr ? GetBoundRadius(m_MergeDuplicateThreshold, mdf->GetScale()) : 0;
+
   std::vector< TractClusteringFilter::Cluster > new_clusters;
-  for (Cluster c1 : clusters)
+  std::vector< vnl_matrix<float> > new_centroids;
+  std::vector< double > new_means;
+  for (const Cluster& c1 : clusters)
   {
     vnl_matrix<float> t = c1.h / c1.n;
+    double t_mean[3];
+    GetMeanPoint(t.data_block(), t.cols(), t_mean);
 
-    int min_idx = -1;
-    float min_d = 99999;
-    bool flip = false;
-
+    std::vector< float > dists(new_clusters.size(), 99999);
+    std::vector< unsigned char > flips(new_clusters.size(), 0);
 #pragma omp parallel for
     for (int k2=0; k2<(int)new_clusters.size(); ++k2)
     {
-      Cluster c2 = new_clusters.at(k2);
-      vnl_matrix<float> v = c2.h / c2.n;
+      if (mdf!=nullptr && SquaredDistance(t_mean, &new_means[3*k2]) > radius*radius)
+        continue;
 
       bool f = false;
       float d = 0;
       for (auto m : m_Metrics)
-        d += m->CalculateDistance(t, v, f);
+        d += m->CalculateDistance(t, new_centroids[k2], f);
       d /= m_Metrics.size();
+      dists[k2] = d;
+      flips[k2] = f;
+    }
 
-#pragma omp critical
-      if (d<min_d && d<m_MergeDuplicateThreshold)
+    // serial selection, so ties are resolved by cluster order independent of the thread scheduling
+    int min_idx = -1;
+    float min_d = 99999;
+    bool flip = false;
+    for (unsigned int k2=0; k2<dists.size(); ++k2)
+      if (dists[k2]<min_d && dists[k2]<m_MergeDuplicateThreshold)
       {
-        min_d = d;
+        min_d = dists[k2];
         min_idx = k2;
-        flip = f;
+        flip = flips[k2];
       }
-    }
 
     if (min_idx<0)
+    {
       new_clusters.push_back(c1);
+      new_centroids.push_back(t);
+      new_means.insert(new_means.end(), t_mean, t_mean+3);
+    }
     else
     {
       for (int i=0; i<c1.n; ++i)
@@ -315,7 +504,12 @@ std::vector< TractClusteringFilter::Cluster > TractClusteringFilter::MergeDuplic
       if (!flip)
         new_clusters[min_idx].h += c1.h;
       else
-        new_clusters[min_idx].h += c1.h.fliplr();
+      {
+        vnl_matrix<float> h = c1.h;
+        new_clusters[min_idx].h += h.fliplr();
+      }
+      new_centroids[min_idx] = new_clusters[min_idx].h / new_clusters[min_idx].n;
+      GetMeanPoint(new_centroids[min_idx].data_block(), new_centroids[min_idx].cols(), &new_means[3*min_idx]);
     }
   }
 
@@ -404,14 +598,14 @@ std::vector<TractClusteringFilter::Cluster> TractClusteringFilter::AddToKnownClu
   int N = f_indices.size();
 
   std::vector< Cluster > C;
-  vnl_matrix<float> zero_h; zero_h.set_size(T.at(0).rows(), T.at(0).cols()); zero_h.fill(0.0);
+  vnl_matrix<float> zero_h; zero_h.set_size(3, m_NumPoints); zero_h.fill(0.0);
   Cluster no_fit;
   no_fit.h = zero_h;
 
   for (unsigned int i=0; i<centroids.size(); ++i)
   {
     Cluster c;
-    c.h.set_size(T.at(0).rows(), T.at(0).cols()); c.h.fill(0.0);
+    c.h.set_size(3, m_NumPoints); c.h.fill(0.0);
     c.f_id = i;
     C.push_back(c);
   }
@@ -419,7 +613,7 @@ std::vector<TractClusteringFilter::Cluster> TractClusteringFilter::AddToKnownClu
 #pragma omp parallel for
   for (int i=0; i<N; ++i)
   {
-    vnl_matrix<float> t = T.at(f_indices.at(i));
+    vnl_matrix<float> t(GetStreamline(f_indices.at(i)), 3, m_NumPoints);
 
     int min_cluster_index = -1;
     float min_cluster_distance = 99999;
@@ -428,7 +622,7 @@ std::vector<TractClusteringFilter::Cluster> TractClusteringFilter::AddToKnownClu
     if (CalcOverlap(t)>=m_OverlapThreshold)
     {
       int c_idx = 0;
-      for (vnl_matrix<float> centroid : centroids)
+      for (vnl_matrix<float>& centroid : centroids)
       {
         bool f = false;
         float d = 0;
@@ -485,15 +679,15 @@ void TractClusteringFilter::GenerateData()
     return;
   }
 
-  T = ResampleFibers(m_Tractogram);
-  if (T.empty())
+  m_Streamlines = ResampleFibers(m_Tractogram);
+  if (m_Streamlines.empty())
   {
     MITK_INFO << "No fibers in tractogram!";
     return;
   }
 
   std::vector< unsigned int > f_indices;
-  for (unsigned int i=0; i<T.size(); ++i)
+  for (unsigned int i=0; i<m_Streamlines.size()/(3*m_NumPoints); ++i)
     f_indices.push_back(i);
   //  std::random_shuffle(f_indices.begin(), f_indices.end());
 
@@ -509,7 +703,10 @@ void TractClusteringFilter::GenerateData()
   }
   else
   {
-    std::vector<vnl_matrix<float> > centroids = ResampleFibers(m_InCentroids);
+    std::vector< float > centroid_buffer = ResampleFibers(m_InCentroids);
+    std::vector<vnl_matrix<float> > centroids;
+    for (std::size_t i=0; i<centroid_buffer.size(); i+=3*m_NumPoints)
+      centroids.push_back(vnl_matrix<float>(&centroid_buffer[i], 3, m_NumPoints));
     if (centroids.empty())
     {
       MITK_INFO << "No fibers in centroid tractogram!";
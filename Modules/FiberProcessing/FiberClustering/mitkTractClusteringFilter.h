@@ -20,6 +20,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <mitkPlanarEllipse.h>
 #include <mitkFiberBundle.h>
 #include "mitkClusteringMetric.h"
+#include "mitkClusteringMetricEuclideanMean.h"
 #include <MitkFiberProcessingExports.h>
 
 // ITK
@@ -98,7 +99,9 @@ public:
 protected:
 
   void GenerateData();
-  std::vector< vnl_matrix<float> > ResampleFibers(FiberBundle::Pointer tractogram);
+  std::vector< float > ResampleFibers(FiberBundle::Pointer tractogram); ///< resampled fibers, each stored like a 3xNumPoints vnl_matrix (x, y and z rows)
+  const float* GetStreamline(unsigned int i) const { return &m_Streamlines[static_cast<std::size_t>(i)*3*m_NumPoints]; }
+  ClusteringMetricEuclideanMean* GetMeanDistanceMetric() const; ///< the metric if mean euclidean distance is the only metric, else nullptr
   float CalcOverlap(vnl_matrix<float>& t);
 
   std::vector< Cluster > ClusterStep(std::vector< unsigned int > f_indices, std::vector< float > distances);
@@ -114,7 +117,7 @@ protected:
   mitk::FiberBundle::Pointer                  m_InCentroids;
   std::vector< mitk::FiberBundle::Pointer >   m_OutTractograms;
   std::vector< mitk::FiberBundle::Pointer >   m_OutCentroids;
-  std::vector<vnl_matrix<float> >             T;
+  std::vector< float >                        m_Streamlines;
   unsigned int                                m_MinClusterSize;
   unsigned int                                m_MaxClusters;
   unsigned int                                m_DiscardedClusters;
@@ -27,6 +27,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <boost/timer/progress_display.hpp>
 #include <vtkBox.h>
 #include <mitkDiffusionModellingHelperFunctions.h>
+#include <omp.h>
 
 namespace itk{
 
@@ -59,11 +60,42 @@ void TractDensityImageFilter< OutputImageType, RefImageType >::SetMode(const TDI
   m_Mode = Mode;
 }
 
+template< class OutputImageType, class RefImageType >
+void TractDensityImageFilter< OutputImageType, RefImageType >::SetFiberBundles(const std::vector< mitk::FiberBundle::Pointer >& FiberBundles)
+{
+  m_FiberBundles = FiberBundles;
+  this->Modified();
+}
+
+template< class OutputImageType, class RefImageType >
+std::vector< typename OutputImageType::Pointer > TractDensityImageFilter< OutputImageType, RefImageType >::GetBundleImages() const
+{
+  return m_BundleImages;
+}
+
+template< class OutputImageType, class RefImageType >
+std::vector< typename TractDensityImageFilter< OutputImageType, RefImageType >::OutPixelType > TractDensityImageFilter< OutputImageType, RefImageType >::GetMaxDensities() const
+{
+  return m_MaxDensities;
+}
+
+template< class OutputImageType, class RefImageType >
+std::vector< unsigned int > TractDensityImageFilter< OutputImageType, RefImageType >::GetNumCoveredVoxelsPerBundle() const
+{
+  return m_NumCoveredVoxelsPerBundle;
+}
+
 template< class OutputImageType, class RefImageType >
 void TractDensityImageFilter< OutputImageType, RefImageType >::GenerateData()
 {
+  std::vector< mitk::FiberBundle::Pointer > bundles = m_FiberBundles;
+  if (bundles.empty())
+    bundles.push_back(m_FiberBundle);
+  if (bundles.size()>1 && !(m_UseImageGeometry && !m_InputImage.IsNull()))
+    itkExceptionMacro("TractDensityImageFilter: rasterizing multiple fiber bundles requires a reference image geometry");
+
   // generate upsampled image
-  mitk::BaseGeometry::Pointer geometry = m_FiberBundle->GetGeometry();
+  mitk::BaseGeometry::Pointer geometry = bundles.at(0)->GetGeometry();
   typename OutputImageType::Pointer outImage = this->GetOutput();
 
   // calculate new image parameters
@@ -104,7 +136,6 @@ void TractDensityImageFilter< OutputImageType, RefImageType >::GenerateData()
     upsampledRegion.SetSize(1, ceil( geometry->GetExtent(1)*m_UpsamplingFactor ) );
     upsampledRegion.SetSize(2, ceil( geometry->GetExtent(2)*m_UpsamplingFactor ) );
   }
-  typename OutputImageType::RegionType::SizeType upsampledSize = upsampledRegion.GetSize();
 
   // apply new image parameters
   outImage->SetSpacing( newSpacing );
@@ -116,96 +147,186 @@ void TractDensityImageFilter< OutputImageType, RefImageType >::GenerateData()
   outImage->Allocate();
   outImage->FillBuffer(0.0);
 
-  int w = upsampledSize[0];
-  int h = upsampledSize[1];
-  int d = upsampledSize[2];
-
-  // set/initialize output
-  OutPixelType* outImageBufferPointer = (OutPixelType*)outImage->GetBufferPointer();
+  // one output volume per bundle, the first one is the filter output
+  m_BundleImages.clear();
+  m_BundleImages.push_back(outImage);
+  for (unsigned int b=1; b<bundles.size(); ++b)
+  {
+    typename OutputImageType::Pointer image = OutputImageType::New();
+    image->CopyInformation(outImage);
+    image->SetBufferedRegion( upsampledRegion );
+    image->SetRequestedRegion( upsampledRegion );
+    image->Allocate();
+    image->FillBuffer(0.0);
+    m_BundleImages.push_back(image);
+  }
 
   MITK_INFO << "TractDensityImageFilter: starting image generation";
-  vtkSmartPointer<vtkPolyData> fiberPolyData = m_FiberBundle->GetFiberPolyData();
+  RasterizeFibers(bundles);
 
-  int numFibers = m_FiberBundle->GetNumFibers();
-  boost::timer::progress_display disp(numFibers);
-  for( int i=0; i<numFibers; i++ )
-  {
-    ++disp;
-    vtkCell* cell = fiberPolyData->GetCell(i);
-    int numPoints = cell->GetNumberOfPoints();
-    vtkPoints* points = cell->GetPoints();
+  m_MaxDensities.clear();
+  for (auto image : m_BundleImages)
+    m_MaxDensities.push_back(NormalizeImage(image));
+  m_MaxDensity = m_MaxDensities.at(0);
+  m_NumCoveredVoxels = m_NumCoveredVoxelsPerBundle.at(0);
+  MITK_INFO << "TractDensityImageFilter: finished processing";
+}
+
+template< class OutputImageType, class RefImageType >
+void TractDensityImageFilter< OutputImageType, RefImageType >::RasterizeFibers(const std::vector< mitk::FiberBundle::Pointer >& bundles)
+{
+  typename OutputImageType::Pointer outImage = this->GetOutput();
+  const ImageRegion<3> region = outImage->GetLargestPossibleRegion();
+  const itk::Vector<double,3> spacing = outImage->GetSpacing();
+  const int depth = region.GetSize(2);
+  const int num_slabs = std::max(1, std::min(omp_get_max_threads(), depth));
+
+  std::vector< OutPixelType* > buffers;
+  for (auto image : m_BundleImages)
+    buffers.push_back(image->GetBufferPointer());
+  std::vector< std::vector< unsigned int > > covered(num_slabs, std::vector< unsigned int >(bundles.size(), 0));
 
-    float weight = m_FiberBundle->GetFiberWeight(i);
+  // global fiber list: (bundle, fiber) in bundle order
+  std::vector< std::pair< unsigned int, unsigned int > > fibers;
+  for (unsigned int b=0; b<bundles.size(); ++b)
+    for (unsigned int i=0; i<bundles.at(b)->GetNumFibers(); ++i)
+      fibers.push_back(std::make_pair(b, i));
+  std::vector< const mitk::FiberBundle::FiberPointView* > views;
+  for (auto fib : bundles)
+    views.push_back(&fib->GetFiberPointView());
 
-    // fill output image
-    for( int j=0; j<numPoints-1; j++)
+  // slab of z-slices owned by each thread
+  std::vector< int > slab_of_slice(depth);
+  for (int t=0; t<num_slabs; ++t)
+    for (int z=t*depth/num_slabs; z<(t+1)*depth/num_slabs; ++z)
+      slab_of_slice[z] = t;
+
+  // Fibers are processed in batches. The voxel intersections of a batch are computed in parallel per fiber and
+  // bucketed by slab. Then every thread applies the intersections of its slab in fiber order. Each voxel thus
+  // receives its contributions in the same order as with sequential processing, so the result is exactly the same.
+  const int batch_size = 10000;
+  std::vector< std::vector< std::vector< Segment > > > segments(std::min(static_cast<std::size_t>(batch_size), fibers.size()), std::vector< std::vector< Segment > >(num_slabs));
+  boost::timer::progress_display disp(fibers.size());
+  for (std::size_t batch_start=0; batch_start<fibers.size(); batch_start+=batch_size)
+  {
+    int batch_end = static_cast<int>(std::min(fibers.size(), batch_start+batch_size) - batch_start);
+
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int f=0; f<batch_end; ++f)
     {
-      itk::Point<float, 3> startVertex = mitk::imv::GetItkPoint(points->GetPoint(j));
-      itk::Index<3> startIndex;
-      itk::ContinuousIndex<float, 3> startIndexCont;
-      (void)outImage->TransformPhysicalPointToIndex(startVertex, startIndex);
-      (void)outImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
-
-      itk::Point<float, 3> endVertex = mitk::imv::GetItkPoint(points->GetPoint(j + 1));
-      itk::Index<3> endIndex;
-      itk::ContinuousIndex<float, 3> endIndexCont;
-      (void)outImage->TransformPhysicalPointToIndex(endVertex, endIndex);
-      (void)outImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
-
-      std::vector< std::pair< itk::Index<3>, double > > segments = mitk::imv::IntersectImage(newSpacing, startIndex, endIndex, startIndexCont, endIndexCont);
-      for (std::pair< itk::Index<3>, double > segment : segments)
+      unsigned int b = fibers[batch_start+f].first;
+      unsigned int i = fibers[batch_start+f].second;
+      const mitk::FiberBundle::FiberPointView& view = *views[b];
+      float weight = bundles.at(b)->GetFiberWeight(i);
+      std::vector< std::vector< Segment > >& fiber_segments = segments[f];
+      for (auto& slab_segments : fiber_segments)
+        slab_segments.clear();
+
+      int numPoints = view.GetNumberOfPoints(i);
+      for( int j=0; j<numPoints-1; j++)
       {
-        if (!outImage->GetLargestPossibleRegion().IsInside(segment.first))
-          continue;
-        if (outImage->GetPixel(segment.first)==0)
-          m_NumCoveredVoxels++;
+        const float* p1 = view.GetPoint(i, j);
+        itk::Point<float, 3> startVertex; startVertex[0] = p1[0]; startVertex[1] = p1[1]; startVertex[2] = p1[2];
+        itk::Index<3> startIndex;
+        itk::ContinuousIndex<float, 3> startIndexCont;
+        (void)outImage->TransformPhysicalPointToIndex(startVertex, startIndex);
+        (void)outImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
 
-        switch (m_Mode)
-        {
-        case BINARY:
-        {
-          outImage->SetPixel(segment.first, 1);
-          break;
-        }
-        case VISITATION_COUNT:
-        {
-          outImage->SetPixel(segment.first, outImage->GetPixel(segment.first) + 1);
-          break;
-        }
-        case DENSITY:
+        const float* p2 = view.GetPoint(i, j+1);
+        itk::Point<float, 3> endVertex; endVertex[0] = p2[0]; endVertex[1] = p2[1]; endVertex[2] = p2[2];
+        itk::Index<3> endIndex;
+        itk::ContinuousIndex<float, 3> endIndexCont;
+        (void)outImage->TransformPhysicalPointToIndex(endVertex, endIndex);
+        (void)outImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
+
+        std::vector< std::pair< itk::Index<3>, double > > intersections = mitk::imv::IntersectImage(spacing, startIndex, endIndex, startIndexCont, endIndexCont);
+        for (std::pair< itk::Index<3>, double > intersection : intersections)
         {
-          outImage->SetPixel(segment.first, outImage->GetPixel(segment.first)+segment.second * weight);
-          break;
+          if (!region.IsInside(intersection.first))
+            continue;
+          Segment segment;
+          segment.m_Offset = outImage->ComputeOffset(intersection.first);
+          segment.m_Value = intersection.second * weight;
+          fiber_segments[slab_of_slice[intersection.first[2] - region.GetIndex(2)]].push_back(segment);
         }
-        default:
+      }
+#pragma omp critical
+      ++disp;
+    }
+
+#pragma omp parallel for schedule(static, 1)
+    for (int t=0; t<num_slabs; ++t)
+    {
+      for (int f=0; f<batch_end; ++f)
+      {
+        unsigned int b = fibers[batch_start+f].first;
+        OutPixelType* buffer = buffers[b];
+        for (const Segment& segment : segments[f][t])
         {
-          outImage->SetPixel(segment.first, outImage->GetPixel(segment.first)+segment.second * weight);
-        }
+          OutPixelType& pixel = buffer[segment.m_Offset];
+          if (pixel==0)
+            covered[t][b]++;
+
+          switch (m_Mode)
+          {
+          case BINARY:
+          {
+            pixel = 1;
+            break;
+          }
+          case VISITATION_COUNT:
+          {
+            pixel = pixel + 1;
+            break;
+          }
+          case DENSITY:
+          {
+            pixel = pixel + segment.m_Value;
+            break;
+          }
+          default:
+          {
+            pixel = pixel + segment.m_Value;
+          }
+          }
         }
       }
     }
   }
 
-  m_MaxDensity = 0;
-  for (int i=0; i<w*h*d; i++)
-    if (m_MaxDensity < outImageBufferPointer[i])
-      m_MaxDensity = outImageBufferPointer[i];
+  m_NumCoveredVoxelsPerBundle.assign(bundles.size(), 0);
+  for (int t=0; t<num_slabs; ++t)
+    for (unsigned int b=0; b<bundles.size(); ++b)
+      m_NumCoveredVoxelsPerBundle[b] += covered[t][b];
+}
+
+template< class OutputImageType, class RefImageType >
+typename TractDensityImageFilter< OutputImageType, RefImageType >::OutPixelType TractDensityImageFilter< OutputImageType, RefImageType >::NormalizeImage(typename OutputImageType::Pointer image)
+{
+  OutPixelType* outImageBufferPointer = image->GetBufferPointer();
+  int num_voxels = image->GetLargestPossibleRegion().GetNumberOfPixels();
+
+  OutPixelType max_density = 0;
+  for (int i=0; i<num_voxels; i++)
+    if (max_density < outImageBufferPointer[i])
+      max_density = outImageBufferPointer[i];
   if (!m_OutputAbsoluteValues && m_Mode!=BINARY)
   {
     MITK_INFO << "TractDensityImageFilter: max-normalizing output image";
-    if (m_MaxDensity>0)
-      for (int i=0; i<w*h*d; i++)
-      {
-        outImageBufferPointer[i] /= m_MaxDensity;
-      }
+    if (max_density>0)
+    {
+#pragma omp parallel for
+      for (int i=0; i<num_voxels; i++)
+        outImageBufferPointer[i] /= max_density;
+    }
   }
   if (m_InvertImage)
   {
     MITK_INFO << "TractDensityImageFilter: inverting image";
-    for (int i=0; i<w*h*d; i++)
+#pragma omp parallel for
+    for (int i=0; i<num_voxels; i++)
       outImageBufferPointer[i] = 1-outImageBufferPointer[i];
   }
-  MITK_INFO << "TractDensityImageFilter: finished processing";
+  return max_density;
 }
 }
-
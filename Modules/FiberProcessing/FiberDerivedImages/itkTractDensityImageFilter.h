@@ -64,6 +64,14 @@ public:
 
   void GenerateData() override;
 
+  /** Rasterize several bundles in one pass over the data. Requires UseImageGeometry and an input image. The filter
+   * output is the image of the first bundle, GetBundleImages() returns the images of all bundles in input order.
+   * Each image is identical to the output of a separate run with the respective bundle. */
+  void SetFiberBundles(const std::vector< mitk::FiberBundle::Pointer >& FiberBundles);
+  std::vector< typename OutputImageType::Pointer > GetBundleImages() const;
+  std::vector< OutPixelType > GetMaxDensities() const;
+  std::vector< unsigned int > GetNumCoveredVoxelsPerBundle() const;
+
   TDI_MODE GetMode() const;
   void SetMode(const TDI_MODE &Mode);
 
@@ -72,6 +80,16 @@ protected:
   TractDensityImageFilter();
   ~TractDensityImageFilter() override;
 
+  /** Fiber segment inside a voxel: buffer offset and weighted length */
+  struct Segment
+  {
+    OffsetValueType m_Offset;
+    double          m_Value;
+  };
+
+  void RasterizeFibers(const std::vector< mitk::FiberBundle::Pointer >& bundles);
+  OutPixelType NormalizeImage(typename OutputImageType::Pointer image); ///< normalizes/inverts the image and returns its maximum before normalization
+
   typename RefImageType::Pointer    m_InputImage;           ///< use input image geometry to initialize output image
   mitk::FiberBundle::Pointer        m_FiberBundle;          ///< input fiber bundle
   float                             m_UpsamplingFactor;     ///< use higher resolution for ouput image
@@ -84,6 +102,11 @@ protected:
   bool                              m_WorkOnFiberCopy;
   OutPixelType                      m_MaxDensity;
   unsigned int                      m_NumCoveredVoxels;
+
+  std::vector< mitk::FiberBundle::Pointer >         m_FiberBundles;
+  std::vector< typename OutputImageType::Pointer >  m_BundleImages;
+  std::vector< OutPixelType >                       m_MaxDensities;
+  std::vector< unsigned int >                       m_NumCoveredVoxelsPerBundle;
 };
 
 }
@@ -13,6 +13,8 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include <boost/timer/progress_display.hpp>
+#include <algorithm>
+#include <tuple>
 #include <mitkDiffusionModellingHelperFunctions.h>
 
 namespace itk{
@@ -130,157 +132,146 @@ void TractsToVectorImageFilter< PixelType >::GenerateData()
   m_DirectionImage->Allocate();
   m_DirectionImage->FillBuffer(0.0);
 
-  // iterate over all fibers
-  vtkSmartPointer<vtkPolyData> fiberPolyData = m_FiberBundle->GetFiberPolyData();
+  const mitk::FiberBundle::FiberPointView& view = m_FiberBundle->GetFiberPointView();
   int numFibers = m_FiberBundle->GetNumFibers();
-  m_DirectionsContainer = ContainerType::New();
-
-  VectorContainer< unsigned int, std::vector< double > >::Pointer peakLengths = VectorContainer< unsigned int, std::vector< double > >::New();
+  const std::size_t numVoxels = outImageSize[0]*outImageSize[1]*outImageSize[2];
 
+  // first pass: number of segments per voxel, stored at offsets[voxel+1]
   MITK_INFO << "Generating directions from tractogram";
-  boost::timer::progress_display disp(numFibers);
+  std::vector< std::size_t > offsets(numVoxels+1, 0);
+#pragma omp parallel for schedule(dynamic, 16)
   for( int i=0; i<numFibers; i++ )
   {
-    ++disp;
-    vtkCell* cell = fiberPolyData->GetCell(i);
-    int numPoints = cell->GetNumberOfPoints();
-    vtkPoints* points = cell->GetPoints();
-    if (numPoints<2)
-      continue;
-
-    vnl_vector_fixed<double, 3> dir;
-    vnl_vector<double> v;
+    this->ForEachVoxelSegment(view, i, [&](std::size_t voxel, unsigned int, unsigned int, const float*, double)
+    {
+#pragma omp atomic
+      ++offsets[voxel+1];
+    });
+  }
+  for (std::size_t v=0; v<numVoxels; ++v)
+    offsets[v+1] += offsets[v];
 
+  // second pass: offsets[voxel] is used as write position of the voxel and ends up at the start of the next voxel
+  std::vector< VoxelSegment > segments(offsets[numVoxels]);
+  boost::timer::progress_display disp(numFibers);
+#pragma omp parallel for schedule(dynamic, 16)
+  for( int i=0; i<numFibers; i++ )
+  {
     float fiberWeight = m_FiberBundle->GetFiberWeight(i);
-
-    for( int j=0; j<numPoints-1; j++)
+    this->ForEachVoxelSegment(view, i, [&](std::size_t voxel, unsigned int j, unsigned int k, const float* dir, double length)
     {
-      itk::Point<float, 3> startVertex = mitk::imv::GetItkPoint(points->GetPoint(j));
-      itk::Index<3> startIndex;
-      itk::ContinuousIndex<float, 3> startIndexCont;
-      (void)m_MaskImage->TransformPhysicalPointToIndex(startVertex, startIndex);
-      (void)m_MaskImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
-
-      itk::Point<float, 3> endVertex = mitk::imv::GetItkPoint(points->GetPoint(j + 1));
-      itk::Index<3> endIndex;
-      itk::ContinuousIndex<float, 3> endIndexCont;
-      (void)m_MaskImage->TransformPhysicalPointToIndex(endVertex, endIndex);
-      (void)m_MaskImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
-
-      dir[0] = endVertex[0]-startVertex[0];
-      dir[1] = endVertex[1]-startVertex[1];
-      dir[2] = endVertex[2]-startVertex[2];
-      if (dir.is_zero())
-        continue;
-      dir.normalize();
-
-      std::vector< std::pair< itk::Index<3>, double > > segments = mitk::imv::IntersectImage(spacing3, startIndex, endIndex, startIndexCont, endIndexCont);
-      for (std::pair< itk::Index<3>, double > segment : segments)
-      {
-        if (!m_MaskImage->GetLargestPossibleRegion().IsInside(segment.first) || (!m_OnlyUseMaskGeometry && m_MaskImage->GetPixel(segment.first)==0))
-          continue;
-
-        // add direction to container
-        unsigned int idx = segment.first[0] + outImageSize[0]*(segment.first[1] + outImageSize[1]*segment.first[2]);
-        DirectionContainerType::Pointer dirCont;
-        if (m_DirectionsContainer->IndexExists(idx))
-        {
-          peakLengths->ElementAt(idx).push_back(fiberWeight*segment.second);
-
-          dirCont = m_DirectionsContainer->GetElement(idx);
-          if (dirCont.IsNull())
-          {
-            dirCont = DirectionContainerType::New();
-            dirCont->push_back(dir);
-            m_DirectionsContainer->InsertElement(idx, dirCont);
-          }
-          else
-            dirCont->push_back(dir);
-        }
-        else
-        {
-          dirCont = DirectionContainerType::New();
-          dirCont->push_back(dir);
-          m_DirectionsContainer->InsertElement(idx, dirCont);
-
-          std::vector< double > lengths; lengths.push_back(fiberWeight*segment.second);
-          peakLengths->InsertElement(idx, lengths);
-        }
-      }
-
-    }
+      std::size_t pos;
+#pragma omp atomic capture
+      pos = offsets[voxel]++;
+
+      VoxelSegment& segment = segments[pos];
+      segment.m_Direction[0] = dir[0];
+      segment.m_Direction[1] = dir[1];
+      segment.m_Direction[2] = dir[2];
+      segment.m_Length = fiberWeight*length;
+      segment.m_Fiber = static_cast<unsigned int>(i);
+      segment.m_Segment = j;
+      segment.m_Intersection = k;
+    });
+#pragma omp critical
+    ++disp;
   }
-
-  itk::ImageRegionIterator<ItkUcharImgType> dirIt(m_NumDirectionsImage, m_NumDirectionsImage->GetLargestPossibleRegion());
+  for (std::size_t v=numVoxels; v>0; --v)
+    offsets[v] = offsets[v-1];
+  offsets[0] = 0;
 
   MITK_INFO << "Clustering directions";
   float max_dir_mag = 0;
-  boost::timer::progress_display disp2(outImageSize[0]*outImageSize[1]*outImageSize[2]);
-  while(!dirIt.IsAtEnd())
+  const int numSlices = static_cast<int>(outImageSize[2]);
+  boost::timer::progress_display disp2(numSlices);
+#pragma omp parallel
   {
-    ++disp2;
-    OutputImageType::IndexType idx3 = dirIt.GetIndex();
-    int idx_lin = idx3[0]+(idx3[1]+idx3[2]*outImageSize[1])*outImageSize[0];
-
-    itk::Index<4> idx4; idx4[0] = idx3[0]; idx4[1] = idx3[1]; idx4[2] = idx3[2];
-
-    if (!m_DirectionsContainer->IndexExists(idx_lin))
-    {
-      ++dirIt;
-      continue;
-    }
-    DirectionContainerType::Pointer dirCont = m_DirectionsContainer->GetElement(idx_lin);
-    if (dirCont.IsNull() || dirCont->empty())
+    float thread_max_dir_mag = 0;
+#pragma omp for schedule(dynamic, 1)
+    for (int z=0; z<numSlices; ++z)
     {
-      ++dirIt;
-      continue;
-    }
+      for (unsigned int y=0; y<outImageSize[1]; ++y)
+        for (unsigned int x=0; x<outImageSize[0]; ++x)
+        {
+          std::size_t idx_lin = x+(y+z*outImageSize[1])*outImageSize[0];
+          if (offsets[idx_lin]==offsets[idx_lin+1])
+            continue;
+
+          // restore the order of the sequential rasterization, the clustering depends on it. The keys are unique, so
+          // the order does not depend on the order in which the threads filled the voxel.
+          auto begin = segments.begin()+offsets[idx_lin];
+          auto end = segments.begin()+offsets[idx_lin+1];
+          std::sort(begin, end, [](const VoxelSegment& a, const VoxelSegment& b)
+          {
+            return std::tie(a.m_Fiber, a.m_Segment, a.m_Intersection) < std::tie(b.m_Fiber, b.m_Segment, b.m_Intersection);
+          });
 
-    DirectionContainerType::Pointer directions;
-    if (m_MaxNumDirections>0)
-    {
-      directions = FastClustering(dirCont, peakLengths->GetElement(idx_lin));
-      std::sort( directions->begin(), directions->end(), CompareVectorLengths );
-    }
-    else
-      directions = dirCont;
+          DirectionContainerType::Pointer dirCont = DirectionContainerType::New();
+          std::vector< double > lengths;
+          for (auto it=begin; it!=end; ++it)
+          {
+            DirectionType dir;
+            dir[0] = it->m_Direction[0];
+            dir[1] = it->m_Direction[1];
+            dir[2] = it->m_Direction[2];
+            dir.normalize();
+            dirCont->push_back(dir);
+            lengths.push_back(it->m_Length);
+          }
 
-    unsigned int numDir = directions->size();
-    if (m_MaxNumDirections>0 && numDir>m_MaxNumDirections)
-      numDir = m_MaxNumDirections;
+          DirectionContainerType::Pointer directions;
+          if (m_MaxNumDirections>0)
+          {
+            directions = FastClustering(dirCont, lengths);
+            std::sort( directions->begin(), directions->end(), CompareVectorLengths );
+          }
+          else
+            directions = dirCont;
 
-    float voxel_max_mag = 0;
-    for (unsigned int i=0; i<numDir; i++)
-    {
-      DirectionType dir = directions->at(i);
-      float mag = dir.magnitude();
+          unsigned int numDir = directions->size();
+          if (m_MaxNumDirections>0 && numDir>m_MaxNumDirections)
+            numDir = m_MaxNumDirections;
 
-      if (mag>voxel_max_mag)
-        voxel_max_mag = mag;
-      if (mag>max_dir_mag)
-        max_dir_mag = mag;
-    }
+          float voxel_max_mag = 0;
+          for (unsigned int i=0; i<numDir; i++)
+          {
+            DirectionType dir = directions->at(i);
+            float mag = dir.magnitude();
 
-    int count = 0;
-    for (unsigned int i=0; i<numDir; i++)
-    {
-      DirectionType dir = directions->at(i);
-      count++;
+            if (mag>voxel_max_mag)
+              voxel_max_mag = mag;
+            if (mag>thread_max_dir_mag)
+              thread_max_dir_mag = mag;
+          }
 
-      float mag = dir.magnitude();
-      if (m_NormalizationMethod==MAX_VEC_NORM && voxel_max_mag>mitk::eps)
-        dir /= voxel_max_mag;
-      else if (m_NormalizationMethod==SINGLE_VEC_NORM && mag>mitk::eps)
-        dir.normalize();
+          itk::Index<4> idx4; idx4[0] = x; idx4[1] = y; idx4[2] = z;
+          int count = 0;
+          for (unsigned int i=0; i<numDir; i++)
+          {
+            DirectionType dir = directions->at(i);
+            count++;
+
+            float mag = dir.magnitude();
+            if (m_NormalizationMethod==MAX_VEC_NORM && voxel_max_mag>mitk::eps)
+              dir /= voxel_max_mag;
+            else if (m_NormalizationMethod==SINGLE_VEC_NORM && mag>mitk::eps)
+              dir.normalize();
+
+            for (unsigned int j = 0; j<3; j++)
+            {
+              idx4[3] = i*3 + j;
+              m_DirectionImage->SetPixel(idx4, dir[j]);
+            }
+          }
 
-      for (unsigned int j = 0; j<3; j++)
-      {
-        idx4[3] = i*3 + j;
-        m_DirectionImage->SetPixel(idx4, dir[j]);
-      }
+          OutputImageType::IndexType idx3; idx3[0] = x; idx3[1] = y; idx3[2] = z;
+          m_NumDirectionsImage->SetPixel(idx3, count);
+        }
+#pragma omp critical
+      ++disp2;
     }
-    dirIt.Set(count);
-    ++dirIt;
+#pragma omp critical
+    max_dir_mag = std::max(max_dir_mag, thread_max_dir_mag);
   }
 
   if (m_NormalizationMethod==GLOBAL_MAX && max_dir_mag>0)
@@ -298,6 +289,51 @@ void TractsToVectorImageFilter< PixelType >::GenerateData()
 }
 
 
+template< class PixelType >
+template< class TCallback >
+void TractsToVectorImageFilter< PixelType >::ForEachVoxelSegment(const mitk::FiberBundle::FiberPointView& view, unsigned int fiber, TCallback callback) const
+{
+  const ImageRegion<3>& region = m_MaskImage->GetLargestPossibleRegion();
+  const OutputImageType::RegionType::SizeType size = region.GetSize();
+  const itk::Vector<double> spacing = m_MaskImage->GetSpacing();
+
+  int numPoints = view.GetNumberOfPoints(fiber);
+  for( int j=0; j<numPoints-1; j++)
+  {
+    const float* p1 = view.GetPoint(fiber, j);
+    itk::Point<float, 3> startVertex; startVertex[0] = p1[0]; startVertex[1] = p1[1]; startVertex[2] = p1[2];
+    itk::Index<3> startIndex;
+    itk::ContinuousIndex<float, 3> startIndexCont;
+    (void)m_MaskImage->TransformPhysicalPointToIndex(startVertex, startIndex);
+    (void)m_MaskImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
+
+    const float* p2 = view.GetPoint(fiber, j+1);
+    itk::Point<float, 3> endVertex; endVertex[0] = p2[0]; endVertex[1] = p2[1]; endVertex[2] = p2[2];
+    itk::Index<3> endIndex;
+    itk::ContinuousIndex<float, 3> endIndexCont;
+    (void)m_MaskImage->TransformPhysicalPointToIndex(endVertex, endIndex);
+    (void)m_MaskImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
+
+    float dir[3];
+    dir[0] = endVertex[0]-startVertex[0];
+    dir[1] = endVertex[1]-startVertex[1];
+    dir[2] = endVertex[2]-startVertex[2];
+    if (dir[0]==0 && dir[1]==0 && dir[2]==0)
+      continue;
+
+    std::vector< std::pair< itk::Index<3>, double > > intersections = mitk::imv::IntersectImage(spacing, startIndex, endIndex, startIndexCont, endIndexCont);
+    for (unsigned int k=0; k<intersections.size(); ++k)
+    {
+      const std::pair< itk::Index<3>, double >& intersection = intersections[k];
+      if (!region.IsInside(intersection.first) || (!m_OnlyUseMaskGeometry && m_MaskImage->GetPixel(intersection.first)==0))
+        continue;
+
+      std::size_t idx = intersection.first[0] + size[0]*(intersection.first[1] + size[1]*intersection.first[2]);
+      callback(idx, static_cast<unsigned int>(j), k, dir, intersection.second);
+    }
+  }
+}
+
 template< class PixelType >
 TractsToVectorImageFilter< PixelType >::DirectionContainerType::Pointer TractsToVectorImageFilter< PixelType >::FastClustering(DirectionContainerType::Pointer inDirs, std::vector< double > lengths)
 {
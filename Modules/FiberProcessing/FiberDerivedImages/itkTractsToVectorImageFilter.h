@@ -18,7 +18,12 @@
 namespace itk{
 
 /**
-* \brief Extracts the voxel-wise main directions of the input fiber bundle.   */
+* \brief Extracts the voxel-wise main directions of the input fiber bundle.
+*
+* The fibers are rasterized in parallel in two passes: the first pass counts the fiber segments of each voxel, the
+* second one writes the segment directions into one flat buffer, ordered by voxel. The directions of each voxel are
+* then sorted into fiber order and clustered in parallel.
+*/
 
 template< class PixelType >
 class TractsToVectorImageFilter : public ImageSource< Image< PixelType, 4 > >
@@ -70,8 +75,23 @@ public:
 
 protected:
 
+  /** Fiber segment inside one voxel */
+  struct VoxelSegment
+  {
+    float         m_Direction[3];   ///< unnormalized segment vector
+    double        m_Length;         ///< weighted length of the segment inside the voxel
+    unsigned int  m_Fiber;          ///< fiber index, segment index and intersection index form a unique key that
+    unsigned int  m_Segment;        ///< restores the order of the sequential rasterization
+    unsigned int  m_Intersection;
+  };
+
   DirectionContainerType::Pointer FastClustering(DirectionContainerType::Pointer inDirs, std::vector< double > lengths);  ///< cluster fiber directions
 
+  /** Calls callback(voxel, segment index, intersection index, segment vector, length) for every part of a segment of
+   * the fiber that lies inside a mask voxel. Thread safe. */
+  template< class TCallback >
+  void ForEachVoxelSegment(const mitk::FiberBundle::FiberPointView& view, unsigned int fiber, TCallback callback) const;
+
   vnl_vector_fixed<double, 3> GetVnlVector(double point[3]);
 
 
@@ -84,7 +104,6 @@ protected:
   float                               m_Epsilon;                          ///< epsilon for vector equality check
   ItkUcharImgType::Pointer            m_MaskImage;                        ///< only voxels inside the binary mask are processed
   itk::Vector<float>                  m_OutImageSpacing;                  ///< spacing of output image
-  ContainerType::Pointer              m_DirectionsContainer;              ///< container for fiber directions
   unsigned long                       m_MaxNumDirections;                 ///< if more directions per voxel are extracted, only the largest are kept
   float                               m_SizeThreshold;
   bool                                m_OnlyUseMaskGeometry;
@@ -37,37 +37,33 @@ FiberCurvatureFilter::~FiberCurvatureFilter()
 
 void FiberCurvatureFilter::GenerateData()
 {
-    vtkSmartPointer<vtkPolyData> inputPoly = m_InputFiberBundle->GetFiberPolyData();
+    typedef std::vector< vnl_vector_fixed< double, 3 > > PolyLineType;
     vtkSmartPointer<vtkPoints> vtkNewPoints = vtkSmartPointer<vtkPoints>::New();
     vtkSmartPointer<vtkCellArray> vtkNewCells = vtkSmartPointer<vtkCellArray>::New();
 
     MITK_INFO << "Applying curvature threshold";
-    boost::timer::progress_display disp(inputPoly->GetNumberOfCells());
+    const mitk::FiberBundle::FiberPointView& view = m_InputFiberBundle->GetFiberPointView();
+    int numFibers = view.GetNumberOfFibers();
+    std::vector< std::vector< PolyLineType > > output_lines(numFibers);
+    boost::timer::progress_display disp(numFibers);
 #pragma omp parallel for
-    for (int i=0; i<inputPoly->GetNumberOfCells(); i++)
+    for (int i=0; i<numFibers; i++)
     {
         std::vector< vnl_vector_fixed< double, 3 > > vertices;
-
-#pragma omp critical
+        for (unsigned int j=0; j<view.GetNumberOfPoints(i); j++)
         {
-            ++disp;
-            vtkCell* cell = inputPoly->GetCell(i);
-            int numPoints = cell->GetNumberOfPoints();
-            vtkPoints* points = cell->GetPoints();
-
-            for (int j=0; j<numPoints; j++)
-            {
-                double p[3];
-                points->GetPoint(j, p);
-                vnl_vector_fixed< double, 3 > p_vec;
-                p_vec[0]=p[0]; p_vec[1]=p[1]; p_vec[2]=p[2];
-                vertices.push_back(p_vec);
-            }
+            const float* p = view.GetPoint(i, j);
+            vnl_vector_fixed< double, 3 > p_vec;
+            p_vec[0]=p[0]; p_vec[1]=p[1]; p_vec[2]=p[2];
+            vertices.push_back(p_vec);
         }
+#pragma omp critical
+        ++disp;
 
         // calculate curvatures
         int numPoints = vertices.size();
-        vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
+        std::vector< PolyLineType >& lines = output_lines[i];
+        PolyLineType container;
         for (int j=0; j<numPoints; j++)
         {
             double dist = 0;
@@ -123,34 +119,40 @@ void FiberCurvatureFilter::GenerateData()
 
             if (dev<m_AngularDeviation)
             {
-#pragma omp critical
-              {
-                vtkIdType id = vtkNewPoints->InsertNextPoint(vertices.at(j).data_block());
-                container->GetPointIds()->InsertNextId(id);
-              }
+                container.push_back(vertices.at(j));
             }
             else
             {
                 if (m_RemoveFibers)
                 {
-                    container = vtkSmartPointer<vtkPolyLine>::New();
+                    container.clear();
                     break;
                 }
 
-                if (container->GetNumberOfPoints()>0)
-                {
-#pragma omp critical
-                    vtkNewCells->InsertNextCell(container);
-                }
-                container = vtkSmartPointer<vtkPolyLine>::New();
+                if (container.size()>0)
+                    lines.push_back(container);
+                container.clear();
             }
         }
 
-#pragma omp critical
+        if (container.size()>0)
+            lines.push_back(container);
+    }
+
+    // assemble the output in fiber order
+    for (auto& lines : output_lines)
+    {
+        for (auto& line : lines)
         {
-          if (container->GetNumberOfPoints()>0)
-              vtkNewCells->InsertNextCell(container);
+            vtkSmartPointer<vtkPolyLine> container = vtkSmartPointer<vtkPolyLine>::New();
+            for (auto& v : line)
+            {
+                vtkIdType id = vtkNewPoints->InsertNextPoint(v.data_block());
+                container->GetPointIds()->InsertNextId(id);
+            }
+            vtkNewCells->InsertNextCell(container);
         }
+        std::vector< PolyLineType >().swap(lines);
     }
 
     vtkSmartPointer<vtkPolyData> outputPoly = vtkSmartPointer<vtkPolyData>::New();
@@ -21,13 +21,21 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <itkImageRegionConstIterator.h>
 #include <itkImageRegionConstIteratorWithIndex.h>
 #include <itkImageRegionIterator.h>
+#include <itkSignedMaurerDistanceMapImageFilter.h>
+#include <itkLinearInterpolateImageFunction.h>
+#include <itkMultiThreaderBase.h>
 #include <vtkImplicitPolyDataDistance.h>
 #include <math.h>
+#include <atomic>
+#include <mutex>
 
 namespace itk {
 
 template< class TPixelType >
 DistanceFromSegmentationImageFilter< TPixelType >::DistanceFromSegmentationImageFilter()
+  : m_UseDistanceTransform(false)
+  , m_SubVoxelRefinement(false)
+  , m_RefinementBand(2.0)
 {
   m_Thresholds = {0.0, 3.0, 5.0, 7.0};
 }
@@ -47,6 +55,12 @@ void DistanceFromSegmentationImageFilter< TPixelType >::GenerateData()
   outputImage->FillBuffer(0.0);
   ImageRegionIterator< InputImageType > out_it(outputImage, outputImage->GetLargestPossibleRegion());
 
+  if (m_UseDistanceTransform)
+  {
+    this->GenerateDataFromDistanceTransform(input_tdi, outputImage);
+    return;
+  }
+
   vtkSmartPointer<vtkImplicitPolyDataDistance> vtkFilter = vtkSmartPointer<vtkImplicitPolyDataDistance>::New();
   vtkFilter->SetInput(m_SegmentationSurface->GetVtkPolyData());
 
@@ -79,6 +93,119 @@ void DistanceFromSegmentationImageFilter< TPixelType >::GenerateData()
   }
 }
 
+template< class TPixelType >
+void DistanceFromSegmentationImageFilter< TPixelType >::GenerateDataFromDistanceTransform(const InputImageType* input_tdi, OutputImageType* outputImage)
+{
+  if (m_SegmentationMask.IsNull())
+    itkExceptionMacro("The distance transform mode requires a segmentation mask.");
+  if (m_SubVoxelRefinement && m_SegmentationSurface.IsNull())
+    itkExceptionMacro("The sub-voxel refinement requires a segmentation surface.");
+
+  // signed distance in mm to the boundary voxels of the mask, negative inside (as vtkImplicitPolyDataDistance)
+  typedef SignedMaurerDistanceMapImageFilter< ItkUcharImgType, DistanceImageType > DistanceFilterType;
+  typename DistanceFilterType::Pointer distance_filter = DistanceFilterType::New();
+  distance_filter->SetInput(m_SegmentationMask);
+  distance_filter->SetBackgroundValue(0);
+  distance_filter->SetInsideIsPositive(false);
+  distance_filter->SetSquaredDistance(false);
+  distance_filter->SetUseImageSpacing(true);
+  distance_filter->SetNumberOfWorkUnits(this->GetNumberOfWorkUnits());
+  distance_filter->Update();
+  typename DistanceImageType::Pointer distance_map = distance_filter->GetOutput();
+
+  typedef LinearInterpolateImageFunction< DistanceImageType, double > InterpolatorType;
+  typename InterpolatorType::Pointer interpolator = InterpolatorType::New();
+  interpolator->SetInputImage(distance_map);
+  const ImageRegion<3> mask_region = distance_map->GetLargestPossibleRegion();
+
+  // sample the distance map at the voxels of the input image
+  MultiThreaderBase* threader = this->GetMultiThreader();
+  threader->SetNumberOfWorkUnits(this->GetNumberOfWorkUnits());
+  threader->template ParallelizeImageRegion<3>(outputImage->GetLargestPossibleRegion(), [&](const ImageRegion<3>& region)
+  {
+    ImageRegionConstIterator< InputImageType > tdi_it(input_tdi, region);
+    ImageRegionIterator< OutputImageType > out_it(outputImage, region);
+    for (; !tdi_it.IsAtEnd(); ++tdi_it, ++out_it)
+    {
+      if (tdi_it.Get()<=0)
+        continue;
+
+      itk::Point<double, 3> point3D;
+      input_tdi->TransformIndexToPhysicalPoint(tdi_it.GetIndex(), point3D);
+      itk::ContinuousIndex<double, 3> cidx;
+      distance_map->TransformPhysicalPointToContinuousIndex(point3D, cidx);
+      if (interpolator->IsInsideBuffer(cidx))
+        out_it.Set(interpolator->EvaluateAtContinuousIndex(cidx));
+      else
+      {
+        // outside of the mask grid: distance of the closest grid voxel plus the distance to this voxel
+        itk::Index<3> nearest;
+        for (int d=0; d<3; ++d)
+          nearest[d] = std::min(std::max(static_cast<long>(std::round(cidx[d])), mask_region.GetIndex(d)), mask_region.GetIndex(d)+static_cast<long>(mask_region.GetSize(d))-1);
+        itk::Point<double, 3> nearest_point;
+        distance_map->TransformIndexToPhysicalPoint(nearest, nearest_point);
+        out_it.Set(distance_map->GetPixel(nearest) + point3D.EuclideanDistanceTo(nearest_point));
+      }
+    }
+  }, nullptr);
+
+  // exact surface distance in a narrow band around the boundary
+  if (m_SubVoxelRefinement)
+  {
+    double max_spacing = std::max(distance_map->GetSpacing()[0], std::max(distance_map->GetSpacing()[1], distance_map->GetSpacing()[2]));
+    double band = m_RefinementBand*max_spacing;
+
+    // vtkImplicitPolyDataDistance is not thread-safe, every work unit evaluates the surface with its own instance.
+    // Only the setup, which runs the VTK pipeline on the shared surface, is serialized.
+    std::atomic< unsigned int > num_refined(0);
+    std::mutex vtk_mutex;
+    threader->template ParallelizeImageRegion<3>(outputImage->GetLargestPossibleRegion(), [&](const ImageRegion<3>& region)
+    {
+      vtkSmartPointer<vtkImplicitPolyDataDistance> vtkFilter;
+      ImageRegionConstIteratorWithIndex< InputImageType > tdi_it(input_tdi, region);
+      ImageRegionIterator< OutputImageType > out_it(outputImage, region);
+      for (; !tdi_it.IsAtEnd(); ++tdi_it, ++out_it)
+      {
+        if (tdi_it.Get()<=0 || std::fabs(out_it.Get())>band)
+          continue;
+
+        if (vtkFilter==nullptr)
+        {
+          std::lock_guard< std::mutex > lock(vtk_mutex);
+          vtkFilter = vtkSmartPointer<vtkImplicitPolyDataDistance>::New();
+          vtkFilter->SetInput(m_SegmentationSurface->GetVtkPolyData());
+        }
+
+        itk::Point<float, 3> point3D;
+        input_tdi->TransformIndexToPhysicalPoint(tdi_it.GetIndex(), point3D);
+        out_it.Set(vtkFilter->EvaluateFunction(point3D[0], point3D[1], point3D[2]));
+        ++num_refined;
+      }
+    }, nullptr);
+    MITK_INFO << "Refined distance of " << num_refined << " voxels";
+  }
+
+  ImageRegionConstIterator< InputImageType > tdi_it(input_tdi, input_tdi->GetLargestPossibleRegion());
+  ImageRegionIterator< OutputImageType > out_it(outputImage, outputImage->GetLargestPossibleRegion());
+  m_MinDistance = 999999;
+  m_Counts.resize(m_Thresholds.size(), 0);
+  for (; !tdi_it.IsAtEnd(); ++tdi_it, ++out_it)
+  {
+    if (tdi_it.Get()<=0)
+      continue;
+
+    double dist = out_it.Get();
+    if (dist<m_MinDistance)
+      m_MinDistance = dist;
+
+    for (unsigned int i=0; i<m_Thresholds.size(); ++i)
+    {
+      if (dist<m_Thresholds.at(i))
+        m_Counts[i] += 1;
+    }
+  }
+}
+
 template< class TPixelType >
 float DistanceFromSegmentationImageFilter< TPixelType >::GetMinDistance() const
 {
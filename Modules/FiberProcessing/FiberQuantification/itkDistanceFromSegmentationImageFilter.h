@@ -29,7 +29,15 @@ This file is based heavily on a corresponding ITK filter.
 namespace itk{
 
 /**
-* \brief  */
+* \brief Distance of all voxels with a value larger than zero (e.g. of a tract density image) to a segmentation.
+*
+* By default, the signed distance to the segmentation surface is evaluated with vtkImplicitPolyDataDistance for every
+* voxel (negative inside). With SetUseDistanceTransform(true), a signed Euclidean distance transform of the
+* segmentation mask is computed instead (multi-threaded, linear in the number of voxels, in mm). Its zero level lies on
+* the centers of the boundary voxels of the mask, so the distances agree with the surface mode to within one voxel.
+* With SetSubVoxelRefinement(true), the voxels closer to the boundary than the refinement band are evaluated exactly
+* with the segmentation surface.
+*/
 
 template< class TPixelType >
 class DistanceFromSegmentationImageFilter : public ImageToImageFilter< Image< TPixelType, 3 >, Image< TPixelType, 3 > >
@@ -49,11 +57,20 @@ public:
   /** Runtime information support. */
   itkTypeMacro(DistanceFromSegmentationImageFilter, ImageToImageFilter)
 
-  itkSetMacro( SegmentationSurface, mitk::Surface::Pointer )
-
   typedef typename Superclass::InputImageType         InputImageType;
   typedef typename Superclass::OutputImageType        OutputImageType;
   typedef typename Superclass::OutputImageRegionType  OutputImageRegionType;
+  typedef itk::Image< unsigned char, 3 >              ItkUcharImgType;
+  typedef itk::Image< float, 3 >                      DistanceImageType;
+
+  itkSetMacro( SegmentationSurface, mitk::Surface::Pointer )
+  itkSetMacro( SegmentationMask, ItkUcharImgType::Pointer )   ///< binary segmentation, required by the distance transform mode
+  itkSetMacro( UseDistanceTransform, bool )                   ///< use a distance transform of the mask instead of the surface distance
+  itkGetMacro( UseDistanceTransform, bool )
+  itkSetMacro( SubVoxelRefinement, bool )                     ///< distance transform mode: use the surface distance close to the boundary
+  itkGetMacro( SubVoxelRefinement, bool )
+  itkSetMacro( RefinementBand, float )                        ///< width of the refined band on both sides of the boundary in voxels (default 2)
+  itkGetMacro( RefinementBand, float )
 
   void SetThresholds(const std::vector<float> &Thresholds);
   std::vector<float> GetThresholds() const;
@@ -68,9 +85,16 @@ protected:
 
   void GenerateData() override;
 
+  /** Distance transform mode of GenerateData */
+  void GenerateDataFromDistanceTransform(const InputImageType* input_tdi, OutputImageType* outputImage);
+
 private:
 
   mitk::Surface::Pointer m_SegmentationSurface;
+  ItkUcharImgType::Pointer m_SegmentationMask;
+  bool m_UseDistanceTransform;
+  bool m_SubVoxelRefinement;
+  float m_RefinementBand;
   std::vector<float> m_Thresholds;
   std::vector<int> m_Counts;
   float m_MinDistance;
@@ -22,8 +22,57 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <mitkIOUtil.h>
 #include <itkFiberCurvatureFilter.h>
 #include <omp.h>
+#include <itkTimeProbe.h>
+#include <mitkTractClusteringFilter.h>
+#include <itkTractDensityImageFilter.h>
+#include <itkTractsToVectorImageFilter.h>
+#include <mitkDiffusionImageHelperFunctions.h>
+#include <itkDistanceFromSegmentationImageFilter.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <vtkSphereSource.h>
+#include <mitkClusteringMetricEuclideanMean.h>
 #include "mitkTestFixture.h"
 
+/** Mean euclidean distance as computed before the contiguous clustering kernel. Not recognized as
+ * ClusteringMetricEuclideanMean, so the clustering filter uses its exhaustive search with this metric. */
+class ReferenceClusteringMetric : public mitk::ClusteringMetric
+{
+public:
+
+  float CalculateDistance(vnl_matrix<float>& s, vnl_matrix<float>& t, bool &flipped) override
+  {
+    float d_direct = 0;
+    float d_flipped = 0;
+    for (unsigned int i=0; i<s.cols(); ++i)
+    {
+      d_direct += (s.get_column(i)-t.get_column(i)).magnitude();
+      d_flipped += (s.get_column(i)-t.get_column(s.cols()-i-1)).magnitude();
+    }
+    if (d_direct>d_flipped)
+    {
+      flipped = true;
+      return m_Scale*d_flipped/s.cols();
+    }
+    flipped = false;
+    return m_Scale*d_direct/s.cols();
+  }
+};
+
+/** Exposes the direction clustering of the peak filter for the serial reference in Test23 */
+class ReferencePeakFilter : public itk::TractsToVectorImageFilter< float >
+{
+public:
+
+  typedef ReferencePeakFilter Self;
+  typedef itk::SmartPointer< Self > Pointer;
+  itkFactorylessNewMacro(Self)
+
+  DirectionContainerType::Pointer Cluster(DirectionContainerType::Pointer dirs, std::vector< double > lengths)
+  {
+    return this->FastClustering(dirs, lengths);
+  }
+};
+
 class mitkFiberProcessingTestSuite : public mitk::TestFixture
 {
 
@@ -46,9 +95,16 @@ class mitkFiberProcessingTestSuite : public mitk::TestFixture
     MITK_TEST(Test16);
     MITK_TEST(Test17);
     MITK_TEST(Test18);
+    MITK_TEST(Test19);
+    MITK_TEST(Test20);
+    MITK_TEST(Test21);
+    MITK_TEST(Test22);
+    MITK_TEST(Test23);
+    MITK_TEST(Test24);
     CPPUNIT_TEST_SUITE_END();
 
     typedef itk::Image<unsigned char, 3> ItkUcharImgType;
+    typedef itk::Image< float, 3 > FloatImageType;
 
 private:
 
@@ -299,6 +355,410 @@ public:
         CPPUNIT_ASSERT_MESSAGE("Should be equal", ref->Equals(fib));
     }
 
+    void Test19()
+    {
+        MITK_INFO << "TEST 19: Endpoint matching (subtract, add without duplicates, unordered comparison)";
+
+        mitk::FiberBundle::Pointer fib = original->GetDeepCopy();
+        mitk::FiberBundle::Pointer fib2 = mitk::IOUtil::Load<mitk::FiberBundle>(GetTestDataFilePath("DiffusionImaging/FiberProcessing/remove_length.fib"));
+
+        mitk::FiberBundle::Pointer empty = fib->SubtractBundle(fib);
+        CPPUNIT_ASSERT_MESSAGE("Subtracting bundle from itself", empty->GetNumFibers()==0);
+
+        mitk::FiberBundle::Pointer subtracted = fib->SubtractBundle(fib2);
+        mitk::FiberBundle::Pointer merged = subtracted->AddBundles({fib2, fib}, true);
+        CPPUNIT_ASSERT_MESSAGE("Number of fibers after merging without duplicates", merged->GetNumFibers()==fib->GetNumFibers());
+        CPPUNIT_ASSERT_MESSAGE("Should be equal (unordered)", fib->Equals(merged, 0.01, true));
+        CPPUNIT_ASSERT_MESSAGE("Should not be equal (unordered)", !fib->Equals(subtracted->AddBundle(subtracted), 0.01, true));
+    }
+
+    void Test20()
+    {
+        MITK_INFO << "TEST 20: Flat fiber point view (multi-threaded access and timings)";
+
+        int num_threads = omp_get_num_procs();
+        omp_set_num_threads(num_threads);
+        mitk::FiberBundle::Pointer fib = original->GetDeepCopy();
+        vtkSmartPointer<vtkPolyData> polydata = fib->GetFiberPolyData();
+        int numFibers = static_cast<int>(fib->GetNumFibers());
+
+        // fiber lengths with vtk cell access, which needs a critical section
+        std::vector< double > lengths_cell(numFibers, 0);
+        itk::TimeProbe clock_cell;
+        clock_cell.Start();
+#pragma omp parallel for
+        for (int i=0; i<numFibers; i++)
+        {
+            std::vector< vnl_vector_fixed< double, 3 > > vertices;
+#pragma omp critical
+            {
+                vtkCell* cell = polydata->GetCell(i);
+                vtkPoints* points = cell->GetPoints();
+                for (int j=0; j<cell->GetNumberOfPoints(); j++)
+                {
+                    double p[3];
+                    points->GetPoint(j, p);
+                    vnl_vector_fixed< double, 3 > v; v[0]=p[0]; v[1]=p[1]; v[2]=p[2];
+                    vertices.push_back(v);
+                }
+            }
+            for (unsigned int j=1; j<vertices.size(); j++)
+                lengths_cell[i] += (vertices[j]-vertices[j-1]).magnitude();
+        }
+        clock_cell.Stop();
+
+        // same with the flat point view and without locking
+        std::vector< double > lengths_view(numFibers, 0);
+        itk::TimeProbe clock_view;
+        clock_view.Start();
+        const mitk::FiberBundle::FiberPointView& view = fib->GetFiberPointView();
+#pragma omp parallel for
+        for (int i=0; i<numFibers; i++)
+        {
+            for (unsigned int j=1; j<view.GetNumberOfPoints(i); j++)
+            {
+                const float* p1 = view.GetPoint(i, j-1);
+                const float* p2 = view.GetPoint(i, j);
+                vnl_vector_fixed< double, 3 > v;
+                v[0] = static_cast<double>(p2[0])-p1[0]; v[1] = static_cast<double>(p2[1])-p1[1]; v[2] = static_cast<double>(p2[2])-p1[2];
+                lengths_view[i] += v.magnitude();
+            }
+        }
+        clock_view.Stop();
+
+        MITK_INFO << "Point access with " << num_threads << " threads (vtk cells + critical / flat view incl. build): " << clock_cell.GetTotal() << "s / " << clock_view.GetTotal() << "s";
+        CPPUNIT_ASSERT_MESSAGE("One view entry per fiber", view.GetNumberOfFibers()==fib->GetNumFibers());
+        for (int i=0; i<numFibers; i++)
+            CPPUNIT_ASSERT_MESSAGE("Fiber lengths from view and vtk cells should be equal", std::fabs(lengths_cell[i]-lengths_view[i])<0.0001);
+
+        // the ported operations are deterministic, so single- and multi-threaded results have to match
+        std::vector< std::string > names = {"ResampleLinear", "ResampleSpline", "Compress", "ResampleToNumPoints"};
+        for (unsigned int k=0; k<names.size(); k++)
+        {
+            mitk::FiberBundle::Pointer single = original->GetDeepCopy();
+            mitk::FiberBundle::Pointer multi = original->GetDeepCopy();
+            double times[2];
+            for (int t=0; t<2; t++)
+            {
+                mitk::FiberBundle::Pointer f = t==0 ? single : multi;
+                omp_set_num_threads(t==0 ? 1 : num_threads);
+                itk::TimeProbe clock;
+                clock.Start();
+                if (k==0)
+                    f->ResampleLinear();
+                else if (k==1)
+                    f->ResampleSpline(5);
+                else if (k==2)
+                    f->Compress(0.1f);
+                else
+                    f->ResampleToNumPoints(20);
+                clock.Stop();
+                times[t] = clock.GetTotal();
+            }
+            MITK_INFO << names[k] << " (1 / " << num_threads << " threads): " << times[0] << "s / " << times[1] << "s";
+            CPPUNIT_ASSERT_MESSAGE("Single- and multi-threaded results should be equal", single->Equals(multi));
+        }
+        omp_set_num_threads(1);
+    }
+
+    void Test21()
+    {
+        MITK_INFO << "TEST 21: Tract clustering (pruned contiguous kernel vs. exhaustive search)";
+
+        std::vector< std::vector< mitk::TractClusteringFilter::Cluster > > results;
+        for (int t=0; t<2; t++)
+        {
+            std::vector< mitk::ClusteringMetric* > metrics;
+            if (t==0)
+                metrics.push_back(new ReferenceClusteringMetric());
+            else
+                metrics.push_back(new mitk::ClusteringMetricEuclideanMean());
+
+            mitk::TractClusteringFilter clusterer;
+            clusterer.SetDistances({10, 20});
+            clusterer.SetTractogram(original);
+            clusterer.SetMetrics(metrics);
+            itk::TimeProbe clock;
+            clock.Start();
+            clusterer.Update();
+            clock.Stop();
+            MITK_INFO << (t==0 ? "Exhaustive: " : "Pruned: ") << clock.GetTotal() << "s";
+            results.push_back(clusterer.GetOutClusters());
+        }
+
+        CPPUNIT_ASSERT_MESSAGE("Number of clusters should be equal", results[0].size()==results[1].size());
+        for (unsigned int c=0; c<results[0].size(); c++)
+        {
+            CPPUNIT_ASSERT_MESSAGE("Cluster sizes should be equal", results[0][c].n==results[1][c].n);
+            CPPUNIT_ASSERT_MESSAGE("Cluster members should be equal", results[0][c].I==results[1][c].I);
+            CPPUNIT_ASSERT_MESSAGE("Centroids should be equal", results[0][c].h==results[1][c].h);
+        }
+    }
+
+    void Test22()
+    {
+        MITK_INFO << "TEST 22: Tract density images (multi-threaded multi-bundle pass and multi-threaded single bundles vs. single-threaded single bundles)";
+
+        typedef itk::TractDensityImageFilter< FloatImageType, ItkUcharImgType > TdiFilterType;
+
+        mitk::FiberBundle::Pointer fib2 = original->GetDeepCopy();
+        fib2->ResampleLinear(0.5);
+        std::vector< mitk::FiberBundle::Pointer > bundles = {original, fib2, original->GetDeepCopy()};
+        int num_threads = omp_get_num_procs();
+
+        std::vector< TDI_MODE > modes = {BINARY, VISITATION_COUNT, DENSITY};
+        for (TDI_MODE mode : modes)
+        {
+            omp_set_num_threads(num_threads);
+            TdiFilterType::Pointer batch = TdiFilterType::New();
+            batch->SetFiberBundles(bundles);
+            batch->SetInputImage(mask);
+            batch->SetUseImageGeometry(true);
+            batch->SetUpsamplingFactor(2);
+            batch->SetMode(mode);
+            batch->Update();
+            std::vector< FloatImageType::Pointer > images = batch->GetBundleImages();
+            CPPUNIT_ASSERT_MESSAGE("One image per bundle", images.size()==bundles.size());
+
+            for (unsigned int b=0; b<bundles.size(); b++)
+            {
+                omp_set_num_threads(num_threads);
+                TdiFilterType::Pointer multi = TdiFilterType::New();
+                multi->SetFiberBundle(bundles.at(b));
+                multi->SetInputImage(mask);
+                multi->SetUseImageGeometry(true);
+                multi->SetUpsamplingFactor(2);
+                multi->SetMode(mode);
+                multi->Update();
+
+                omp_set_num_threads(1);
+                TdiFilterType::Pointer single = TdiFilterType::New();
+                single->SetFiberBundle(bundles.at(b));
+                single->SetInputImage(mask);
+                single->SetUseImageGeometry(true);
+                single->SetUpsamplingFactor(2);
+                single->SetMode(mode);
+                single->Update();
+
+                FloatImageType::Pointer ref = single->GetOutput();
+                unsigned int num_voxels = ref->GetLargestPossibleRegion().GetNumberOfPixels();
+                CPPUNIT_ASSERT_MESSAGE("Same image size", images.at(b)->GetLargestPossibleRegion()==ref->GetLargestPossibleRegion());
+                CPPUNIT_ASSERT_MESSAGE("Same image size", multi->GetOutput()->GetLargestPossibleRegion()==ref->GetLargestPossibleRegion());
+                CPPUNIT_ASSERT_MESSAGE("Same number of covered voxels", batch->GetNumCoveredVoxelsPerBundle().at(b)==single->GetNumCoveredVoxels());
+                CPPUNIT_ASSERT_MESSAGE("Same number of covered voxels", multi->GetNumCoveredVoxels()==single->GetNumCoveredVoxels());
+                CPPUNIT_ASSERT_MESSAGE("Same maximum density", batch->GetMaxDensities().at(b)==single->GetMaxDensity());
+                CPPUNIT_ASSERT_MESSAGE("Same maximum density", multi->GetMaxDensity()==single->GetMaxDensity());
+                for (unsigned int i=0; i<num_voxels; i++)
+                {
+                    CPPUNIT_ASSERT_MESSAGE("Voxel values of multi-bundle pass should be identical", images.at(b)->GetBufferPointer()[i]==ref->GetBufferPointer()[i]);
+                    CPPUNIT_ASSERT_MESSAGE("Voxel values of multi-threaded pass should be identical", multi->GetOutput()->GetBufferPointer()[i]==ref->GetBufferPointer()[i]);
+                }
+            }
+        }
+        omp_set_num_threads(1);
+    }
+
+    void Test23()
+    {
+        MITK_INFO << "TEST 23: Fiber peaks (single- and multi-threaded vs. serial reference)";
+
+        typedef itk::TractsToVectorImageFilter< float > PeakFilterType;
+        typedef PeakFilterType::DirectionContainerType DirectionContainerType;
+
+        float angular_threshold = cos(30.0*itk::Math::pi/180.0);
+        unsigned int max_num_dirs = 3;
+
+        // serial reference: the directions of each voxel are collected in fiber, segment and intersection order, as by
+        // the filter before the two-pass rasterization, and clustered with the clustering of the filter
+        ItkUcharImgType::RegionType region = mask->GetLargestPossibleRegion();
+        ItkUcharImgType::SizeType size = region.GetSize();
+        std::vector< DirectionContainerType::Pointer > voxel_dirs(region.GetNumberOfPixels());
+        std::vector< std::vector< double > > voxel_lengths(region.GetNumberOfPixels());
+        vtkSmartPointer<vtkPolyData> polydata = original->GetFiberPolyData();
+        for (unsigned int i=0; i<original->GetNumFibers(); ++i)
+        {
+            vtkCell* cell = polydata->GetCell(i);
+            int num_points = cell->GetNumberOfPoints();
+            vtkPoints* points = cell->GetPoints();
+            float fiber_weight = original->GetFiberWeight(i);
+            for (int j=0; j<num_points-1; ++j)
+            {
+                itk::Point<float, 3> start_vertex = mitk::imv::GetItkPoint(points->GetPoint(j));
+                itk::Index<3> start_index;
+                itk::ContinuousIndex<float, 3> start_index_cont;
+                mask->TransformPhysicalPointToIndex(start_vertex, start_index);
+                mask->TransformPhysicalPointToContinuousIndex(start_vertex, start_index_cont);
+
+                itk::Point<float, 3> end_vertex = mitk::imv::GetItkPoint(points->GetPoint(j+1));
+                itk::Index<3> end_index;
+                itk::ContinuousIndex<float, 3> end_index_cont;
+                mask->TransformPhysicalPointToIndex(end_vertex, end_index);
+                mask->TransformPhysicalPointToContinuousIndex(end_vertex, end_index_cont);
+
+                PeakFilterType::DirectionType dir;
+                dir[0] = end_vertex[0]-start_vertex[0];
+                dir[1] = end_vertex[1]-start_vertex[1];
+                dir[2] = end_vertex[2]-start_vertex[2];
+                if (dir.is_zero())
+                    continue;
+                dir.normalize();
+
+                std::vector< std::pair< itk::Index<3>, double > > intersections = mitk::imv::IntersectImage(mask->GetSpacing(), start_index, end_index, start_index_cont, end_index_cont);
+                for (auto intersection : intersections)
+                {
+                    if (!region.IsInside(intersection.first) || mask->GetPixel(intersection.first)==0)
+                        continue;
+                    std::size_t idx = intersection.first[0] + size[0]*(intersection.first[1] + size[1]*intersection.first[2]);
+                    if (voxel_dirs[idx].IsNull())
+                        voxel_dirs[idx] = DirectionContainerType::New();
+                    voxel_dirs[idx]->push_back(dir);
+                    voxel_lengths[idx].push_back(fiber_weight*intersection.second);
+                }
+            }
+        }
+
+        ReferencePeakFilter::Pointer clustering = ReferencePeakFilter::New();
+        clustering->SetAngularThreshold(angular_threshold);
+        clustering->SetMaxNumDirections(max_num_dirs);
+        std::vector< std::vector< PeakFilterType::DirectionType > > ref_peaks(voxel_dirs.size());
+        for (std::size_t idx=0; idx<voxel_dirs.size(); ++idx)
+        {
+            if (voxel_dirs[idx].IsNull())
+                continue;
+            DirectionContainerType::Pointer directions = clustering->Cluster(voxel_dirs[idx], voxel_lengths[idx]);
+            std::sort(directions->begin(), directions->end(), [](const PeakFilterType::DirectionType& a, const PeakFilterType::DirectionType& b){ return a.magnitude()>b.magnitude(); });
+            for (unsigned int i=0; i<directions->size() && i<max_num_dirs; ++i)
+            {
+                PeakFilterType::DirectionType dir = directions->at(i);
+                float mag = dir.magnitude();
+                if (mag>mitk::eps)
+                    dir.normalize();
+                ref_peaks[idx].push_back(dir);
+            }
+        }
+
+        std::vector< int > thread_counts = {1, omp_get_num_procs()};
+        std::vector< PeakFilterType::Pointer > filters;
+        for (int num_threads : thread_counts)
+        {
+            omp_set_num_threads(num_threads);
+            PeakFilterType::Pointer filter = PeakFilterType::New();
+            filter->SetFiberBundle(original);
+            filter->SetMaskImage(mask);
+            filter->SetAngularThreshold(angular_threshold);
+            filter->SetNormalizationMethod(PeakFilterType::NormalizationMethods::SINGLE_VEC_NORM);
+            filter->SetMaxNumDirections(max_num_dirs);
+            filter->Update();
+            filters.push_back(filter);
+        }
+        omp_set_num_threads(1);
+
+        for (PeakFilterType::Pointer filter : filters)
+        {
+            PeakFilterType::ItkDirectionImageType::Pointer peaks = filter->GetDirectionImage();
+            ItkUcharImgType::Pointer num_dirs = filter->GetNumDirectionsImage();
+            CPPUNIT_ASSERT_MESSAGE("Same image size", num_dirs->GetLargestPossibleRegion()==region);
+
+            itk::ImageRegionIteratorWithIndex< ItkUcharImgType > it(num_dirs, region);
+            for (; !it.IsAtEnd(); ++it)
+            {
+                ItkUcharImgType::IndexType idx3 = it.GetIndex();
+                std::size_t idx = idx3[0] + size[0]*(idx3[1] + size[1]*idx3[2]);
+
+                CPPUNIT_ASSERT_MESSAGE("Number of directions should match serial reference", it.Get()==ref_peaks[idx].size());
+                itk::Index<4> idx4; idx4[0] = idx3[0]; idx4[1] = idx3[1]; idx4[2] = idx3[2];
+                for (unsigned int i=0; i<max_num_dirs; ++i)
+                    for (unsigned int j=0; j<3; ++j)
+                    {
+                        idx4[3] = i*3 + j;
+                        float ref = i<ref_peaks[idx].size() ? static_cast<float>(ref_peaks[idx][i][j]) : 0;
+                        CPPUNIT_ASSERT_MESSAGE("Peaks should match serial reference", peaks->GetPixel(idx4)==ref);
+                    }
+            }
+        }
+
+        // 1 vs. N threads, bitwise
+        unsigned int num_values = filters[0]->GetDirectionImage()->GetLargestPossibleRegion().GetNumberOfPixels();
+        for (unsigned int i=0; i<num_values; ++i)
+            CPPUNIT_ASSERT_MESSAGE("Peaks should not depend on the number of threads", filters[0]->GetDirectionImage()->GetBufferPointer()[i]==filters[1]->GetDirectionImage()->GetBufferPointer()[i]);
+    }
+
+    void Test24()
+    {
+        MITK_INFO << "TEST 24: Distance to segmentation (distance transform vs. surface distance)";
+
+        typedef itk::DistanceFromSegmentationImageFilter< float > DistanceFilterType;
+
+        // spherical segmentation, voxel centers closer than the radius to the center are inside
+        double radius = 8.0;
+        ItkUcharImgType::Pointer segmentation = ItkUcharImgType::New();
+        ItkUcharImgType::SizeType size; size.Fill(32);
+        ItkUcharImgType::SpacingType spacing; spacing.Fill(1.0);
+        segmentation->SetRegions(size);
+        segmentation->SetSpacing(spacing);
+        segmentation->Allocate();
+
+        FloatImageType::Pointer tdi = FloatImageType::New();
+        tdi->SetRegions(size);
+        tdi->SetSpacing(spacing);
+        tdi->Allocate();
+        tdi->FillBuffer(1.0);
+
+        itk::Point<double, 3> center; center.Fill(15.5);
+        itk::ImageRegionIteratorWithIndex< ItkUcharImgType > it(segmentation, segmentation->GetLargestPossibleRegion());
+        for (; !it.IsAtEnd(); ++it)
+        {
+            itk::Point<double, 3> p;
+            segmentation->TransformIndexToPhysicalPoint(it.GetIndex(), p);
+            it.Set(p.EuclideanDistanceTo(center)<radius ? 1 : 0);
+        }
+
+        vtkSmartPointer<vtkSphereSource> sphere = vtkSmartPointer<vtkSphereSource>::New();
+        sphere->SetCenter(center[0], center[1], center[2]);
+        sphere->SetRadius(radius);
+        sphere->SetThetaResolution(128);
+        sphere->SetPhiResolution(128);
+        sphere->Update();
+        mitk::Surface::Pointer surface = mitk::Surface::New();
+        surface->SetVtkPolyData(sphere->GetOutput());
+
+        DistanceFilterType::Pointer surface_filter = DistanceFilterType::New();
+        surface_filter->SetInput(tdi);
+        surface_filter->SetSegmentationSurface(surface);
+        surface_filter->Update();
+
+        DistanceFilterType::Pointer dt_filter = DistanceFilterType::New();
+        dt_filter->SetInput(tdi);
+        dt_filter->SetSegmentationMask(segmentation);
+        dt_filter->SetUseDistanceTransform(true);
+        dt_filter->Update();
+
+        DistanceFilterType::Pointer refined_filter = DistanceFilterType::New();
+        refined_filter->SetInput(tdi);
+        refined_filter->SetSegmentationMask(segmentation);
+        refined_filter->SetSegmentationSurface(surface);
+        refined_filter->SetUseDistanceTransform(true);
+        refined_filter->SetSubVoxelRefinement(true);
+        refined_filter->Update();
+
+        // the zero level of the distance transform lies on the boundary voxel centers, which are less than one voxel
+        // away from the surface (plus the polygonal approximation of the sphere)
+        float tolerance = spacing[0] + 0.01;
+        float band = refined_filter->GetRefinementBand()*spacing[0];
+        unsigned int num_voxels = tdi->GetLargestPossibleRegion().GetNumberOfPixels();
+        for (unsigned int i=0; i<num_voxels; i++)
+        {
+            float surface_dist = surface_filter->GetOutput()->GetBufferPointer()[i];
+            float dt_dist = dt_filter->GetOutput()->GetBufferPointer()[i];
+            float refined_dist = refined_filter->GetOutput()->GetBufferPointer()[i];
+            CPPUNIT_ASSERT_MESSAGE("Distance transform should agree with surface distance within a voxel", std::fabs(dt_dist-surface_dist)<=tolerance);
+            CPPUNIT_ASSERT_MESSAGE("Refined distance should agree with surface distance within a voxel", std::fabs(refined_dist-surface_dist)<=tolerance);
+            if (std::fabs(dt_dist)<=band)
+                CPPUNIT_ASSERT_MESSAGE("Refined distance should equal surface distance in the refinement band", std::fabs(refined_dist-surface_dist)<0.00001);
+        }
+        CPPUNIT_ASSERT_MESSAGE("Minimum distance should agree within a voxel", std::fabs(dt_filter->GetMinDistance()-surface_filter->GetMinDistance())<=tolerance);
+    }
+
 };
 
 MITK_TEST_SUITE_REGISTRATION(mitkFiberProcessing)
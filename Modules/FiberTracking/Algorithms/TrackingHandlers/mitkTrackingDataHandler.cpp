@@ -20,8 +20,10 @@ namespace mitk
 {
 TrackingDataHandler::TrackingDataHandler()
   : m_RngItk(ItkRngType::New())
+  , m_RngSeed(0)
   , m_NeedsDataInit(true)
 {
+  m_RngStreams.resize(static_cast<unsigned int>(std::max(omp_get_max_threads(), 1)));
 
 }
 }
@@ -19,19 +19,81 @@ See LICENSE.txt or http://www.mitk.org for details.
 
 #include <MitkFiberTrackingExports.h>
 #include <boost/random/discrete_distribution.hpp>
-#include <boost/random/mersenne_twister.hpp>
 #include <boost/random/variate_generator.hpp>
+#include <cassert>
 #include <deque>
 #include <itkImage.h>
 #include <itkLinearInterpolateImageFunction.h>
 #include <itkMersenneTwisterRandomVariateGenerator.h>
 #include <itkPoint.h>
+#include <itkMath.h>
 #include <mitkBaseData.h>
 #include <mitkDiffusionModellingHelperFunctions.h>
 #include <mitkStreamlineTractographyParameters.h>
+#include <omp.h>
+#include <cstdint>
+#include <random>
 
 namespace mitk
 {
+  /**
+   * \brief  Counter based random number stream. The n-th number of a stream is a SplitMix64 hash of (key, n), so a
+   * stream only depends on its key and not on the thread that evaluates it. Fulfills the UniformRandomBitGenerator
+   * requirements and can be used with the boost/std distributions. Padded by a cache line, so the state of two streams
+   * stored next to each other never shares a cache line (no alignas, std::vector ignores over-alignment before C++17). */
+  struct TrackingRngStream
+  {
+    typedef uint64_t result_type;
+
+    TrackingRngStream() : m_Key(0), m_Counter(0) {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    void Reset(uint64_t key)
+    {
+      m_Key = Mix(key);
+      m_Counter = 0;
+    }
+
+    result_type operator()()
+    {
+      ++m_Counter;
+      return Mix(m_Key + m_Counter*0x9E3779B97F4A7C15ull);
+    }
+
+    double GetUniformVariate(double a, double b)  ///< uniform in [a,b)
+    {
+      return a + (b-a)*(static_cast<double>((*this)() >> 11) * (1.0/9007199254740992.0));
+    }
+
+    unsigned int GetIntegerVariate(unsigned int n)  ///< uniform integer in [0,n]
+    {
+      return static_cast<unsigned int>( ((*this)() >> 32) * (static_cast<uint64_t>(n)+1) >> 32 );
+    }
+
+    double GetNormalVariate(double mean, double sigma)  ///< Box-Muller
+    {
+      double u1 = GetUniformVariate(0, 1);
+      double u2 = GetUniformVariate(0, 1);
+      if (u1<1e-300)
+        u1 = 1e-300;
+      return mean + sigma*std::sqrt(-2.0*std::log(u1))*std::cos(2.0*itk::Math::pi*u2);
+    }
+
+    static uint64_t Mix(uint64_t z)
+    {
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      return z ^ (z >> 31);
+    }
+
+  private:
+    uint64_t m_Key;
+    uint64_t m_Counter;
+    char     m_Padding[64];
+  };
+
   /**
    * \brief  Abstract class for tracking handler. A tracking handler deals with determining the next progression
    * direction of a streamline fiber. There are different handlers for tensor images, peak images, ... */
@@ -43,7 +105,6 @@ namespace mitk
     virtual ~TrackingDataHandler() {}
 
     typedef itk::Statistics::MersenneTwisterRandomVariateGenerator ItkRngType;
-    typedef boost::mt19937 BoostRngType;
     typedef itk::Image<unsigned char, 3> ItkUcharImgType;
     typedef itk::Image<short, 3> ItkShortImgType;
     typedef itk::Image<float, 3> ItkFloatImgType;
@@ -69,19 +130,44 @@ namespace mitk
 
       if (m_Parameters->m_FixRandomSeed)
       {
-        m_Rng.seed(0);
         std::srand(0);
         m_RngItk->SetSeed(0);
+        m_RngSeed = 0;
       }
       else
       {
-        m_Rng.seed();
         m_RngItk->SetSeed();
         std::srand(std::time(nullptr));
+        std::random_device rd;
+        m_RngSeed = (static_cast<uint64_t>(rd()) << 32) | rd();
       }
+      InitRngStreams(static_cast<unsigned int>(m_RngStreams.size()));
+    }
+
+    /** Creates one random number stream per thread of the team that runs the tracking. Has to be called before the
+     * parallel region with its team size, GetRngStream() is only valid for thread numbers below num_threads. */
+    void InitRngStreams(unsigned int num_threads)
+    {
+      m_RngStreams.clear();
+      m_RngStreams.resize(std::max(num_threads, 1u));
+      for (unsigned int i=0; i<m_RngStreams.size(); ++i)
+        m_RngStreams[i].Reset(m_RngSeed + i);
+    }
+
+    /** Restarts the random number stream of the calling thread. Called by the tracker once per streamline with the
+     * seed point index, so that the tracking result is independent of the number of threads. */
+    void InitRngStream(uint64_t stream_id) { GetRngStream().Reset(m_RngSeed ^ TrackingRngStream::Mix(stream_id + 1)); }
+
+    /** Random number stream of the calling thread. */
+    TrackingRngStream& GetRngStream()
+    {
+      auto t = static_cast<unsigned int>(omp_get_thread_num());
+      assert(t<m_RngStreams.size() && "InitRngStreams() was not called with the team size of the tracking");
+      return m_RngStreams[t];
     }
 
-    double GetRandDouble(const double &a, const double &b) { return m_RngItk->GetUniformVariate(a, b); }
+    double GetRandDouble(const double &a, const double &b) { return GetRngStream().GetUniformVariate(a, b); } ///< thread safe, uses the stream of the calling thread
+    double GetSerialRandDouble(const double &a, const double &b) { return m_RngItk->GetUniformVariate(a, b); } ///< not thread safe, for serial code paths only
 
   protected:
     void CalculateMinVoxelSize()
@@ -101,8 +187,9 @@ namespace mitk
       m_Parameters->SetMinVoxelSizeMm(minVoxelSize);
     }
 
-    BoostRngType m_Rng;
     ItkRngType::Pointer m_RngItk;
+    uint64_t m_RngSeed;
+    std::vector< TrackingRngStream > m_RngStreams;
     bool m_NeedsDataInit;
     std::shared_ptr<mitk::StreamlineTractographyParameters> m_Parameters;
 
@@ -94,6 +94,13 @@ void TrackingHandlerOdf::InitForTracking()
   m_OdfInterpolator->SetInputImage(m_OdfImage);
   this->CalculateMinVoxelSize();
 
+  m_ThreadScratch.resize(static_cast<unsigned int>(std::max(omp_get_max_threads(), 1)));
+  for (auto& scratch : m_ThreadScratch)
+  {
+    scratch.m_Probs.set_size(m_OdfHemisphereIndices.size());
+    scratch.m_Angles.set_size(m_OdfHemisphereIndices.size());
+  }
+
   std::cout << "TrackingHandlerOdf - GFA threshold: " << m_Parameters->m_Cutoff << std::endl;
   std::cout << "TrackingHandlerOdf - ODF threshold: " << m_Parameters->m_OdfCutoff << std::endl;
   if (m_Parameters->m_SharpenOdfs > 1)
@@ -107,15 +114,12 @@ int TrackingHandlerOdf::SampleOdf(vnl_vector< float >& probs, vnl_vector< float
   int max_sample_idx = -1;
   float max_prob = 0;
   int trials = 0;
+  TrackingRngStream& rng = this->GetRngStream();
 
   for (int i=0; i<m_NumProbSamples; i++)  // we sample m_NumProbSamples times and retain the sample with maximum probabilty
   {
     trials++;
-#pragma omp critical
-    {
-      boost::random::variate_generator<boost::random::mt19937&, boost::random::discrete_distribution<int,float>> sampler(m_Rng, dist);
-      sampled_idx = sampler();
-    }
+    sampled_idx = dist(rng);
     if (probs[sampled_idx]>max_prob && probs[sampled_idx]>m_Parameters->m_OdfCutoff && fabs(angles[sampled_idx])>=m_Parameters->GetAngularThresholdDot())
     {
       max_prob = probs[sampled_idx];
@@ -162,8 +166,12 @@ vnl_vector_fixed<float,3> TrackingHandlerOdf::ProposeDirection(const itk::Point<
     return last_dir;
 
   ItkOdfImageType::PixelType odf_values = mitk::imv::GetImageValue<ItkOdfImageType::PixelType>(pos, m_Parameters->m_InterpolateTractographyData, m_OdfInterpolator);
-  vnl_vector< float > probs; probs.set_size(m_OdfHemisphereIndices.size());
-  vnl_vector< float > angles; angles.set_size(m_OdfHemisphereIndices.size()); angles.fill(1.0);
+  auto thread = static_cast<unsigned int>(omp_get_thread_num());
+  if (thread>=m_ThreadScratch.size())
+    mitkThrow() << "ODF tracking handler not initialized for thread " << thread << "!";
+  vnl_vector< float >& probs = m_ThreadScratch[thread].m_Probs;
+  vnl_vector< float >& angles = m_ThreadScratch[thread].m_Angles;
+  angles.fill(1.0);
 
   // Find ODF maximum and remove <0 values
   float max_odf_val = 0;
@@ -225,7 +233,8 @@ vnl_vector_fixed<float,3> TrackingHandlerOdf::ProposeDirection(const itk::Point<
     last_dir[2] *= -1;
 
   // calculate angles between previous direction and ODF directions
-  angles = m_OdfFloatDirs*last_dir;
+  for (unsigned int i=0; i<m_OdfHemisphereIndices.size(); i++)
+    angles[i] = m_OdfFloatDirs[i][0]*last_dir[0] + m_OdfFloatDirs[i][1]*last_dir[1] + m_OdfFloatDirs[i][2]*last_dir[2];
 
   float probs_sum = 0;
   float max_prob = 0;
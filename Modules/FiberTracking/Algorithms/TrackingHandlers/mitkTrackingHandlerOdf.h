@@ -63,6 +63,13 @@ protected:
 
   int SampleOdf(vnl_vector< float >& probs, vnl_vector< float >& angles);
 
+  /** Per-thread work arrays of ProposeDirection, sized once in InitForTracking. */
+  struct ThreadScratch
+  {
+    vnl_vector< float > m_Probs;
+    vnl_vector< float > m_Angles;
+  };
+
   ItkFloatImgType::Pointer        m_GfaImage;     ///< GFA image used to determine streamline termination.
   ItkOdfImageType::Pointer        m_OdfImage;     ///< Input odf image.
   ItkOdfImageType::Pointer        m_WorkingOdfImage;     ///< Modified odf image.
@@ -70,6 +77,7 @@ protected:
   vnl_matrix< float >             m_OdfFloatDirs;
   int                             m_NumProbSamples;
   bool                            m_OdfFromTensor;
+  std::vector< ThreadScratch >    m_ThreadScratch;
 
   itk::LinearInterpolateImageFunction< itk::Image< float, 3 >, float >::Pointer   m_GfaInterpolator;
   itk::LinearInterpolateImageFunction< itk::Image< ItkOdfImageType::PixelType, 3 >, float >::Pointer   m_OdfInterpolator;
@@ -32,6 +32,10 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <TrackingHandlers/mitkTrackingHandlerTensor.h>
 #include <mitkDiffusionModellingHelperFunctions.h>
 #include <random>
+#include <algorithm>
+#include <map>
+#include <limits>
+#include <thread>
 
 namespace itk {
 
@@ -56,6 +60,8 @@ StreamlineTrackingFilter
   , m_CurrentTracts(0)
   , m_Progress(0)
   , m_StopTracking(false)
+  , m_StreamWriter(nullptr)
+  , m_StreamBatchSize(1000)
   , m_TrackingPriorHandler(nullptr)
 {
   this->SetNumberOfRequiredInputs(0);
@@ -71,9 +77,37 @@ std::string StreamlineTrackingFilter::GetStatusText()
   else
     status += "\nFibers accepted: " + boost::lexical_cast<std::string>(m_CurrentTracts);
 
+  double seconds = std::chrono::duration<double>(std::chrono::system_clock::now() - m_StartTime).count();
+  if (!m_ThreadCounters.empty() && seconds>0)
+  {
+    unsigned long long steps = GetNumSteps();
+    status += "\nSteps/s: " + boost::lexical_cast<std::string>(static_cast<unsigned long long>(steps/seconds));
+    status += " (" + boost::lexical_cast<std::string>(static_cast<unsigned long long>(steps/seconds/m_ThreadCounters.size())) + " per thread)";
+  }
+
+  if (m_ThreadCounters.size()>1)
+  {
+    unsigned long long min_seeds = std::numeric_limits<unsigned long long>::max();
+    unsigned long long max_seeds = 0;
+    for (auto& c : m_ThreadCounters)
+    {
+      min_seeds = std::min(min_seeds, c.m_Seeds.load(std::memory_order_relaxed));
+      max_seeds = std::max(max_seeds, c.m_Seeds.load(std::memory_order_relaxed));
+    }
+    status += "\nSeeds per thread (min/max): " + boost::lexical_cast<std::string>(min_seeds) + "/" + boost::lexical_cast<std::string>(max_seeds);
+  }
+
   return status;
 }
 
+unsigned long long StreamlineTrackingFilter::GetNumSteps()
+{
+  unsigned long long steps = 0;
+  for (auto& c : m_ThreadCounters)
+    steps += c.m_Steps.load(std::memory_order_relaxed);
+  return steps;
+}
+
 void StreamlineTrackingFilter::BeforeTracking()
 {
   m_StopTracking = false;
@@ -208,6 +242,15 @@ void StreamlineTrackingFilter::BeforeTracking()
   if (m_DemoMode)
     omp_set_num_threads(1);
 
+  // the probe directions only depend on the number of samples
+  m_ProbeVectors = CreateDirections(m_Parameters->m_NumSamples);
+  // the team of the tracking loop has omp_get_max_threads() threads, counters and random number streams match it
+  auto num_threads = static_cast<unsigned int>(std::max(omp_get_max_threads(), 1));
+  m_ThreadCounters = std::vector< ThreadCounter >(num_threads);
+  m_TrackingHandler->InitRngStreams(num_threads);
+  if (m_TrackingPriorHandler!=nullptr)
+    m_TrackingPriorHandler->InitRngStreams(num_threads);
+
   if (m_Parameters->m_Mode==mitk::TrackingDataHandler::MODE::DETERMINISTIC)
     std::cout << "StreamlineTracking - Mode: deterministic" << std::endl;
   else if(m_Parameters->m_Mode==mitk::TrackingDataHandler::MODE::PROBABILISTIC)
@@ -331,10 +374,9 @@ vnl_vector_fixed<float,3> StreamlineTrackingFilter::GetNewDirection(const itk::P
   if (!olddirs.empty())
   {
     vnl_vector_fixed<float,3> olddir = olddirs.back();
-    std::vector< vnl_vector_fixed<float,3> > probeVecs = CreateDirections(m_Parameters->m_NumSamples);
     itk::Point<double, 3> sample_pos;
     unsigned int alternatives = 1;
-    for (unsigned int i=0; i<probeVecs.size(); i++)
+    for (unsigned int i=0; i<m_ProbeVectors.size(); i++)
     {
       vnl_vector_fixed<float,3> d;
       bool is_stop_voter = false;
@@ -348,7 +390,7 @@ vnl_vector_fixed<float,3> StreamlineTrackingFilter::GetNewDirection(const itk::P
       }
       else
       {
-        d = probeVecs.at(i);
+        d = m_ProbeVectors[i];
         float dot = dot_product(d, olddir);
         if (m_Parameters->m_StopVotes && dot>0.7f)
         {
@@ -456,8 +498,10 @@ float StreamlineTrackingFilter::FollowStreamline(itk::Point<float, 3> pos, vnl_v
   for (unsigned int i=0; i<m_Parameters->m_NumPreviousDirections-1; i++)
     last_dirs.push_back(zero_dir);
 
+  ThreadCounter& thread_counter = m_ThreadCounters[static_cast<unsigned int>(omp_get_thread_num())];
   for (int step=0; step< 5000; step++)
   {
+    thread_counter.m_Steps.fetch_add(1, std::memory_order_relaxed);
     itk::Index<3> oldIndex;
     m_TrackingHandler->WorldToIndex(pos, oldIndex);
 
@@ -624,9 +668,9 @@ void StreamlineTrackingFilter::GetSeedPointsFromSeedImage()
         m_SeedPoints.push_back(worldPos);
         for (unsigned int s = 1; s < m_Parameters->m_SeedsPerVoxel; s++)
         {
-          start[0] = index[0] + static_cast<float>(m_TrackingHandler->GetRandDouble(-0.5, 0.5));
-          start[1] = index[1] + static_cast<float>(m_TrackingHandler->GetRandDouble(-0.5, 0.5));
-          start[2] = index[2] + static_cast<float>(m_TrackingHandler->GetRandDouble(-0.5, 0.5));
+          start[0] = index[0] + static_cast<float>(m_TrackingHandler->GetSerialRandDouble(-0.5, 0.5));
+          start[1] = index[1] + static_cast<float>(m_TrackingHandler->GetSerialRandDouble(-0.5, 0.5));
+          start[2] = index[2] + static_cast<float>(m_TrackingHandler->GetSerialRandDouble(-0.5, 0.5));
 
           itk::Point<float> worldPos;
           m_SeedImage->TransformContinuousIndexToPhysicalPoint(start, worldPos);
@@ -654,7 +698,6 @@ void StreamlineTrackingFilter::GenerateData()
   int num_seeds = static_cast<int>(m_SeedPoints.size());
   itk::Index<3> zeroIndex; zeroIndex.Fill(0);
   m_Progress = 0;
-  int i = 0;
   int print_interval = num_seeds/100;
   if (print_interval<100)
     m_Verbose=false;
@@ -663,94 +706,191 @@ void StreamlineTrackingFilter::GenerateData()
   if(m_Parameters->m_Mode==mitk::TrackingDataHandler::MODE::PROBABILISTIC)
     trials_per_seed = m_Parameters->m_TrialsPerSeed;
 
-#pragma omp parallel
-  while (i<num_seeds && !m_StopTracking)
+  // seeds are handed out in chunks; idle threads grab the next chunk, so expensive seed regions do not stall the others
+  int num_threads = static_cast<int>(m_ThreadCounters.size());
+  int chunk_size = std::max(1, std::min(64, num_seeds/(num_threads*16)));
+  std::atomic<int> next_seed(0);
+
+  // accepted fibers are collected per thread together with their seed index and merged after tracking,
+  // padded by a cache line so that neighbouring buffers do not share one
+  struct FiberBuffer
   {
-    int temp_i = 0;
-#pragma omp critical
-    {
-      temp_i = i;
-      i++;
-    }
+    std::vector< std::pair<int, FiberType> > m_Fibers;
+    char m_Padding[64];
+  };
+  std::vector< FiberBuffer > fiber_buffers(static_cast<unsigned int>(num_threads));
+
+  // when streaming, finished chunks wait in a reorder buffer keyed by their first seed index and only the contiguous
+  // finished prefix is written, so the file has the same fiber order as the in-memory tractogram
+  std::map< int, std::vector< FiberType > > stream_chunks;
+  int stream_next_chunk = 0;
+
+  // back-pressure: while the reorder buffer holds more than this many fibers (e.g. one slow chunk blocks the prefix),
+  // threads do not start new chunks. The blocking chunks are being tracked by threads that are not waiting, so the
+  // prefix is always completed and written eventually.
+  const std::size_t stream_max_buffered = 4*static_cast<std::size_t>(m_StreamBatchSize);
+  std::atomic<std::size_t> stream_buffered(0);
+
+#pragma omp parallel num_threads(num_threads)
+  while (!m_StopTracking)
+  {
+    if (m_StreamWriter!=nullptr)
+      while (stream_buffered.load()>stream_max_buffered && !m_StopTracking)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
 
-    if (temp_i>=num_seeds || m_StopTracking)
-      continue;
-    else if (m_Verbose && i%print_interval==0)
-#pragma omp critical
-    {
-      m_Progress += static_cast<unsigned int>(print_interval);
-      std::cout << "                                                                                                     \r";
-      if (m_Parameters->m_MaxNumFibers>0)
-        std::cout << "Tried: " << m_Progress << "/" << num_seeds << " | Accepted: " << m_CurrentTracts << "/" << m_Parameters->m_MaxNumFibers << '\r';
-      else
-        std::cout << "Tried: " << m_Progress << "/" << num_seeds << " | Accepted: " << m_CurrentTracts << '\r';
-      cout.flush();
-    }
+    int chunk_start = next_seed.fetch_add(chunk_size);
+    if (chunk_start>=num_seeds)
+      break;
+    int chunk_end = std::min(chunk_start+chunk_size, num_seeds);
 
-    const itk::Point<float> worldPos = m_SeedPoints.at(static_cast<unsigned int>(temp_i));
+    unsigned int thread = static_cast<unsigned int>(omp_get_thread_num());
+    ThreadCounter& thread_counter = m_ThreadCounters[thread];
+    FiberBuffer& fiber_buffer = fiber_buffers[thread];
 
-    for (unsigned int trials=0; trials<trials_per_seed; ++trials)
+    for (int temp_i=chunk_start; temp_i<chunk_end && !m_StopTracking; ++temp_i)
     {
-      FiberType fib;
-      DirectionContainer direction_container;
-      float tractLength = 0;
-      unsigned long counter = 0;
-
-      // get starting direction
-      vnl_vector_fixed<float,3> dir; dir.fill(0.0);
-      std::deque< vnl_vector_fixed<float,3> > olddirs;
-      dir = GetNewDirection(worldPos, olddirs, zeroIndex) * 0.5f;
-
-      bool exclude = false;
-      if (m_ExclusionRegions.IsNotNull() && mitk::imv::IsInsideMask<float>(worldPos, m_Parameters->m_InterpolateRoiImages, m_ExclusionInterpolator))
-        exclude = true;
-
-      bool success = false;
-      if (dir.magnitude()>0.0001f && !exclude)
+      thread_counter.m_Seeds.fetch_add(1, std::memory_order_relaxed);
+      const itk::Point<float> worldPos = m_SeedPoints.at(static_cast<unsigned int>(temp_i));
+
+      for (unsigned int trials=0; trials<trials_per_seed; ++trials)
       {
-        // forward tracking
-        tractLength = FollowStreamline(worldPos, dir, &fib, &direction_container, 0, false, exclude);
-        fib.push_front(worldPos);
+        // one random number stream per seed and trial --> same result for any number of threads
+        uint64_t stream_id = static_cast<uint64_t>(temp_i)*trials_per_seed + trials;
+        m_TrackingHandler->InitRngStream(stream_id);
+        if (m_TrackingPriorHandler!=nullptr)
+          m_TrackingPriorHandler->InitRngStream(stream_id);
+
+        FiberType fib;
+        DirectionContainer direction_container;
+        float tractLength = 0;
+        unsigned long counter = 0;
+
+        // get starting direction
+        vnl_vector_fixed<float,3> dir; dir.fill(0.0);
+        std::deque< vnl_vector_fixed<float,3> > olddirs;
+        dir = GetNewDirection(worldPos, olddirs, zeroIndex) * 0.5f;
+
+        bool exclude = false;
+        if (m_ExclusionRegions.IsNotNull() && mitk::imv::IsInsideMask<float>(worldPos, m_Parameters->m_InterpolateRoiImages, m_ExclusionInterpolator))
+          exclude = true;
+
+        bool success = false;
+        if (dir.magnitude()>0.0001f && !exclude)
+        {
+          // forward tracking
+          tractLength = FollowStreamline(worldPos, dir, &fib, &direction_container, 0, false, exclude);
+          fib.push_front(worldPos);
 
-        // backward tracking
-        if (!exclude)
-          tractLength = FollowStreamline(worldPos, -dir, &fib, &direction_container, tractLength, true, exclude);
+          // backward tracking
+          if (!exclude)
+            tractLength = FollowStreamline(worldPos, -dir, &fib, &direction_container, tractLength, true, exclude);
 
-        counter = fib.size();
+          counter = fib.size();
 
-        if (tractLength>=m_Parameters->m_MinTractLengthMm && counter>=2 && !exclude)
-        {
-#pragma omp critical
-          if ( IsValidFiber(&fib) )
+          if (tractLength>=m_Parameters->m_MinTractLengthMm && counter>=2 && !exclude && IsValidFiber(&fib) && !m_StopTracking)
           {
-            if (!m_StopTracking)
+            unsigned int num_tracts = 0;
+#pragma omp atomic capture
+            num_tracts = ++m_CurrentTracts;
+
+            if (m_Parameters->m_MaxNumFibers <= 0 || num_tracts<=static_cast<unsigned int>(m_Parameters->m_MaxNumFibers))
             {
-              if (!m_Parameters->m_OutputProbMap)
-                m_Tractogram.push_back(fib);
-              else
+              if (m_Parameters->m_OutputProbMap)
+              {
+#pragma omp critical
                 FiberToProbmap(&fib);
-              m_CurrentTracts++;
+              }
+              else if (m_DemoMode)
+                m_Tractogram.push_back(fib);  // single threaded, the demo visualization shows m_Tractogram
+              else
+                fiber_buffer.m_Fibers.emplace_back(temp_i, std::move(fib));
               success = true;
             }
-            if (m_Parameters->m_MaxNumFibers > 0 && m_CurrentTracts>=static_cast<unsigned int>(m_Parameters->m_MaxNumFibers))
+
+            if (m_Parameters->m_MaxNumFibers > 0 && num_tracts>=static_cast<unsigned int>(m_Parameters->m_MaxNumFibers))
             {
-              if (!m_StopTracking)
+#pragma omp critical
               {
-                std::cout << "                                                                                                     \r";
-                MITK_INFO << "Reconstructed maximum number of tracts (" << m_CurrentTracts << "). Stopping tractography.";
+                if (!m_StopTracking)
+                {
+                  std::cout << "                                                                                                     \r";
+                  MITK_INFO << "Reconstructed maximum number of tracts (" << m_Parameters->m_MaxNumFibers << "). Stopping tractography.";
+                }
+                m_StopTracking = true;
               }
-              m_StopTracking = true;
             }
           }
         }
-      }
 
-      if (success || m_Parameters->m_Mode!=MODE::PROBABILISTIC)
-        break;  // we only try one seed point multiple times if we use a probabilistic tracker and have not found a valid streamline yet
+        if (success || m_Parameters->m_Mode!=MODE::PROBABILISTIC)
+          break;  // we only try one seed point multiple times if we use a probabilistic tracker and have not found a valid streamline yet
+
+      }// trials per seed
+    }// seeds in chunk
+
+    if (m_StreamWriter!=nullptr)
+    {
+      std::vector< FiberType > chunk_fibers;
+      chunk_fibers.reserve(fiber_buffer.m_Fibers.size());
+      for (auto& f : fiber_buffer.m_Fibers)
+        chunk_fibers.push_back(std::move(f.second));
+      fiber_buffer.m_Fibers.clear();
+
+#pragma omp critical (stream_writer)
+      {
+        stream_buffered += chunk_fibers.size();
+        stream_chunks[chunk_start] = std::move(chunk_fibers);
+
+        // number of fibers in the finished prefix, written once it holds at least StreamBatchSize fibers
+        std::size_t num_ready = 0;
+        int expected = stream_next_chunk;
+        for (auto it = stream_chunks.begin(); it!=stream_chunks.end() && it->first==expected; ++it, expected+=chunk_size)
+          num_ready += it->second.size();
 
-    }// trials per seed
+        if (num_ready>=m_StreamBatchSize)
+          for (auto it = stream_chunks.begin(); it!=stream_chunks.end() && it->first==stream_next_chunk; it = stream_chunks.erase(it))
+          {
+            for (auto& f : it->second)
+              m_StreamWriter->WriteFiber(f);
+            stream_buffered -= it->second.size();
+            stream_next_chunk += chunk_size;
+          }
+      }
+    }
+
+    unsigned int progress = 0;
+#pragma omp atomic capture
+    progress = m_Progress += static_cast<unsigned int>(chunk_end-chunk_start);
 
-  }// seed points
+    if (m_Verbose && progress/print_interval != (progress-static_cast<unsigned int>(chunk_end-chunk_start))/print_interval)
+#pragma omp critical
+    {
+      std::cout << "                                                                                                     \r";
+      if (m_Parameters->m_MaxNumFibers>0)
+        std::cout << "Tried: " << progress << "/" << num_seeds << " | Accepted: " << m_CurrentTracts << "/" << m_Parameters->m_MaxNumFibers << '\r';
+      else
+        std::cout << "Tried: " << progress << "/" << num_seeds << " | Accepted: " << m_CurrentTracts << '\r';
+      cout.flush();
+    }
+  }// seed chunks
+
+  if (m_Parameters->m_MaxNumFibers > 0 && m_CurrentTracts>static_cast<unsigned int>(m_Parameters->m_MaxNumFibers))
+    m_CurrentTracts = static_cast<unsigned int>(m_Parameters->m_MaxNumFibers);
+
+  // merge the per-thread buffers ordered by seed index. This yields the same order for any number of threads.
+  std::vector< std::pair<int, std::pair<unsigned int, unsigned int>> > order;
+  for (unsigned int t=0; t<fiber_buffers.size(); ++t)
+    for (unsigned int f=0; f<fiber_buffers[t].m_Fibers.size(); ++f)
+      order.push_back({fiber_buffers[t].m_Fibers[f].first, {t, f}});
+  std::sort(order.begin(), order.end());
+  m_Tractogram.reserve(m_Tractogram.size() + order.size());
+  for (auto& o : order)
+    m_Tractogram.push_back(std::move(fiber_buffers[o.second.first].m_Fibers[o.second.second].second));
+
+  // remaining streamed chunks in seed order (chunks may be missing if the tracking was stopped)
+  for (auto& c : stream_chunks)
+    for (auto& f : c.second)
+      m_StreamWriter->WriteFiber(f);
 
   this->AfterTracking();
 }
@@ -896,7 +1036,10 @@ void StreamlineTrackingFilter::AfterTracking()
     std::cout << "                                                                                                     \r";
   if (!m_Parameters->m_OutputProbMap)
   {
-    MITK_INFO << "Reconstructed " << m_Tractogram.size() << " fibers.";
+    if (m_StreamWriter!=nullptr)
+      MITK_INFO << "Reconstructed " << m_CurrentTracts << " fibers (streamed to file).";
+    else
+      MITK_INFO << "Reconstructed " << m_Tractogram.size() << " fibers.";
     MITK_INFO << "Generating polydata ";
     BuildFibers(false);
   }
@@ -918,6 +1061,9 @@ void StreamlineTrackingFilter::AfterTracking()
   mm %= 60;
   ss %= 60;
   MITK_INFO << "Tracking took " << hh.count() << "h, " << mm.count() << "m and " << ss.count() << "s";
+  double seconds = std::chrono::duration<double>(m_EndTime - m_StartTime).count();
+  if (seconds>0)
+    MITK_INFO << "Integration steps: " << GetNumSteps() << " (" << static_cast<unsigned long long>(GetNumSteps()/seconds/m_ThreadCounters.size()) << " steps/s per thread)";
 
   m_SeedPoints.clear();
 }
@@ -32,9 +32,11 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <mitkDiffusionPropertyHelper.h>
 #include <mitkPointSet.h>
 #include <chrono>
+#include <atomic>
 #include <TrackingHandlers/mitkTrackingDataHandler.h>
 #include <MitkFiberTrackingExports.h>
 #include <mitkFiberBundle.h>
+#include <mitkFiberBundleStreamWriter.h>
 #include <mitkPeakImage.h>
 #include <mitkStreamlineTractographyParameters.h>
 
@@ -106,6 +108,15 @@ public:
     m_TrackingHandler = h;
   }
 
+  /** If set, accepted fibers are written to this (opened) writer in seed order, in batches of at least
+   * StreamBatchSize fibers, instead of being collected in memory. The fiber polydata output stays empty. The writer is not closed by the filter.
+   * Fibers that wait for an earlier, unfinished seed chunk are buffered; no new chunks are started while more than 4*StreamBatchSize fibers wait. */
+  void SetStreamWriter( mitk::FiberBundleStreamWriter* w )
+  {
+    m_StreamWriter = w;
+  }
+  itkSetMacro( StreamBatchSize, unsigned int )
+
   void Update() override{
     this->GenerateData();
   }
@@ -133,6 +144,17 @@ protected:
 
   std::vector< vnl_vector_fixed<float,3> > CreateDirections(unsigned int NPoints);
 
+  /** Work statistics of one thread (integration steps and processed seeds). Padded by a cache line to avoid false
+   * sharing between neighbouring counters in the std::vector (which does not honour alignas before C++17). */
+  struct ThreadCounter
+  {
+    ThreadCounter() : m_Steps(0), m_Seeds(0) {}
+    std::atomic<unsigned long long> m_Steps;
+    std::atomic<unsigned long long> m_Seeds;
+    char                            m_Padding[64];
+  };
+  unsigned long long GetNumSteps();
+
   void BeforeTracking();
   void AfterTracking();
 
@@ -160,6 +182,10 @@ protected:
   float CheckCurvature(DirectionContainer *fib, bool front);
 
   mitk::TrackingDataHandler*          m_TrackingHandler;
+  mitk::FiberBundleStreamWriter*      m_StreamWriter;
+  unsigned int                        m_StreamBatchSize;
+  std::vector< vnl_vector_fixed<float,3> > m_ProbeVectors;   ///< neighbourhood sampling directions, created once in BeforeTracking
+  std::vector< ThreadCounter >        m_ThreadCounters;       ///< one per thread
 
   std::chrono::time_point<std::chrono::system_clock> m_StartTime;
   std::chrono::time_point<std::chrono::system_clock> m_EndTime;
@@ -33,6 +33,10 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <itksys/SystemTools.hxx>
 #include <mitkEqual.h>
 #include <mitkStreamlineTractographyParameters.h>
+#include <mitkFiberBundleStreamWriter.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkRescaleIntensityImageFilter.h>
+#include <vtkCell.h>
 
 class mitkStreamlineTractographyTestSuite : public mitk::TestFixture
 {
@@ -49,6 +53,8 @@ class mitkStreamlineTractographyTestSuite : public mitk::TestFixture
   MITK_TEST(Test_Odf4);
   MITK_TEST(Test_Odf5);
   MITK_TEST(Test_Odf6);
+  MITK_TEST(Test_OdfReproducibility);
+  MITK_TEST(Test_OdfStreamed);
   CPPUNIT_TEST_SUITE_END();
 
   typedef itk::VectorImage< short, 3>   ItkDwiType;
@@ -387,29 +393,134 @@ public:
     delete handler;
   }
 
-  void Test_Odf5()
+  void SetupProbabilisticOdf()
   {
-    mitk::TrackingHandlerOdf* handler = new mitk::TrackingHandlerOdf();
-    handler->SetOdfImage(itk_odf_image);
-
     params->m_Cutoff = gfa_threshold;
     params->m_OdfCutoff = 0;
     params->m_SeedsPerVoxel = 10;
     params->m_SharpenOdfs = 8;
     params->m_Mode = mitk::TrackingDataHandler::MODE::PROBABILISTIC;
+  }
 
+  mitk::FiberBundle::Pointer TrackFibers(mitk::TrackingDataHandler* handler, int num_threads)
+  {
+    omp_set_num_threads(num_threads);
     SetupTracker(handler);
     tracker->Update();
+    omp_set_num_threads(1);
+    return mitk::FiberBundle::New(tracker->GetFiberPolyData());
+  }
 
-    vtkSmartPointer< vtkPolyData > poly = tracker->GetFiberPolyData();
-    mitk::FiberBundle::Pointer outFib = mitk::FiberBundle::New(poly);
+  itk::StreamlineTrackingFilter::ItkDoubleImgType::Pointer TrackProbabilityMap(mitk::TrackingDataHandler* handler, int num_threads)
+  {
+    params->m_OutputProbMap = true;
+    omp_set_num_threads(num_threads);
+    SetupTracker(handler);
+    tracker->Update();
+    omp_set_num_threads(1);
+    params->m_OutputProbMap = false;
+    return tracker->GetOutputProbabilityMap();
+  }
 
-    CheckFibResult("Test_Odf5.fib", outFib);
+  /** Serial reference of the probability map: every fiber counts once per visited voxel, the map is rescaled to [0,1]. */
+  itk::StreamlineTrackingFilter::ItkDoubleImgType::Pointer GetReferenceProbabilityMap(mitk::FiberBundle::Pointer fib, itk::StreamlineTrackingFilter::ItkDoubleImgType::Pointer geometry)
+  {
+    typedef itk::StreamlineTrackingFilter::ItkDoubleImgType ItkDoubleImgType;
+    ItkDoubleImgType::Pointer map = ItkDoubleImgType::New();
+    map->SetSpacing(geometry->GetSpacing());
+    map->SetOrigin(geometry->GetOrigin());
+    map->SetDirection(geometry->GetDirection());
+    map->SetRegions(geometry->GetLargestPossibleRegion());
+    map->Allocate();
+    map->FillBuffer(0);
+
+    vtkPolyData* poly = fib->GetFiberPolyData();
+    for (unsigned int i=0; i<fib->GetNumFibers(); ++i)
+    {
+      vtkCell* cell = poly->GetCell(i);
+      vtkPoints* points = cell->GetPoints();
+      ItkDoubleImgType::IndexType last_idx; last_idx.Fill(0);
+      for (int j=0; j<cell->GetNumberOfPoints(); ++j)
+      {
+        // the tracker works on float points, the polydata stores them unchanged
+        double p[3];
+        points->GetPoint(j, p);
+        itk::Point<float, 3> point;
+        point[0] = static_cast<float>(p[0]); point[1] = static_cast<float>(p[1]); point[2] = static_cast<float>(p[2]);
+
+        ItkDoubleImgType::IndexType idx;
+        if (map->TransformPhysicalPointToIndex(point, idx) && idx != last_idx)
+        {
+          map->SetPixel(idx, map->GetPixel(idx)+1);
+          last_idx = idx;
+        }
+      }
+    }
+
+    itk::RescaleIntensityImageFilter< ItkDoubleImgType, ItkDoubleImgType >::Pointer filter = itk::RescaleIntensityImageFilter< ItkDoubleImgType, ItkDoubleImgType >::New();
+    filter->SetInput(map);
+    filter->SetOutputMaximum(1.0);
+    filter->SetOutputMinimum(0.0);
+    filter->Update();
+    return filter->GetOutput();
+  }
+
+  void Test_Odf5()
+  {
+    mitk::TrackingHandlerOdf* handler = new mitk::TrackingHandlerOdf();
+    handler->SetOdfImage(itk_odf_image);
+    SetupProbabilisticOdf();
+
+    // the random numbers of each seed only depend on the fixed seed and the seed index, so repeated runs and runs with
+    // a different number of threads have to produce the same fibers in the same order
+    mitk::FiberBundle::Pointer fib = TrackFibers(handler, 1);
+    mitk::FiberBundle::Pointer fib_repeated = TrackFibers(handler, 1);
+    mitk::FiberBundle::Pointer fib_threaded = TrackFibers(handler, 4);
+
+    CPPUNIT_ASSERT_MESSAGE("Probabilistic tractography should reconstruct fibers", fib->GetNumFibers()>0);
+    CPPUNIT_ASSERT_MESSAGE("Probabilistic tractography with fixed random seed should be reproducible", fib->Equals(fib_repeated, 0));
+    CPPUNIT_ASSERT_MESSAGE("Probabilistic tractography should not depend on the number of threads", fib->Equals(fib_threaded, 0));
 
     delete handler;
   }
 
   void Test_Odf6()
+  {
+    typedef itk::StreamlineTrackingFilter::ItkDoubleImgType ItkDoubleImgType;
+
+    mitk::TrackingHandlerOdf* handler = new mitk::TrackingHandlerOdf();
+    handler->SetOdfImage(itk_odf_image);
+    SetupProbabilisticOdf();
+
+    // the probability map accumulates the same fibers that are otherwise returned as tractogram
+    mitk::FiberBundle::Pointer fib = TrackFibers(handler, 1);
+    ItkDoubleImgType::Pointer map = TrackProbabilityMap(handler, 1);
+    ItkDoubleImgType::Pointer map_threaded = TrackProbabilityMap(handler, 4);
+    ItkDoubleImgType::Pointer reference = GetReferenceProbabilityMap(fib, map);
+
+    CPPUNIT_ASSERT_MESSAGE("Probability map should have the size of the tracking image", map->GetLargestPossibleRegion()==reference->GetLargestPossibleRegion());
+    CPPUNIT_ASSERT_MESSAGE("Probability map should have the size of the tracking image", map_threaded->GetLargestPossibleRegion()==reference->GetLargestPossibleRegion());
+
+    double max = 0;
+    itk::ImageRegionConstIterator< ItkDoubleImgType > it(map, map->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator< ItkDoubleImgType > it_threaded(map_threaded, map_threaded->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator< ItkDoubleImgType > it_ref(reference, reference->GetLargestPossibleRegion());
+    while (!it.IsAtEnd())
+    {
+      // the visit counts are integers, their sum does not depend on the order in which the threads add them
+      CPPUNIT_ASSERT_MESSAGE("Probability map should not depend on the number of threads", it.Get()==it_threaded.Get());
+      CPPUNIT_ASSERT_DOUBLES_EQUAL_MESSAGE("Probability map should match the serial reference", it_ref.Get(), it.Get(), 1e-12);
+      max = std::max(max, it.Get());
+      ++it;
+      ++it_threaded;
+      ++it_ref;
+    }
+    CPPUNIT_ASSERT_DOUBLES_EQUAL_MESSAGE("Probability map should be normalized", 1.0, max, 1e-12);
+
+    delete handler;
+  }
+
+  void Test_OdfReproducibility()
   {
     mitk::TrackingHandlerOdf* handler = new mitk::TrackingHandlerOdf();
     handler->SetOdfImage(itk_odf_image);
@@ -419,18 +530,60 @@ public:
     params->m_SeedsPerVoxel = 10;
     params->m_SharpenOdfs = 8;
     params->m_Mode = mitk::TrackingDataHandler::MODE::PROBABILISTIC;
-    params->m_OutputProbMap = true;
 
     SetupTracker(handler);
     tracker->Update();
+    mitk::FiberBundle::Pointer fib1 = mitk::FiberBundle::New(tracker->GetFiberPolyData());
+
+    omp_set_num_threads(4);
+    SetupTracker(handler);
+    tracker->Update();
+    mitk::FiberBundle::Pointer fib2 = mitk::FiberBundle::New(tracker->GetFiberPolyData());
+    omp_set_num_threads(1);
 
-    itk::StreamlineTrackingFilter::ItkDoubleImgType::Pointer outImg = tracker->GetOutputProbabilityMap();
-    mitk::Image::Pointer img = mitk::Image::New();
-    img->InitializeByItk(outImg.GetPointer());
-    img->SetVolume(outImg->GetBufferPointer());
+    // the order of the fibers depends on the thread scheduling, the fibers themselves must not
+    CPPUNIT_ASSERT_MESSAGE("Probabilistic tractography should not depend on the number of threads", fib1->Equals(fib2, 0.01, true));
 
-    mitk::IOUtil::Save(img, mitk::IOUtil::GetTempPath()+"Test_Odf6.nrrd");
-    CheckImageResult("Test_Odf6.nrrd", img);
+    delete handler;
+  }
+
+  void Test_OdfStreamed()
+  {
+    mitk::TrackingHandlerOdf* handler = new mitk::TrackingHandlerOdf();
+    handler->SetOdfImage(itk_odf_image);
+
+    params->m_Cutoff = gfa_threshold;
+    params->m_OdfCutoff = 0;
+    params->m_SeedsPerVoxel = 10;
+    params->m_SharpenOdfs = 8;
+    params->m_Mode = mitk::TrackingDataHandler::MODE::PROBABILISTIC;
+
+    mitk::Image::Pointer seed_image = mitk::Image::New();
+    seed_image->InitializeByItk(itk_seed_image.GetPointer());
+
+    int thread_counts[2] = {1, 4};
+    for (int num_threads : thread_counts)
+    {
+      omp_set_num_threads(num_threads);
+
+      SetupTracker(handler);
+      tracker->Update();
+      mitk::FiberBundle::Pointer fib_memory = mitk::FiberBundle::New(tracker->GetFiberPolyData());
+
+      // small batches, so that many chunks wait in the reorder buffer
+      std::string filename = mitk::IOUtil::GetTempPath() + "Test_OdfStreamed.tck";
+      mitk::FiberBundleStreamWriter writer;
+      writer.Open(filename, seed_image->GetGeometry());
+      SetupTracker(handler);
+      tracker->SetStreamWriter(&writer);
+      tracker->SetStreamBatchSize(1);
+      tracker->Update();
+      writer.Close();
+      mitk::FiberBundle::Pointer fib_streamed = mitk::IOUtil::Load<mitk::FiberBundle>(filename);
+
+      CPPUNIT_ASSERT_MESSAGE("Streamed tractogram should contain the in-memory fibers in the same order (" + std::to_string(num_threads) + " threads)", fib_memory->Equals(fib_streamed));
+    }
+    omp_set_num_threads(1);
 
     delete handler;
   }
@@ -0,0 +1,4 @@
+set(MODULE_CUSTOM_TESTS
+  mitkIvimKurtosisFitTest.cpp
+  mitkRegularizedIvimReconstructionTest.cpp
+)
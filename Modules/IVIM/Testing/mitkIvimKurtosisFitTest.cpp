@@ -0,0 +1,336 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#include <mitkTestingMacros.h>
+#include <mitkTestFixture.h>
+#include <itkDiffusionIntravoxelIncoherentMotionReconstructionImageFilter.h>
+#include <itkDiffusionKurtosisReconstructionImageFilter.h>
+#include <vnl/vnl_least_squares_function.h>
+#include <vnl/algo/vnl_levenberg_marquardt.h>
+#include <random>
+
+class mitkIvimKurtosisFitTestSuite : public mitk::TestFixture
+{
+
+  CPPUNIT_TEST_SUITE(mitkIvimKurtosisFitTestSuite);
+  MITK_TEST(IvimFixDStarFit);
+  MITK_TEST(Ivim3ParamFit);
+  MITK_TEST(KurtosisFit);
+  MITK_TEST(KurtosisOmitUnweightedFit);
+  CPPUNIT_TEST_SUITE_END();
+
+  private:
+
+  /** IVIM least-squares functions with finite difference Jacobian, as fitted with vnl_levenberg_marquardt before the
+   * IVIM models used mitk::LevenbergMarquardtSolver. Fits all three parameters or f and D with fixed DStar. */
+  struct VnlIvimFunction : public vnl_least_squares_function
+  {
+    VnlIvimFunction(unsigned int num_params, const vnl_vector<double>& b, double dstar)
+      : vnl_least_squares_function(num_params, b.size(), no_gradient)
+      , bvalues(b)
+      , fixDStar(dstar)
+    {}
+
+    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override
+    {
+      double ef = x[0];
+      double D = x[1];
+      double Dstar = get_number_of_unknowns()==3 ? x[2] : fixDStar;
+
+      for(unsigned int s=0; s<bvalues.size(); ++s)
+      {
+        double approx = (1-ef)*exp(-bvalues[s]*D)+ef*exp(-bvalues[s]*(D+Dstar));
+        fx[s] = std::fabs( measurements[s] - approx );
+
+        if (D<0)
+          fx[s] -= D*100000;
+        if (D>0.003)
+          fx[s] += D*100000;
+
+        if (get_number_of_unknowns()==3)
+        {
+          if (Dstar<0)
+            fx[s] -= Dstar*100000;
+          if (Dstar>0.3)
+            fx[s] += Dstar*100000;
+        }
+      }
+    }
+
+    vnl_vector<double> bvalues;
+    vnl_vector<double> measurements;
+    double fixDStar;
+  };
+
+  /** Kurtosis least-squares function with finite difference Jacobian, as fitted with vnl_levenberg_marquardt before
+   * kurtosis_fit_function used mitk::LevenbergMarquardtSolver (straight scale, no bounds). With three parameters the
+   * unweighted signal is fitted, otherwise the first measurement is used. */
+  struct VnlKurtosisFunction : public vnl_least_squares_function
+  {
+    VnlKurtosisFunction(unsigned int num_params, const vnl_vector<double>& b)
+      : vnl_least_squares_function(num_params, b.size(), no_gradient)
+      , bvalues(b)
+    {}
+
+    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override
+    {
+      for ( unsigned int s=0; s < fx.size(); s++ )
+      {
+        double S0 = get_number_of_unknowns()==3 ? x[2] : measurements[0];
+        const double factor = ( measurements[s] - S0 * exp( -1. * bvalues[s] * x[0] + bvalues[s]*bvalues[s] * x[0] * x[0] * x[1] / 6 ) );
+        fx[s] = factor * factor;
+      }
+    }
+
+    vnl_vector<double> bvalues;
+    vnl_vector<double> measurements;
+  };
+
+  /** RMS of the reference residuals at x. */
+  static double GetRmsError(vnl_least_squares_function& function, const vnl_vector<double>& x)
+  {
+    vnl_vector<double> fx(function.get_number_of_residuals());
+    function.f(x, fx);
+    return fx.rms();
+  }
+
+  /** The fits may end in different local minima for single voxels, but not systematically. */
+  static void CompareErrors(const std::vector< double >& errors, const std::vector< double >& vnl_errors, std::string name)
+  {
+    unsigned int num_worse = 0;
+    double mean_error = 0;
+    double mean_vnl_error = 0;
+    for (unsigned int i=0; i<errors.size(); ++i)
+    {
+      if (errors[i] > vnl_errors[i]*1.01 + 1e-6)
+        ++num_worse;
+      mean_error += errors[i]/errors.size();
+      mean_vnl_error += vnl_errors[i]/errors.size();
+    }
+    MITK_INFO << name << ": mean RMS error " << mean_error << " (vnl_levenberg_marquardt " << mean_vnl_error << "), " << num_worse << " voxels with larger error";
+    MITK_TEST_CONDITION_REQUIRED(mean_error <= mean_vnl_error*1.01 + 1e-6, name + " error test.");
+    MITK_TEST_CONDITION_REQUIRED(num_worse <= errors.size()/20, name + " voxelwise error test.");
+  }
+
+  /** Normalized IVIM signals with noise. */
+  vnl_matrix<double> CreateIvimSignal(unsigned int seed)
+  {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> noise(0, 0.01);
+
+    vnl_matrix<double> signal(m_NumVoxels, m_IvimBValues.size());
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      double ef = 0.05 + 0.25*uniform(rng);
+      double D = 0.0005 + 0.0015*uniform(rng);
+      double Dstar = 0.01 + 0.04*uniform(rng);
+      for (unsigned int s=0; s<m_IvimBValues.size(); ++s)
+        signal(i, s) = (1-ef)*exp(-m_IvimBValues[s]*D)+ef*exp(-m_IvimBValues[s]*(D+Dstar)) + noise(rng);
+    }
+    return signal;
+  }
+
+  /** Kurtosis signals with noise, the first b-value is 0. */
+  vnl_matrix<double> CreateKurtosisSignal(unsigned int seed)
+  {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> noise(0, 5);
+
+    vnl_matrix<double> signal(m_NumVoxels, m_KurtosisBValues.size());
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      double D = 0.0005 + 0.001*uniform(rng);
+      double K = 0.3 + 0.9*uniform(rng);
+      for (unsigned int s=0; s<m_KurtosisBValues.size(); ++s)
+        signal(i, s) = 1000*exp(-m_KurtosisBValues[s]*D + 1./6.*m_KurtosisBValues[s]*m_KurtosisBValues[s]*D*D*K) + noise(rng);
+    }
+    return signal;
+  }
+
+  unsigned int m_NumVoxels;
+  vnl_vector<double> m_IvimBValues;
+  vnl_vector<double> m_KurtosisBValues;
+
+  public:
+
+  void setUp() override
+  {
+    m_NumVoxels = 1000;
+
+    double ivim_b[9] = {10, 20, 50, 100, 200, 400, 600, 800, 1000};
+    m_IvimBValues = vnl_vector<double>(ivim_b, 9);
+
+    double kurtosis_b[7] = {0, 500, 1000, 1500, 2000, 2500, 3000};
+    m_KurtosisBValues = vnl_vector<double>(kurtosis_b, 7);
+  }
+
+  void tearDown() override
+  {
+
+  }
+
+  void IvimFixDStarFit()
+  {
+    // fit as in DiffusionIntravoxelIncoherentMotionReconstructionImageFilter (IVIM_DSTAR_FIX)
+    double DStar = 0.02;
+    vnl_matrix<double> signal = CreateIvimSignal(1);
+    VnlIvimFunction reference(2, m_IvimBValues, DStar);
+
+    std::vector< double > errors(m_NumVoxels);
+    std::vector< double > vnl_errors(m_NumVoxels);
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      vnl_vector<double> meas = signal.get_row(i);
+      reference.measurements = meas;
+
+      itk::IVIM_fixdstar f_fixdstar(meas.size(), DStar);
+      f_fixdstar.set_bvalues(m_IvimBValues);
+      f_fixdstar.set_measurements(meas);
+      mitk::LevenbergMarquardtSolver< itk::IVIM_fixdstar >::ParametersType x;
+      x[0] = 0.1;
+      x[1] = 0.001;
+      mitk::LevenbergMarquardtSolver< itk::IVIM_fixdstar > lm(f_fixdstar);
+      lm.SetFunctionTolerance(0.0001);
+      lm.Minimize(x);
+      errors[i] = GetRmsError(reference, vnl_vector<double>(x.data_block(), x.size()));
+
+      vnl_vector<double> vnl_x(2);
+      vnl_x[0] = 0.1;
+      vnl_x[1] = 0.001;
+      vnl_levenberg_marquardt vnl_lm(reference);
+      vnl_lm.set_f_tolerance(0.0001);
+      vnl_lm.minimize(vnl_x);
+      vnl_errors[i] = GetRmsError(reference, vnl_x);
+    }
+    CompareErrors(errors, vnl_errors, "IVIM fit with fixed DStar");
+  }
+
+  void Ivim3ParamFit()
+  {
+    // fit as in DiffusionIntravoxelIncoherentMotionReconstructionImageFilter (IVIM_FIT_ALL)
+    vnl_matrix<double> signal = CreateIvimSignal(2);
+    VnlIvimFunction reference(3, m_IvimBValues, 0);
+
+    std::vector< double > errors(m_NumVoxels);
+    std::vector< double > vnl_errors(m_NumVoxels);
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      vnl_vector<double> meas = signal.get_row(i);
+      reference.measurements = meas;
+
+      itk::IVIM_3param f_3param(meas.size());
+      f_3param.set_bvalues(m_IvimBValues);
+      f_3param.set_measurements(meas);
+      mitk::LevenbergMarquardtSolver< itk::IVIM_3param >::ParametersType x;
+      x[0] = 0.1;
+      x[1] = 0.001;
+      x[2] = 0.01;
+      mitk::LevenbergMarquardtSolver< itk::IVIM_3param > lm(f_3param);
+      lm.SetFunctionTolerance(0.0001);
+      lm.Minimize(x);
+      errors[i] = GetRmsError(reference, vnl_vector<double>(x.data_block(), x.size()));
+
+      vnl_vector<double> vnl_x(3);
+      vnl_x[0] = 0.1;
+      vnl_x[1] = 0.001;
+      vnl_x[2] = 0.01;
+      vnl_levenberg_marquardt vnl_lm(reference);
+      vnl_lm.set_f_tolerance(0.0001);
+      vnl_lm.minimize(vnl_x);
+      vnl_errors[i] = GetRmsError(reference, vnl_x);
+    }
+    CompareErrors(errors, vnl_errors, "IVIM fit of all parameters");
+  }
+
+  void KurtosisFit()
+  {
+    // fit as in DiffusionKurtosisReconstructionImageFilter (straight scale, b=0 not omitted)
+    vnl_matrix<double> signal = CreateKurtosisSignal(3);
+    VnlKurtosisFunction reference(2, m_KurtosisBValues);
+
+    itk::kurtosis_fit_lsq_function kurtosis_cost_fn( m_KurtosisBValues.size() );
+    kurtosis_cost_fn.set_fit_logscale( false );
+    kurtosis_cost_fn.set_bvalues( m_KurtosisBValues );
+    mitk::LevenbergMarquardtSolver< itk::kurtosis_fit_lsq_function > nonlinear_fit( kurtosis_cost_fn );
+
+    std::vector< double > errors(m_NumVoxels);
+    std::vector< double > vnl_errors(m_NumVoxels);
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      vnl_vector<double> meas = signal.get_row(i);
+      reference.measurements = meas;
+
+      mitk::LevenbergMarquardtSolver< itk::kurtosis_fit_lsq_function >::ParametersType x;
+      x[0] = 0.001;
+      x[1] = 1;
+      if (kurtosis_cost_fn.SetMeasurements(meas.data_block()))
+        nonlinear_fit.Minimize(x);
+      errors[i] = GetRmsError(reference, vnl_vector<double>(x.data_block(), x.size()));
+
+      vnl_vector<double> vnl_x(2);
+      vnl_x[0] = 0.001;
+      vnl_x[1] = 1;
+      vnl_levenberg_marquardt vnl_lm(reference);
+      vnl_lm.minimize(vnl_x);
+      vnl_errors[i] = GetRmsError(reference, vnl_x);
+    }
+    CompareErrors(errors, vnl_errors, "Kurtosis fit");
+  }
+
+  void KurtosisOmitUnweightedFit()
+  {
+    // fit as in DiffusionKurtosisReconstructionImageFilter (straight scale, b=0 omitted and S_0 fitted)
+    vnl_matrix<double> full_signal = CreateKurtosisSignal(4);
+    vnl_matrix<double> signal = full_signal.extract(m_NumVoxels, m_KurtosisBValues.size()-1, 0, 1);
+    vnl_vector<double> bvalues = m_KurtosisBValues.extract(m_KurtosisBValues.size()-1, 1);
+    VnlKurtosisFunction reference(3, bvalues);
+
+    itk::kurtosis_fit_omit_unweighted kurtosis_cost_fn( bvalues.size() );
+    kurtosis_cost_fn.set_fit_logscale( false );
+    kurtosis_cost_fn.set_bvalues( bvalues );
+    mitk::LevenbergMarquardtSolver< itk::kurtosis_fit_omit_unweighted > nonlinear_fit( kurtosis_cost_fn );
+
+    std::vector< double > errors(m_NumVoxels);
+    std::vector< double > vnl_errors(m_NumVoxels);
+    for (unsigned int i=0; i<m_NumVoxels; ++i)
+    {
+      vnl_vector<double> meas = signal.get_row(i);
+      reference.measurements = meas;
+
+      mitk::LevenbergMarquardtSolver< itk::kurtosis_fit_omit_unweighted >::ParametersType x;
+      x[0] = 0.001;
+      x[1] = 1;
+      x[2] = 1000;
+      if (kurtosis_cost_fn.SetMeasurements(meas.data_block()))
+        nonlinear_fit.Minimize(x);
+      errors[i] = GetRmsError(reference, vnl_vector<double>(x.data_block(), x.size()));
+
+      vnl_vector<double> vnl_x(3);
+      vnl_x[0] = 0.001;
+      vnl_x[1] = 1;
+      vnl_x[2] = 1000;
+      vnl_levenberg_marquardt vnl_lm(reference);
+      vnl_lm.minimize(vnl_x);
+      vnl_errors[i] = GetRmsError(reference, vnl_x);
+    }
+    CompareErrors(errors, vnl_errors, "Kurtosis fit with fitted unweighted signal");
+  }
+
+};
+
+MITK_TEST_SUITE_REGISTRATION(mitkIvimKurtosisFit)
@@ -0,0 +1,211 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#include <mitkTestingMacros.h>
+#include <mitkTestFixture.h>
+#include <itkRegularizedIVIMReconstructionFilter.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionConstIterator.h>
+#include <random>
+
+class mitkRegularizedIvimReconstructionTestSuite : public mitk::TestFixture
+{
+
+  CPPUNIT_TEST_SUITE(mitkRegularizedIvimReconstructionTestSuite);
+  MITK_TEST(Equal_SingleIterationChain_ReturnsTrue);
+  MITK_TEST(Equal_MultiThreaded_ReturnsTrue);
+  MITK_TEST(ConvergenceThreshold_StopsEarly);
+  CPPUNIT_TEST_SUITE_END();
+
+  typedef itk::RegularizedIVIMReconstructionFilter< double, double, float > FilterType;
+  typedef FilterType::InputImageType ImageType;
+  typedef FilterType::OutputImageType OutputImageType;
+  typedef FilterType::RefImageType RefImageType;
+  typedef FilterType::SingleIterationFilterType SingleIterationFilterType;
+
+  private:
+
+  ImageType::Pointer m_InitialFit;
+  RefImageType::Pointer m_Reference;
+  vnl_vector<double> m_BValues;
+  double m_Lambda;
+
+  /** Smooth f and D with noise as initial fit, the reference contains the noisy signal of the smooth parameters at the
+   * high b-values. One measurement is marked as invalid. */
+  void CreateData()
+  {
+    double b[4] = {200, 400, 600, 800};
+    m_BValues = vnl_vector<double>(b, 4);
+    m_Lambda = 10;
+
+    ImageType::RegionType region;
+    region.SetSize(0, 10);
+    region.SetSize(1, 8);
+    region.SetSize(2, 6);
+
+    m_InitialFit = ImageType::New();
+    m_InitialFit->SetRegions(region);
+    m_InitialFit->Allocate();
+
+    m_Reference = RefImageType::New();
+    m_Reference->SetRegions(region);
+    m_Reference->SetVectorLength(m_BValues.size());
+    m_Reference->Allocate();
+
+    std::mt19937 rng(1);
+    std::normal_distribution<double> noise(0, 1);
+    itk::ImageRegionIterator<ImageType> it(m_InitialFit, region);
+    itk::ImageRegionIterator<RefImageType> rit(m_Reference, region);
+    for (; !it.IsAtEnd(); ++it, ++rit)
+    {
+      ImageType::IndexType idx = it.GetIndex();
+      double f = 0.1 + 0.01*idx[0];
+      double D = 0.0008 + 0.00005*idx[1] + 0.00002*idx[2];
+
+      ImageType::PixelType fit;
+      fit[0] = f + 0.02*noise(rng);
+      fit[1] = D + 0.0001*noise(rng);
+      fit[2] = 0.02 + 0.005*noise(rng);
+      it.Set(fit);
+
+      RefImageType::PixelType signal(m_BValues.size());
+      for (unsigned int s=0; s<m_BValues.size(); ++s)
+        signal[s] = static_cast<float>((1-f)*std::exp(-m_BValues[s]*D) + 0.005*noise(rng));
+      if (idx[0]==3 && idx[1]==4 && idx[2]==2)
+        signal[1] = IVIM_FOO;
+      rit.Set(signal);
+    }
+  }
+
+  FilterType::Pointer CreateFilter(int iterations)
+  {
+    FilterType::Pointer filter = FilterType::New();
+    filter->SetInput(m_InitialFit);
+    filter->SetReferenceImage(m_Reference);
+    filter->SetBValues(m_BValues);
+    filter->SetLambda(m_Lambda);
+    filter->SetNumberIterations(iterations);
+    return filter;
+  }
+
+  /** Reference: one pipeline of RegularizedIVIMReconstructionSingleIteration per iteration */
+  OutputImageType::Pointer RunSingleIterations(int iterations)
+  {
+    OutputImageType::Pointer current = m_InitialFit;
+    for (int i=0; i<iterations; ++i)
+    {
+      SingleIterationFilterType::Pointer filter = SingleIterationFilterType::New();
+      filter->SetInput(current);
+      filter->SetOriginalImage(m_Reference);
+      filter->SetBValues(m_BValues);
+      filter->SetLambda(m_Lambda);
+      filter->Update();
+      current = filter->GetOutput();
+      current->DisconnectPipeline();
+    }
+    return current;
+  }
+
+  /** f and D have to match within the tolerances (the single iteration filter keeps the local variation in float,
+   * RegularizedIVIMReconstructionFilter in double). D* is passed through unchanged by RegularizedIVIMReconstructionFilter,
+   * the single iteration filter does not set it, so it is compared with the initial fit. */
+  void CompareImages(OutputImageType::Pointer result, OutputImageType::Pointer reference, double f_tolerance, double d_tolerance, std::string message)
+  {
+    itk::ImageRegionConstIterator<OutputImageType> it(result, result->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator<OutputImageType> ref_it(reference, reference->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator<ImageType> init_it(m_InitialFit, m_InitialFit->GetLargestPossibleRegion());
+    double max_f_diff = 0;
+    double max_d_diff = 0;
+    bool dstar_equal = true;
+    for (; !it.IsAtEnd(); ++it, ++ref_it, ++init_it)
+    {
+      max_f_diff = std::max(max_f_diff, std::fabs(it.Get()[0]-ref_it.Get()[0]));
+      max_d_diff = std::max(max_d_diff, std::fabs(it.Get()[1]-ref_it.Get()[1]));
+      if (it.Get()[2]!=init_it.Get()[2])
+        dstar_equal = false;
+    }
+    MITK_INFO << message << ": maximum difference f " << max_f_diff << ", D " << max_d_diff;
+    CPPUNIT_ASSERT_MESSAGE(message + " (f)", max_f_diff<=f_tolerance);
+    CPPUNIT_ASSERT_MESSAGE(message + " (D)", max_d_diff<=d_tolerance);
+    CPPUNIT_ASSERT_MESSAGE(message + " (D*)", dstar_equal);
+  }
+
+  public:
+
+  void setUp() override
+  {
+    CreateData();
+  }
+
+  void tearDown() override
+  {
+    m_InitialFit = nullptr;
+    m_Reference = nullptr;
+  }
+
+  void Equal_SingleIterationChain_ReturnsTrue()
+  {
+    const int iterations = 20;
+    FilterType::Pointer filter = CreateFilter(iterations);
+    filter->Update();
+    CPPUNIT_ASSERT_EQUAL(iterations, filter->GetNumberOfPerformedIterations());
+
+    // relative tolerance of about 1e-6 for f (~0.1) and D (~0.001)
+    CompareImages(filter->GetOutput(), RunSingleIterations(iterations), 1e-7, 1e-9, "Regularized IVIM equals single iteration chain");
+  }
+
+  void Equal_MultiThreaded_ReturnsTrue()
+  {
+    const int iterations = 20;
+    FilterType::Pointer single_threaded = CreateFilter(iterations);
+    single_threaded->SetNumberOfWorkUnits(1);
+    single_threaded->Update();
+
+    FilterType::Pointer multi_threaded = CreateFilter(iterations);
+    multi_threaded->SetNumberOfWorkUnits(4);
+    multi_threaded->Update();
+
+    // Jacobi updates and per slice sums, the result does not depend on the number of work units
+    CompareImages(multi_threaded->GetOutput(), single_threaded->GetOutput(), 0, 0, "Regularized IVIM independent of work units");
+    CPPUNIT_ASSERT_EQUAL(single_threaded->GetResidual(), multi_threaded->GetResidual());
+  }
+
+  void ConvergenceThreshold_StopsEarly()
+  {
+    const int max_iterations = 50;
+    FilterType::Pointer filter = CreateFilter(max_iterations);
+    filter->Update();
+    CPPUNIT_ASSERT_EQUAL(max_iterations, filter->GetNumberOfPerformedIterations());
+
+    // stop once the update is smaller than after 5 iterations
+    const int iterations = 5;
+    FilterType::Pointer reference = CreateFilter(iterations);
+    reference->Update();
+    const double threshold = reference->GetResidual()*1.000001;
+
+    FilterType::Pointer converging = CreateFilter(max_iterations);
+    converging->SetConvergenceThreshold(threshold);
+    converging->Update();
+    const int performed = converging->GetNumberOfPerformedIterations();
+    MITK_INFO << "Converged after " << performed << " iterations, residual " << converging->GetResidual() << ", threshold " << threshold;
+    CPPUNIT_ASSERT_MESSAGE("Convergence threshold stops the iteration early", performed>=1 && performed<=iterations);
+    CPPUNIT_ASSERT_MESSAGE("Residual of the last iteration is below the threshold", converging->GetResidual()<threshold);
+    CompareImages(converging->GetOutput(), RunSingleIterations(performed), 1e-7, 1e-9, "Converged regularized IVIM equals single iteration chain");
+  }
+
+};
+
+MITK_TEST_SUITE_REGISTRATION(mitkRegularizedIvimReconstruction)
@@ -40,7 +40,8 @@ DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
   m_GradientDirectionContainer(nullptr),
   m_Method(IVIM_DSTAR_FIX),
   m_FitDStar(true),
-  m_Verbose(false)
+  m_Verbose(false),
+  m_ConvergenceThreshold(0.0)
 {
   this->SetNumberOfRequiredInputs( 1 );
 
@@ -319,14 +320,14 @@ void DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
       f_donly.set_bvalues(input.bvals);
       f_donly.set_measurements(input.meas);
 
-      vnl_vector< double > x_donly(2);
+      mitk::LevenbergMarquardtSolver< IVIM_d_and_f >::ParametersType x_donly;
       x_donly[0] = 0.001;
       x_donly[1] = 0.1;
       // f 0.1 Dstar 0.01 D 0.001
 
-      vnl_levenberg_marquardt lm_donly(f_donly);
-      lm_donly.set_f_tolerance(0.0001);
-      lm_donly.minimize(x_donly);
+      mitk::LevenbergMarquardtSolver< IVIM_d_and_f > lm_donly(f_donly);
+      lm_donly.SetFunctionTolerance(0.0001);
+      lm_donly.Minimize(x_donly);
       m_Snap.currentD = x_donly[0];
       m_Snap.currentF = x_donly[1];
 
@@ -341,8 +342,8 @@ void DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
         f_dstar_only.set_bvalues(input2.bvals);
         f_dstar_only.set_measurements(input2.meas);
 
-        vnl_vector< double > x_dstar_only(1);
-        vnl_vector< double > fx_dstar_only(input2.N);
+        mitk::LevenbergMarquardtSolver< IVIM_dstar_only > lm_dstar_only(f_dstar_only);
+        mitk::LevenbergMarquardtSolver< IVIM_dstar_only >::ParametersType x_dstar_only;
 
         double opt = 1111111111111111.0;
         int opt_idx = -1;
@@ -352,8 +353,7 @@ void DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
         for(int i=0; i<num_its; i++)
         {
           x_dstar_only[0] = min_val + i * ((max_val-min_val) / num_its);
-          f_dstar_only.f(x_dstar_only, fx_dstar_only);
-          double err = fx_dstar_only.two_norm();
+          double err = lm_dstar_only.GetResidualNorm(x_dstar_only);
           if(err<opt)
           {
             opt = err;
@@ -377,14 +377,14 @@ void DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
       f_fixdstar.set_bvalues(input.bvals);
       f_fixdstar.set_measurements(input.meas);
 
-      vnl_vector< double > x(2);
+      mitk::LevenbergMarquardtSolver< IVIM_fixdstar >::ParametersType x;
       x[0] = 0.1;
       x[1] = 0.001;
       // f 0.1 Dstar 0.01 D 0.001
 
-      vnl_levenberg_marquardt lm(f_fixdstar);
-      lm.set_f_tolerance(0.0001);
-      lm.minimize(x);
+      mitk::LevenbergMarquardtSolver< IVIM_fixdstar > lm(f_fixdstar);
+      lm.SetFunctionTolerance(0.0001);
+      lm.Minimize(x);
 
       m_Snap.currentF = x[0];
       m_Snap.currentD = x[1];
@@ -405,15 +405,15 @@ void DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
       f_3param.set_bvalues(input.bvals);
       f_3param.set_measurements(input.meas);
 
-      vnl_vector< double > x(3);
+      mitk::LevenbergMarquardtSolver< IVIM_3param >::ParametersType x;
       x[0] = 0.1;
       x[1] = 0.001;
       x[2] = 0.01;
       // f 0.1 Dstar 0.01 D 0.001
 
-      vnl_levenberg_marquardt lm(f_3param);
-      lm.set_f_tolerance(0.0001);
-      lm.minimize(x);
+      mitk::LevenbergMarquardtSolver< IVIM_3param > lm(f_3param);
+      lm.SetFunctionTolerance(0.0001);
+      lm.Minimize(x);
 
       m_Snap.currentF = x[0];
       m_Snap.currentD = x[1];
@@ -490,8 +490,8 @@ void DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
         f_dstar_only.set_bvalues(input2.bvals);
         f_dstar_only.set_measurements(input2.meas);
 
-        vnl_vector< double > x_dstar_only(1);
-        vnl_vector< double > fx_dstar_only(input2.N);
+        mitk::LevenbergMarquardtSolver< IVIM_dstar_only > lm_dstar_only(f_dstar_only);
+        mitk::LevenbergMarquardtSolver< IVIM_dstar_only >::ParametersType x_dstar_only;
 
         double opt = 1111111111111111.0;
         int opt_idx = -1;
@@ -501,8 +501,7 @@ void DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
         for(int i=0; i<num_its; i++)
         {
           x_dstar_only[0] = min_val + i * ((max_val-min_val) / num_its);
-          f_dstar_only.f(x_dstar_only, fx_dstar_only);
-          double err = fx_dstar_only.two_norm();
+          double err = lm_dstar_only.GetResidualNorm(x_dstar_only);
           if(err<opt)
           {
             opt = err;
@@ -534,7 +533,7 @@ void DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
 
       MeasAndBvals input = ApplyS0Threshold(m_Snap.high_meas, m_Snap.high_bvalues);
 
-      vnl_vector< double > x_donly(2);
+      mitk::LevenbergMarquardtSolver< IVIM_d_and_f >::ParametersType x_donly;
       x_donly[0] = 0.001;
       x_donly[1] = 0.1;
 
@@ -544,9 +543,9 @@ void DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
         f_donly.set_bvalues(input.bvals);
         f_donly.set_measurements(input.meas);
         //MITK_INFO << "initial fit N=" << input.N << ", min-b = " << input.bvals[0] << ", max-b = " << input.bvals[input.N-1];
-        vnl_levenberg_marquardt lm_donly(f_donly);
-        lm_donly.set_f_tolerance(0.0001);
-        lm_donly.minimize(x_donly);
+        mitk::LevenbergMarquardtSolver< IVIM_d_and_f > lm_donly(f_donly);
+        lm_donly.SetFunctionTolerance(0.0001);
+        lm_donly.Minimize(x_donly);
       }
 
       typename InitialFitImageType::PixelType initvec;
@@ -642,8 +641,8 @@ void DiffusionIntravoxelIncoherentMotionReconstructionImageFilter<TIn, TOut>
     filter->SetReferenceImage(m_InternalVectorImage);
     filter->SetBValues(m_Snap.high_bvalues);
     filter->SetNumberIterations(m_NumberIterations);
-    filter->SetNumberOfWorkUnits(1);
     filter->SetLambda(m_Lambda);
+    filter->SetConvergenceThreshold(m_ConvergenceThreshold);
     filter->Update();
     typename RegFitType::OutputImageType::Pointer outimg = filter->GetOutput();
 
@@ -26,203 +26,253 @@ See LICENSE.txt or http://www.mitk.org for details.
 //#include "QuadProg.h"
 #include "itkVectorImage.h"
 
-#include "vnl/vnl_least_squares_function.h"
 #include "vnl/vnl_cost_function.h"
-#include "vnl/algo/vnl_levenberg_marquardt.h"
 #include "vnl/vnl_math.h"
+#include <mitkLevenbergMarquardtSolver.h>
 
 #define IVIM_CEIL(val,u,o) (val) =       \
   ( (val) < (u) ) ? ( (u) ) : ( ( (val)>(o) ) ? ( (o) ) : ( (val) ) );
 
 namespace itk{
 
-  /** baseclass for IVIM fitting algorithms */
+  /** baseclass for IVIM fitting algorithms. The fits are models of mitk::LevenbergMarquardtSolver with analytic
+   * derivatives. Measurements and b-values are referenced, not copied, and have to outlive the fit. */
   struct IVIM_base
   {
 
     void set_measurements(const vnl_vector<double>& x)
     {
-      measurements.set_size(x.size());
-      measurements.copy_in(x.data_block());
+      measurements = x.data_block();
     }
 
     void set_bvalues(const vnl_vector<double>& x)
     {
-      bvalues.set_size(x.size());
-      bvalues.copy_in(x.data_block());
+      bvalues = x.data_block();
     }
 
-    vnl_vector<double> measurements;
-    vnl_vector<double> bvalues;
+    unsigned int GetNumberOfResiduals() const { return N; }
+
+    bool SetMeasurements(const double* x)
+    {
+      measurements = x;
+      return true;
+    }
+
+    const double* measurements;
+    const double* bvalues;
 
     int N;
 
+  protected:
+
+    IVIM_base(unsigned int number_of_measurements)
+      : measurements(nullptr)
+      , bvalues(nullptr)
+      , N(number_of_measurements)
+    {}
+
+    /** penalty of parameters outside of [0,upper] and its derivative */
+    static void AddPenalty(double val, double upper, double& penalty, double& d_penalty)
+    {
+      d_penalty = 0;
+      if (val<0)
+      {
+        penalty -= val*100000;
+        d_penalty = -100000;
+      }
+      if (val>upper)
+      {
+        penalty += val*100000;
+        d_penalty = 100000;
+      }
+    }
+
+    /** residual |meas-approx| + penalty, d_diff contains the derivatives of meas-approx */
+    template< unsigned int NParams >
+    static double Residual(double meas, double approx, const double* d_diff, double penalty, const double* d_penalty, double* dr_dx)
+    {
+      double diff = meas - approx;
+      double sign = diff<0 ? -1.0 : 1.0;
+      for (unsigned int i=0; i<NParams; ++i)
+        dr_dx[i] = sign*d_diff[i] + d_penalty[i];
+      return std::fabs( diff ) + penalty;
+    }
+
   };
 
   /** Fitt all three parameters */
-  struct IVIM_3param : public IVIM_base, vnl_least_squares_function
+  struct IVIM_3param : public IVIM_base
   {
+    static const unsigned int NumberOfParameters = 3;
 
-    IVIM_3param(unsigned int number_of_measurements) :
-        vnl_least_squares_function(3, number_of_measurements, no_gradient)
+    IVIM_3param(unsigned int number_of_measurements) : IVIM_base(number_of_measurements)
     {
-      N = get_number_of_residuals();
     }
 
-    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override {
-
-      double ef = x[0];
-      double D = x[1];
-      double Dstar = x[2];
-
-      for(int s=0; s<N; ++s)
-      {
-        double approx = (1-ef)*exp(-bvalues[s]*D)+ef*exp(-bvalues[s]*(D+Dstar));
-        fx[s] = std::fabs( measurements[s] - approx );
-
-        if (D<0)
-          fx[s] -= D*100000;
-        if (Dstar<0)
-          fx[s] -= Dstar*100000;
-
-        if (D>0.003)
-          fx[s] += D*100000;
-        if (Dstar>0.3)
-          fx[s] += Dstar*100000;
-      }
+    void SetParameters(const double* x)
+    {
+      ef = x[0];
+      D = x[1];
+      Dstar = x[2];
+
+      penalty = 0;
+      d_penalty[0] = 0;
+      AddPenalty(D, 0.003, penalty, d_penalty[1]);
+      AddPenalty(Dstar, 0.3, penalty, d_penalty[2]);
+    }
 
+    double GetResidual(unsigned int s, double* dr_dx) const
+    {
+      double e1 = exp(-bvalues[s]*D);
+      double e2 = exp(-bvalues[s]*(D+Dstar));
+      double approx = (1-ef)*e1+ef*e2;
+      double d_diff[3] = { e1-e2, bvalues[s]*approx, bvalues[s]*ef*e2 };
+      return Residual<3>(measurements[s], approx, d_diff, penalty, d_penalty, dr_dx);
     }
+
+    double ef, D, Dstar;
+    double penalty;
+    double d_penalty[3];
   };
 
   /** fit by setting DStar to a fix value */
-  struct IVIM_fixdstar : public IVIM_base, vnl_least_squares_function
+  struct IVIM_fixdstar : public IVIM_base
   {
+    static const unsigned int NumberOfParameters = 2;
 
-    IVIM_fixdstar(unsigned int number_of_measurements, double DStar) :
-        vnl_least_squares_function(2, number_of_measurements, no_gradient)
+    IVIM_fixdstar(unsigned int number_of_measurements, double DStar) : IVIM_base(number_of_measurements)
     {
-      N = get_number_of_residuals();
       fixDStar = DStar;
     }
 
-    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override {
-
-      double ef = x[0];
-      double D = x[1];
-
-      for(int s=0; s<N; s++)
-      {
-        double approx = (1-ef)*exp(-bvalues[s]*D)+ef*exp(-bvalues[s]*(D+fixDStar));
-        fx[s] = std::fabs( measurements[s] - approx );
-
-        if (D<0)
-          fx[s] -= D*100000;
+    void SetParameters(const double* x)
+    {
+      ef = x[0];
+      D = x[1];
 
-        if (D>0.003)
-          fx[s] += D*100000;
-      }
+      penalty = 0;
+      d_penalty[0] = 0;
+      AddPenalty(D, 0.003, penalty, d_penalty[1]);
+    }
 
+    double GetResidual(unsigned int s, double* dr_dx) const
+    {
+      double e1 = exp(-bvalues[s]*D);
+      double e2 = exp(-bvalues[s]*(D+fixDStar));
+      double approx = (1-ef)*e1+ef*e2;
+      double d_diff[2] = { e1-e2, bvalues[s]*approx };
+      return Residual<2>(measurements[s], approx, d_diff, penalty, d_penalty, dr_dx);
     }
 
     double fixDStar;
 
+    double ef, D;
+    double penalty;
+    double d_penalty[2];
   };
 
   /** fit a monoexponential curve only estimating D and f */
-  struct IVIM_d_and_f : public IVIM_base, vnl_least_squares_function
+  struct IVIM_d_and_f : public IVIM_base
   {
+    static const unsigned int NumberOfParameters = 2;
 
-    IVIM_d_and_f(unsigned int number_of_measurements) :
-        vnl_least_squares_function(2, number_of_measurements, no_gradient)
+    IVIM_d_and_f(unsigned int number_of_measurements) : IVIM_base(number_of_measurements)
     {
-      N = get_number_of_residuals();
     }
 
-    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override {
-
-      double D = x[0];
-      double f = x[1];
-
-      for(int s=0; s<N; s++)
-      {
-        double approx = (1-f) * exp(-bvalues[s]*D);
-        fx[s] = std::fabs( measurements[s] - approx );
-
-        if (D<0)
-          fx[s] -= D*100000;
+    void SetParameters(const double* x)
+    {
+      D = x[0];
+      f = x[1];
 
-        if (D>0.003)
-          fx[s] += D*100000;
-      }
+      penalty = 0;
+      d_penalty[1] = 0;
+      AddPenalty(D, 0.003, penalty, d_penalty[0]);
+    }
 
+    double GetResidual(unsigned int s, double* dr_dx) const
+    {
+      double e1 = exp(-bvalues[s]*D);
+      double approx = (1-f) * e1;
+      double d_diff[2] = { bvalues[s]*approx, e1 };
+      return Residual<2>(measurements[s], approx, d_diff, penalty, d_penalty, dr_dx);
     }
+
+    double D, f;
+    double penalty;
+    double d_penalty[2];
   };
 
   /** fiting DStar and f with fix value of D */
-  struct IVIM_fixd : public IVIM_base, vnl_least_squares_function
+  struct IVIM_fixd : public IVIM_base
   {
+    static const unsigned int NumberOfParameters = 2;
 
-    IVIM_fixd(unsigned int number_of_measurements, double D) :
-        vnl_least_squares_function(2, number_of_measurements, no_gradient)
+    IVIM_fixd(unsigned int number_of_measurements, double D) : IVIM_base(number_of_measurements)
     {
-      N = get_number_of_residuals();
       fixD = D;
     }
 
-    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override {
-
-      double ef = x[0];
-      double Dstar = x[1];
-
-      for(int s=0; s<N; s++)
-      {
-        double approx = (1-ef)*exp(-bvalues[s]*fixD)+ef*exp(-bvalues[s]*(fixD+Dstar));
-        fx[s] = std::fabs( measurements[s] - approx );
-
-        if (Dstar<0)
-          fx[s] -= Dstar*100000;
+    void SetParameters(const double* x)
+    {
+      ef = x[0];
+      Dstar = x[1];
 
-        if (Dstar>0.3)
-          fx[s] += Dstar*100000;
-      }
+      penalty = 0;
+      d_penalty[0] = 0;
+      AddPenalty(Dstar, 0.3, penalty, d_penalty[1]);
+    }
 
+    double GetResidual(unsigned int s, double* dr_dx) const
+    {
+      double e1 = exp(-bvalues[s]*fixD);
+      double e2 = exp(-bvalues[s]*(fixD+Dstar));
+      double approx = (1-ef)*e1+ef*e2;
+      double d_diff[2] = { e1-e2, bvalues[s]*ef*e2 };
+      return Residual<2>(measurements[s], approx, d_diff, penalty, d_penalty, dr_dx);
     }
 
     double fixD;
+
+    double ef, Dstar;
+    double penalty;
+    double d_penalty[2];
   };
 
   /** fiting DStar with given f and D */
-  struct IVIM_dstar_only : public IVIM_base, vnl_least_squares_function
+  struct IVIM_dstar_only : public IVIM_base
   {
+    static const unsigned int NumberOfParameters = 1;
 
-    IVIM_dstar_only(unsigned int number_of_measurements, double D, double f) :
-        vnl_least_squares_function(1, number_of_measurements, no_gradient)
+    IVIM_dstar_only(unsigned int number_of_measurements, double D, double f) : IVIM_base(number_of_measurements)
     {
-      N = get_number_of_residuals();
       fixD = D;
       fixF = f;
     }
 
-    void f(const vnl_vector<double>& x, vnl_vector<double>& fx) override {
-
-      double Dstar = x[0];
-
-      for(int s=0; s<N; s++)
-      {
-        double approx = (1-fixF)*exp(-bvalues[s]*fixD)+fixF*exp(-bvalues[s]*(fixD+Dstar));
-        fx[s] = std::fabs( measurements[s] - approx );
-
-        if (Dstar<0)
-          fx[s] -= Dstar*100000;
+    void SetParameters(const double* x)
+    {
+      Dstar = x[0];
 
-        if (Dstar>0.3)
-          fx[s] += Dstar*100000;
-      }
+      penalty = 0;
+      AddPenalty(Dstar, 0.3, penalty, d_penalty[0]);
+    }
 
+    double GetResidual(unsigned int s, double* dr_dx) const
+    {
+      double e1 = exp(-bvalues[s]*fixD);
+      double e2 = exp(-bvalues[s]*(fixD+Dstar));
+      double approx = (1-fixF)*e1+fixF*e2;
+      double d_diff[1] = { bvalues[s]*fixF*e2 };
+      return Residual<1>(measurements[s], approx, d_diff, penalty, d_penalty, dr_dx);
     }
 
     double fixD;
     double fixF;
+
+    double Dstar;
+    double penalty;
+    double d_penalty[1];
   };
 
   struct MeasAndBvals
@@ -336,6 +386,7 @@ namespace itk{
     void SetVerbose(bool verbose){m_Verbose = verbose;}
     void SetNumberIterations(int num){m_NumberIterations = num;}
     void SetLambda(double lambda){m_Lambda = lambda;}
+    void SetConvergenceThreshold(double threshold){m_ConvergenceThreshold = threshold;}
     void SetCrossPosition(typename InputImageType::IndexType crosspos){this->m_CrossPosition = crosspos;}
     void SetMethod(IVIM_Method method){m_Method = method;}
 
@@ -402,6 +453,7 @@ namespace itk{
 
     double m_Lambda;
 
+    double m_ConvergenceThreshold; // relative update of the total variation iterations
     typename InputImageType::IndexType m_CrossPosition;
 
   };
@@ -29,15 +29,15 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <itkComposeImageFilter.h>
 #include <itkDiscreteGaussianImageFilter.h>
 
-template< class TInputPixelType>
-static void FitSingleVoxel( const itk::VariableLengthVector< TInputPixelType > &input,
-                            const vnl_vector<double>& bvalues,
-                            vnl_vector<double>& result,
-                            itk::KurtosisFitConfiguration kf_config)
+#include <vector>
+
+/** Input indices of the fitted measurements and their b-values. The b-values are the same for all voxels, so the
+ * selection is computed once per fit configuration. Excluded high b-values leave zero entries (index -1) at the end. */
+static void GetFitSelection( const vnl_vector<double>& bvalues,
+                             const itk::KurtosisFitConfiguration& kf_config,
+                             std::vector<int>& fit_indices,
+                             vnl_vector<double>& fit_bvalues )
 {
-  // check for length
-  assert( input.Size() == bvalues.size() );
-
   // assembly data vectors for fitting
   auto bvalueIter = bvalues.begin();
   unsigned int unused_values = 0;
@@ -51,8 +51,9 @@ static void FitSingleVoxel( const itk::VariableLengthVector< TInputPixelType > &
   }
 
   // initialize data vectors with the estimated size (after filtering)
-  vnl_vector<double> fit_measurements( input.Size() - unused_values, 0 );
-  vnl_vector<double> fit_bvalues( input.Size() - unused_values, 0 );
+  fit_indices.assign( bvalues.size() - unused_values, -1 );
+  fit_bvalues.set_size( bvalues.size() - unused_values );
+  fit_bvalues.fill( 0 );
 
   bvalueIter = bvalues.begin();
   unsigned int running_index = 0;
@@ -68,52 +69,83 @@ static void FitSingleVoxel( const itk::VariableLengthVector< TInputPixelType > &
     }
     else
     {
-      fit_measurements[ running_index - skip_count ]  = input.GetElement(running_index);
+      fit_indices[ running_index - skip_count ] = running_index;
       fit_bvalues[ running_index - skip_count] = *bvalueIter;
     }
 
     ++running_index;
     ++bvalueIter;
   }
+}
 
+template< class TModel >
+static void ConfigureModel( TModel& kurtosis_cost_fn, const vnl_vector<double>& fit_bvalues, const itk::KurtosisFitConfiguration& kf_config )
+{
+  kurtosis_cost_fn.set_fit_logscale( static_cast<bool>(kf_config.fit_scale) );
+  kurtosis_cost_fn.set_bvalues( fit_bvalues );
+
+  if( kf_config.use_K_limits)
+  {
+    kurtosis_cost_fn.set_K_bounds( kf_config.K_limits );
+  }
+}
+
+/** Fits one voxel with a configured model. result contains the initial position and receives the fitted parameters. */
+template< class TModel, class TInputPixelType >
+static void FitSingleVoxel( TModel& kurtosis_cost_fn,
+                            mitk::LevenbergMarquardtSolver< TModel >& nonlinear_fit,
+                            const itk::VariableLengthVector< TInputPixelType > &input,
+                            const std::vector<int>& fit_indices,
+                            vnl_vector<double>& fit_measurements,
+                            vnl_vector<double>& result )
+{
+  for( unsigned int i=0; i<fit_indices.size(); ++i )
+    fit_measurements[i] = fit_indices[i]>=0 ? static_cast<double>( input.GetElement( fit_indices[i] ) ) : 0.0;
 
   MITK_DEBUG("KurtosisFilter.FitSingleVoxel.Meas") << fit_measurements;
+
+  // the fit is skipped if the measurements are invalid, the initial position is returned in this case
+  typename mitk::LevenbergMarquardtSolver< TModel >::ParametersType x( result.data_block() );
+  if( kurtosis_cost_fn.SetMeasurements( fit_measurements.data_block() ) )
+    nonlinear_fit.Minimize( x );
+  result.copy_in( x.data_block() );
+
+  MITK_DEBUG("KurtosisFilter.FitSingleVoxel.Rslt") << result;
+}
+
+template< class TInputPixelType>
+static void FitSingleVoxel( const itk::VariableLengthVector< TInputPixelType > &input,
+                            const vnl_vector<double>& bvalues,
+                            vnl_vector<double>& result,
+                            itk::KurtosisFitConfiguration kf_config)
+{
+  // check for length
+  assert( input.Size() == bvalues.size() );
+
+  std::vector<int> fit_indices;
+  vnl_vector<double> fit_bvalues;
+  GetFitSelection( bvalues, kf_config, fit_indices, fit_bvalues );
+  vnl_vector<double> fit_measurements( fit_indices.size(), 0 );
+
   MITK_DEBUG("KurtosisFilter.FitSingleVoxel.Bval") << fit_bvalues;
 
   // perform fit on data vectors
   if( kf_config.omit_bzero )
   {
-   itk::kurtosis_fit_omit_unweighted kurtosis_cost_fn( fit_measurements.size() );
-   // configuration
-   kurtosis_cost_fn.set_fit_logscale( static_cast<bool>(kf_config.fit_scale) );
-   kurtosis_cost_fn.initialize( fit_measurements, fit_bvalues );
-
-   if( kf_config.use_K_limits)
-   {
-    kurtosis_cost_fn.set_K_bounds( kf_config.K_limits );
-   }
+   itk::kurtosis_fit_omit_unweighted kurtosis_cost_fn( fit_indices.size() );
+   ConfigureModel( kurtosis_cost_fn, fit_bvalues, kf_config );
 
-   vnl_levenberg_marquardt nonlinear_fit( kurtosis_cost_fn );
-   nonlinear_fit.minimize( result );
+   mitk::LevenbergMarquardtSolver< itk::kurtosis_fit_omit_unweighted > nonlinear_fit( kurtosis_cost_fn );
+   FitSingleVoxel( kurtosis_cost_fn, nonlinear_fit, input, fit_indices, fit_measurements, result );
   }
   else
   {
-   itk::kurtosis_fit_lsq_function kurtosis_cost_fn( fit_measurements.size() );
-   // configuration
-   kurtosis_cost_fn.set_fit_logscale( static_cast<bool>(kf_config.fit_scale) );
-   kurtosis_cost_fn.initialize( fit_measurements, fit_bvalues );
-
-   if( kf_config.use_K_limits)
-   {
-    kurtosis_cost_fn.set_K_bounds( kf_config.K_limits );
-   }
-
+   itk::kurtosis_fit_lsq_function kurtosis_cost_fn( fit_indices.size() );
+   ConfigureModel( kurtosis_cost_fn, fit_bvalues, kf_config );
 
-   vnl_levenberg_marquardt nonlinear_fit( kurtosis_cost_fn );
-   nonlinear_fit.minimize(result);
+   mitk::LevenbergMarquardtSolver< itk::kurtosis_fit_lsq_function > nonlinear_fit( kurtosis_cost_fn );
+   FitSingleVoxel( kurtosis_cost_fn, nonlinear_fit, input, fit_indices, fit_measurements, result );
   }
-
-  MITK_DEBUG("KurtosisFilter.FitSingleVoxel.Rslt") << result;
 }
 
 
@@ -461,15 +493,33 @@ void itk::DiffusionKurtosisReconstructionImageFilter<TInputPixelType, TOutputPix
     initial_position = this->m_InitialPosition;
   }
 
+  // the b-values are the same for all voxels: select the fitted measurements and set up both models once per region
+  std::vector<int> fit_indices;
+  vnl_vector<double> fit_bvalues;
+  GetFitSelection( this->m_BValues, fit_config, fit_indices, fit_bvalues );
+  vnl_vector<double> fit_measurements( fit_indices.size(), 0 );
+
+  kurtosis_fit_lsq_function kurtosis_cost_fn( fit_indices.size() );
+  ConfigureModel( kurtosis_cost_fn, fit_bvalues, fit_config );
+  mitk::LevenbergMarquardtSolver< kurtosis_fit_lsq_function > nonlinear_fit( kurtosis_cost_fn );
+
+  kurtosis_fit_omit_unweighted kurtosis_omit_cost_fn( fit_indices.size() );
+  ConfigureModel( kurtosis_omit_cost_fn, fit_bvalues, fit_config );
+  mitk::LevenbergMarquardtSolver< kurtosis_fit_omit_unweighted > nonlinear_omit_fit( kurtosis_omit_cost_fn );
+
+  vnl_vector<double> result( initial_position.size() );
   while( !inputIter.IsAtEnd() )
   {
     // set (reset) each iteration
-    vnl_vector<double> result = initial_position;
+    result = initial_position;
 
     // fit single voxel (if inside mask )
     if( maskIter.Get() > 0 )
     {
-      FitSingleVoxel( inputIter.Get(), this->m_BValues, result, fit_config );
+      if( fit_config.omit_bzero )
+        FitSingleVoxel( kurtosis_omit_cost_fn, nonlinear_omit_fit, inputIter.Get(), fit_indices, fit_measurements, result );
+      else
+        FitSingleVoxel( kurtosis_cost_fn, nonlinear_fit, inputIter.Get(), fit_indices, fit_measurements, result );
     }
     else
     {
@@ -22,74 +22,51 @@ See LICENSE.txt or http://www.mitk.org for details.
 
 #include "mitkDiffusionPropertyHelper.h"
 
-// vnl includes
-#include <vnl/algo/vnl_levenberg_marquardt.h>
-#include <vnl/vnl_least_squares_function.h>
+#include <mitkLevenbergMarquardtSolver.h>
+#include <vnl/vnl_math.h>
 
 namespace itk
 {
 
   // Fitting routines
 
-  /** @struct Kurtosis_fit_lsq_function
+  /** @struct kurtosis_fit_function
       @brief A base least-squares function for the diffusion kurtosis fit (non-IVIM)
 
       The basic function fits the signal to S_0 = S * exp [ -b * D + -b^2 * D^2 * K^2 ]
+
+      Model of mitk::LevenbergMarquardtSolver, the residuals are (meas - M)^2 + penalty with analytic derivatives. With
+      three parameters the unweighted signal b_0 is fitted as third parameter instead of using the first measurement.
       */
-  struct kurtosis_fit_lsq_function :
-      public vnl_least_squares_function
+  template< unsigned int NParams >
+  struct kurtosis_fit_function
   {
   public:
-    /** full lsq_function constructor */
-    kurtosis_fit_lsq_function( unsigned int num_params, unsigned int num_measurements, UseGradient g=no_gradient)
-      : vnl_least_squares_function( num_params, num_measurements, g),
-        m_use_bounds(false),
-        m_use_logscale(false),
-        m_skip_fit(false)
-    {}
+    static const unsigned int NumberOfParameters = NParams;
 
-    /** simplified constructor for the 2-parameters fit */
-    kurtosis_fit_lsq_function( unsigned int number_measurements)
-      : kurtosis_fit_lsq_function( 2, number_measurements, no_gradient )
+    kurtosis_fit_function( unsigned int number_measurements)
+      : m_use_bounds(false),
+        m_use_logscale(false),
+        m_skip_fit(false),
+        meas(number_measurements, 0)
     {}
 
-
     /** Initialize the function by setting measurements and the corresponding b-values */
     void initialize( vnl_vector< double > const& _meas, vnl_vector< double> const& _bvals )
     {
-      meas = _meas;
-      if( m_use_logscale )
-      {
-        for( unsigned int i=0; i< meas.size(); ++i)
-        {
-          // would produce NaN values, skip the fit
-          // using the virtual function from the superclass (sets a boolean flag)
-          if( meas[i] < vnl_math::eps )
-          {
-            m_skip_fit = true;
-            throw_failure();
-
-            continue;
-          }
-
-          meas[i] = log( meas[i] );
-
-        }
-      }
-
       bvalues = _bvals;
+      SetMeasurements( _meas.data_block() );
     }
 
-
     /** use penalty terms on fitting to force the parameters stay within the default bounds */
     void use_bounds()
     {
       m_use_bounds = true;
 
       // initialize bounds
-      double upper_bounds[2] = {4e-3, 4 };
-      kurtosis_upper_bounds = vnl_vector<double>(2, 2, upper_bounds);
-      kurtosis_lower_bounds = vnl_vector<double>(2, 0);
+      kurtosis_upper_bounds[0] = 4e-3;
+      kurtosis_upper_bounds[1] = 4;
+      kurtosis_lower_bounds.fill(0);
     }
 
     void set_fit_logscale( bool flag )
@@ -107,51 +84,109 @@ namespace itk
       kurtosis_upper_bounds[1] = k_bounds[1];
     }
 
-    virtual void f(const vnl_vector<double> &x, vnl_vector<double> &fx)
+    void set_bvalues( vnl_vector< double> const& _bvals )
     {
-      for ( unsigned int s=0; s < fx.size(); s++ )
-      {
-        const double factor = ( meas[s] - M(x, s) );
-        fx[s] = factor * factor + penalty_term(x);
-      }
+      bvalues = _bvals;
+    }
 
-      MITK_DEBUG("Fit.x_and_f") << x << " | " << fx;
+    /** true if the last measurements can not be fitted (non-positive values in logarithmic scale) */
+    bool skip_fit() const
+    {
+      return m_skip_fit;
     }
 
-  protected:
+    unsigned int GetNumberOfResiduals() const
+    {
+      return meas.size();
+    }
 
-    /** Formula for diffusion term, use for internal computations */
-    double Diff( double x1, double x2, double b)
+    /** Copies the measurements (logarithm in logarithmic scale). Returns false if the fit has to be skipped. */
+    bool SetMeasurements( const double* _meas )
     {
-      const double quotient = -1. * b * x1 + b*b * x1 * x1 * x2 / 6;
+      m_skip_fit = false;
+      for( unsigned int i=0; i< meas.size(); ++i)
+      {
+        meas[i] = _meas[i];
+        if( m_use_logscale )
+        {
+          // would produce NaN values, skip the fit
+          if( meas[i] < vnl_math::eps )
+          {
+            m_skip_fit = true;
+            continue;
+          }
 
-      if( m_use_logscale )
-        return quotient;
+          meas[i] = log( meas[i] );
+        }
+      }
+      return !m_skip_fit;
+    }
+
+    void SetParameters( const double* x )
+    {
+      D = x[0];
+      K = x[1];
+
+      // the unweighted signal is either the first measurement or the third parameter
+      d_S0 = 0;
+      if( NParams<3 )
+        S0 = meas[0];
+      else if( m_use_logscale )
+      {
+        S0 = log( x[2] );
+        d_S0 = 1.0 / x[2];
+      }
       else
-        return exp(quotient);
+        S0 = x[2];
+
+      penalty_term( x );
     }
 
-    /** The fitting measurement function, has to be reimplemented in the classes */
-    virtual double M( vnl_vector<double> const& x, unsigned int idx )
+    double GetResidual( unsigned int idx, double* dr_dx ) const
     {
-      const double bvalue = bvalues[idx];
+      const double b = bvalues[idx];
 
-      double result = Diff( x[0], x[1], bvalue);
+      // Diff( D, K, b ) and its derivatives
+      const double quotient = -1. * b * D + b*b * D * D * K / 6;
+      const double d_quotient_D = -1. * b + b*b * D * K / 3;
+      const double d_quotient_K = b*b * D * D / 6;
 
+      double M, dM[3];
       if( m_use_logscale )
-        return meas[0] + result;
+      {
+        M = S0 + quotient;
+        dM[0] = d_quotient_D;
+        dM[1] = d_quotient_K;
+        dM[2] = d_S0;
+      }
       else
-        return meas[0] * result ;
+      {
+        const double e = exp( quotient );
+        M = S0 * e;
+        dM[0] = M * d_quotient_D;
+        dM[1] = M * d_quotient_K;
+        dM[2] = e;
+      }
+
+      const double factor = ( meas[idx] - M );
+      for( unsigned int i=0; i<NParams; ++i)
+        dr_dx[i] = -2 * factor * dM[i] + ( i<2 ? d_penalty[i] : 0 );
+
+      return factor * factor + penalty;
     }
 
+  protected:
+
     /** Penalty term on D and K during fitting, make sure the vector that is passed in contains (D, K) in this ordering */
-    virtual double penalty_term( vnl_vector<double> const& x)
+    void penalty_term( const double* x )
     {
-      double penalty = 0;
+      penalty = 0;
+      d_penalty[0] = 0;
+      d_penalty[1] = 0;
 
       // skip when turned off
       if( !m_use_bounds )
-        return penalty;
+        return;
 
       // we have bounds for D and K only (the first two params )
       for( unsigned int i=0; i< 2; i++)
@@ -162,17 +197,17 @@ namespace itk
 
         if( x[i] < kurtosis_lower_bounds[i] + penalty_boundary )
         {
-          penalty += 1e6 * exp( -1 * ( x[i] - kurtosis_lower_bounds[i]) / penalty_boundary );
+          double p = 1e6 * exp( -1 * ( x[i] - kurtosis_lower_bounds[i]) / penalty_boundary );
+          penalty += p;
+          d_penalty[i] = -p / penalty_boundary;
         }
         else if ( x[i] > kurtosis_upper_bounds[i] - penalty_boundary )
         {
-          penalty += 1e6 * exp( -1 * ( kurtosis_upper_bounds[i] - x[i]) / penalty_boundary );
+          double p = 1e6 * exp( -1 * ( kurtosis_upper_bounds[i] - x[i]) / penalty_boundary );
+          penalty += p;
+          d_penalty[i] = p / penalty_boundary;
         }
       }
-
-      MITK_DEBUG("Fit.Orig.Penalty") << x << " || penalty: " << penalty;
-
-      return penalty;
     }
 
     bool m_use_bounds;
@@ -181,38 +216,26 @@ namespace itk
 
     bool m_skip_fit;
 
-    vnl_vector<double> kurtosis_upper_bounds;
-    vnl_vector<double> kurtosis_lower_bounds;
+    vnl_vector_fixed<double, 2> kurtosis_upper_bounds;
+    vnl_vector_fixed<double, 2> kurtosis_lower_bounds;
 
     vnl_vector<double> meas;
     vnl_vector<double> bvalues;
 
+    // values of the current parameters
+    double D;
+    double K;
+    double S0;
+    double d_S0;
+    double penalty;
+    double d_penalty[2];
   };
 
-  /** @struct kurtosis_fit_omit_unweighted
-      @brief A fitting function handling the unweighted signal b_0 as a fitted parameter */
-  struct kurtosis_fit_omit_unweighted
-      : public kurtosis_fit_lsq_function
-  {
-  public:
-    /** simplified constructor for the 3-parameters fit */
-    kurtosis_fit_omit_unweighted( unsigned int number_measurements)
-      : kurtosis_fit_lsq_function( 3, number_measurements, no_gradient )
-    {}
+  /** @brief The 2-parameters fit (D, K), uses the first measurement as unweighted signal */
+  typedef kurtosis_fit_function<2> kurtosis_fit_lsq_function;
 
-  protected:
-    virtual double M(const vnl_vector<double> &x, unsigned int idx) override
-    {
-      const double bvalue = bvalues[idx];
-
-      double result = Diff( x[0], x[1], bvalue);
-
-      if( m_use_logscale )
-        return log( x[2] ) + result;
-      else
-        return x[2] * result ;
-    }
-  };
+  /** @brief A fitting function handling the unweighted signal b_0 as a fitted parameter (D, K, b_0) */
+  typedef kurtosis_fit_function<3> kurtosis_fit_omit_unweighted;
 
   enum FitScale
   {
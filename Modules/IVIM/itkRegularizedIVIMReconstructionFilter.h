@@ -29,6 +29,10 @@ namespace itk
  *
  * Reference: Tony F. Chan et al., The digital TV filter and nonlinear denoising
  *
+ * Performs the same Jacobi iterations as a chain of RegularizedIVIMReconstructionSingleIteration filters, but all
+ * iterations work on preallocated double buffers and each iteration is parallelized over the slices of the image. The
+ * iteration stops early if the relative update of f and D falls below the convergence threshold.
+ *
  * \sa Image
  * \sa Neighborhood
  * \sa NeighborhoodOperator
@@ -93,6 +97,14 @@ public:
   itkSetMacro(NumberIterations, int);
   itkGetMacro(NumberIterations, int);
 
+  /** Stop if the relative RMS update of f and D in one iteration is below this value (default 0: never stop early) */
+  itkSetMacro(ConvergenceThreshold, double);
+  itkGetMacro(ConvergenceThreshold, double);
+
+  /** Relative RMS update of the last performed iteration */
+  itkGetMacro(Residual, double);
+  itkGetMacro(NumberOfPerformedIterations, int);
+
   void SetBValues( vnl_vector<double> bvals )
   { this->m_BValues = bvals; }
   vnl_vector<double> GetBValues()
@@ -108,11 +120,16 @@ protected:
   virtual ~RegularizedIVIMReconstructionFilter() {}
   void PrintSelf(std::ostream& os, Indent indent) const;
 
+  void GenerateInputRequestedRegion();
+  void EnlargeOutputRequestedRegion(DataObject* output);
   void GenerateData();
 
   double m_Lambda;
 
   int m_NumberIterations;
+  double m_ConvergenceThreshold;
+  double m_Residual;
+  int m_NumberOfPerformedIterations;
 
   typename RefImageType::Pointer m_ReferenceImage;
 
@@ -24,6 +24,7 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include "itkZeroFluxNeumannBoundaryCondition.h"
 #include "itkOffset.h"
 #include "itkProgressReporter.h"
+#include "itkTimeProbe.h"
 
 #include <vector>
 #include <algorithm>
@@ -36,6 +37,36 @@ namespace itk
     ::RegularizedIVIMReconstructionFilter()
   {
     m_Lambda = 1.0;
+    m_NumberIterations = 1;
+    m_ConvergenceThreshold = 0.0;
+    m_Residual = 0.0;
+    m_NumberOfPerformedIterations = 0;
+  }
+
+
+  /**
+  * every iteration needs the whole image
+  */
+  template <class TInputPixel, class TOutputPixel, class TRefPixelType>
+  void
+  RegularizedIVIMReconstructionFilter<TInputPixel, TOutputPixel, TRefPixelType>
+    ::GenerateInputRequestedRegion()
+  {
+    Superclass::GenerateInputRequestedRegion();
+
+    InputImageType* inputPtr = const_cast< InputImageType * >( this->GetInput() );
+    if ( inputPtr )
+      inputPtr->SetRequestedRegionToLargestPossibleRegion();
+  }
+
+
+  template <class TInputPixel, class TOutputPixel, class TRefPixelType>
+  void
+  RegularizedIVIMReconstructionFilter<TInputPixel, TOutputPixel, TRefPixelType>
+    ::EnlargeOutputRequestedRegion(DataObject* output)
+  {
+    Superclass::EnlargeOutputRequestedRegion(output);
+    output->SetRequestedRegionToLargestPossibleRegion();
   }
 
 
@@ -44,48 +75,184 @@ namespace itk
   RegularizedIVIMReconstructionFilter<TInputPixel, TOutputPixel, TRefPixelType>
     ::GenerateData()
   {
-    // first we cast the input image to match output type
-    typename CastType::Pointer infilter = CastType::New();
-    infilter->SetInput(this->GetInput());
-    infilter->Update();
-    typename OutputImageType::Pointer image = infilter->GetOutput();
+    const InputImageType* input = this->GetInput();
+    const InputImageRegionType region = input->GetLargestPossibleRegion();
+    if ( m_ReferenceImage.IsNull() || m_ReferenceImage->GetLargestPossibleRegion().GetSize()!=region.GetSize() )
+      itkExceptionMacro("Reference image missing or its size does not match the input image.");
+    if ( m_ReferenceImage->GetNumberOfComponentsPerPixel()<m_BValues.size() )
+      itkExceptionMacro("Reference image has less components than b-values.");
+
+    const int size_x = static_cast<int>(region.GetSize(0));
+    const int size_y = static_cast<int>(region.GetSize(1));
+    const int size_z = static_cast<int>(region.GetSize(2));
+    const std::size_t slice_size = static_cast<std::size_t>(size_x)*size_y;
+    const std::size_t num_voxels = slice_size*size_z;
+    const int num_bvalues = static_cast<int>(m_BValues.size());
+
+    // f and D in two buffers each (Jacobi iteration: read from one, write to the other), D* is not changed
+    std::vector<double> f_buffer[2];
+    std::vector<double> d_buffer[2];
+    std::vector<double> dstar(num_voxels);
+    for (int i=0; i<2; ++i)
+    {
+      f_buffer[i].resize(num_voxels);
+      d_buffer[i].resize(num_voxels);
+    }
+    // inverse local variation 1/||nabla(u)|| of the current iterate
+    std::vector<double> inv_loc_var(num_voxels);
+    std::vector<double> bvalues(m_BValues.begin(), m_BValues.end());
 
-    typename SingleIterationFilterType::Pointer filter;
+    std::vector<double> reference(num_voxels*num_bvalues);
+    {
+      itk::ImageRegionConstIterator<InputImageType> iit(input, region);
+      itk::ImageRegionConstIterator<RefImageType> rit(m_ReferenceImage, m_ReferenceImage->GetLargestPossibleRegion());
+      for (std::size_t v=0; !iit.IsAtEnd(); ++iit, ++rit, ++v)
+      {
+        f_buffer[0][v] = iit.Get()[0];
+        d_buffer[0][v] = iit.Get()[1];
+        dstar[v] = iit.Get()[2];
+        RefVectorType ref = rit.Get();
+        for (int b=0; b<num_bvalues; ++b)
+          reference[v*num_bvalues+b] = ref[b];
+      }
+    }
+
+    // squared updates and squared values of f and D per slice, summed after each iteration
+    std::vector<double> slice_sums(4*size_z);
+
+    itk::MultiThreaderBase* threader = this->GetMultiThreader();
+    threader->SetNumberOfWorkUnits(this->GetNumberOfWorkUnits());
+
+    const double lambda = m_Lambda;
+    int current = 0;
+    m_Residual = 0;
+    m_NumberOfPerformedIterations = 0;
     for(int i=0; i<m_NumberIterations; i++)
     {
-      filter = SingleIterationFilterType::New();
-      filter->SetInput( image.GetPointer() );
-      filter->SetOriginalImage( m_ReferenceImage );
-      filter->SetBValues(m_BValues);
-      filter->SetLambda(m_Lambda);
-      filter->SetNumberOfWorkUnits(this->GetNumberOfWorkUnits());
-      filter->UpdateLargestPossibleRegion();
-      image = filter->GetOutput();
-      std::cout << "Iteration " << i+1 << "/" <<
-        m_NumberIterations << std::endl;
+      itk::TimeProbe clock;
+      clock.Start();
+
+      const double* f_in = f_buffer[current].data();
+      const double* d_in = d_buffer[current].data();
+      double* f_out = f_buffer[1-current].data();
+      double* d_out = d_buffer[1-current].data();
+
+      // local variation of D, the zero flux Neumann boundary condition makes all differences across the border zero
+      threader->ParallelizeArray(0, size_z, [&](SizeValueType z)
+      {
+        for (int y=0; y<size_y; ++y)
+          for (int x=0; x<size_x; ++x)
+          {
+            const std::size_t v = z*slice_size + y*size_x + x;
+            double d = d_in[v];
+            double sum = 0;
+            double diff;
+            if (z>0) { diff = d_in[v-slice_size]-d; sum += diff*diff; }
+            if (y>0) { diff = d_in[v-size_x]-d; sum += diff*diff; }
+            if (x>0) { diff = d_in[v-1]-d; sum += diff*diff; }
+            if (x<size_x-1) { diff = d_in[v+1]-d; sum += diff*diff; }
+            if (y<size_y-1) { diff = d_in[v+size_x]-d; sum += diff*diff; }
+            if (static_cast<int>(z)<size_z-1) { diff = d_in[v+slice_size]-d; sum += diff*diff; }
+            inv_loc_var[v] = 1.0/sqrt(sum + 0.0001);
+          }
+      }, nullptr);
+
+      threader->ParallelizeArray(0, size_z, [&](SizeValueType z)
+      {
+        double sums[4] = {0, 0, 0, 0};
+        for (int y=0; y<size_y; ++y)
+          for (int x=0; x<size_x; ++x)
+          {
+            const std::size_t v = z*slice_size + y*size_x + x;
+
+            // neighbors outside of the image are replaced by the center voxel
+            std::size_t neighbors[6];
+            neighbors[0] = z>0 ? v-slice_size : v;
+            neighbors[1] = y>0 ? v-size_x : v;
+            neighbors[2] = x>0 ? v-1 : v;
+            neighbors[3] = x<size_x-1 ? v+1 : v;
+            neighbors[4] = y<size_y-1 ? v+size_x : v;
+            neighbors[5] = static_cast<int>(z)<size_z-1 ? v+slice_size : v;
+
+            // w_alphabeta(u) = 1 / ||nabla_alpha(u)||_a + 1 / ||nabla_beta(u)||_a
+            double ws[6];
+            double wsum = 0;
+            for (int k=0; k<6; ++k)
+            {
+              ws[k] = inv_loc_var[v] + inv_loc_var[neighbors[k]];
+              wsum += ws[k];
+            }
+
+            const double f = f_in[v];
+            const double d = d_in[v];
+            const double* orig = reference.data() + v*num_bvalues;
+            double step0 = 0;
+            double step1 = 0;
+            for (int b=0; b<num_bvalues; ++b)
+            {
+              if (orig[b] == IVIM_FOO)
+                continue;
+              double estimdash1 = exp(-bvalues[b]*d);
+              double estim = (1-f)*estimdash1;
+              double estimdash2 = (-1.0) * (1.0-f) * bvalues[b] * estimdash1;
+              step0 += (orig[b] - estim) * estimdash2;
+              step1 += (orig[b] - estim) * estimdash1;
+            }
+
+            step1 *= lambda / (lambda+wsum);
+
+            // add the different h_alphabeta * u_beta
+            for (int k=0; k<6; ++k)
+              step1 += (d_in[neighbors[k]] - d) * (ws[k] / (lambda+wsum));
+
+            f_out[v] = f + .001*step0;
+            d_out[v] = d + .00001*step1;
+
+            sums[0] += (f_out[v]-f)*(f_out[v]-f);
+            sums[1] += f*f;
+            sums[2] += (d_out[v]-d)*(d_out[v]-d);
+            sums[3] += d*d;
+          }
+        for (int k=0; k<4; ++k)
+          slice_sums[4*z+k] = sums[k];
+      }, nullptr);
+      current = 1-current;
+
+      double sums[4] = {0, 0, 0, 0};
+      for (int z=0; z<size_z; ++z)
+        for (int k=0; k<4; ++k)
+          sums[k] += slice_sums[4*z+k];
+      double f_update = sums[1]>0 ? sqrt(sums[0]/sums[1]) : sqrt(sums[0]);
+      double d_update = sums[3]>0 ? sqrt(sums[2]/sums[3]) : sqrt(sums[2]);
+      m_Residual = std::max(f_update, d_update);
+      m_NumberOfPerformedIterations = i+1;
+
+      clock.Stop();
+      std::cout << "Iteration " << i+1 << "/" << m_NumberIterations << ": " << clock.GetTotal() << "s, relative update f "
+                << f_update << ", D " << d_update << std::endl;
+
+      if (m_Residual<m_ConvergenceThreshold)
+      {
+        std::cout << "Converged after " << i+1 << " iterations" << std::endl;
+        break;
+      }
     }
 
     typename OutputImageType::Pointer output = this->GetOutput();
-    output->SetOrigin( image->GetOrigin() );     // Set the image origin
-    output->SetDirection( image->GetDirection() );  // Set the image direction
-    output->SetSpacing(image->GetSpacing());
-    output->SetLargestPossibleRegion( image->GetLargestPossibleRegion() );
-    output->SetBufferedRegion( image->GetLargestPossibleRegion() );
+    output->SetOrigin( input->GetOrigin() );
+    output->SetDirection( input->GetDirection() );
+    output->SetSpacing( input->GetSpacing() );
+    output->SetRegions( region );
     output->Allocate();
 
-    itk::ImageRegionIterator<OutputImageType> oit(
-      output, output->GetLargestPossibleRegion());
-    oit.GoToBegin();
-
-    itk::ImageRegionConstIterator<OutputImageType> iit(
-      image, image->GetLargestPossibleRegion());
-    iit.GoToBegin();
-
-    while(!oit.IsAtEnd())
+    itk::ImageRegionIterator<OutputImageType> oit(output, region);
+    for (std::size_t v=0; !oit.IsAtEnd(); ++oit, ++v)
     {
-      oit.Set(iit.Get());
-      ++iit;
-      ++oit;
+      OutputVectorType out;
+      out[0] = f_buffer[current][v];
+      out[1] = d_buffer[current][v];
+      out[2] = dstar[v];
+      oit.Set(out);
     }
   }
 
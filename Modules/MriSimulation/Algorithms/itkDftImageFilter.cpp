@@ -41,51 +41,76 @@ template< class TPixelType >
 void DftImageFilter< TPixelType >
 ::BeforeThreadedGenerateData()
 {
-
-}
-
-template< class TPixelType >
-void DftImageFilter< TPixelType >
-::DynamicThreadedGenerateData(const OutputImageRegionType& outputRegionForThread)
-{
-  typename OutputImageType::Pointer outputImage = static_cast< OutputImageType * >(this->ProcessObject::GetOutput(0));
-
-  ImageRegionIterator< OutputImageType > oit(outputImage, outputRegionForThread);
-
-  typedef ImageRegionConstIterator< InputImageType > InputIteratorType;
   typename InputImageType::Pointer inputImage  = static_cast< InputImageType * >( this->ProcessObject::GetInput(0) );
 
-  float szx = outputImage->GetLargestPossibleRegion().GetSize(0);
-  float szy = outputImage->GetLargestPossibleRegion().GetSize(1);
+  int nx = inputImage->GetLargestPossibleRegion().GetSize(0);
+  int ny = inputImage->GetLargestPossibleRegion().GetSize(1);
+  float szx = nx;
+  float szy = ny;
 
   float x_shift = 0;
   float y_shift = 0;
-  if (static_cast<int>(szx)%2==1)
+  if (nx%2==1)
       x_shift = (szx-1)/2;
   else
       x_shift = szx/2;
-  if (static_cast<int>(szy)%2==1)
+  if (ny%2==1)
       y_shift = (szy-1)/2;
   else
       y_shift = szy/2;
 
-  while( !oit.IsAtEnd() )
+  std::vector< std::complex<TPixelType> > row_twiddles(nx*nx);
+  for (int k=0; k<nx; ++k)
   {
-    float kx = oit.GetIndex()[0] - x_shift;
-    float ky = oit.GetIndex()[1] - y_shift;
-    kx /= szx;
-    ky /= szy;
+    float kx = (k - x_shift)/szx;
+    for (int x=0; x<nx; ++x)
+      row_twiddles[k*nx + x] = exp( std::complex<TPixelType>(0, -itk::Math::twopi * (kx*(x - x_shift)) ) );
+  }
 
-    std::complex<TPixelType> s(0,0);
-    InputIteratorType it(inputImage, inputImage->GetLargestPossibleRegion() );
-    while( !it.IsAtEnd() )
-    {
-      float x = it.GetIndex()[0] - x_shift;
-      float y = it.GetIndex()[1] - y_shift;
+  m_ColTwiddles.resize(ny*ny);
+  for (int k=0; k<ny; ++k)
+  {
+    float ky = (k - y_shift)/szy;
+    for (int y=0; y<ny; ++y)
+      m_ColTwiddles[k*ny + y] = exp( std::complex<TPixelType>(0, -itk::Math::twopi * (ky*(y - y_shift)) ) );
+  }
 
-      s += it.Get() * exp( std::complex<TPixelType>(0, -itk::Math::twopi * (kx*x + ky*y) ) );
-      ++it;
+  // transform all rows in x
+  const std::complex<TPixelType>* in = inputImage->GetBufferPointer();
+  m_RowDft.resize(nx*ny);
+  for (int y=0; y<ny; ++y)
+  {
+    const std::complex<TPixelType>* row = in + y*nx;
+    for (int k=0; k<nx; ++k)
+    {
+      const std::complex<TPixelType>* tw = row_twiddles.data() + k*nx;
+      std::complex<TPixelType> sum(0,0);
+      for (int x=0; x<nx; ++x)
+        sum += row[x] * tw[x];
+      m_RowDft[k*ny + y] = sum;
     }
+  }
+}
+
+template< class TPixelType >
+void DftImageFilter< TPixelType >
+::DynamicThreadedGenerateData(const OutputImageRegionType& outputRegionForThread)
+{
+  typename OutputImageType::Pointer outputImage = static_cast< OutputImageType * >(this->ProcessObject::GetOutput(0));
+
+  ImageRegionIterator< OutputImageType > oit(outputImage, outputRegionForThread);
+
+  int ny = outputImage->GetLargestPossibleRegion().GetSize(1);
+
+  // transform the columns of the row transform in y
+  while( !oit.IsAtEnd() )
+  {
+    const std::complex<TPixelType>* col = m_RowDft.data() + oit.GetIndex()[0]*ny;
+    const std::complex<TPixelType>* tw = m_ColTwiddles.data() + oit.GetIndex()[1]*ny;
+
+    std::complex<TPixelType> s(0,0);
+    for (int y=0; y<ny; ++y)
+      s += col[y] * tw[y];
 
     oit.Set(s);
     ++oit;
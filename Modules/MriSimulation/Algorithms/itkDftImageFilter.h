@@ -25,11 +25,16 @@ This file is based heavily on a corresponding ITK filter.
 #include <itkImageToImageFilter.h>
 #include <itkDiffusionTensor3D.h>
 #include <mitkFiberfoxParameters.h>
+#include <vector>
+#include <complex>
 
 namespace itk{
 
 /**
-* \brief 2D Discrete Fourier Transform Filter (complex to real). Special issue for Fiberfox -> rearranges slice. */
+* \brief 2D Discrete Fourier Transform Filter (complex to real). Special issue for Fiberfox -> rearranges slice.
+*
+* The transform is evaluated as row-column DFT: the rows are transformed once in BeforeThreadedGenerateData and
+* each output pixel is obtained by transforming one column of the intermediate result. */
 
 template< class TPixelType >
 class DftImageFilter :
@@ -66,6 +71,9 @@ protected:
 private:
 
     FiberfoxParameters  m_Parameters;
+
+    std::vector< std::complex< TPixelType > >   m_RowDft;       ///< [kx][y]
+    std::vector< std::complex< TPixelType > >   m_ColTwiddles;  ///< [ky][y]
 };
 
 }
@@ -43,6 +43,43 @@ FitFibersToImageFilter::~FitFibersToImageFilter()
 
 }
 
+void FitFibersToImageFilter::CopyFiberPoints(std::vector< PointType3 >& points, std::vector< std::size_t >& offsets, std::vector< unsigned int >& columns)
+{
+  // concatenate the flat point views of all bundles for the parallel intersection
+  points.clear();
+  offsets.assign(1, 0);
+  columns.clear();
+  m_GroupSizes.clear();
+  unsigned int fiber = 0;
+  for (unsigned int bundle=0; bundle<m_Tractograms.size(); bundle++)
+  {
+    const mitk::FiberBundle::FiberPointView& view = m_Tractograms.at(bundle)->GetFiberPointView();
+    m_GroupSizes.push_back(m_Tractograms.at(bundle)->GetNumFibers());
+    for (unsigned int i=0; i<m_Tractograms.at(bundle)->GetNumFibers(); ++i)
+    {
+      unsigned int numPoints = view.GetNumberOfPoints(i);
+
+      if (numPoints<2)
+        MITK_INFO << "FIBER WITH ONLY ONE POINT ENCOUNTERED!";
+
+      for (unsigned int j=0; j<numPoints; ++j)
+      {
+        const float* p = view.GetPoint(i, j);
+        PointType3 point;
+        point[0] = p[0]; point[1] = p[1]; point[2] = p[2];
+        points.push_back(point);
+      }
+      offsets.push_back(points.size());
+
+      if (m_FitIndividualFibers)
+        columns.push_back(fiber);
+      else
+        columns.push_back(bundle);
+      ++fiber;
+    }
+  }
+}
+
 void FitFibersToImageFilter::CreateDiffSystem()
 {
   sz_x = m_DiffImage->GetLargestPossibleRegion().GetSize(0);
@@ -65,7 +102,6 @@ void FitFibersToImageFilter::CreateDiffSystem()
   MITK_INFO << "Num. residuals: " << m_NumResiduals;
   MITK_INFO << "Creating system ...";
 
-  A.set_size(m_NumResiduals, m_NumUnknowns);
   b.set_size(m_NumResiduals); b.fill(0.0);
 
   m_MeanTractDensity = 0;
@@ -74,100 +110,110 @@ void FitFibersToImageFilter::CreateDiffSystem()
   fiber_count = 0;
   vnl_vector<int> voxel_indicator; voxel_indicator.set_size(sz_x*sz_y*sz_z); voxel_indicator.fill(0);
 
-  unsigned int numFibers = 0;
-  for (unsigned int bundle=0; bundle<m_Tractograms.size(); bundle++)
-    numFibers += m_Tractograms.at(bundle)->GetNumFibers();
+  std::vector< PointType3 > points;
+  std::vector< std::size_t > point_offsets;
+  std::vector< unsigned int > columns;
+  CopyFiberPoints(points, point_offsets, columns);
+  int numFibers = static_cast<int>(columns.size());
+
+  // m_Row: voxel index, m_Signal: mean measured signal, m_Density: mean simulated signal
+  std::vector< std::vector< SystemEntry > > entries(numFibers);
+  std::vector< std::vector< mitk::SparseSystemMatrix::Triplet > > fiber_triplets(numFibers);
+
   boost::timer::progress_display disp(numFibers);
-  m_GroupSizes.clear();
-  for (unsigned int bundle=0; bundle<m_Tractograms.size(); bundle++)
+#pragma omp parallel for schedule(dynamic, 16)
+  for (int i=0; i<numFibers; ++i)
   {
-    vtkSmartPointer<vtkPolyData> polydata = m_Tractograms.at(bundle)->GetFiberPolyData();
-    m_GroupSizes.push_back(m_Tractograms.at(bundle)->GetNumFibers());
-    for (unsigned int i=0; i<m_Tractograms.at(bundle)->GetNumFibers(); ++i)
+    for (std::size_t j=point_offsets[i]; j+1<point_offsets[i+1]; ++j)
     {
-      ++disp;
-      vtkCell* cell = polydata->GetCell(i);
-      int numPoints = cell->GetNumberOfPoints();
-      vtkPoints* points = cell->GetPoints();
-
-      if (numPoints<2)
-        MITK_INFO << "FIBER WITH ONLY ONE POINT ENCOUNTERED!";
-
-      for (int j=0; j<numPoints-1; ++j)
+      PointType3 startVertex = points[j];
+      itk::Index<3> startIndex;
+      itk::ContinuousIndex<float, 3> startIndexCont;
+      (void)m_DiffImage->TransformPhysicalPointToIndex(startVertex, startIndex);
+      (void)m_DiffImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
+
+      PointType3 endVertex = points[j+1];
+      itk::Index<3> endIndex;
+      itk::ContinuousIndex<float, 3> endIndexCont;
+      (void)m_DiffImage->TransformPhysicalPointToIndex(endVertex, endIndex);
+      (void)m_DiffImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
+
+      mitk::DiffusionSignalModel<>::GradientType fiber_dir;
+      fiber_dir[0] = endVertex[0]-startVertex[0];
+      fiber_dir[1] = endVertex[1]-startVertex[1];
+      fiber_dir[2] = endVertex[2]-startVertex[2];
+      fiber_dir.Normalize();
+
+      std::vector< std::pair< itk::Index<3>, double > > segments = mitk::imv::IntersectImage(spacing, startIndex, endIndex, startIndexCont, endIndexCont);
+      for (std::pair< itk::Index<3>, double > seg : segments)
       {
-        PointType3 startVertex = mitk::imv::GetItkPoint(points->GetPoint(j));
-        itk::Index<3> startIndex;
-        itk::ContinuousIndex<float, 3> startIndexCont;
-        (void)m_DiffImage->TransformPhysicalPointToIndex(startVertex, startIndex);
-        (void)m_DiffImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
-
-        PointType3 endVertex = mitk::imv::GetItkPoint(points->GetPoint(j+1));
-        itk::Index<3> endIndex;
-        itk::ContinuousIndex<float, 3> endIndexCont;
-        (void)m_DiffImage->TransformPhysicalPointToIndex(endVertex, endIndex);
-        (void)m_DiffImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
-
-        mitk::DiffusionSignalModel<>::GradientType fiber_dir;
-        fiber_dir[0] = endVertex[0]-startVertex[0];
-        fiber_dir[1] = endVertex[1]-startVertex[1];
-        fiber_dir[2] = endVertex[2]-startVertex[2];
-        fiber_dir.Normalize();
-
-        std::vector< std::pair< itk::Index<3>, double > > segments = mitk::imv::IntersectImage(spacing, startIndex, endIndex, startIndexCont, endIndexCont);
-        for (std::pair< itk::Index<3>, double > seg : segments)
-        {
-          if (!m_DiffImage->GetLargestPossibleRegion().IsInside(seg.first) || (m_MaskImage.IsNotNull() && m_MaskImage->GetPixel(seg.first)==0))
-            continue;
-
-          int x = seg.first[0];
-          int y = seg.first[1];
-          int z = seg.first[2];
+        if (!m_DiffImage->GetLargestPossibleRegion().IsInside(seg.first) || (m_MaskImage.IsNotNull() && m_MaskImage->GetPixel(seg.first)==0))
+          continue;
 
-          mitk::DiffusionSignalModel<>::PixelType simulated_pixel = m_SignalModel->SimulateMeasurement(fiber_dir)*seg.second;
-          VectorImgType::PixelType measured_pixel = m_DiffImage->GetPixel(seg.first);
+        int x = seg.first[0];
+        int y = seg.first[1];
+        int z = seg.first[2];
 
-          double simulated_mean = 0;
-          double measured_mean = 0;
-          int num_nonzero_g = 0;
-          for (int g=0; g<dim_four_size; ++g)
-          {
-            if( m_SignalModel->GetGradientDirection(g).GetNorm()<mitk::eps )
-              continue;
-            simulated_mean += simulated_pixel[g];
-            measured_mean += (double)measured_pixel[g];
-            ++num_nonzero_g;
-          }
-          simulated_mean /= num_nonzero_g;
-          measured_mean /= num_nonzero_g;
-          simulated_pixel -= simulated_mean;
+        mitk::DiffusionSignalModel<>::PixelType simulated_pixel = m_SignalModel->SimulateMeasurement(fiber_dir)*seg.second;
+        VectorImgType::PixelType measured_pixel = m_DiffImage->GetPixel(seg.first);
 
-          if (voxel_indicator[x + sz_x*y + sz_x*sz_y*z]==0)
-            m_MeanSignal += measured_mean;
-          m_MeanTractDensity += simulated_mean;
-          voxel_indicator[x + sz_x*y + sz_x*sz_y*z] = 1;
+        double simulated_mean = 0;
+        double measured_mean = 0;
+        int num_nonzero_g = 0;
+        for (int g=0; g<dim_four_size; ++g)
+        {
+          if( m_SignalModel->GetGradientDirection(g).GetNorm()<mitk::eps )
+            continue;
+          simulated_mean += simulated_pixel[g];
+          measured_mean += (double)measured_pixel[g];
+          ++num_nonzero_g;
+        }
+        simulated_mean /= num_nonzero_g;
+        measured_mean /= num_nonzero_g;
+        simulated_pixel -= simulated_mean;
 
-          for (int g=0; g<dim_four_size; ++g)
-          {
-            unsigned int linear_index = x + sz_x*y + sz_x*sz_y*z + sz_x*sz_y*sz_z*g;
+        unsigned int voxel = x + sz_x*y + sz_x*sz_y*z;
+        entries[i].push_back({voxel, measured_mean, simulated_mean});
 
-            if (m_FitIndividualFibers)
-            {
-              b[linear_index] = (double)measured_pixel[g] - measured_mean;
-              A.put(linear_index, fiber_count, A.get(linear_index, fiber_count) + simulated_pixel[g]);
-            }
-            else
-            {
-              b[linear_index] = (double)measured_pixel[g] - measured_mean;
-              A.put(linear_index, bundle, A.get(linear_index, bundle) + simulated_pixel[g]);
-            }
-          }
+        for (int g=0; g<dim_four_size; ++g)
+        {
+          unsigned int linear_index = voxel + sz_x*sz_y*sz_z*g;
+          fiber_triplets[i].push_back({linear_index, columns[i], simulated_pixel[g]});
         }
-
       }
+    }
+#pragma omp critical
+    ++disp;
+  }
 
-      ++fiber_count;
+  // fiber order bookkeeping, identical to a serial assembly
+  std::vector< mitk::SparseSystemMatrix::Triplet > triplets;
+  for (int i=0; i<numFibers; ++i)
+  {
+    for (const SystemEntry& e : entries[i])
+    {
+      if (voxel_indicator[e.m_Row]==0)
+      {
+        m_MeanSignal += e.m_Signal;
+
+        itk::Index<3> idx;
+        idx[0] = e.m_Row % sz_x;
+        idx[1] = (e.m_Row / sz_x) % sz_y;
+        idx[2] = e.m_Row / (sz_x*sz_y);
+        VectorImgType::PixelType measured_pixel = m_DiffImage->GetPixel(idx);
+        for (int g=0; g<dim_four_size; ++g)
+          b[e.m_Row + sz_x*sz_y*sz_z*g] = (double)measured_pixel[g] - e.m_Signal;
+      }
+      m_MeanTractDensity += e.m_Density;
+      voxel_indicator[e.m_Row] = 1;
     }
+    std::vector< SystemEntry >().swap(entries[i]);
+
+    triplets.insert(triplets.end(), fiber_triplets[i].begin(), fiber_triplets[i].end());
+    std::vector< mitk::SparseSystemMatrix::Triplet >().swap(fiber_triplets[i]);
+    ++fiber_count;
   }
+  A.SetFromTriplets(m_NumResiduals, m_NumUnknowns, triplets);
 
   m_NumCoveredDirections = voxel_indicator.sum();
   if (m_NumCoveredDirections==0 || m_MeanSignal<0.0001)
@@ -229,7 +275,6 @@ void FitFibersToImageFilter::CreatePeakSystem()
   MITK_INFO << "Num. residuals: " << m_NumResiduals;
   MITK_INFO << "Creating system ...";
 
-  A.set_size(m_NumResiduals, m_NumUnknowns);
   b.set_size(m_NumResiduals); b.fill(0.0);
 
   m_MeanTractDensity = 0;
@@ -237,95 +282,90 @@ void FitFibersToImageFilter::CreatePeakSystem()
   m_NumCoveredDirections = 0;
   fiber_count = 0;
 
-  m_GroupSizes.clear();
+  std::vector< PointType3 > points;
+  std::vector< std::size_t > point_offsets;
+  std::vector< unsigned int > columns;
+  CopyFiberPoints(points, point_offsets, columns);
+  int numFibers = static_cast<int>(columns.size());
+
+  // m_Row: residual index, m_Signal: peak magnitude, m_Density: fiber weight in the voxel
+  std::vector< std::vector< SystemEntry > > entries(numFibers);
 
-  int numFibers = 0;
-  for (unsigned int bundle=0; bundle<m_Tractograms.size(); bundle++)
-    numFibers += m_Tractograms.at(bundle)->GetNumFibers();
   boost::timer::progress_display disp(numFibers);
-  for (unsigned int bundle=0; bundle<m_Tractograms.size(); bundle++)
+#pragma omp parallel for schedule(dynamic, 16)
+  for (int i=0; i<numFibers; ++i)
   {
-    vtkSmartPointer<vtkPolyData> polydata = m_Tractograms.at(bundle)->GetFiberPolyData();
-
-    m_GroupSizes.push_back(m_Tractograms.at(bundle)->GetNumFibers());
-    for (unsigned int i=0; i<m_Tractograms.at(bundle)->GetNumFibers(); ++i)
+    for (std::size_t j=point_offsets[i]; j+1<point_offsets[i+1]; ++j)
     {
-      ++disp;
-      vtkCell* cell = polydata->GetCell(i);
-      int numPoints = cell->GetNumberOfPoints();
-      vtkPoints* points = cell->GetPoints();
-
-      if (numPoints<2)
-        MITK_INFO << "FIBER WITH ONLY ONE POINT ENCOUNTERED!";
-
-      for (int j=0; j<numPoints-1; ++j)
+      PointType3 startVertex = points[j];
+      itk::Index<3> startIndex;
+      itk::ContinuousIndex<float, 3> startIndexCont;
+      (void)m_MaskImage->TransformPhysicalPointToIndex(startVertex, startIndex);
+      (void)m_MaskImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
+
+      PointType3 endVertex = points[j+1];
+      itk::Index<3> endIndex;
+      itk::ContinuousIndex<float, 3> endIndexCont;
+      (void)m_MaskImage->TransformPhysicalPointToIndex(endVertex, endIndex);
+      (void)m_MaskImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
+
+      vnl_vector_fixed<float,3> fiber_dir;
+      fiber_dir[0] = endVertex[0]-startVertex[0];
+      fiber_dir[1] = endVertex[1]-startVertex[1];
+      fiber_dir[2] = endVertex[2]-startVertex[2];
+      fiber_dir.normalize();
+
+      std::vector< std::pair< itk::Index<3>, double > > segments = mitk::imv::IntersectImage(spacing, startIndex, endIndex, startIndexCont, endIndexCont);
+      for (std::pair< itk::Index<3>, double > seg : segments)
       {
-        PointType3 startVertex = mitk::imv::GetItkPoint(points->GetPoint(j));
-        itk::Index<3> startIndex;
-        itk::ContinuousIndex<float, 3> startIndexCont;
-        (void)m_MaskImage->TransformPhysicalPointToIndex(startVertex, startIndex);
-        (void)m_MaskImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
-
-        PointType3 endVertex = mitk::imv::GetItkPoint(points->GetPoint(j+1));
-        itk::Index<3> endIndex;
-        itk::ContinuousIndex<float, 3> endIndexCont;
-        (void)m_MaskImage->TransformPhysicalPointToIndex(endVertex, endIndex);
-        (void)m_MaskImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
-
-        vnl_vector_fixed<float,3> fiber_dir;
-        fiber_dir[0] = endVertex[0]-startVertex[0];
-        fiber_dir[1] = endVertex[1]-startVertex[1];
-        fiber_dir[2] = endVertex[2]-startVertex[2];
-        fiber_dir.normalize();
-
-        std::vector< std::pair< itk::Index<3>, double > > segments = mitk::imv::IntersectImage(spacing, startIndex, endIndex, startIndexCont, endIndexCont);
-        for (std::pair< itk::Index<3>, double > seg : segments)
-        {
-          if (!m_MaskImage->GetLargestPossibleRegion().IsInside(seg.first) || m_MaskImage->GetPixel(seg.first)==0)
-            continue;
-
-          itk::Index<4> idx4;
-          idx4[0]=seg.first[0];
-          idx4[1]=seg.first[1];
-          idx4[2]=seg.first[2];
-          idx4[3]=0;
-
-          double w = 1;
-          int peak_id = dim_four_size-1;
+        if (!m_MaskImage->GetLargestPossibleRegion().IsInside(seg.first) || m_MaskImage->GetPixel(seg.first)==0)
+          continue;
 
-          double peak_mag = 0;
-          GetClosestPeak(idx4, m_PeakImage, fiber_dir, peak_id, w, peak_mag);
-          w *= seg.second;
+        itk::Index<4> idx4;
+        idx4[0]=seg.first[0];
+        idx4[1]=seg.first[1];
+        idx4[2]=seg.first[2];
+        idx4[3]=0;
 
-          int x = idx4[0];
-          int y = idx4[1];
-          int z = idx4[2];
+        double w = 1;
+        int peak_id = dim_four_size-1;
 
-          unsigned int linear_index = x + sz_x*y + sz_x*sz_y*z + sz_x*sz_y*sz_z*peak_id;
+        double peak_mag = 0;
+        GetClosestPeak(idx4, m_PeakImage, fiber_dir, peak_id, w, peak_mag);
+        w *= seg.second;
 
-          if (b[linear_index] == 0 && peak_id<dim_four_size-1)
-          {
-            m_NumCoveredDirections++;
-            m_MeanSignal += peak_mag;
-          }
-          m_MeanTractDensity += w;
+        int x = idx4[0];
+        int y = idx4[1];
+        int z = idx4[2];
 
-          if (m_FitIndividualFibers)
-          {
-            b[linear_index] = peak_mag;
-            A.put(linear_index, fiber_count, A.get(linear_index, fiber_count) + w);
-          }
-          else
-          {
-            b[linear_index] = peak_mag;
-            A.put(linear_index, bundle, A.get(linear_index, bundle) + w);
-          }
-        }
+        unsigned int linear_index = x + sz_x*y + sz_x*sz_y*z + sz_x*sz_y*sz_z*peak_id;
+        entries[i].push_back({linear_index, peak_mag, w});
       }
+    }
+#pragma omp critical
+    ++disp;
+  }
 
-      ++fiber_count;
+  // fiber order bookkeeping, identical to a serial assembly
+  std::vector< mitk::SparseSystemMatrix::Triplet > triplets;
+  unsigned int zero_peak_offset = sz_x*sz_y*sz_z*(dim_four_size-1);
+  for (int i=0; i<numFibers; ++i)
+  {
+    for (const SystemEntry& e : entries[i])
+    {
+      if (b[e.m_Row] == 0 && e.m_Row<zero_peak_offset)
+      {
+        m_NumCoveredDirections++;
+        m_MeanSignal += e.m_Signal;
+      }
+      m_MeanTractDensity += e.m_Density;
+      b[e.m_Row] = e.m_Signal;
+      triplets.push_back({e.m_Row, columns[i], e.m_Density});
     }
+    std::vector< SystemEntry >().swap(entries[i]);
+    ++fiber_count;
   }
+  A.SetFromTriplets(m_NumResiduals, m_NumUnknowns, triplets);
 
   if (m_NumCoveredDirections==0 || m_MeanSignal<0.0001)
     mitkThrow() << "No overlap between fibers and non-zero image!";
@@ -356,7 +396,6 @@ void FitFibersToImageFilter::CreateScalarSystem()
   MITK_INFO << "Num. residuals: " << m_NumResiduals;
   MITK_INFO << "Creating system ...";
 
-  A.set_size(m_NumResiduals, m_NumUnknowns);
   b.set_size(m_NumResiduals); b.fill(0.0);
 
   m_MeanTractDensity = 0;
@@ -364,73 +403,71 @@ void FitFibersToImageFilter::CreateScalarSystem()
   int numCoveredVoxels = 0;
   fiber_count = 0;
 
-  int numFibers = 0;
-  for (unsigned int bundle=0; bundle<m_Tractograms.size(); bundle++)
-    numFibers += m_Tractograms.at(bundle)->GetNumFibers();
+  std::vector< PointType3 > points;
+  std::vector< std::size_t > point_offsets;
+  std::vector< unsigned int > columns;
+  CopyFiberPoints(points, point_offsets, columns);
+  int numFibers = static_cast<int>(columns.size());
+
+  // m_Row: voxel index, m_Signal: image value, m_Density: segment length in the voxel
+  std::vector< std::vector< SystemEntry > > entries(numFibers);
+
   boost::timer::progress_display disp(numFibers);
-  m_GroupSizes.clear();
-  for (unsigned int bundle=0; bundle<m_Tractograms.size(); bundle++)
+#pragma omp parallel for schedule(dynamic, 16)
+  for (int i=0; i<numFibers; ++i)
   {
-    vtkSmartPointer<vtkPolyData> polydata = m_Tractograms.at(bundle)->GetFiberPolyData();
-
-    m_GroupSizes.push_back(m_Tractograms.at(bundle)->GetNumFibers());
-    for (unsigned int i=0; i<m_Tractograms.at(bundle)->GetNumFibers(); ++i)
+    for (std::size_t j=point_offsets[i]; j+1<point_offsets[i+1]; ++j)
     {
-      ++disp;
-      vtkCell* cell = polydata->GetCell(i);
-      int numPoints = cell->GetNumberOfPoints();
-      vtkPoints* points = cell->GetPoints();
-
-      for (int j=0; j<numPoints-1; ++j)
+      PointType3 startVertex = points[j];
+      itk::Index<3> startIndex;
+      itk::ContinuousIndex<float, 3> startIndexCont;
+      (void)m_ScalarImage->TransformPhysicalPointToIndex(startVertex, startIndex);
+      (void)m_ScalarImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
+
+      PointType3 endVertex = points[j+1];
+      itk::Index<3> endIndex;
+      itk::ContinuousIndex<float, 3> endIndexCont;
+      (void)m_ScalarImage->TransformPhysicalPointToIndex(endVertex, endIndex);
+      (void)m_ScalarImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
+
+      std::vector< std::pair< itk::Index<3>, double > > segments = mitk::imv::IntersectImage(spacing, startIndex, endIndex, startIndexCont, endIndexCont);
+      for (std::pair< itk::Index<3>, double > seg : segments)
       {
-        PointType3 startVertex = mitk::imv::GetItkPoint(points->GetPoint(j));
-        itk::Index<3> startIndex;
-        itk::ContinuousIndex<float, 3> startIndexCont;
-        (void)m_ScalarImage->TransformPhysicalPointToIndex(startVertex, startIndex);
-        (void)m_ScalarImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
-
-        PointType3 endVertex = mitk::imv::GetItkPoint(points->GetPoint(j+1));
-        itk::Index<3> endIndex;
-        itk::ContinuousIndex<float, 3> endIndexCont;
-        (void)m_ScalarImage->TransformPhysicalPointToIndex(endVertex, endIndex);
-        (void)m_ScalarImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
-
-        std::vector< std::pair< itk::Index<3>, double > > segments = mitk::imv::IntersectImage(spacing, startIndex, endIndex, startIndexCont, endIndexCont);
-        for (std::pair< itk::Index<3>, double > seg : segments)
-        {
-          if (!m_ScalarImage->GetLargestPossibleRegion().IsInside(seg.first) || (m_MaskImage.IsNotNull() && m_MaskImage->GetPixel(seg.first)==0))
-            continue;
-
-          float image_value = m_ScalarImage->GetPixel(seg.first);
-          int x = seg.first[0];
-          int y = seg.first[1];
-          int z = seg.first[2];
+        if (!m_ScalarImage->GetLargestPossibleRegion().IsInside(seg.first) || (m_MaskImage.IsNotNull() && m_MaskImage->GetPixel(seg.first)==0))
+          continue;
 
-          unsigned int linear_index = x + sz_x*y + sz_x*sz_y*z;
+        float image_value = m_ScalarImage->GetPixel(seg.first);
+        int x = seg.first[0];
+        int y = seg.first[1];
+        int z = seg.first[2];
 
-          if (b[linear_index] == 0)
-          {
-            numCoveredVoxels++;
-            m_MeanSignal += image_value;
-          }
-          m_MeanTractDensity += seg.second;
-
-          if (m_FitIndividualFibers)
-          {
-            b[linear_index] = image_value;
-            A.put(linear_index, fiber_count, A.get(linear_index, fiber_count) + seg.second);
-          }
-          else
-          {
-            b[linear_index] = image_value;
-            A.put(linear_index, bundle, A.get(linear_index, bundle) + seg.second);
-          }
-        }
+        unsigned int linear_index = x + sz_x*y + sz_x*sz_y*z;
+        entries[i].push_back({linear_index, image_value, seg.second});
       }
+    }
+#pragma omp critical
+    ++disp;
+  }
 
-      ++fiber_count;
+  // fiber order bookkeeping, identical to a serial assembly
+  std::vector< mitk::SparseSystemMatrix::Triplet > triplets;
+  for (int i=0; i<numFibers; ++i)
+  {
+    for (const SystemEntry& e : entries[i])
+    {
+      if (b[e.m_Row] == 0)
+      {
+        numCoveredVoxels++;
+        m_MeanSignal += e.m_Signal;
+      }
+      m_MeanTractDensity += e.m_Density;
+      b[e.m_Row] = e.m_Signal;
+      triplets.push_back({e.m_Row, columns[i], e.m_Density});
     }
+    std::vector< SystemEntry >().swap(entries[i]);
+    ++fiber_count;
   }
+  A.SetFromTriplets(m_NumResiduals, m_NumUnknowns, triplets);
 
   if (numCoveredVoxels==0 || m_MeanSignal<0.0001)
     mitkThrow() << "No overlap between fibers and non-zero image!";
@@ -473,6 +510,11 @@ void FitFibersToImageFilter::GenerateData()
   else
     mitkThrow() << "No input image set!";
 
+  MITK_INFO << "Non-zero system matrix entries: " << A.GetNumberOfNonZeros();
+  MITK_INFO << std::fixed << "System memory footprint: " << setprecision(2)
+            << (A.GetMemoryFootprint() + b.size()*sizeof(double))/(1024.0*1024.0) << " MB (matrix in CSR and CSC format: "
+            << A.GetMemoryFootprint()/(1024.0*1024.0) << " MB)";
+
   MITK_INFO << "Initializing optimizer";
   double init_lambda = fiber_count;  // initialization for lambda estimation
 
@@ -556,7 +598,7 @@ void FitFibersToImageFilter::GenerateData()
   MITK_INFO << "NumEvals: " << minimizer.get_num_evaluations();
   MITK_INFO << "NumIterations: " << minimizer.get_num_iterations();
   MITK_INFO << "Residual cost: " << minimizer.get_end_error();
-  m_RMSE = cost.S->get_rms_error(m_Weights);
+  m_RMSE = cost.get_rms_error(m_Weights);
   MITK_INFO << "Final RMSE: " << m_RMSE;
 
   clock.Stop();
@@ -586,7 +628,7 @@ void FitFibersToImageFilter::GenerateData()
 
         ++fiber_count;
       }
-      double d_rms = cost.S->get_rms_error(temp_weights) - m_RMSE;
+      double d_rms = cost.get_rms_error(temp_weights) - m_RMSE;
       m_RmsDiffPerBundle[bundle] = d_rms;
     }
   }
@@ -598,7 +640,7 @@ void FitFibersToImageFilter::GenerateData()
       temp_weights.set_size(m_Weights.size());
       temp_weights.copy_in(m_Weights.data_block());
       temp_weights[i] = 0;
-      double d_rms = cost.S->get_rms_error(temp_weights) - m_RMSE;
+      double d_rms = cost.get_rms_error(temp_weights) - m_RMSE;
       m_RmsDiffPerBundle[i] = d_rms;
 
       m_Tractograms.at(i)->SetFiberWeights(m_Weights[i]);
@@ -650,7 +692,7 @@ void FitFibersToImageFilter::GenerateOutputDiffImages()
   m_FittedImageDiff->FillBuffer(pix);
 
   vnl_vector<double> fitted_b; fitted_b.set_size(b.size());
-  cost.S->multiply(m_Weights, fitted_b);
+  A.Multiply(m_Weights, fitted_b);
 
   itk::ImageRegionIterator<VectorImgType> it1 = itk::ImageRegionIterator<VectorImgType>(m_DiffImage, m_DiffImage->GetLargestPossibleRegion());
   itk::ImageRegionIterator<VectorImgType> it2 = itk::ImageRegionIterator<VectorImgType>(m_FittedImageDiff, m_FittedImageDiff->GetLargestPossibleRegion());
@@ -741,7 +783,7 @@ void FitFibersToImageFilter::GenerateOutputScalarImages()
   m_FittedImageScalar->FillBuffer(0);
 
   vnl_vector<double> fitted_b; fitted_b.set_size(b.size());
-  cost.S->multiply(m_Weights, fitted_b);
+  A.Multiply(m_Weights, fitted_b);
 
   itk::ImageRegionIterator<DoubleImgType> it1 = itk::ImageRegionIterator<DoubleImgType>(m_ScalarImage, m_ScalarImage->GetLargestPossibleRegion());
   itk::ImageRegionIterator<DoubleImgType> it2 = itk::ImageRegionIterator<DoubleImgType>(m_FittedImageScalar, m_FittedImageScalar->GetLargestPossibleRegion());
@@ -827,7 +869,7 @@ void FitFibersToImageFilter::GenerateOutputPeakImages()
   m_FittedImage->FillBuffer(0.0);
 
   vnl_vector<double> fitted_b; fitted_b.set_size(b.size());
-  cost.S->multiply(m_Weights, fitted_b);
+  A.Multiply(m_Weights, fitted_b);
 
   for (unsigned int r=0; r<b.size(); r++)
   {
@@ -6,8 +6,7 @@
 #include <itkImageSource.h>
 #include <mitkPeakImage.h>
 #include <vnl/algo/vnl_lbfgsb.h>
-#include <vnl/vnl_sparse_matrix.h>
-#include <vnl/vnl_sparse_matrix_linear_system.h>
+#include <mitkSparseSystemMatrix.h>
 #include <itkImageDuplicator.h>
 #include <itkTimeProbe.h>
 #include <itkMersenneTwisterRandomVariateGenerator.h>
@@ -29,9 +28,7 @@ public:
     NONE
   };
 
-  vnl_sparse_matrix_linear_system< double >* S;
-  vnl_sparse_matrix< double > m_A;
-  vnl_sparse_matrix< double > m_A_Ones; // matrix indicating active weights with 1
+  const mitk::SparseSystemMatrix* m_A;  // system matrix, also defines the active weights of each row
   vnl_vector< double > m_b;
   double m_Lambda;  // regularization factor
 
@@ -40,40 +37,39 @@ public:
   REGU regularization;
   std::vector<unsigned int> group_sizes;
 
-  void SetProblem(vnl_sparse_matrix< double >& A, vnl_vector<double>& b, double lambda, REGU regu)
+  void SetProblem(const mitk::SparseSystemMatrix& A, vnl_vector<double>& b, double lambda, REGU regu)
   {
-    S = new vnl_sparse_matrix_linear_system<double>(A, b);
-    m_A = A;
+    m_A = &A;
     m_b = b;
     m_Lambda = lambda;
 
-    m_A_Ones.set_size(m_A.rows(), m_A.cols());
-    m_A.reset();
-    while (m_A.next())
-      m_A_Ones.put(m_A.getrow(), m_A.getcolumn(), 1);
-
     unsigned int N = m_b.size();
     vnl_vector<double> ones; ones.set_size(dim); ones.fill(1.0);
     row_sums.set_size(N);
-    m_A_Ones.mult(ones, row_sums);
+    m_A->MultiplyPattern(ones, row_sums);
     local_weight_means.set_size(N);
     regularization = regu;
   }
 
+  double get_rms_error(vnl_vector<double> const &x) const
+  {
+    return m_A->GetRmsError(x, m_b);
+  }
+
   void SetGroupSizes(std::vector<unsigned int> sizes)
   {
     unsigned int sum = 0;
     for (auto s : sizes)
       sum += s;
-    if (sum!=m_A.cols())
+    if (sum!=m_A->cols())
     {
-      MITK_INFO << "Group sizes do not match number of unknowns (" << sum << " vs. " << m_A.cols() << ")";
+      MITK_INFO << "Group sizes do not match number of unknowns (" << sum << " vs. " << m_A->cols() << ")";
       return;
     }
     group_sizes = sizes;
   }
 
-  VnlCostFunction(const int NumVars=0) : vnl_cost_function(NumVars)
+  VnlCostFunction(const int NumVars=0) : vnl_cost_function(NumVars), m_A(nullptr)
   {
   }
 
@@ -121,21 +117,30 @@ public:
   // Regularization: voxel-weise mean squared deaviation of weights from voxel-wise mean weight (enforce locally uniform weights)
   void regu_VoxelVariance(vnl_vector<double> const &x, double& cost)
   {
-    m_A_Ones.mult(x, local_weight_means);
+    m_A->MultiplyPattern(x, local_weight_means);
     local_weight_means = element_quotient(local_weight_means, row_sums);
 
-    m_A_Ones.reset();
-    double regu = 0;
-    while (m_A_Ones.next())
+    // row-wise partial sums, added up serially to keep the result independent of the thread count
+    const std::vector< std::size_t >& offsets = m_A->GetRowOffsets();
+    const std::vector< unsigned int >& columns = m_A->GetColumnIndices();
+    int N = static_cast<int>(m_A->rows());
+    vnl_vector<double> row_regu(N, 0);
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (int r=0; r<N; ++r)
     {
-      double d = 0;
-      if (x[m_A_Ones.getcolumn()]>local_weight_means[m_A_Ones.getrow()])
-        d = std::exp(x[m_A_Ones.getcolumn()]) - std::exp(local_weight_means[m_A_Ones.getrow()]);
-      else
-        d = x[m_A_Ones.getcolumn()] - local_weight_means[m_A_Ones.getrow()];
-      regu += d*d;
+      double regu = 0;
+      for (std::size_t e=offsets[r]; e<offsets[r+1]; ++e)
+      {
+        double d = 0;
+        if (x[columns[e]]>local_weight_means[r])
+          d = std::exp(x[columns[e]]) - std::exp(local_weight_means[r]);
+        else
+          d = x[columns[e]] - local_weight_means[r];
+        regu += d*d;
+      }
+      row_regu[r] = regu;
     }
-    cost += m_Lambda*regu/dim;
+    cost += m_Lambda*row_regu.sum()/dim;
   }
 
   // Regularization: group Lasso: sum_g(lambda_g * ||x_g||_2)
@@ -195,23 +200,27 @@ public:
 
   void grad_regu_VoxelVariance(vnl_vector<double> const &x, vnl_vector<double> &dx)
   {
-    m_A_Ones.mult(x, local_weight_means);
+    m_A->MultiplyPattern(x, local_weight_means);
     local_weight_means = element_quotient(local_weight_means, row_sums);
 
     vnl_vector<double> exp_x = x.apply(std::exp);
     vnl_vector<double> exp_means = local_weight_means.apply(std::exp);
 
+    // column-wise using the CSC pattern, each entry of tdx is written by one thread
+    const std::vector< std::size_t >& offsets = m_A->GetColumnOffsets();
+    const std::vector< unsigned int >& rows = m_A->GetRowIndices();
     vnl_vector<double> tdx(dim, 0);
-    m_A_Ones.reset();
-    while (m_A_Ones.next())
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int c=0; c<dim; ++c)
     {
-      int c = m_A_Ones.getcolumn();
-      int r = m_A_Ones.getrow();
-
-      if (x[c]>local_weight_means[r])
-        tdx[c] += exp_x[c] * ( exp_x[c] - exp_means[r] );
-      else
-        tdx[c] += x[c] - local_weight_means[r];
+      for (std::size_t e=offsets[c]; e<offsets[c+1]; ++e)
+      {
+        unsigned int r = rows[e];
+        if (x[c]>local_weight_means[r])
+          tdx[c] += exp_x[c] * ( exp_x[c] - exp_means[r] );
+        else
+          tdx[c] += x[c] - local_weight_means[r];
+      }
     }
     dx += tdx*2.0*m_Lambda/dim;
   }
@@ -275,7 +284,7 @@ public:
     // RMS error
     unsigned int N = m_b.size();
     vnl_vector<double> d; d.set_size(N);
-    S->multiply(x,d);
+    m_A->Multiply(x,d);
     double cost = (d - m_b).squared_magnitude()/N;
 
     // regularize
@@ -292,12 +301,12 @@ public:
 
     // calculate output difference d
     vnl_vector<double> d; d.set_size(N);
-    S->multiply(x,d);
+    m_A->Multiply(x,d);
     d -= m_b;
 
     // (f(u(x)))' = f'(u(x)) * u'(x)
     // d/dx_j = 1/N * Sum_i A_i,j * 2*(A_i,j * x_j - b_i)
-    S->transpose_multiply(d, dx);
+    m_A->TransposeMultiply(d, dx);
     dx *= 2.0/N;
 
     calc_regularization_gradient(x,dx);
@@ -394,9 +403,19 @@ public:
 
 protected:
 
+  /** Contribution of one fiber segment to a residual, collected in parallel and added to the system in fiber order. */
+  struct SystemEntry
+  {
+    unsigned int  m_Row;
+    double        m_Signal;
+    double        m_Density;
+  };
+
   FitFibersToImageFilter();
   virtual ~FitFibersToImageFilter();
 
+  void CopyFiberPoints(std::vector< PointType3 >& points, std::vector< std::size_t >& offsets, std::vector< unsigned int >& columns);
+
   void GetClosestPeak(itk::Index<4> idx, PeakImgType::Pointer m_PeakImage , vnl_vector_fixed<float,3> fiber_dir, int& id, double& w, double& peak_mag );
 
   void CreatePeakSystem();
@@ -450,7 +469,7 @@ protected:
 
   mitk::DiffusionSignalModel<>*               m_SignalModel;
 
-  vnl_sparse_matrix<double>                   A;
+  mitk::SparseSystemMatrix                    A;
   vnl_vector<double>                          b;
   VnlCostFunction                             cost;
   unsigned int                                sz_x;
@@ -42,6 +42,10 @@ namespace itk {
     , m_SpikesPerSlice(0)
     , m_IsBaseline(true)
     , m_StoreTimings(false)
+    , m_UseSeparableDft(true)
+    , m_SeparableDft(false)
+    , m_NumDftCompartments(0)
+    , m_NumDftParities(1)
   {
     m_DiffusionGradientDirection.Fill(0.0);
     m_CoilPosition.Fill(0.0);
@@ -72,6 +76,29 @@ namespace itk {
     yMaxFov_half = (yMaxFov-1)/2;
     numPix = kxMax*kyMax;
 
+    // precalculate shifts for DFT
+    x_shift = 0;
+    y_shift = 0;
+    if (static_cast<int>(xMax)%2==1)
+        x_shift = (xMax-1)/2;
+    else
+        x_shift = xMax/2;
+    if (static_cast<int>(yMax)%2==1)
+        y_shift = (yMax-1)/2;
+    else
+        y_shift = yMax/2;
+
+    kx_shift = 0;
+    ky_shift = 0;
+    if (static_cast<int>(kxMax)%2==1)
+        kx_shift = (kxMax-1)/2;
+    else
+        kx_shift = kxMax/2;
+    if (static_cast<int>(kyMax)%2==1)
+        ky_shift = (kyMax-1)/2;
+    else
+        ky_shift = kyMax/2;
+
     float ringing_factor = static_cast<float>(m_Parameters->m_SignalGen.m_ZeroRinging)/100.0;
     ringing_lines_x = static_cast<int>(ceil(kxMax/2 * ringing_factor));
     ringing_lines_y = static_cast<int>(ceil(kyMax/2 * ringing_factor));
@@ -235,6 +262,105 @@ namespace itk {
 
         m_T1Relax.push_back(relaxation);
       }
+
+    // eddy currents and off-resonance frequencies add a phase that depends on position and time and is not separable
+    bool eddy = m_Parameters->m_Misc.m_DoAddEddyCurrents && m_Parameters->m_SignalGen.m_EddyStrength>0 && !m_IsBaseline;
+    bool fmap = m_Parameters->m_Misc.m_DoAddDistortions && (m_MovedFmap.IsNotNull() || m_Parameters->m_SignalGen.m_FrequencyMap.IsNotNull());
+    m_SeparableDft = m_UseSeparableDft && !eddy && !fmap;
+    if (m_SeparableDft)
+      PrecomputeSeparableDft();
+  }
+
+  template< class ScalarType >
+  void KspaceImageFilter< ScalarType >::PrecomputeSeparableDft()
+  {
+    const int nx = static_cast<int>(xMax);
+    const int ny = static_cast<int>(yMax);
+    const int nkx = static_cast<int>(kxMax);
+    const int nky = static_cast<int>(kyMax);
+
+    // relaxation is applied per compartment and readout time, otherwise the compartments can be summed up front
+    m_NumDftCompartments = m_Parameters->m_SignalGen.m_DoSimulateRelaxation ? m_CompartmentImages.size() : 1;
+    m_NumDftParities = m_Parameters->m_Misc.m_DoAddGhosts ? 2 : 1;
+
+    // weighted pixel values per compartment (coil sensitivity and signal scale)
+    std::vector< ScalarType > pixels(m_NumDftCompartments*nx*ny, 0);
+    typename InputImageType::IndexType input_idx;
+    for (int y=0; y<ny; ++y)
+      for (int x=0; x<nx; ++x)
+      {
+        input_idx[0] = x; input_idx[1] = y;
+
+        for (unsigned int i=0; i<m_CompartmentImages.size(); i++)
+          pixels[(m_NumDftCompartments>1 ? i : 0)*nx*ny + y*nx + x] += m_CompartmentImages[i]->GetPixel(input_idx);
+
+        float sens = 1;
+        if (m_Parameters->m_SignalGen.m_CoilSensitivityProfile!=SignalGenerationParameters::COIL_CONSTANT)
+        {
+          VectorType pos;
+          pos[0] = x - x_shift; pos[1] = y - y_shift; pos[2] = m_Z;
+          pos = m_Transform*pos;
+          sens = CoilSensitivity(pos);
+        }
+
+        for (unsigned int i=0; i<m_NumDftCompartments; i++)
+          pixels[i*nx*ny + y*nx + x] *= sens * m_Parameters->m_SignalGen.m_SignalScale;
+      }
+
+    // x twiddle factors, one set per line parity if ghosts shift the readout lines
+    std::vector< std::complex<ScalarType> > row_twiddles(m_NumDftParities*nkx*nx);
+    for (unsigned int p=0; p<m_NumDftParities; ++p)
+      for (int k=0; k<nkx; ++k)
+      {
+        float kx = k - kx_shift;
+        if (m_Parameters->m_Misc.m_DoAddGhosts)
+        {
+          if (p == 1)
+            kx -= m_Parameters->m_SignalGen.m_KspaceLineOffset;
+          else
+            kx += m_Parameters->m_SignalGen.m_KspaceLineOffset;
+        }
+        kx /= xMax;
+        for (int x=0; x<nx; ++x)
+          row_twiddles[(p*nkx + k)*nx + x] = std::exp( std::complex<ScalarType>(0, itk::Math::twopi * (kx*(x - x_shift))) );
+      }
+
+    // y twiddle factors, signal from outside the FOV is wrapped back (aliasing)
+    m_ColTwiddles.resize(nky*ny);
+    for (int k=0; k<nky; ++k)
+    {
+      float ky = (k - ky_shift)/yMaxFov;
+      for (int yi=0; yi<ny; ++yi)
+      {
+        float y = yi - y_shift;
+        if (m_Parameters->m_Misc.m_DoAddAliasing)
+        {
+          if (y<-yMaxFov_half)
+            y += yMaxFov;
+          else if (y>yMaxFov_half)
+            y -= yMaxFov;
+        }
+        m_ColTwiddles[k*ny + yi] = std::exp( std::complex<ScalarType>(0, itk::Math::twopi * (ky*y)) );
+      }
+    }
+
+    // transform all rows in x
+    m_RowDft.assign(m_NumDftCompartments*m_NumDftParities*nkx*ny, std::complex<ScalarType>(0,0));
+    for (unsigned int i=0; i<m_NumDftCompartments; ++i)
+      for (unsigned int p=0; p<m_NumDftParities; ++p)
+        for (int k=0; k<nkx; ++k)
+        {
+          const std::complex<ScalarType>* tw = row_twiddles.data() + (p*nkx + k)*nx;
+          std::complex<ScalarType>* out = m_RowDft.data() + ((i*m_NumDftParities + p)*nkx + k)*ny;
+          for (int y=0; y<ny; ++y)
+          {
+            const ScalarType* row = pixels.data() + i*nx*ny + y*nx;
+            std::complex<ScalarType> sum(0,0);
+            for (int x=0; x<nx; ++x)
+              sum += row[x] * tw[x];
+            out[y] = sum;
+          }
+        }
   }
 
   template< class ScalarType >
@@ -276,29 +402,6 @@ namespace itk {
     ImageRegionIterator< OutputImageType > oit(outputImage, outputRegionForThread);
     typedef ImageRegionConstIterator< InputImageType > InputIteratorType;
 
-    // precalculate shifts for DFT
-    float x_shift = 0;
-    float y_shift = 0;
-    if (static_cast<int>(xMax)%2==1)
-        x_shift = (xMax-1)/2;
-    else
-        x_shift = xMax/2;
-    if (static_cast<int>(yMax)%2==1)
-        y_shift = (yMax-1)/2;
-    else
-        y_shift = yMax/2;
-
-    float kx_shift = 0;
-    float ky_shift = 0;
-    if (static_cast<int>(kxMax)%2==1)
-        kx_shift = (kxMax-1)/2;
-    else
-        kx_shift = kxMax/2;
-    if (static_cast<int>(kyMax)%2==1)
-        ky_shift = (kyMax-1)/2;
-    else
-        ky_shift = kyMax/2;
-
     std::complex<ScalarType> zero = std::complex<ScalarType>(0, 0);
     while( !oit.IsAtEnd() )
     {
@@ -390,70 +493,90 @@ namespace itk {
 
       // calculate signal s at k-space position (kx, ky)
       std::complex<ScalarType> s(0,0);
-      InputIteratorType it(m_CompartmentImages[0], m_CompartmentImages[0]->GetLargestPossibleRegion() );
-      while( !it.IsAtEnd() )
+      if (m_SeparableDft)
       {
-        typename InputImageType::IndexType input_idx = it.GetIndex();
-
-        // shift x,y for DFT: (0 -- N) --> (-N/2 -- N/2)
-        float x = input_idx[0] - x_shift;
-        float y = input_idx[1] - y_shift;
-
-        // sum compartment signals and simulate relaxation
-        ScalarType f_real = 0;
-        for (unsigned int i=0; i<m_CompartmentImages.size(); i++)
-          if ( m_Parameters->m_SignalGen.m_DoSimulateRelaxation)
-            f_real += m_CompartmentImages[i]->GetPixel(input_idx) * relaxFactor[i];
-          else
-            f_real += m_CompartmentImages[i]->GetPixel(input_idx);
-
-        // vector from image center to current position (in meter)
-        // only necessary for eddy currents and non-constant coil sensitivity
-        VectorType pos;
-        if ((m_Parameters->m_Misc.m_DoAddEddyCurrents && m_Parameters->m_SignalGen.m_EddyStrength>0 && !m_IsBaseline) ||
-            m_Parameters->m_SignalGen.m_CoilSensitivityProfile!=SignalGenerationParameters::COIL_CONSTANT)
+        // transform the precomputed row transforms in y
+        const int ny = static_cast<int>(yMax);
+        const unsigned int parity = (m_NumDftParities>1 && kIdx[1]%2 == 1) ? 1 : 0;
+        const std::complex<ScalarType>* tw = m_ColTwiddles.data() + kIdx[1]*ny;
+        for (unsigned int i=0; i<m_NumDftCompartments; i++)
         {
-          pos[0] = x; pos[1] = y; pos[2] = m_Z;
-          pos = m_Transform*pos;
+          const std::complex<ScalarType>* col = m_RowDft.data() + ((i*m_NumDftParities + parity)*static_cast<int>(kxMax) + kIdx[0])*ny;
+          std::complex<ScalarType> si(0,0);
+          for (int y=0; y<ny; ++y)
+            si += col[y] * tw[y];
+          if ( m_Parameters->m_SignalGen.m_DoSimulateRelaxation)
+            si *= relaxFactor[i];
+          s += si;
         }
+      }
+      else
+      {
+        InputIteratorType it(m_CompartmentImages[0], m_CompartmentImages[0]->GetLargestPossibleRegion() );
+        while( !it.IsAtEnd() )
+        {
+          typename InputImageType::IndexType input_idx = it.GetIndex();
+
+          // shift x,y for DFT: (0 -- N) --> (-N/2 -- N/2)
+          float x = input_idx[0] - x_shift;
+          float y = input_idx[1] - y_shift;
+
+          // sum compartment signals and simulate relaxation
+          ScalarType f_real = 0;
+          for (unsigned int i=0; i<m_CompartmentImages.size(); i++)
+            if ( m_Parameters->m_SignalGen.m_DoSimulateRelaxation)
+              f_real += m_CompartmentImages[i]->GetPixel(input_idx) * relaxFactor[i];
+            else
+              f_real += m_CompartmentImages[i]->GetPixel(input_idx);
+
+          // vector from image center to current position (in meter)
+          // only necessary for eddy currents and non-constant coil sensitivity
+          VectorType pos;
+          if ((m_Parameters->m_Misc.m_DoAddEddyCurrents && m_Parameters->m_SignalGen.m_EddyStrength>0 && !m_IsBaseline) ||
+              m_Parameters->m_SignalGen.m_CoilSensitivityProfile!=SignalGenerationParameters::COIL_CONSTANT)
+          {
+            pos[0] = x; pos[1] = y; pos[2] = m_Z;
+            pos = m_Transform*pos;
+          }
 
-        if (m_Parameters->m_SignalGen.m_CoilSensitivityProfile!=SignalGenerationParameters::COIL_CONSTANT)
-          f_real *= CoilSensitivity(pos);
+          if (m_Parameters->m_SignalGen.m_CoilSensitivityProfile!=SignalGenerationParameters::COIL_CONSTANT)
+            f_real *= CoilSensitivity(pos);
 
-        // simulate eddy currents and other distortions
-        float phi = 0;   // phase shift
-        if (  m_Parameters->m_Misc.m_DoAddEddyCurrents && m_Parameters->m_SignalGen.m_EddyStrength>0 && !m_IsBaseline)
-        {
-          // duration (tRead) already included in "eddyDecay"
-          phi += (m_DiffusionGradientDirection[0]*pos[0]+m_DiffusionGradientDirection[1]*pos[1]+m_DiffusionGradientDirection[2]*pos[2]) * eddyDecay;
-        }
+          // simulate eddy currents and other distortions
+          float phi = 0;   // phase shift
+          if (  m_Parameters->m_Misc.m_DoAddEddyCurrents && m_Parameters->m_SignalGen.m_EddyStrength>0 && !m_IsBaseline)
+          {
+            // duration (tRead) already included in "eddyDecay"
+            phi += (m_DiffusionGradientDirection[0]*pos[0]+m_DiffusionGradientDirection[1]*pos[1]+m_DiffusionGradientDirection[2]*pos[2]) * eddyDecay;
+          }
 
-        // simulate distortions
-        if (m_Parameters->m_Misc.m_DoAddDistortions)
-        {
-          if (m_MovedFmap.IsNotNull())    // if we have headmotion, use moved map
-            phi += m_MovedFmap->GetPixel(input_idx) * t;
-          else if (m_Parameters->m_SignalGen.m_FrequencyMap.IsNotNull())
+          // simulate distortions
+          if (m_Parameters->m_Misc.m_DoAddDistortions)
           {
-            itk::Image<float, 3>::IndexType index; index[0] = input_idx[0]; index[1] = input_idx[1]; index[2] = m_Zidx;
-            phi += m_Parameters->m_SignalGen.m_FrequencyMap->GetPixel(index) * t;
+            if (m_MovedFmap.IsNotNull())    // if we have headmotion, use moved map
+              phi += m_MovedFmap->GetPixel(input_idx) * t;
+            else if (m_Parameters->m_SignalGen.m_FrequencyMap.IsNotNull())
+            {
+              itk::Image<float, 3>::IndexType index; index[0] = input_idx[0]; index[1] = input_idx[1]; index[2] = m_Zidx;
+              phi += m_Parameters->m_SignalGen.m_FrequencyMap->GetPixel(index) * t;
+            }
           }
-        }
 
-        // if signal comes from outside FOV, mirror it back (wrap-around artifact - aliasing
-        if (m_Parameters->m_Misc.m_DoAddAliasing)
-        {
-          if (y<-yMaxFov_half)
-            y += yMaxFov;
-          else if (y>yMaxFov_half)
-            y -= yMaxFov;
-        }
+          // if signal comes from outside FOV, mirror it back (wrap-around artifact - aliasing
+          if (m_Parameters->m_Misc.m_DoAddAliasing)
+          {
+            if (y<-yMaxFov_half)
+              y += yMaxFov;
+            else if (y>yMaxFov_half)
+              y -= yMaxFov;
+          }
 
-        // actual DFT term
-        std::complex<ScalarType> f(f_real * m_Parameters->m_SignalGen.m_SignalScale, 0);
-        s += f * std::exp( std::complex<ScalarType>(0, itk::Math::twopi * (kx*x + ky*y + phi )) );
+          // actual DFT term
+          std::complex<ScalarType> f(f_real * m_Parameters->m_SignalGen.m_SignalScale, 0);
+          s += f * std::exp( std::complex<ScalarType>(0, itk::Math::twopi * (kx*x + ky*y + phi )) );
 
-        ++it;
+          ++it;
+        }
       }
       s /= numPix;
 
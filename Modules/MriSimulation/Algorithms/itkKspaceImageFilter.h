@@ -40,7 +40,9 @@ namespace itk{
 * - Image distortions (off-frequency effects)
 * - Gibbs ringing
 * - Eddy current effects
-* Based on a discrete fourier transformation.
+* Based on a discrete fourier transformation. If no eddy currents and no off-resonance frequency map are simulated, the
+* phase term of the transform is separable in x and y and the transform is evaluated as row-column DFT with precomputed
+* twiddle factors (O(N^3) per slice instead of O(N^4)). The exact sum is used otherwise or if UseSeparableDft is off.
 * See "Fiberfox: Facilitating the creation of realistic white matter software phantoms" (DOI: 10.1002/mrm.25045) for details.
 */
 
@@ -78,6 +80,7 @@ namespace itk{
     itkSetMacro( RotationMatrix, MatrixType )
     itkSetMacro( Zidx, int )
     itkSetMacro( StoreTimings, bool )
+    itkSetMacro( UseSeparableDft, bool )            ///< Use the separable DFT if the simulated effects allow it (default). Set to false to always evaluate the exact sum.
     itkSetMacro( FiberBundle, FiberBundle::Pointer )
     itkSetMacro( CoilPosition, VectorType )
     itkGetMacro( KSpaceImage, typename InputImageType::Pointer )    ///< k-space magnitude image
@@ -98,6 +101,9 @@ namespace itk{
 
     float CoilSensitivity(VectorType& pos);
 
+    /** Computes the x-transform of each compartment image row and the y twiddle factors used by the separable DFT. */
+    void PrecomputeSeparableDft();
+
     void BeforeThreadedGenerateData() override;
     void DynamicThreadedGenerateData( const OutputImageRegionType &outputRegionForThread) override;
     void AfterThreadedGenerateData() override;
@@ -143,8 +149,19 @@ namespace itk{
     float                                   yMaxFov;
     float                                   yMaxFov_half;
     float                                   numPix;
+    float                                   x_shift;
+    float                                   y_shift;
+    float                                   kx_shift;
+    float                                   ky_shift;
     bool                                    m_StoreTimings;
 
+    bool                                    m_UseSeparableDft;
+    bool                                    m_SeparableDft;   ///< separable DFT is used for the current slice
+    unsigned int                            m_NumDftCompartments;
+    unsigned int                            m_NumDftParities; ///< two sets of kx positions if ghosts are simulated (odd/even lines)
+    std::vector< std::complex<ScalarType> > m_RowDft;         ///< [compartment][parity][kx][y]
+    std::vector< std::complex<ScalarType> > m_ColTwiddles;    ///< [ky][y]
+
   private:
 
   };
@@ -64,6 +64,8 @@ template< class PixelType >
 TractsToDWIImageFilter< PixelType >::TractsToDWIImageFilter()
   : m_StatusText("")
   , m_UseConstantRandSeed(false)
+  , m_UseSeparableDft(true)
+  , m_FibersMoved(true)
   , m_RandGen(itk::Statistics::MersenneTwisterRandomVariateGenerator::New())
 {
   m_DoubleInterpolator = itk::LinearInterpolateImageFunction< ItkDoubleImgType, float >::New();
@@ -271,6 +273,7 @@ SimulateKspaceAcquisition( std::vector< DoubleDwiType::Pointer >& compartment_im
         idft->SetRotationMatrix(m_RotationsInv.at(g));
         idft->SetDiffusionGradientDirection(m_Parameters.m_SignalGen.GetGradientDirection(g)*m_Parameters.m_SignalGen.GetBvalue()/1000.0);
         idft->SetSpikesPerSlice(numSpikes);
+        idft->SetUseSeparableDft(m_UseSeparableDft);
         idft->SetNumberOfWorkUnits(in_threads);
 #pragma omp critical
         if (output_timing)
@@ -880,6 +883,7 @@ void TractsToDWIImageFilter< PixelType >::InitializeFiberData()
 
   // a second fiber bundle is needed to store the transformed version of the m_FiberBundleWorkingCopy
   m_FiberBundleTransformed = m_FiberBundle->GetDeepCopy();
+  m_FibersMoved = true;
 }
 
 
@@ -1039,112 +1043,73 @@ void TractsToDWIImageFilter< PixelType >::GenerateData()
       if (this->GetAbortGenerateData())
         continue;
 
-      vtkPolyData* fiberPolyData = m_FiberBundleTransformed->GetFiberPolyData();
       // generate fiber signal (if there are any fiber models present)
       if (!m_Parameters.m_FiberModelList.empty())
       {
-        std::vector< double* > buffers;
-        for (unsigned int i=0; i<m_CompartmentImages.size(); ++i)
-          buffers.push_back(m_CompartmentImages.at(i)->GetBufferPointer());
-#pragma omp parallel for
-        for( int i=0; i<numFibers; ++i )
+        // fiber segment to voxel intersections only change if the fibers moved
+        if (m_FibersMoved)
         {
-          if (this->GetAbortGenerateData())
-            continue;
-
-          float fiberWeight = m_FiberBundleTransformed->GetFiberWeight(i);
-          if (fiberWeight == 0)
-            continue;
+          BuildSegmentVoxelTable();
+          m_FibersMoved = false;
+        }
+        const SegmentVoxelTable& table = m_SegmentVoxelTable;
+        int numSegments = static_cast<int>(table.m_Volumes.size());
+        int numVoxels = static_cast<int>(table.m_Voxels.size());
 
-          int numPoints = -1;
-          std::vector< itk::Vector<double, 3> > points_copy;
-#pragma omp critical
+        // signal of each segment and fiber compartment, each model evaluates all segment directions in one batch
+        std::vector< std::vector< double > > segmentSignals(numFiberCompartments, std::vector< double >(numSegments, 0.0));
+        for (int k=0; k<numFiberCompartments && !this->GetAbortGenerateData(); ++k)
+        {
+          double* signal = segmentSignals[k].data();
+          m_Parameters.m_FiberModelList[k]->SimulateMeasurement(g, table.m_Directions.data(), numSegments, signal);
+#pragma omp parallel for
+          for( int j=0; j<numSegments; ++j )
           {
-            vtkCell* cell = fiberPolyData->GetCell(i);
-            numPoints = cell->GetNumberOfPoints();
-            vtkPoints* points = cell->GetPoints();
-            for (int j=0; j<numPoints; j++)
-              points_copy.push_back(GetItkVector(points->GetPoint(j)));
+            if (table.m_Volumes[j]<=0 || this->GetAbortGenerateData())
+              signal[j] = 0;
+            else
+              signal[j] *= table.m_Volumes[j];
           }
+        }
 
-          if (numPoints<2)
-            continue;
-
-          double seg_volume = fiberWeight*itk::Math::pi*m_mmRadius*m_mmRadius;
-          for( int j=0; j<numPoints - 1; ++j)
+        // gather the signal per voxel, each voxel is written by exactly one thread
+        std::vector< double* > buffers;
+        for (unsigned int i=0; i<m_CompartmentImages.size(); ++i)
+          buffers.push_back(m_CompartmentImages.at(i)->GetBufferPointer());
+#pragma omp parallel
+        {
+          double threadMaxVolume = 0;
+#pragma omp for
+          for( int v=0; v<numVoxels; ++v )
           {
-            if (this->GetAbortGenerateData())
-            {
-              j=numPoints;
-              continue;
-            }
-
-            itk::Vector<double> v = points_copy.at(j);
-
-            itk::Vector<double, 3> dir = points_copy.at(j+1)-v;
-            if ( dir.GetSquaredNorm()<0.0001 || dir[0]!=dir[0] || dir[1]!=dir[1] || dir[2]!=dir[2] )
-              continue;
-            dir.Normalize();
-
-            auto tmp = points_copy.at(j);
-            itk::Point<float, 3> startVertex;
-            startVertex[0] = tmp[0]; startVertex[1] = tmp[1]; startVertex[2] = tmp[2];
-            itk::Index<3> startIndex;
-            itk::ContinuousIndex<float, 3> startIndexCont;
-            (void)m_TransformedMaskImage->TransformPhysicalPointToIndex(startVertex, startIndex);
-            (void)m_TransformedMaskImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
-
-            tmp = points_copy.at(j+1);
-            itk::Point<float, 3> endVertex;
-            endVertex[0] = tmp[0]; endVertex[1] = tmp[1]; endVertex[2] = tmp[2];
-            itk::Index<3> endIndex;
-            itk::ContinuousIndex<float, 3> endIndexCont;
-            (void)m_TransformedMaskImage->TransformPhysicalPointToIndex(endVertex, endIndex);
-            (void)m_TransformedMaskImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
-
-            std::vector< std::pair< itk::Index<3>, double > > segments = mitk::imv::IntersectImage(m_WorkingSpacing, startIndex, endIndex, startIndexCont, endIndexCont);
-
-            // generate signal for each fiber compartment
+            unsigned int voxel = table.m_Voxels[v];
             for (int k=0; k<numFiberCompartments; ++k)
             {
-              double signal_add = m_Parameters.m_FiberModelList[k]->SimulateMeasurement(g, dir)*seg_volume;
-              for (std::pair< itk::Index<3>, double > seg : segments)
-              {
-                if (!m_TransformedMaskImage->GetLargestPossibleRegion().IsInside(seg.first) || m_TransformedMaskImage->GetPixel(seg.first)<=0)
-                  continue;
-
-                double seg_signal = seg.second*signal_add;
-
-                unsigned int linear_index = g + num_gradients*seg.first[0] + num_gradients*image_size_x*seg.first[1] + num_gradients*image_size_x*region_size_y*seg.first[2];
-
-                // update dMRI volume
-#pragma omp atomic
-                buffers[k][linear_index] += seg_signal;
-
-                // update fiber volume image
-                if (k==0)
-                {
-                  linear_index = seg.first[0] + image_size_x*seg.first[1] + image_size_x*region_size_y*seg.first[2];
-#pragma omp atomic
-                  intraAxBuffer[linear_index] += seg.second*seg_volume;
-                  double vol = intraAxBuffer[linear_index];
-                  if (vol>maxVolume) { maxVolume = vol; }
-                }
-              }
-
+              double signal = 0;
+              for (std::size_t e=table.m_Offsets[v]; e<table.m_Offsets[v+1]; ++e)
+                signal += table.m_Lengths[e]*segmentSignals[k][table.m_Segments[e]];
+              buffers[k][g + num_gradients*static_cast<std::size_t>(voxel)] += signal;
             }
-          }
 
-#pragma omp critical
-          {
-            // progress report
-            ++disp;
-            unsigned long newTick = 50*disp.count()/disp.expected_count();
-            for (unsigned int tick = 0; tick<(newTick-lastTick); ++tick)
-              PrintToLog("*", false, false, false);
-            lastTick = newTick;
+            // update fiber volume image
+            double volume = 0;
+            for (std::size_t e=table.m_Offsets[v]; e<table.m_Offsets[v+1]; ++e)
+              volume += table.m_Lengths[e]*table.m_Volumes[table.m_Segments[e]];
+            intraAxBuffer[voxel] += volume;
+            if (intraAxBuffer[voxel]>threadMaxVolume)
+              threadMaxVolume = intraAxBuffer[voxel];
           }
+#pragma omp critical
+          if (threadMaxVolume>maxVolume)
+            maxVolume = threadMaxVolume;
         }
+
+        // progress report
+        disp += numFibers;
+        unsigned long newTick = 50*disp.count()/disp.expected_count();
+        for (unsigned int tick = 0; tick<(newTick-lastTick); ++tick)
+          PrintToLog("*", false, false, false);
+        lastTick = newTick;
       }
 
       // axon radius not manually defined --> set fullest voxel (maxVolume) to full fiber voxel
@@ -1154,6 +1119,26 @@ void TractsToDWIImageFilter< PixelType >::GenerateData()
 
       // generate non-fiber signal
       ImageRegionIterator<ItkUcharImgType> it3(m_TransformedMaskImage, m_TransformedMaskImage->GetLargestPossibleRegion());
+
+      // With partial volume effects every mask voxel contains every non-fiber compartment, so each model evaluates
+      // all mask voxels of this gradient in one batch (in voxel order, as the random draws of the per-voxel calls).
+      // Otherwise only the largest compartment of a voxel is simulated and SimulateExtraAxonalSignal calls the model.
+      m_NonFiberSignals.clear();
+      if (!m_Parameters.m_SignalGen.m_DoDisablePartialVolume)
+      {
+        unsigned int numMaskVoxels = 0;
+        for (; !it3.IsAtEnd(); ++it3)
+          if (it3.Get()>0)
+            ++numMaskVoxels;
+        it3.GoToBegin();
+
+        std::vector< itk::Vector<double, 3> > nullDirs(numMaskVoxels, m_NullDir);
+        m_NonFiberSignals.resize(numNonFiberCompartments, std::vector< double >(numMaskVoxels, 0.0));
+        for (int i=0; i<numNonFiberCompartments; ++i)
+          m_Parameters.m_NonFiberModelList[i]->SimulateMeasurement(g, nullDirs.data(), numMaskVoxels, m_NonFiberSignals[i].data());
+      }
+
+      unsigned int maskVoxel = 0;
       while(!it3.IsAtEnd())
       {
         if (it3.Get()>0)
@@ -1185,7 +1170,7 @@ void TractsToDWIImageFilter< PixelType >::GenerateData()
               DoubleDwiType::PixelType pix = m_CompartmentImages.at(0)->GetPixel(index);
               pix[g] = 0;
               m_CompartmentImages.at(0)->SetPixel(index, pix);
-              SimulateExtraAxonalSignal(index, volume_fraction_point, 0, g);
+              SimulateExtraAxonalSignal(index, volume_fraction_point, 0, g, maskVoxel);
             }
           }
           else
@@ -1243,8 +1228,9 @@ void TractsToDWIImageFilter< PixelType >::GenerateData()
             iAxVolume = density_correction_voxel*iAxVolume; // new intra-axonal volume = old intra-axonal volume * correction factor
 
             // simulate other compartments
-            SimulateExtraAxonalSignal(index, volume_fraction_point, iAxVolume, g);
+            SimulateExtraAxonalSignal(index, volume_fraction_point, iAxVolume, g, maskVoxel);
           }
+          ++maskVoxel;
         }
         ++it3;
       }
@@ -1452,6 +1438,104 @@ void TractsToDWIImageFilter< PixelType >::PrintToLog(std::string m, bool addTime
     m_Logfile.flush();
 }
 
+template< class PixelType >
+void TractsToDWIImageFilter< PixelType >::BuildSegmentVoxelTable()
+{
+  typedef std::pair< unsigned int, double > VoxelLength;
+
+  // the flat point view can be read concurrently, vtk cell access is not thread safe
+  const mitk::FiberBundle::FiberPointView& view = m_FiberBundleTransformed->GetFiberPointView();
+  int numFibers = m_FiberBundleTransformed->GetNumFibers();
+  const std::vector< std::size_t >& pointOffsets = view.m_Offsets;
+  std::vector< itk::Vector<double, 3> > points(view.m_PointIds.size());
+#pragma omp parallel for
+  for (int k=0; k<static_cast<int>(points.size()); ++k)
+  {
+    points[k][0] = view.m_Points[3*k];
+    points[k][1] = view.m_Points[3*k+1];
+    points[k][2] = view.m_Points[3*k+2];
+  }
+
+  SegmentVoxelTable& table = m_SegmentVoxelTable;
+  table.m_Directions.assign(points.size(), itk::Vector<double, 3>(0.0));
+  table.m_Volumes.assign(points.size(), 0.0);
+
+  unsigned int image_size_x = m_WorkingImageRegion.GetSize(0);
+  unsigned int region_size_y = m_WorkingImageRegion.GetSize(1);
+  std::vector< std::vector< VoxelLength > > intersections(points.size());
+
+#pragma omp parallel for schedule(dynamic, 16)
+  for( int i=0; i<numFibers; ++i )
+  {
+    float fiberWeight = m_FiberBundleTransformed->GetFiberWeight(i);
+    if (fiberWeight == 0 || pointOffsets[i+1]-pointOffsets[i]<2)
+      continue;
+
+    double seg_volume = fiberWeight*itk::Math::pi*m_mmRadius*m_mmRadius;
+    for( std::size_t j=pointOffsets[i]; j<pointOffsets[i+1]-1; ++j)
+    {
+      itk::Vector<double, 3> dir = points[j+1]-points[j];
+      if ( dir.GetSquaredNorm()<0.0001 || dir[0]!=dir[0] || dir[1]!=dir[1] || dir[2]!=dir[2] )
+        continue;
+      dir.Normalize();
+      table.m_Directions[j] = dir;
+      table.m_Volumes[j] = seg_volume;
+
+      itk::Point<float, 3> startVertex;
+      startVertex[0] = points[j][0]; startVertex[1] = points[j][1]; startVertex[2] = points[j][2];
+      itk::Index<3> startIndex;
+      itk::ContinuousIndex<float, 3> startIndexCont;
+      (void)m_TransformedMaskImage->TransformPhysicalPointToIndex(startVertex, startIndex);
+      (void)m_TransformedMaskImage->TransformPhysicalPointToContinuousIndex(startVertex, startIndexCont);
+
+      itk::Point<float, 3> endVertex;
+      endVertex[0] = points[j+1][0]; endVertex[1] = points[j+1][1]; endVertex[2] = points[j+1][2];
+      itk::Index<3> endIndex;
+      itk::ContinuousIndex<float, 3> endIndexCont;
+      (void)m_TransformedMaskImage->TransformPhysicalPointToIndex(endVertex, endIndex);
+      (void)m_TransformedMaskImage->TransformPhysicalPointToContinuousIndex(endVertex, endIndexCont);
+
+      std::vector< std::pair< itk::Index<3>, double > > segments = mitk::imv::IntersectImage(m_WorkingSpacing, startIndex, endIndex, startIndexCont, endIndexCont);
+      for (std::pair< itk::Index<3>, double > seg : segments)
+      {
+        if (!m_TransformedMaskImage->GetLargestPossibleRegion().IsInside(seg.first) || m_TransformedMaskImage->GetPixel(seg.first)<=0)
+          continue;
+        unsigned int linear_index = seg.first[0] + image_size_x*seg.first[1] + image_size_x*region_size_y*seg.first[2];
+        intersections[j].push_back(VoxelLength(linear_index, seg.second));
+      }
+    }
+  }
+
+  // sort the intersections by voxel (counting sort, the segments of each voxel stay in ascending order)
+  std::size_t numVoxels = m_WorkingImageRegion.GetNumberOfPixels();
+  std::vector< std::size_t > counts(numVoxels+1, 0);
+  for (const auto& segment : intersections)
+    for (const VoxelLength& vl : segment)
+      ++counts[vl.first+1];
+
+  table.m_Voxels.clear();
+  table.m_Offsets.assign(1, 0);
+  for (std::size_t v=0; v<numVoxels; ++v)
+  {
+    if (counts[v+1]>0)
+    {
+      table.m_Voxels.push_back(v);
+      table.m_Offsets.push_back(table.m_Offsets.back() + counts[v+1]);
+    }
+    counts[v+1] += counts[v];
+  }
+
+  table.m_Segments.resize(counts[numVoxels]);
+  table.m_Lengths.resize(counts[numVoxels]);
+  for (std::size_t s=0; s<intersections.size(); ++s)
+    for (const VoxelLength& vl : intersections[s])
+    {
+      std::size_t e = counts[vl.first]++;
+      table.m_Segments[e] = s;
+      table.m_Lengths[e] = vl.second;
+    }
+}
+
 template< class PixelType >
 void TractsToDWIImageFilter< PixelType >::SimulateMotion(int g)
 {
@@ -1463,6 +1547,7 @@ void TractsToDWIImageFilter< PixelType >::SimulateMotion(int g)
     // The last volume was randomly moved, so we have to reset to fiberbundle and the mask.
     // Without motion or with linear motion, we keep the last position --> no reset.
     m_FiberBundleTransformed = m_FiberBundle->GetDeepCopy();
+    m_FibersMoved = true;
 
     if (m_MaskImageSet)
     {
@@ -1501,6 +1586,7 @@ void TractsToDWIImageFilter< PixelType >::SimulateMotion(int g)
           -m_Parameters.m_SignalGen.m_Translation[2];
 
       m_FiberBundleTransformed->TransformFibers(rotation[0], rotation[1], rotation[2], translation[0], translation[1], translation[2]);
+      m_FibersMoved = true;
 
     }
     else
@@ -1511,6 +1597,7 @@ void TractsToDWIImageFilter< PixelType >::SimulateMotion(int g)
       m_MotionCounter++;
 
       m_FiberBundleTransformed->TransformFibers(rotation[0], rotation[1], rotation[2], translation[0], translation[1], translation[2]);
+      m_FibersMoved = true;
 
       rotation *= m_MotionCounter;
       translation *= m_MotionCounter;
@@ -1602,7 +1689,7 @@ itk::Point<float, 3> TractsToDWIImageFilter< PixelType >::GetMovedPoint(itk::Ind
 
 template< class PixelType >
 void TractsToDWIImageFilter< PixelType >::
-SimulateExtraAxonalSignal(ItkUcharImgType::IndexType& index, itk::Point<float, 3>& volume_fraction_point, double intraAxonalVolume, int g)
+SimulateExtraAxonalSignal(ItkUcharImgType::IndexType& index, itk::Point<float, 3>& volume_fraction_point, double intraAxonalVolume, int g, unsigned int maskVoxel)
 {
   int numFiberCompartments = m_Parameters.m_FiberModelList.size();
   int numNonFiberCompartments = m_Parameters.m_NonFiberModelList.size();
@@ -1701,7 +1788,7 @@ SimulateExtraAxonalSignal(ItkUcharImgType::IndexType& index, itk::Point<float, 3
       }
 
       DoubleDwiType::PixelType pix = m_CompartmentImages.at(i+numFiberCompartments)->GetPixel(index);
-      pix[g] += m_Parameters.m_NonFiberModelList[i]->SimulateMeasurement(g, m_NullDir)*volume;
+      pix[g] += m_NonFiberSignals[i][maskVoxel]*volume;
       m_CompartmentImages.at(i+numFiberCompartments)->SetPixel(index, pix);
 
       compartmentSum += volume;
@@ -66,6 +66,7 @@ public:
     itkSetMacro( FiberBundle, FiberBundleType )             ///< Input fiber bundle
     itkSetMacro( InputImage, typename OutputImageType::Pointer )     ///< Input diffusion-weighted image. If no fiber bundle is set, then the acquisition is simulated for this image without a new diffusion simulation.
     itkSetMacro( UseConstantRandSeed, bool )                ///< Seed for random generator.
+    itkSetMacro( UseSeparableDft, bool )                    ///< Use the separable (row-column) DFT for k-space simulation whenever the simulated artifacts allow it. Default true.
     void SetParameters( FiberfoxParameters param )  ///< Simulation parameters.
     { m_Parameters = param; }
 
@@ -107,12 +108,16 @@ protected:
     /** Transform generated image compartment by compartment, channel by channel and slice by slice using DFT and add k-space artifacts/effects. */
     DoubleDwiType::Pointer SimulateKspaceAcquisition(std::vector< DoubleDwiType::Pointer >& images);
 
-    /** Generate signal of non-fiber compartments. */
-    void SimulateExtraAxonalSignal(ItkUcharImgType::IndexType& index, itk::Point<float, 3>& volume_fraction_point, double intraAxonalVolume, int g);
+    /** Generate signal of non-fiber compartments. maskVoxel is the position of the voxel in m_NonFiberSignals. */
+    void SimulateExtraAxonalSignal(ItkUcharImgType::IndexType& index, itk::Point<float, 3>& volume_fraction_point, double intraAxonalVolume, int g, unsigned int maskVoxel);
 
     /** Move fibers to simulate headmotion */
     void SimulateMotion(int g=-1);
 
+    /** Intersects all segments of m_FiberBundleTransformed with the voxels of m_TransformedMaskImage and stores the
+     * result voxel-major in m_SegmentVoxelTable. */
+    void BuildSegmentVoxelTable();
+
     void CheckVolumeFractionImages();
     ItkDoubleImgType::Pointer NormalizeInsideMask(ItkDoubleImgType::Pointer image);
     void InitializeData();
@@ -120,6 +125,19 @@ protected:
 
     itk::Point<float, 3> GetMovedPoint(itk::Index<3>& index, bool forward);
 
+    /** Fiber segments and their intersection with the voxels inside the mask. Segments are indexed by the global index
+     * of their start point. The intersections are stored per voxel (CSR) so that the signal of each voxel can be
+     * accumulated without synchronization. Only rebuilt if the fibers moved. */
+    struct SegmentVoxelTable
+    {
+      std::vector< itk::Vector<double, 3> >   m_Directions;   ///< normalized segment direction
+      std::vector< double >                   m_Volumes;      ///< fiber cross section (mm²) times fiber weight, 0 for invalid segments
+      std::vector< unsigned int >             m_Voxels;       ///< linear indices of all intersected voxels
+      std::vector< std::size_t >              m_Offsets;      ///< intersections of m_Voxels[i] are m_Offsets[i] ... m_Offsets[i+1]-1
+      std::vector< std::size_t >              m_Segments;     ///< intersecting segment
+      std::vector< double >                   m_Lengths;      ///< length of the segment inside the voxel
+    };
+
     // input
     mitk::FiberfoxParameters                    m_Parameters;
     FiberBundleType                             m_FiberBundle;
@@ -137,6 +155,7 @@ protected:
     // MISC
     itk::TimeProbe                              m_TimeProbe;
     bool                                        m_UseConstantRandSeed;
+    bool                                        m_UseSeparableDft;
     bool                                        m_MaskImageSet;
     std::ofstream                                    m_Logfile;
     std::string                                 m_MotionLog;
@@ -144,6 +163,9 @@ protected:
 
     // signal generation
     FiberBundleType                             m_FiberBundleTransformed;   ///< transformed bundle simulating headmotion
+    bool                                        m_FibersMoved;              ///< m_FiberBundleTransformed changed since m_SegmentVoxelTable was built
+    SegmentVoxelTable                           m_SegmentVoxelTable;
+    std::vector< std::vector< double > >        m_NonFiberSignals;          ///< signal of each non-fiber compartment per mask voxel for the current gradient (partial volume mode)
     itk::Vector<double,3>                       m_WorkingSpacing;
     itk::Point<double,3>                        m_WorkingOrigin;
     ImageRegion<3>                              m_WorkingImageRegion;
@@ -0,0 +1,253 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#ifndef _MITK_SparseSystemMatrix_H
+#define _MITK_SparseSystemMatrix_H
+
+#include <vnl/vnl_vector.h>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+namespace mitk {
+
+/**
+  * \brief Sparse matrix of a linear system A*x=b, stored row-major (CSR) and column-major (CSC).
+  *
+  * The matrix is assembled once from a list of (row, column, value) triplets. Duplicate triplets are summed in the
+  * order they appear in the list, so an assembly that emits its triplets in a fixed order yields the same matrix
+  * as incrementally adding each value with vnl_sparse_matrix::put(i,j,get(i,j)+v). The CSR arrays are used for A*x,
+  * the CSC arrays for A^T*x. Both products are parallelized over output elements, so no atomics are needed and the
+  * summation order (increasing column resp. row index) matches vnl_sparse_matrix.
+  */
+class SparseSystemMatrix
+{
+public:
+
+  struct Triplet
+  {
+    unsigned int m_Row;
+    unsigned int m_Col;
+    double       m_Value;
+  };
+
+  SparseSystemMatrix() : m_Rows(0), m_Cols(0) {}
+
+  unsigned int rows() const { return m_Rows; }
+  unsigned int cols() const { return m_Cols; }
+  std::size_t GetNumberOfNonZeros() const { return m_Values.size(); }
+
+  const std::vector< std::size_t >& GetRowOffsets() const { return m_RowOffsets; }
+  const std::vector< unsigned int >& GetColumnIndices() const { return m_ColumnIndices; }
+  const std::vector< double >& GetValues() const { return m_Values; }
+  const std::vector< std::size_t >& GetColumnOffsets() const { return m_ColOffsets; }
+  const std::vector< unsigned int >& GetRowIndices() const { return m_RowIndices; }
+
+  /** Builds CSR and CSC arrays from the triplets. The triplet list is consumed (cleared) to free its memory early. */
+  void SetFromTriplets(unsigned int rows, unsigned int cols, std::vector< Triplet >& triplets)
+  {
+    m_Rows = rows;
+    m_Cols = cols;
+
+    // stable counting sort by row
+    std::vector< std::size_t > offsets(static_cast<std::size_t>(rows)+1, 0);
+    for (const Triplet& t : triplets)
+      ++offsets[t.m_Row+1];
+    for (unsigned int r=0; r<rows; ++r)
+      offsets[r+1] += offsets[r];
+
+    std::vector< unsigned int > cols_sorted(triplets.size());
+    std::vector< double > vals_sorted(triplets.size());
+    {
+      std::vector< std::size_t > pos(offsets.begin(), offsets.end()-1);
+      for (const Triplet& t : triplets)
+      {
+        std::size_t p = pos[t.m_Row]++;
+        cols_sorted[p] = t.m_Col;
+        vals_sorted[p] = t.m_Value;
+      }
+    }
+    triplets.clear();
+    triplets.shrink_to_fit();
+
+    // sort each row by column and merge duplicates in place
+    std::vector< std::size_t > row_nnz(rows, 0);
+#pragma omp parallel
+    {
+      std::vector< std::pair< unsigned int, double > > row;
+#pragma omp for schedule(dynamic, 256)
+      for (int r=0; r<static_cast<int>(rows); ++r)
+      {
+        std::size_t begin = offsets[r];
+        std::size_t end = offsets[r+1];
+        if (begin==end)
+          continue;
+
+        row.clear();
+        for (std::size_t e=begin; e<end; ++e)
+          row.push_back(std::make_pair(cols_sorted[e], vals_sorted[e]));
+        std::stable_sort(row.begin(), row.end(), [](const std::pair< unsigned int, double >& a, const std::pair< unsigned int, double >& b){ return a.first<b.first; });
+
+        std::size_t out = begin;
+        cols_sorted[out] = row[0].first;
+        vals_sorted[out] = row[0].second;
+        for (std::size_t e=1; e<row.size(); ++e)
+        {
+          if (row[e].first==cols_sorted[out])
+            vals_sorted[out] += row[e].second;
+          else
+          {
+            ++out;
+            cols_sorted[out] = row[e].first;
+            vals_sorted[out] = row[e].second;
+          }
+        }
+        row_nnz[r] = out-begin+1;
+      }
+    }
+
+    // compact CSR
+    m_RowOffsets.assign(static_cast<std::size_t>(rows)+1, 0);
+    for (unsigned int r=0; r<rows; ++r)
+      m_RowOffsets[r+1] = m_RowOffsets[r] + row_nnz[r];
+    m_ColumnIndices.resize(m_RowOffsets[rows]);
+    m_Values.resize(m_RowOffsets[rows]);
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int r=0; r<static_cast<int>(rows); ++r)
+    {
+      std::copy(cols_sorted.begin()+offsets[r], cols_sorted.begin()+offsets[r]+row_nnz[r], m_ColumnIndices.begin()+m_RowOffsets[r]);
+      std::copy(vals_sorted.begin()+offsets[r], vals_sorted.begin()+offsets[r]+row_nnz[r], m_Values.begin()+m_RowOffsets[r]);
+    }
+    cols_sorted.clear(); cols_sorted.shrink_to_fit();
+    vals_sorted.clear(); vals_sorted.shrink_to_fit();
+
+    BuildColumnMajor();
+  }
+
+  /** y = A*x */
+  void Multiply(const vnl_vector< double >& x, vnl_vector< double >& y) const
+  {
+    y.set_size(m_Rows);
+    const double* xp = x.data_block();
+    double* yp = y.data_block();
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (int r=0; r<static_cast<int>(m_Rows); ++r)
+    {
+      double sum = 0;
+      for (std::size_t e=m_RowOffsets[r]; e<m_RowOffsets[r+1]; ++e)
+        sum += m_Values[e]*xp[m_ColumnIndices[e]];
+      yp[r] = sum;
+    }
+  }
+
+  /** y = A^T*x */
+  void TransposeMultiply(const vnl_vector< double >& x, vnl_vector< double >& y) const
+  {
+    y.set_size(m_Cols);
+    const double* xp = x.data_block();
+    double* yp = y.data_block();
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int c=0; c<static_cast<int>(m_Cols); ++c)
+    {
+      double sum = 0;
+      for (std::size_t e=m_ColOffsets[c]; e<m_ColOffsets[c+1]; ++e)
+        sum += m_ColValues[e]*xp[m_RowIndices[e]];
+      yp[c] = sum;
+    }
+  }
+
+  /** y = B*x, where B has the sparsity pattern of A and all entries equal to one. */
+  void MultiplyPattern(const vnl_vector< double >& x, vnl_vector< double >& y) const
+  {
+    y.set_size(m_Rows);
+    const double* xp = x.data_block();
+    double* yp = y.data_block();
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (int r=0; r<static_cast<int>(m_Rows); ++r)
+    {
+      double sum = 0;
+      for (std::size_t e=m_RowOffsets[r]; e<m_RowOffsets[r+1]; ++e)
+        sum += xp[m_ColumnIndices[e]];
+      yp[r] = sum;
+    }
+  }
+
+  /** Root mean square of A*x-b, equivalent to vnl_linear_system::get_rms_error. */
+  double GetRmsError(const vnl_vector< double >& x, const vnl_vector< double >& b) const
+  {
+    vnl_vector< double > resid;
+    Multiply(x, resid);
+    resid -= b;
+    return resid.rms();
+  }
+
+  SparseSystemMatrix& operator*=(double s)
+  {
+    for (double& v : m_Values)
+      v *= s;
+    for (double& v : m_ColValues)
+      v *= s;
+    return *this;
+  }
+
+  /** Memory occupied by the CSR and CSC arrays in bytes. */
+  std::size_t GetMemoryFootprint() const
+  {
+    return m_RowOffsets.capacity()*sizeof(std::size_t) + m_ColOffsets.capacity()*sizeof(std::size_t)
+        + m_ColumnIndices.capacity()*sizeof(unsigned int) + m_RowIndices.capacity()*sizeof(unsigned int)
+        + m_Values.capacity()*sizeof(double) + m_ColValues.capacity()*sizeof(double);
+  }
+
+protected:
+
+  void BuildColumnMajor()
+  {
+    m_ColOffsets.assign(static_cast<std::size_t>(m_Cols)+1, 0);
+    for (unsigned int c : m_ColumnIndices)
+      ++m_ColOffsets[c+1];
+    for (unsigned int c=0; c<m_Cols; ++c)
+      m_ColOffsets[c+1] += m_ColOffsets[c];
+
+    // rows are visited in increasing order, so the row indices of each column are sorted
+    m_RowIndices.resize(m_ColumnIndices.size());
+    m_ColValues.resize(m_Values.size());
+    std::vector< std::size_t > pos(m_ColOffsets.begin(), m_ColOffsets.end()-1);
+    for (unsigned int r=0; r<m_Rows; ++r)
+      for (std::size_t e=m_RowOffsets[r]; e<m_RowOffsets[r+1]; ++e)
+      {
+        std::size_t p = pos[m_ColumnIndices[e]]++;
+        m_RowIndices[p] = r;
+        m_ColValues[p] = m_Values[e];
+      }
+  }
+
+  unsigned int                  m_Rows;
+  unsigned int                  m_Cols;
+
+  // CSR
+  std::vector< std::size_t >    m_RowOffsets;
+  std::vector< unsigned int >   m_ColumnIndices;
+  std::vector< double >         m_Values;
+
+  // CSC
+  std::vector< std::size_t >    m_ColOffsets;
+  std::vector< unsigned int >   m_RowIndices;
+  std::vector< double >         m_ColValues;
+};
+
+}
+
+#endif
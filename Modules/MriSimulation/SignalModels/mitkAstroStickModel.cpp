@@ -120,3 +120,21 @@ typename AstroStickModel< ScalarType >::PixelType AstroStickModel< ScalarType >:
 
     return signal;
 }
+
+template< class ScalarType >
+void AstroStickModel< ScalarType >::SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, ScalarType* signal)
+{
+    if (m_RandomizeSticks)  // new random sticks for each direction, the random generator has to be used in order
+    {
+        for (unsigned int i=0; i<numDirections; ++i)
+        {
+            GradientType fiberDirection = fiberDirections[i];
+            signal[i] = SimulateMeasurement(dir, fiberDirection);
+        }
+        return;
+    }
+
+    // fixed stick configuration, the signal does not depend on the fiber direction
+    GradientType nullDir; nullDir.Fill(0.0);
+    std::fill(signal, signal+numDirections, SimulateMeasurement(dir, nullDir));
+}
@@ -70,3 +70,11 @@ typename BallModel< ScalarType >::PixelType BallModel< ScalarType >::SimulateMea
 
     return signal;
 }
+
+template< class ScalarType >
+void BallModel< ScalarType >::SimulateMeasurement(unsigned int dir, const GradientType* , unsigned int numDirections, ScalarType* signal)
+{
+    // isotropic, the signal does not depend on the fiber direction
+    GradientType nullDir; nullDir.Fill(0.0);
+    std::fill(signal, signal+numDirections, SimulateMeasurement(dir, nullDir));
+}
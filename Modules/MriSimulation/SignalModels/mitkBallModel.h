@@ -54,6 +54,7 @@ public:
   /** Actual signal generation **/
   PixelType SimulateMeasurement(GradientType& fiberDirection) override;
   ScalarType SimulateMeasurement(unsigned int dir, GradientType& fiberDirection) override;
+  void SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, ScalarType* signal) override;
 
   void SetDiffusivity(double D) { m_Diffusivity = D; }
   double GetDiffusivity() { return m_Diffusivity; }
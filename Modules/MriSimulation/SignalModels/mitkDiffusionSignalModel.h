@@ -54,6 +54,17 @@ public:
     virtual PixelType SimulateMeasurement(GradientType& fiberDirection) = 0;
     virtual ScalarType SimulateMeasurement(unsigned int dir, GradientType& fiberDirection) = 0;
 
+    /** Batched signal generation for gradient dir. signal[i] corresponds to fiberDirections[i]. Should be preferred over
+     * repeated calls of the single direction version, the subclasses evaluate the batch in parallel where possible. **/
+    virtual void SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, ScalarType* signal)
+    {
+      for (unsigned int i=0; i<numDirections; ++i)
+      {
+        GradientType fiberDirection = fiberDirections[i];
+        signal[i] = SimulateMeasurement(dir, fiberDirection);
+      }
+    }
+
     void SetGradientList(DPH::GradientDirectionsContainerType::ConstPointer gradients)
     {
       m_GradientList.clear();
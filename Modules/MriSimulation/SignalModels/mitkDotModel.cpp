@@ -45,3 +45,9 @@ typename DotModel< ScalarType >::PixelType DotModel< ScalarType >::SimulateMeasu
     signal.Fill(1);
     return signal;
 }
+
+template< class ScalarType >
+void DotModel< ScalarType >::SimulateMeasurement(unsigned int /*dir*/, const GradientType* , unsigned int numDirections, ScalarType* signal)
+{
+    std::fill(signal, signal+numDirections, 1);
+}
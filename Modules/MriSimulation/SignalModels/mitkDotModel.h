@@ -50,6 +50,7 @@ public:
   /** Actual signal generation **/
   PixelType SimulateMeasurement(GradientType& fiberDirection) override;
   ScalarType SimulateMeasurement(unsigned int dir, GradientType& fiberDirection) override;
+  void SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, ScalarType* signal) override;
 
 protected:
 
@@ -41,6 +41,7 @@ RawShModel< ScalarType >::RawShModel()
   m_AdcRange.second = 0.004;
   m_FaRange.first = 0;
   m_FaRange.second = 1;
+  UpdateShTerms();
 }
 
 template< class ScalarType >
@@ -60,7 +61,7 @@ void RawShModel< ScalarType >::Clear()
 template< class ScalarType >
 void RawShModel< ScalarType >::RandomModel()
 {
-  m_ModelIndex = this->m_RandGen->GetIntegerVariate(m_B0Signal.size()-1);
+  m_ModelIndex = GetRandomModelIndex();
 }
 
 template< class ScalarType >
@@ -289,106 +290,216 @@ bool RawShModel< ScalarType >::SetShCoefficients(vnl_vector< double > shCoeffici
   //    maxDir.Normalize();
   //    m_PrototypeMaxDirection.push_back(maxDir);
 
-  Cart2Sph( this->m_GradientList );
+  UpdateShTerms();
   m_ModelIndex = -1;
 
   return true;
 }
 
 template< class ScalarType >
-ScalarType RawShModel< ScalarType >::SimulateMeasurement(unsigned int dir, GradientType& fiberDirection)
+void RawShModel< ScalarType >::UpdateShTerms()
 {
-  ScalarType signal = 0;
-
-  if (m_ModelIndex==-1)
-    RandomModel();
+  // normalization factors N_l^m = sqrt( (2l+1)/(4pi) * (l-m)!/(l+m)! ) including the sqrt(2) and sign of the real basis
+  m_ShTerms.clear();
+  const int order = static_cast<int>(m_ShOrder);
+  for (int m=0; m<=order; ++m)
+    for (int l=m; l<=order; ++l)
+    {
+      if (l%2!=0)
+        continue;
 
-  vnl_matrix<double> sphCoords = this->SetFiberDirection(fiberDirection);
+      double ratio = 1.0;
+      for (int i=l-m+1; i<=l+m; ++i)
+        ratio /= i;
+      double norm = sqrt((2.0*l+1.0)/(4.0*itk::Math::pi)*ratio);
 
-  if (dir>=this->m_GradientList.size())
-    return signal;
+      ShTerm t;
+      t.m_CosIndex = (l*l + l + 2)/2 - m - 1;
+      t.m_SinIndex = (l*l + l + 2)/2 + m - 1;
+      if (m==0)
+      {
+        t.m_CosFactor = norm;
+        t.m_SinFactor = 0;
+      }
+      else
+      {
+        t.m_CosFactor = sqrt(2.0)*norm;
+        t.m_SinFactor = (m%2==0 ? 1.0 : -1.0)*sqrt(2.0)*norm;
+      }
+      m_ShTerms.push_back(t);
+    }
+}
 
-  int j, m; double mag, plm;
+template< class ScalarType >
+double RawShModel< ScalarType >::EvaluateSh(const vnl_vector< double >& coefficients, const GradientType& direction) const
+{
+  // spherical coordinates of the normalized direction without any trigonometric function calls
+  double cos_theta = std::max(-1.0, std::min(1.0, direction[2]));
+  double sin_theta = sqrt(direction[0]*direction[0] + direction[1]*direction[1]);
+  double cos_phi = 1;
+  double sin_phi = 0;
+  if (sin_theta>0)
+  {
+    cos_phi = direction[0]/sin_theta;
+    sin_phi = direction[1]/sin_theta;
+  }
 
-  if (this->m_GradientList[dir].GetNorm()>0.001)
+  // P_m^m = (-1)^m (2m-1)!! sin(theta)^m, upward recurrence in l for P_l^m and angle addition for cos(m*phi), sin(m*phi)
+  const int order = static_cast<int>(m_ShOrder);
+  double val = 0;
+  double pmm = 1;
+  double cos_m = 1;
+  double sin_m = 0;
+  auto term = m_ShTerms.begin();
+  for (int m=0; m<=order; ++m)
   {
-    j=0;
-    for (int l=0; l<=static_cast<int>(m_ShOrder); l=l+2)
-      for (m=-l; m<=l; m++)
+    if (m>0)
+    {
+      pmm *= -(2.0*m-1.0)*sin_theta;
+      double tmp = cos_m*cos_phi - sin_m*sin_phi;
+      sin_m = sin_m*cos_phi + cos_m*sin_phi;
+      cos_m = tmp;
+    }
+
+    double p2 = 0;
+    double p1 = pmm;
+    for (int l=m; l<=order; ++l)
+    {
+      if (l>m)
       {
-        plm = legendre_p<double>(l,abs(m),cos(sphCoords(dir,0)));
-        mag = sqrt((double)(2*l+1)/(4.0*itk::Math::pi)*factorial<double>(l-abs(m))/factorial<double>(l+abs(m)))*plm;
-        double basis;
-
-        if (m<0)
-          basis = sqrt(2.0)*mag*cos(fabs((double)m)*sphCoords(dir,1));
-        else if (m==0)
-          basis = mag;
-        else
-          basis = pow(-1.0, m)*sqrt(2.0)*mag*sin(m*sphCoords(dir,1));
-
-        signal += m_ShCoefficients.at(m_ModelIndex)[j]*basis;
-        j++;
+        double p = ((2.0*l-1.0)*cos_theta*p1 - (l+m-1.0)*p2)/(l-m);
+        p2 = p1;
+        p1 = p;
       }
+      if (l%2!=0)
+        continue;
+
+      const ShTerm& t = *term;
+      ++term;
+      if (m==0)
+        val += coefficients[t.m_CosIndex]*t.m_CosFactor*p1;
+      else
+        val += p1*(coefficients[t.m_CosIndex]*t.m_CosFactor*cos_m + coefficients[t.m_SinIndex]*t.m_SinFactor*sin_m);
+    }
   }
-  else
-    signal = m_B0Signal.at(m_ModelIndex);
+  return val;
+}
 
-  m_ModelIndex = -1;
+template< class ScalarType >
+typename RawShModel< ScalarType >::MatrixType RawShModel< ScalarType >::GetPrototypeRotation(const GradientType& fiberDirection, int modelIndex) const
+{
+  // rotation around fiberDirection x prototypeDirection that maps the fiber onto the prototype direction (Rodrigues)
+  MatrixType rotation;
+  rotation.SetIdentity();
+
+  GradientType f = fiberDirection;
+  GradientType p = m_PrototypeMaxDirection.at(modelIndex);
+  if (f.GetNorm()<=0.0001 || p.GetNorm()<=0.0001)
+    return rotation;
+  f.Normalize();
+  p.Normalize();
+
+  GradientType v = itk::CrossProduct(f, p);
+  double c = f*p;
+  double s2 = v.GetSquaredNorm();
+  if (s2<1e-20)
+  {
+    // (anti)parallel: the signal is antipodally symmetric
+    return rotation;
+  }
 
-  return signal;
+  double k = (1.0-c)/s2;
+  for (int i=0; i<3; ++i)
+    for (int j=0; j<3; ++j)
+      rotation[i][j] = (i==j ? c : 0.0) + k*v[i]*v[j];
+  rotation[0][1] -= v[2]; rotation[0][2] += v[1];
+  rotation[1][0] += v[2]; rotation[1][2] -= v[0];
+  rotation[2][0] -= v[1]; rotation[2][1] += v[0];
+  return rotation;
 }
 
 template< class ScalarType >
-typename RawShModel< ScalarType >::PixelType RawShModel< ScalarType >::SimulateMeasurement(GradientType& fiberDirection)
+int RawShModel< ScalarType >::GetRandomModelIndex()
 {
-  if (m_ModelIndex==-1)
-    RandomModel();
+  return this->m_RandGen->GetIntegerVariate(m_B0Signal.size()-1);
+}
 
-  PixelType signal;
-  signal.SetSize(this->m_GradientList.size());
+template< class ScalarType >
+ScalarType RawShModel< ScalarType >::SimulateMeasurement(unsigned int dir, GradientType& fiberDirection, int modelIndex) const
+{
+  if (dir>=this->m_GradientList.size())
+    return 0;
 
-  int M = this->m_GradientList.size();
-  int j, m; double mag, plm;
+  GradientType g = this->m_GradientList[dir];
+  if (g.GetNorm()<=0.001)
+    return m_B0Signal.at(modelIndex);
 
-  vnl_matrix< double > shBasis;
-  shBasis.set_size(M, m_ShCoefficients.at(m_ModelIndex).size());
-  shBasis.fill(0.0);
+  g.Normalize();
+  g = GetPrototypeRotation(fiberDirection, modelIndex)*g;
+  g.Normalize();
+  return EvaluateSh(m_ShCoefficients.at(modelIndex), g);
+}
 
-  vnl_matrix<double> sphCoords = this->SetFiberDirection(fiberDirection);
+template< class ScalarType >
+typename RawShModel< ScalarType >::PixelType RawShModel< ScalarType >::SimulateMeasurement(GradientType& fiberDirection, int modelIndex) const
+{
+  PixelType signal;
+  signal.SetSize(this->m_GradientList.size());
 
-  for (int p=0; p<M; p++)
+  MatrixType rotation = GetPrototypeRotation(fiberDirection, modelIndex);
+  const vnl_vector< double >& coefficients = m_ShCoefficients.at(modelIndex);
+  for (unsigned int p=0; p<this->m_GradientList.size(); p++)
   {
-    if (this->m_GradientList[p].GetNorm()>0.001)
+    GradientType g = this->m_GradientList[p];
+    if (g.GetNorm()>0.001)
     {
-      j=0;
-      for (int l=0; l<=static_cast<int>(m_ShOrder); l=l+2)
-        for (m=-l; m<=l; m++)
-        {
-          plm = legendre_p<double>(l,abs(m),cos(sphCoords(p,0)));
-          mag = sqrt((double)(2*l+1)/(4.0*itk::Math::pi)*factorial<double>(l-abs(m))/factorial<double>(l+abs(m)))*plm;
-
-          if (m<0)
-            shBasis(p,j) = sqrt(2.0)*mag*cos(fabs((double)m)*sphCoords(p,1));
-          else if (m==0)
-            shBasis(p,j) = mag;
-          else
-            shBasis(p,j) = pow(-1.0, m)*sqrt(2.0)*mag*sin(m*sphCoords(p,1));
-
-          j++;
-        }
-
-
-      double val = 0;
-      for (unsigned int cidx=0; cidx<m_ShCoefficients.at(m_ModelIndex).size(); cidx++)
-        val += m_ShCoefficients.at(m_ModelIndex)[cidx]*shBasis(p,cidx);
-      signal[p] = val;
+      g.Normalize();
+      g = rotation*g;
+      g.Normalize();
+      signal[p] = EvaluateSh(coefficients, g);
     }
     else
-      signal[p] = m_B0Signal.at(m_ModelIndex);
+      signal[p] = m_B0Signal.at(modelIndex);
+  }
+
+  return signal;
+}
+
+template< class ScalarType >
+void RawShModel< ScalarType >::SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, const int* modelIndices, ScalarType* signal) const
+{
+#pragma omp parallel for
+  for (int i=0; i<static_cast<int>(numDirections); ++i)
+  {
+    GradientType fiberDirection = fiberDirections[i];
+    signal[i] = SimulateMeasurement(dir, fiberDirection, modelIndices[i]);
   }
+}
 
+template< class ScalarType >
+ScalarType RawShModel< ScalarType >::SimulateMeasurement(unsigned int dir, GradientType& fiberDirection)
+{
+  int modelIndex = m_ModelIndex==-1 ? GetRandomModelIndex() : m_ModelIndex;
   m_ModelIndex = -1;
+  return SimulateMeasurement(dir, fiberDirection, modelIndex);
+}
 
-  return signal;
+template< class ScalarType >
+typename RawShModel< ScalarType >::PixelType RawShModel< ScalarType >::SimulateMeasurement(GradientType& fiberDirection)
+{
+  int modelIndex = m_ModelIndex==-1 ? GetRandomModelIndex() : m_ModelIndex;
+  m_ModelIndex = -1;
+  return SimulateMeasurement(fiberDirection, modelIndex);
+}
+
+template< class ScalarType >
+void RawShModel< ScalarType >::SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, ScalarType* signal)
+{
+  // one random prototype per direction, drawn in order since the random generator can not be used concurrently
+  std::vector< int > modelIndices(numDirections);
+  for (unsigned int i=0; i<numDirections; ++i)
+    modelIndices[i] = GetRandomModelIndex();
+  m_ModelIndex = -1;
+
+  SimulateMeasurement(dir, fiberDirections, numDirections, modelIndices.data(), signal);
 }
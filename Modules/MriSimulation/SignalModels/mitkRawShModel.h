@@ -26,6 +26,9 @@ namespace mitk {
 /**
   * \brief The spherical harmonic representation of a prototype diffusion weighted MR signal is used to obtain the direction dependent signal.
   *
+  * The SH normalization factors are precomputed when the coefficients are set and the basis is evaluated with the
+  * Legendre and cos(m*phi)/sin(m*phi) recurrences directly from the rotated gradient direction. The overloads taking a
+  * prototype index are const and can be called concurrently, the other overloads draw a random prototype per call.
   */
 
 template< class ScalarType = double >
@@ -48,8 +51,10 @@ public:
     this->m_ShCoefficients = model->GetShCoefficients();
     this->m_B0Signal = model->GetB0Signals();
     this->m_ShOrder = model->GetShOrder();
+    this->m_PrototypeMaxDirection = model->GetPrototypeMaxDirections();
     this->m_ModelIndex = model->GetModelIndex();
     this->m_MaxNumKernels = model->GetMaxNumKernels();
+    this->UpdateShTerms();
   }
   ~RawShModel();
 
@@ -65,6 +70,13 @@ public:
   /** Actual signal generation **/
   PixelType SimulateMeasurement(GradientType& fiberDirection) override;
   ScalarType SimulateMeasurement(unsigned int dir, GradientType& fiberDirection) override;
+  void SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, ScalarType* signal) override;
+
+  /** Signal of the given prototype rotated onto the fiber direction. Thread safe. **/
+  PixelType SimulateMeasurement(GradientType& fiberDirection, int modelIndex) const;
+  ScalarType SimulateMeasurement(unsigned int dir, GradientType& fiberDirection, int modelIndex) const;
+  void SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, const int* modelIndices, ScalarType* signal) const;
+  int GetRandomModelIndex();  ///< random prototype index, uses the random generator and is therefore not thread safe
 
   bool SetShCoefficients(vnl_vector< double > shCoefficients, double b0);
   vnl_matrix<double> SetFiberDirection(GradientType& fiberDirection);
@@ -81,6 +93,8 @@ public:
   std::vector< double > GetB0Signals(){ return m_B0Signal; }
   unsigned int GetShOrder(){ return m_ShOrder; }
   int GetModelIndex(){ return m_ModelIndex; }
+  std::vector< GradientType > GetPrototypeMaxDirections(){ return m_PrototypeMaxDirection; }
+  void SetPrototypeMaxDirections(std::vector< GradientType > directions){ m_PrototypeMaxDirection = directions; }
 
   double GetBaselineSignal(int index){ return m_B0Signal.at(index); }
   vnl_vector< double > GetCoefficients(int listIndex){ return m_ShCoefficients.at(listIndex); }
@@ -91,6 +105,18 @@ protected:
 
   vnl_matrix<double> Cart2Sph( GradientListType& gradients );
   void RandomModel();
+  void UpdateShTerms();
+  MatrixType GetPrototypeRotation(const GradientType& fiberDirection, int modelIndex) const;
+  double EvaluateSh(const vnl_vector< double >& coefficients, const GradientType& direction) const;
+
+  /** Precomputed factors of the SH basis functions of degree l and order +-m */
+  struct ShTerm
+  {
+    unsigned int  m_CosIndex;
+    unsigned int  m_SinIndex;
+    double        m_CosFactor;
+    double        m_SinFactor;
+  };
 
   std::vector< vnl_vector< double > > m_ShCoefficients;
   std::vector< double >               m_B0Signal;
@@ -100,6 +126,7 @@ protected:
   unsigned int                        m_ShOrder;
   int                                 m_ModelIndex;
   unsigned int                        m_MaxNumKernels;
+  std::vector< ShTerm >               m_ShTerms;            ///< ordered by m, then l
 };
 
 }
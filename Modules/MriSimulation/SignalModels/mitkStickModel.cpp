@@ -72,3 +72,26 @@ typename StickModel< ScalarType >::PixelType StickModel< ScalarType >::SimulateM
 
   return signal;
 }
+
+template< class ScalarType >
+void StickModel< ScalarType >::SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, ScalarType* signal)
+{
+  if (dir>=this->m_GradientList.size() || this->m_GradientList[dir].GetNorm()<=0.0001)
+  {
+    std::fill(signal, signal+numDirections, dir>=this->m_GradientList.size() ? 0 : 1);
+    return;
+  }
+
+  // same operation order as the single direction version, the loop body has no branches and vectorizes
+  const GradientType g = this->m_GradientList[dir];
+  const double g0 = g[0];
+  const double g1 = g[1];
+  const double g2 = g[2];
+  const double factor = -this->m_BValue*m_Diffusivity;
+#pragma omp parallel for
+  for (int i=0; i<static_cast<int>(numDirections); ++i)
+  {
+    ScalarType dot = fiberDirections[i][0]*g0 + fiberDirections[i][1]*g1 + fiberDirections[i][2]*g2;
+    signal[i] = std::exp( factor*dot*dot );
+  }
+}
@@ -36,89 +36,86 @@ TensorModel< ScalarType >::~TensorModel()
 }
 
 template< class ScalarType >
-ScalarType TensorModel< ScalarType >::SimulateMeasurement(unsigned int dir, GradientType &fiberDirection)
+vnl_matrix_fixed<double, 3, 3> TensorModel< ScalarType >::GetKernelRotation(const GradientType& fiberDirection) const
 {
-  ScalarType signal = 0;
-
-  if (dir>=this->m_GradientList.size())
-    return signal;
-
-  ItkTensorType tensor; tensor.Fill(0.0);
-  vnl_vector_fixed<double, 3> axis = itk::CrossProduct(m_KernelDirection, fiberDirection).GetVnlVector(); axis.normalize();
-  vnl_quaternion<double> rotation(axis, acos(m_KernelDirection*fiberDirection));
-  rotation.normalize();
-  vnl_matrix_fixed<double, 3, 3> matrix = rotation.rotation_matrix_transpose();
+  // rotation around kernelDirection x fiberDirection that maps the kernel onto the fiber direction (Rodrigues), equal
+  // to the quaternion rotation with angle acos(kernelDirection*fiberDirection) but without trigonometric functions
+  vnl_matrix_fixed<double, 3, 3> rotation;
+  rotation.set_identity();
+
+  GradientType f = fiberDirection;
+  if (f.GetNorm()<=0.0001)
+    return rotation;
+  f.Normalize();
+
+  GradientType v = itk::CrossProduct(m_KernelDirection, f);
+  double s2 = v.GetSquaredNorm();
+  if (s2<1e-20)  // (anti)parallel fiber direction, the tensor is point symmetric
+    return rotation;
+
+  double c = m_KernelDirection*f;
+  double k = (1.0-c)/s2;
+  for (int i=0; i<3; ++i)
+    for (int j=0; j<3; ++j)
+      rotation[i][j] = (i==j ? c : 0.0) + k*v[i]*v[j];
+  rotation[0][1] -= v[2]; rotation[0][2] += v[1];
+  rotation[1][0] += v[2]; rotation[1][2] -= v[0];
+  rotation[2][0] -= v[1]; rotation[2][1] += v[0];
+  return rotation;
+}
 
-  vnl_matrix_fixed<double, 3, 3> tensorMatrix = matrix.transpose()*m_KernelTensorMatrix*matrix;
-  tensor[0] = tensorMatrix[0][0]; tensor[1] = tensorMatrix[0][1]; tensor[2] = tensorMatrix[0][2];
-  tensor[3] = tensorMatrix[1][1]; tensor[4] = tensorMatrix[1][2]; tensor[5] = tensorMatrix[2][2];
+template< class ScalarType >
+ScalarType TensorModel< ScalarType >::GetSignal(const vnl_matrix_fixed<double, 3, 3>& rotation, const GradientType& g) const
+{
+  if (g.GetNorm()<=0.0001)
+    return 1;
+
+  // g^T * R * D * R^T * g with the kernel tensor D
+  double h[3];
+  for (int a=0; a<3; ++a)
+    h[a] = rotation[0][a]*g[0] + rotation[1][a]*g[1] + rotation[2][a]*g[2];
+  ScalarType D_scalar = 0;
+  for (int a=0; a<3; ++a)
+    D_scalar += h[a]*(m_KernelTensorMatrix[a][0]*h[0] + m_KernelTensorMatrix[a][1]*h[1] + m_KernelTensorMatrix[a][2]*h[2]);
+
+  // check for corrupted tensor and generate signal
+  if (D_scalar>=0)
+    return std::exp ( -this->m_BValue * D_scalar );  // skip * bVal becaus bVal is already encoded in g^T*g (norm of g encodes b-value relative to baseline b-value m_BValue)
+  return 0;
+}
 
-  GradientType g = this->m_GradientList[dir];
-  if (g.GetNorm()>0.0001)
-  {
-    // calc g^T * D * g
-    itk::DiffusionTensor3D< ScalarType > S;
-    S[0] = g[0]*g[0];
-    S[1] = g[1]*g[0];
-    S[2] = g[2]*g[0];
-    S[3] = g[1]*g[1];
-    S[4] = g[2]*g[1];
-    S[5] = g[2]*g[2];
-
-    ScalarType D_scalar = tensor[0]*S[0] + tensor[1]*S[1] + tensor[2]*S[2] +
-                          tensor[1]*S[1] + tensor[3]*S[3] + tensor[4]*S[4] +
-                          tensor[2]*S[2] + tensor[4]*S[4] + tensor[5]*S[5];
-
-    // check for corrupted tensor and generate signal
-    if (D_scalar>=0)
-      signal = std::exp ( -this->m_BValue * D_scalar );  // skip * bVal becaus bVal is already encoded in g^T*g (norm of g encodes b-value relative to baseline b-value m_BValue)
-  }
-  else
-    signal = 1;
+template< class ScalarType >
+ScalarType TensorModel< ScalarType >::SimulateMeasurement(unsigned int dir, GradientType &fiberDirection)
+{
+  if (dir>=this->m_GradientList.size())
+    return 0;
 
-  return signal;
+  return GetSignal(GetKernelRotation(fiberDirection), this->m_GradientList[dir]);
 }
 
 template< class ScalarType >
 typename TensorModel< ScalarType >::PixelType TensorModel< ScalarType >::SimulateMeasurement(GradientType& fiberDirection)
 {
-  PixelType signal; signal.SetSize(this->m_GradientList.size()); signal.Fill(0.0);
+  PixelType signal; signal.SetSize(this->m_GradientList.size());
 
-  ItkTensorType tensor; tensor.Fill(0.0);
-  vnl_vector_fixed<double, 3> axis = itk::CrossProduct(m_KernelDirection, fiberDirection).GetVnlVector(); axis.normalize();
-  vnl_quaternion<double> rotation(axis, acos(m_KernelDirection*fiberDirection));
-  rotation.normalize();
-  vnl_matrix_fixed<double, 3, 3> matrix = rotation.rotation_matrix_transpose();
+  vnl_matrix_fixed<double, 3, 3> rotation = GetKernelRotation(fiberDirection);
+  for( unsigned int i=0; i<this->m_GradientList.size(); i++)
+    signal[i] = GetSignal(rotation, this->m_GradientList[i]);
 
-  vnl_matrix_fixed<double, 3, 3> tensorMatrix = matrix.transpose()*m_KernelTensorMatrix*matrix;
-  tensor[0] = tensorMatrix[0][0]; tensor[1] = tensorMatrix[0][1]; tensor[2] = tensorMatrix[0][2];
-  tensor[3] = tensorMatrix[1][1]; tensor[4] = tensorMatrix[1][2]; tensor[5] = tensorMatrix[2][2];
+  return signal;
+}
 
-  for( unsigned int i=0; i<this->m_GradientList.size(); i++)
+template< class ScalarType >
+void TensorModel< ScalarType >::SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, ScalarType* signal)
+{
+  if (dir>=this->m_GradientList.size())
   {
-    GradientType g = this->m_GradientList[i];
-    if (g.GetNorm()>0.0001)
-    {
-      // calc g^T * D * g
-      itk::DiffusionTensor3D< ScalarType > S;
-      S[0] = g[0]*g[0];
-      S[1] = g[1]*g[0];
-      S[2] = g[2]*g[0];
-      S[3] = g[1]*g[1];
-      S[4] = g[2]*g[1];
-      S[5] = g[2]*g[2];
-
-      ScalarType D_scalar = tensor[0]*S[0] + tensor[1]*S[1] + tensor[2]*S[2] +
-                     tensor[1]*S[1] + tensor[3]*S[3] + tensor[4]*S[4] +
-                     tensor[2]*S[2] + tensor[4]*S[4] + tensor[5]*S[5];
-
-      // check for corrupted tensor and generate signal
-      if (D_scalar>=0)
-        signal[i] = std::exp ( -this->m_BValue * D_scalar ); // skip * bVal becaus bVal is already encoded in g^T*g (norm of g encodes b-value relative to baseline b-value m_BValue)
-    }
-    else
-      signal[i] = 1;
+    std::fill(signal, signal+numDirections, 0);
+    return;
   }
 
-  return signal;
+  const GradientType g = this->m_GradientList[dir];
+#pragma omp parallel for
+  for (int i=0; i<static_cast<int>(numDirections); ++i)
+    signal[i] = GetSignal(GetKernelRotation(fiberDirections[i]), g);
 }
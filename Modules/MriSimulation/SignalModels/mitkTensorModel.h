@@ -56,6 +56,7 @@ public:
   /** Actual signal generation **/
   PixelType SimulateMeasurement(GradientType& fiberDirection) override;
   ScalarType SimulateMeasurement(unsigned int dir, GradientType& fiberDirection) override;
+  void SimulateMeasurement(unsigned int dir, const GradientType* fiberDirections, unsigned int numDirections, ScalarType* signal) override;
 
   void SetDiffusivity1(double d1){ m_KernelTensorMatrix[0][0] = d1; }
   void SetDiffusivity2(double d2){ m_KernelTensorMatrix[1][1] = d2; }
@@ -71,6 +72,8 @@ protected:
 
   /** Calculates tensor matrix from FA and ADC **/
   void UpdateKernelTensor();
+  vnl_matrix_fixed<double, 3, 3> GetKernelRotation(const GradientType& fiberDirection) const;  ///< rotation of the kernel direction onto the fiber direction
+  ScalarType GetSignal(const vnl_matrix_fixed<double, 3, 3>& rotation, const GradientType& g) const;
   GradientType                        m_KernelDirection;      ///< Direction of the kernel tensors principal eigenvector
   vnl_matrix_fixed<double, 3, 3>      m_KernelTensorMatrix;   ///< 3x3 matrix containing the kernel tensor values
 };
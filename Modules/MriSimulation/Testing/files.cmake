@@ -3,6 +3,7 @@ SET(MODULE_CUSTOM_TESTS
   mitkFiberfoxSignalGenerationTest.cpp
   mitkFiberfoxSignalGenerationBrainSliceTest.cpp
   mitkFiberFitTest.cpp
+  mitkSignalModelTest.cpp
 )
 
 
@@ -29,6 +29,9 @@ See LICENSE.txt or http://www.mitk.org for details.
 #include <mitkImageCast.h>
 #include <itkImageFileWriter.h>
 #include <mitkLocaleSwitch.h>
+#include <mitkSparseSystemMatrix.h>
+#include <vnl/vnl_sparse_matrix.h>
+#include <random>
 
 class mitkFiberFitTestSuite : public mitk::TestFixture
 {
@@ -40,6 +43,7 @@ class mitkFiberFitTestSuite : public mitk::TestFixture
   MITK_TEST(Fit4);
   MITK_TEST(Fit5);
   MITK_TEST(Fit6);
+  MITK_TEST(SparseSystem);
   CPPUNIT_TEST_SUITE_END();
 
   typedef itk::Image<float, 3> ItkFloatImgType;
@@ -272,6 +276,51 @@ public:
     CompareImages(fitter->GetUnderexplainedImage(), "GroupLasso_overexplained_image.nrrd");
   }
 
+  void SparseSystem()
+  {
+    int num_threads = omp_get_max_threads();
+    omp_set_num_threads(omp_get_num_procs());
+    unsigned int rows = 5000;
+    unsigned int cols = 300;
+
+    // random triplets with duplicate entries, summed in order of appearance
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<unsigned int> row_dist(0, rows-1);
+    std::uniform_int_distribution<unsigned int> col_dist(0, cols-1);
+    std::uniform_real_distribution<double> val_dist(-1.0, 1.0);
+
+    vnl_sparse_matrix<double> ref(rows, cols);
+    std::vector< mitk::SparseSystemMatrix::Triplet > triplets;
+    for (int i=0; i<50000; ++i)
+    {
+      unsigned int r = row_dist(rng);
+      unsigned int c = col_dist(rng);
+      double v = val_dist(rng);
+      triplets.push_back({r, c, v});
+      ref.put(r, c, ref.get(r, c) + v);
+    }
+    mitk::SparseSystemMatrix A;
+    A.SetFromTriplets(rows, cols, triplets);
+
+    vnl_vector<double> x(cols);
+    for (unsigned int i=0; i<cols; ++i)
+      x[i] = val_dist(rng);
+    vnl_vector<double> d(rows);
+    for (unsigned int i=0; i<rows; ++i)
+      d[i] = val_dist(rng);
+
+    vnl_vector<double> ref_y, test_y, ref_z, test_z;
+    ref.mult(x, ref_y);
+    A.Multiply(x, test_y);
+    ref.pre_mult(d, ref_z);
+    A.TransposeMultiply(d, test_z);
+    omp_set_num_threads(num_threads);
+
+    CPPUNIT_ASSERT_MESSAGE("A*x of CSR system matches vnl_sparse_matrix", (ref_y-test_y).inf_norm()<1e-12);
+    CPPUNIT_ASSERT_MESSAGE("A^T*x of CSC system matches vnl_sparse_matrix", (ref_z-test_z).inf_norm()<1e-12);
+    MITK_INFO << "Non-zeros: " << A.GetNumberOfNonZeros() << ", memory footprint: " << A.GetMemoryFootprint() << " bytes";
+  }
+
 };
 
 MITK_TEST_SUITE_REGISTRATION(mitkFiberFit)
@@ -53,6 +53,7 @@ class mitkFiberfoxSignalGenerationTestSuite : public mitk::TestFixture
   MITK_TEST(Test7);
   MITK_TEST(Test8);
   MITK_TEST(Test9);
+  MITK_TEST(ExactDft);
   CPPUNIT_TEST_SUITE_END();
 
   typedef itk::VectorImage< short, 3>   ItkDwiType;
@@ -114,10 +115,11 @@ public:
     return out;
   }
 
-  void StartSimulation(FiberfoxParameters parameters, mitk::Image::Pointer refImage, std::string out)
+  void StartSimulation(FiberfoxParameters parameters, mitk::Image::Pointer refImage, std::string out, bool separable_dft=true)
   {
     itk::TractsToDWIImageFilter< short >::Pointer tractsToDwiFilter = itk::TractsToDWIImageFilter< short >::New();
     tractsToDwiFilter->SetUseConstantRandSeed(true);
+    tractsToDwiFilter->SetUseSeparableDft(separable_dft);
     tractsToDwiFilter->SetParameters(parameters);
     tractsToDwiFilter->SetFiberBundle(m_FiberBundle);
     tractsToDwiFilter->Update();
@@ -221,6 +223,15 @@ public:
     StartSimulation(parameters, refImage, "param9.dwi");
   }
 
+  void ExactDft()
+  {
+    // the reference images were generated with the exact k-space sum, Test1-9 check the separable DFT against them
+    FiberfoxParameters parameters;
+    parameters.LoadParameters(GetTestDataFilePath("DiffusionImaging/Fiberfox/params/param1.ffp"), true);
+    mitk::Image::Pointer refImage = mitk::IOUtil::Load<mitk::Image>(GetTestDataFilePath("DiffusionImaging/Fiberfox/params/param1.dwi"));
+    StartSimulation(parameters, refImage, "param1_exact.dwi", false);
+  }
+
 };
 
 MITK_TEST_SUITE_REGISTRATION(mitkFiberfoxSignalGeneration)
@@ -0,0 +1,254 @@
+/*===================================================================
+
+The Medical Imaging Interaction Toolkit (MITK)
+
+Copyright (c) German Cancer Research Center.
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt or http://www.mitk.org for details.
+
+===================================================================*/
+
+#include <mitkTestingMacros.h>
+#include <mitkTestFixture.h>
+#include <mitkRawShModel.h>
+#include <mitkStickModel.h>
+#include <mitkTensorModel.h>
+#include <mitkBallModel.h>
+#include <mitkAstroStickModel.h>
+#include <mitkDotModel.h>
+#include <vnl/vnl_quaternion.h>
+#include <boost/math/special_functions.hpp>
+#include <random>
+
+class mitkSignalModelTestSuite : public mitk::TestFixture
+{
+
+  CPPUNIT_TEST_SUITE(mitkSignalModelTestSuite);
+  MITK_TEST(RawShSignal);
+  MITK_TEST(TensorSignal);
+  MITK_TEST(BatchedSignal);
+  CPPUNIT_TEST_SUITE_END();
+
+  typedef mitk::DiffusionSignalModel<>::GradientType      GradientType;
+  typedef mitk::DiffusionSignalModel<>::GradientListType  GradientListType;
+
+  private:
+
+  GradientListType  m_Gradients;
+  std::mt19937      m_Rng;
+
+  GradientType RandomDirection()
+  {
+    std::normal_distribution<double> normal(0, 1);
+    GradientType d;
+    d[0] = normal(m_Rng); d[1] = normal(m_Rng); d[2] = normal(m_Rng);
+    d.Normalize();
+    return d;
+  }
+
+  /** Signal of one prototype as computed by RawShModel before the basis factors were precomputed: the gradient is
+   * rotated with a quaternion and the basis is evaluated with boost::math::legendre_p. */
+  double ReferenceRawShSignal(const vnl_vector<double>& coeffs, int sh_order, const GradientType& prototype_dir, const GradientType& fiber_dir, GradientType g)
+  {
+    GradientType axis = itk::CrossProduct(fiber_dir, prototype_dir);
+    axis.Normalize();
+    vnl_quaternion<double> rotation(axis.GetVnlVector(), acos(dot_product(fiber_dir.GetVnlVector(), prototype_dir.GetVnlVector())));
+    rotation.normalize();
+
+    g.Normalize();
+    vnl_vector_fixed< double, 3 > r = rotation.rotate(g.GetVnlVector());
+    r.normalize();
+    double theta = acos(r[2]);
+    double phi = atan2(r[1], r[0]);
+
+    double signal = 0;
+    int j = 0;
+    for (int l=0; l<=sh_order; l+=2)
+      for (int m=-l; m<=l; ++m, ++j)
+      {
+        double plm = boost::math::legendre_p<double>(l, abs(m), cos(theta));
+        double mag = sqrt((double)(2*l+1)/(4.0*itk::Math::pi)*boost::math::factorial<double>(l-abs(m))/boost::math::factorial<double>(l+abs(m)))*plm;
+        if (m<0)
+          signal += coeffs[j]*sqrt(2.0)*mag*cos(fabs((double)m)*phi);
+        else if (m==0)
+          signal += coeffs[j]*mag;
+        else
+          signal += coeffs[j]*pow(-1.0, m)*sqrt(2.0)*mag*sin(m*phi);
+      }
+    return signal;
+  }
+
+  /** Runs the batched signal generation for all gradients and compares it to single direction calls of a model copy
+   * with its own, equally seeded random generator. Returns the maximum absolute difference. */
+  template< class ModelType >
+  double CompareBatchedSignal(ModelType& model, const GradientListType& fiber_dirs, const std::string& name)
+  {
+    ModelType reference(&model);
+    reference.SetRandomGenerator(itk::Statistics::MersenneTwisterRandomVariateGenerator::New());
+    model.SetSeed(0);
+    reference.SetSeed(0);
+
+    std::vector< double > batch(fiber_dirs.size());
+    double max_diff = 0;
+    for (unsigned int g=0; g<m_Gradients.size(); ++g)
+    {
+      model.SimulateMeasurement(g, fiber_dirs.data(), fiber_dirs.size(), batch.data());
+      for (unsigned int i=0; i<fiber_dirs.size(); ++i)
+      {
+        GradientType fiber_dir = fiber_dirs[i];
+        max_diff = std::max(max_diff, fabs(batch[i]-reference.SimulateMeasurement(g, fiber_dir)));
+      }
+    }
+    MITK_INFO << name << ": maximum difference " << max_diff;
+    return max_diff;
+  }
+
+  public:
+
+  void setUp() override
+  {
+    m_Rng.seed(1);
+    m_Gradients.clear();
+    GradientType b0; b0.Fill(0.0);
+    m_Gradients.push_back(b0);
+    for (int i=0; i<60; ++i)
+      m_Gradients.push_back(RandomDirection()*(i%2==0 ? 1.0 : 0.7));
+  }
+
+  void tearDown() override
+  {
+
+  }
+
+  void RawShSignal()
+  {
+    for (int sh_order=2; sh_order<=8; sh_order+=2)
+    {
+      unsigned int num_coeffs = (sh_order*sh_order + sh_order + 2)/2 + sh_order;
+      std::uniform_real_distribution<double> uniform(-0.5, 0.5);
+
+      mitk::RawShModel<> model;
+      model.SetGradientList(m_Gradients);
+      std::vector< vnl_vector<double> > coeffs;
+      std::vector< GradientType > prototype_dirs;
+      for (int k=0; k<5; ++k)
+      {
+        vnl_vector<double> c(num_coeffs);
+        for (unsigned int j=0; j<num_coeffs; ++j)
+          c[j] = uniform(m_Rng);
+        coeffs.push_back(c);
+        prototype_dirs.push_back(RandomDirection());
+        model.SetShCoefficients(c, 1.0+k);
+      }
+      model.SetPrototypeMaxDirections(prototype_dirs);
+
+      double max_diff = 0;
+      for (int i=0; i<200; ++i)
+      {
+        GradientType fiber_dir = RandomDirection();
+        int k = i%5;
+        mitk::RawShModel<>::PixelType signal = model.SimulateMeasurement(fiber_dir, k);
+        for (unsigned int g=0; g<m_Gradients.size(); ++g)
+        {
+          double reference = g==0 ? 1.0+k : ReferenceRawShSignal(coeffs[k], sh_order, prototype_dirs[k], fiber_dir, m_Gradients[g]);
+          max_diff = std::max(max_diff, fabs(signal[g]-reference));
+          max_diff = std::max(max_diff, fabs(model.SimulateMeasurement(g, fiber_dir, k)-signal[g]));
+        }
+      }
+      MITK_INFO << "SH order " << sh_order << ": maximum difference " << max_diff;
+      MITK_TEST_CONDITION_REQUIRED(max_diff<1e-9, "RawShModel signal test.");
+    }
+  }
+
+  void TensorSignal()
+  {
+    mitk::TensorModel<> model;
+    model.SetGradientList(m_Gradients);
+    model.SetBvalue(2000);
+    model.SetDiffusivity1(0.0017);
+    model.SetDiffusivity2(0.0004);
+    model.SetDiffusivity3(0.0002);
+
+    // kernel tensor rotated with the quaternion around kernel x fiber direction
+    GradientType kernel_dir = model.GetKernelDirection();
+    vnl_matrix_fixed<double, 3, 3> kernel = model.GetKernelTensorMatrix();
+    double max_diff = 0;
+    for (int i=0; i<200; ++i)
+    {
+      GradientType fiber_dir = RandomDirection();
+      vnl_vector_fixed<double, 3> axis = itk::CrossProduct(kernel_dir, fiber_dir).GetVnlVector(); axis.normalize();
+      vnl_quaternion<double> rotation(axis, acos(kernel_dir*fiber_dir));
+      rotation.normalize();
+      vnl_matrix_fixed<double, 3, 3> matrix = rotation.rotation_matrix_transpose();
+      vnl_matrix_fixed<double, 3, 3> tensor = matrix.transpose()*kernel*matrix;
+
+      mitk::TensorModel<>::PixelType signal = model.SimulateMeasurement(fiber_dir);
+      for (unsigned int g=0; g<m_Gradients.size(); ++g)
+      {
+        vnl_vector_fixed<double, 3> grad = m_Gradients[g].GetVnlVector();
+        double reference = g==0 ? 1.0 : exp(-model.GetBvalue()*dot_product(grad, tensor*grad));
+        max_diff = std::max(max_diff, fabs(signal[g]-reference));
+      }
+    }
+    MITK_INFO << "Tensor model: maximum difference " << max_diff;
+    MITK_TEST_CONDITION_REQUIRED(max_diff<1e-12, "Tensor model signal test.");
+  }
+
+  void BatchedSignal()
+  {
+    unsigned int num_dirs = 1000;
+
+    GradientListType fiber_dirs;
+    for (unsigned int i=0; i<num_dirs; ++i)
+      fiber_dirs.push_back(RandomDirection());
+    GradientType null_dir; null_dir.Fill(0.0);
+    fiber_dirs.push_back(null_dir);
+
+    mitk::StickModel<> stick;
+    stick.SetGradientList(m_Gradients);
+    stick.SetDiffusivity(0.0012);
+    MITK_TEST_CONDITION_REQUIRED(CompareBatchedSignal(stick, fiber_dirs, "Stick model")<1e-12, "Batched stick model test.");
+
+    mitk::TensorModel<> tensor;
+    tensor.SetGradientList(m_Gradients);
+    MITK_TEST_CONDITION_REQUIRED(CompareBatchedSignal(tensor, fiber_dirs, "Tensor model")<1e-12, "Batched tensor model test.");
+
+    mitk::BallModel<> ball;
+    ball.SetGradientList(m_Gradients);
+    MITK_TEST_CONDITION_REQUIRED(CompareBatchedSignal(ball, fiber_dirs, "Ball model")<1e-12, "Batched ball model test.");
+
+    mitk::AstroStickModel<> astrosticks;
+    astrosticks.SetGradientList(m_Gradients);
+    MITK_TEST_CONDITION_REQUIRED(CompareBatchedSignal(astrosticks, fiber_dirs, "Astrosticks model")<1e-12, "Batched astrosticks model test.");
+    astrosticks.SetRandomizeSticks(true);
+    MITK_TEST_CONDITION_REQUIRED(CompareBatchedSignal(astrosticks, fiber_dirs, "Randomized astrosticks model")<1e-12, "Batched randomized astrosticks model test.");
+
+    mitk::DotModel<> dot;
+    dot.SetGradientList(m_Gradients);
+    MITK_TEST_CONDITION_REQUIRED(CompareBatchedSignal(dot, fiber_dirs, "Dot model")<1e-12, "Batched dot model test.");
+
+    mitk::RawShModel<> raw_sh;
+    raw_sh.SetGradientList(m_Gradients);
+    std::uniform_real_distribution<double> uniform(-0.5, 0.5);
+    std::vector< GradientType > prototype_dirs;
+    for (int k=0; k<5; ++k)
+    {
+      vnl_vector<double> c(15);
+      for (unsigned int j=0; j<c.size(); ++j)
+        c[j] = uniform(m_Rng);
+      raw_sh.SetShCoefficients(c, 1.0);
+      prototype_dirs.push_back(RandomDirection());
+    }
+    raw_sh.SetPrototypeMaxDirections(prototype_dirs);
+    MITK_TEST_CONDITION_REQUIRED(CompareBatchedSignal(raw_sh, fiber_dirs, "Prototype model")<1e-12, "Batched prototype model test.");
+  }
+
+};
+
+MITK_TEST_SUITE_REGISTRATION(mitkSignalModel)
@@ -7,6 +7,7 @@ set(H_FILES
   mitkFiberfoxParameters.h
 
   Algorithms/itkFitFibersToImageFilter.h
+  Algorithms/mitkSparseSystemMatrix.h
   Algorithms/itkFibersFromPlanarFiguresFilter.h
   Algorithms/itkTractsToDWIImageFilter.h
   Algorithms/itkKspaceImageFilter.h